@@ -0,0 +1,184 @@
+#include "pdvzip.h"
+#include "adler32_internal.h"
+#include "cpu_features_internal.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#if !defined(PDVZIP_ADLER32_DISABLE_SIMD) && PDVZIP_HAS_X86_CPUID
+#include <immintrin.h>
+#define PDVZIP_HAS_X86_ADLER_SIMD 1
+#else
+#define PDVZIP_HAS_X86_ADLER_SIMD 0
+#endif
+
+namespace {
+
+constexpr std::uint32_t
+	ADLER32_BASE    = 65521,
+	ADLER32_INITIAL = 1;
+
+// Largest n such that 255 * n * (n + 1) / 2 + (n + 1) * (BASE - 1) fits in 32
+// bits: the number of bytes that can be summed before a modulo is needed.
+constexpr std::size_t ADLER32_NMAX = 5552;
+constexpr std::size_t ADLER32_BLOCK_BYTES = 32;
+
+[[nodiscard]] std::uint32_t adler32Scalar(std::uint32_t adler, const unsigned char *data,
+                                          std::size_t length) noexcept {
+	std::uint32_t s1 = adler & 0xFFFFU;
+	std::uint32_t s2 = adler >> 16U;
+	while (length != 0) {
+		std::size_t amount = length < ADLER32_NMAX ? length : ADLER32_NMAX;
+		length -= amount;
+		while (amount-- != 0) {
+			s1 += *data++;
+			s2 += s1;
+		}
+		s1 %= ADLER32_BASE;
+		s2 %= ADLER32_BASE;
+	}
+	return (s2 << 16U) | s1;
+}
+
+#if PDVZIP_HAS_X86_ADLER_SIMD
+
+// Both SIMD kernels work on 32-byte blocks, at most NMAX bytes between
+// reductions. For a run of n blocks starting from (s1, s2):
+//   s1' = s1 + sum(bytes)
+//   s2' = s2 + 32 * n * s1 + 32 * sum over blocks of (s1 before that block)
+//         + sum over blocks of sum(byte[i] * (32 - i))
+// The per-block s1 prefix ("ps") is accumulated lazily and scaled by 32 once
+// per run; the weighted byte sums come from maddubs against a 32..1 ramp.
+
+[[nodiscard]] __attribute__((target("ssse3"))) std::uint32_t
+adler32Ssse3(std::uint32_t adler, const unsigned char *data, std::size_t length) noexcept {
+	std::uint32_t s1 = adler & 0xFFFFU;
+	std::uint32_t s2 = adler >> 16U;
+
+	const __m128i weights_high = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+	const __m128i weights_low  = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi16(1);
+
+	std::size_t blocks = length / ADLER32_BLOCK_BYTES;
+	length %= ADLER32_BLOCK_BYTES;
+	while (blocks != 0) {
+		std::size_t run = ADLER32_NMAX / ADLER32_BLOCK_BYTES;
+		run = run < blocks ? run : blocks;
+		blocks -= run;
+
+		__m128i prefix_sum = _mm_cvtsi32_si128(static_cast<int>(s1 * static_cast<std::uint32_t>(run)));
+		__m128i sum1 = zero;
+		__m128i sum2 = _mm_cvtsi32_si128(static_cast<int>(s2));
+		for (; run != 0; --run, data += ADLER32_BLOCK_BYTES) {
+			const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+			const __m128i low  = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16));
+			prefix_sum = _mm_add_epi32(prefix_sum, sum1);
+			sum1 = _mm_add_epi32(sum1, _mm_add_epi32(_mm_sad_epu8(high, zero), _mm_sad_epu8(low, zero)));
+			sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_maddubs_epi16(high, weights_high), ones));
+			sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_maddubs_epi16(low, weights_low), ones));
+		}
+		sum2 = _mm_add_epi32(sum2, _mm_slli_epi32(prefix_sum, 5));
+
+		sum1 = _mm_add_epi32(sum1, _mm_shuffle_epi32(sum1, _MM_SHUFFLE(1, 0, 3, 2)));
+		sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(2, 3, 0, 1)));
+		sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(1, 0, 3, 2)));
+		s1 = (s1 + static_cast<std::uint32_t>(_mm_cvtsi128_si32(sum1))) % ADLER32_BASE;
+		s2 = static_cast<std::uint32_t>(_mm_cvtsi128_si32(sum2)) % ADLER32_BASE;
+	}
+	return adler32Scalar((s2 << 16U) | s1, data, length);
+}
+
+[[nodiscard]] __attribute__((target("avx2"))) inline std::uint32_t
+sumLanes256(__m256i value) noexcept {
+	__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	return static_cast<std::uint32_t>(_mm_cvtsi128_si32(sum));
+}
+
+// Same scheme as adler32Ssse3 with a whole block per YMM load. The lane
+// split of the partial sums differs, but only their total is ever used.
+[[nodiscard]] __attribute__((target("avx2"))) std::uint32_t
+adler32Avx2(std::uint32_t adler, const unsigned char *data, std::size_t length) noexcept {
+	std::uint32_t s1 = adler & 0xFFFFU;
+	std::uint32_t s2 = adler >> 16U;
+
+	const __m256i weights = _mm256_setr_epi8(
+		32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+		16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i ones = _mm256_set1_epi16(1);
+
+	std::size_t blocks = length / ADLER32_BLOCK_BYTES;
+	length %= ADLER32_BLOCK_BYTES;
+	while (blocks != 0) {
+		std::size_t run = ADLER32_NMAX / ADLER32_BLOCK_BYTES;
+		run = run < blocks ? run : blocks;
+		blocks -= run;
+
+		__m256i prefix_sum = _mm256_zextsi128_si256(
+			_mm_cvtsi32_si128(static_cast<int>(s1 * static_cast<std::uint32_t>(run))));
+		__m256i sum1 = zero;
+		__m256i sum2 = _mm256_zextsi128_si256(_mm_cvtsi32_si128(static_cast<int>(s2)));
+		for (; run != 0; --run, data += ADLER32_BLOCK_BYTES) {
+			const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+			prefix_sum = _mm256_add_epi32(prefix_sum, sum1);
+			sum1 = _mm256_add_epi32(sum1, _mm256_sad_epu8(bytes, zero));
+			sum2 = _mm256_add_epi32(sum2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, weights), ones));
+		}
+		sum2 = _mm256_add_epi32(sum2, _mm256_slli_epi32(prefix_sum, 5));
+
+		s1 = (s1 + sumLanes256(sum1)) % ADLER32_BASE;
+		s2 = sumLanes256(sum2) % ADLER32_BASE;
+	}
+	return adler32Scalar((s2 << 16U) | s1, data, length);
+}
+
+#endif
+
+using Adler32Impl = adler32_internal::Kernel;
+
+[[nodiscard]] Adler32Impl resolveAdler32Impl() noexcept {
+#if PDVZIP_HAS_X86_ADLER_SIMD
+	const cpu_features_internal::X86Features& cpu = cpu_features_internal::x86Features();
+	if (cpu.avx2) {
+		return adler32Avx2;
+	}
+	if (cpu.ssse3) {
+		return adler32Ssse3;
+	}
+#endif
+	return adler32Scalar;
+}
+
+[[nodiscard]] Adler32Impl adler32Impl() noexcept {
+	static const Adler32Impl impl = resolveAdler32Impl();
+	return impl;
+}
+
+} // namespace
+
+// Linked into lodepng in place of its scalar zlib checksum
+// (LODEPNG_NO_COMPILE_ADLER32); used by every cover decode and encode.
+unsigned lodepng_adler32(const unsigned char *data, std::size_t length) {
+	return adler32Impl()(ADLER32_INITIAL, data, length);
+}
+
+namespace adler32_internal {
+
+std::vector<NamedKernel> availableKernels() {
+	std::vector<NamedKernel> kernels{ { "scalar", adler32Scalar } };
+#if PDVZIP_HAS_X86_ADLER_SIMD
+	const cpu_features_internal::X86Features& cpu = cpu_features_internal::x86Features();
+	if (cpu.ssse3) {
+		kernels.push_back({ "ssse3", adler32Ssse3 });
+	}
+	if (cpu.avx2) {
+		kernels.push_back({ "avx2", adler32Avx2 });
+	}
+#endif
+	return kernels;
+}
+
+}  // namespace adler32_internal
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace adler32_internal {
+
+// One Adler-32 kernel, continuing from a running checksum.
+using Kernel = std::uint32_t (*)(std::uint32_t, const unsigned char*, std::size_t) noexcept;
+
+struct NamedKernel {
+	std::string_view name;
+	Kernel kernel;
+};
+
+// Every kernel this build and CPU can run, scalar first. lodepng_adler32
+// dispatches to the last one.
+[[nodiscard]] std::vector<NamedKernel> availableKernels();
+
+}  // namespace adler32_internal
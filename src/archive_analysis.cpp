@@ -1,10 +1,21 @@
 #include "pdvzip.h"
+#include "archive_analysis_internal.h"
+#include "thread_pool.h"
+#include "validation_cache_internal.h"
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cctype>
+#include <chrono>
+#include <cstring>
+#include <exception>
 #include <format>
+#include <functional>
 #include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
 #include <stdexcept>
 #include <utility>
 
@@ -12,6 +23,8 @@
 
 namespace {
 
+using archive_analysis_internal::toLowerAscii;
+
 constexpr auto EXTENSION_LIST = std::to_array<std::string_view>({
 	"mp4", "mp3", "wav", "mpg", "webm", "flac", "3gp", "aac", "aiff", "aif", "alac", "ape", "avchd", "avi",
 	"dsd", "divx", "f4v", "flv", "m4a", "m4v", "mkv", "mov", "midi", "mpeg", "ogg", "pcm", "swf", "wma", "wmv",
@@ -52,13 +65,6 @@ template <typename T>
 	});
 }
 
-[[nodiscard]] char toLowerAscii(char ch) {
-	if (ch >= 'A' && ch <= 'Z') {
-		return static_cast<char>(ch - 'A' + 'a');
-	}
-	return ch;
-}
-
 [[nodiscard]] std::string_view readZipStringView(std::span<const Byte> data, std::size_t start, std::size_t length,
                                                  std::string_view overflow_error, std::string_view bounds_error) {
 	const std::size_t end = checkedAdd(start, length, overflow_error);
@@ -104,11 +110,10 @@ template <typename T>
 struct LocalEntrySpan {
 	std::size_t begin;
 	std::size_t end;
+	uint32_t crc;   // CRC-32 of the raw bytes [begin, end)
 };
 
 constexpr std::size_t
-	ZIP_WRAP_PREFIX_SIZE          = 8,
-	ZIP_WRAP_TRAILER_SIZE         = 4,
 	LOCAL_RECORD_MIN_SIZE         = 30,
 	LOCAL_RECORD_NAME_INDEX       = 30,
 	CENTRAL_RECORD_MIN_SIZE       = 46,
@@ -126,7 +131,49 @@ constexpr std::size_t
 	CENTRAL_EXTERNAL_ATTRIBUTES   = 38,
 	CENTRAL_LOCAL_OFFSET          = 42;
 
-constexpr std::uint64_t MAX_TOTAL_UNCOMPRESSED_SIZE = 2ULL * 1024 * 1024 * 1024;
+using archive_analysis_internal::MAX_TOTAL_UNCOMPRESSED_SIZE;
+using archive_analysis_internal::UncompressedBudget;
+
+// Below this much compressed payload, checking entries on one thread beats
+// starting a pool.
+constexpr std::uint64_t PARALLEL_VERIFY_MIN_BYTES = 1024 * 1024;
+
+// DEFLATE entries up to this declared size are inflated in one pass into a
+// buffer of exactly that size; larger ones stream through zlib so a pool of
+// verifiers never holds more than this much output per thread. Scratch
+// buffers up to INFLATE_SCRATCH_KEEP bytes stay with the thread for reuse.
+constexpr std::size_t
+	WHOLE_BUFFER_INFLATE_LIMIT = 64 * 1024 * 1024,
+	INFLATE_SCRATCH_KEEP       = 4 * 1024 * 1024;
+
+// While the archive is still loading, an entry's check first waits for at
+// most this much of its span; the rest of a larger entry is faulted in as the
+// check reaches it, just behind the loader.
+constexpr std::size_t ENTRY_LOAD_WAIT_LIMIT = 16 * 1024 * 1024;
+
+// Set by tests through setVerifyThreadCount; 0 leaves the choice to the pool.
+std::atomic<unsigned> verify_thread_count{0};
+
+// A local entry whose header has been validated and whose payload (plus any
+// data descriptor) is still to be checked. Self-contained, so checks can run
+// in any order on any thread.
+struct PendingPayload {
+	std::size_t entry_number;
+	std::size_t local_header_start;
+	std::size_t local_record_end;
+	std::size_t compressed_end;
+	bool has_data_descriptor;
+	bool has_zip64_descriptor;   // descriptor sizes are 8 bytes (local header has a ZIP64 field)
+	uint16_t compression_method;
+	uint32_t crc32;
+	uint32_t compressed_size;
+	uint32_t uncompressed_size;
+};
+
+struct VerifiedLocalEntry {
+	LocalEntrySpan span;
+	std::uint64_t uncompressed_size;
+};
 
 constexpr uint16_t
 	ZIP_EXTRA_ZIP64                    = 0x0001,
@@ -136,7 +183,8 @@ constexpr uint16_t
 struct CentralDirectoryBounds {
 	std::size_t start;
 	std::size_t end;
-	uint16_t total_records;
+	std::size_t total_records;
+	std::optional<std::size_t> zip64_eocd_offset;
 };
 
 struct CentralEntryMetadata {
@@ -150,116 +198,206 @@ struct CentralEntryMetadata {
 	uint16_t disk_start;
 	uint32_t external_attributes;
 	std::size_t local_header_offset;
+	std::optional<std::size_t> zip64_offset_field;   // where a ZIP64 local header offset was read from
 	std::string_view name;
 	std::span<const Byte> extra;
+	std::size_t extra_start;
 	std::size_t record_size;
 };
 
-class PortablePathTrie {
-private:
-	static constexpr std::size_t NO_NODE = std::numeric_limits<std::size_t>::max();
-
-	struct Node {
-		std::size_t first_child = NO_NODE;
-		std::size_t next_sibling = NO_NODE;
-		Byte label = 0;
-		bool has_explicit_entry = false;
-		bool is_file = false;
-		bool is_directory = false;
-	};
+} // anonymous namespace
 
-	std::vector<Node> nodes_{1}; // index zero is the root
+namespace archive_analysis_internal {
 
-	[[nodiscard]] std::size_t findOrAddChild(std::size_t parent, Byte label) {
-		for (std::size_t child = nodes_[parent].first_child;
-			 child != NO_NODE;
-			 child = nodes_[child].next_sibling) {
-			if (nodes_[child].label == label) {
-				return child;
-			}
+std::uint64_t PortablePathIndex::hashSeed() {
+	static const std::uint64_t seed = [] {
+		std::random_device device;
+		return (static_cast<std::uint64_t>(device()) << 32) ^ device();
+	}();
+	return seed;
+}
+
+std::uint64_t PortablePathIndex::mix(std::uint64_t lhs, std::uint64_t rhs) noexcept {
+	__extension__ using Product = unsigned __int128;
+	const Product product = static_cast<Product>(lhs) * rhs;
+	return static_cast<std::uint64_t>(product) ^ static_cast<std::uint64_t>(product >> 64);
+}
+
+std::uint64_t PortablePathIndex::hashComponent(uint32_t parent, std::string_view name) {
+	constexpr std::uint64_t
+		MULTIPLIER_A = 0xA0761D6478BD642FULL,
+		MULTIPLIER_B = 0xE7037ED1A0B428DBULL;
+	std::uint64_t hash = mix(hashSeed() ^ parent, MULTIPLIER_A);
+	std::size_t offset = 0;
+	for (; name.size() - offset >= sizeof(std::uint64_t); offset += sizeof(std::uint64_t)) {
+		std::uint64_t word = 0;
+		std::memcpy(&word, name.data() + offset, sizeof(word));
+		hash = mix(hash ^ word, MULTIPLIER_B);
+	}
+	std::uint64_t tail = name.size();
+	for (std::size_t i = offset; i < name.size(); ++i) {
+		tail = (tail << 8) | static_cast<unsigned char>(name[i]);
+	}
+	return mix(hash ^ tail, MULTIPLIER_A ^ MULTIPLIER_B);
+}
+
+void PortablePathIndex::grow() {
+	std::vector<Slot> old = std::exchange(slots_, std::vector<Slot>(slots_.size() * 2));
+	const std::size_t mask = slots_.size() - 1;
+	for (const Slot& slot : old) {
+		if (slot.node == 0) {
+			continue;
 		}
+		std::size_t index = slot.hash & mask;
+		while (slots_[index].node != 0) {
+			index = (index + 1) & mask;
+		}
+		slots_[index] = slot;
+	}
+}
 
-		const std::size_t child = nodes_.size();
-		nodes_.push_back(Node{
-			.next_sibling = nodes_[parent].first_child,
-			.label = label
-		});
-		nodes_[parent].first_child = child;
-		return child;
+uint32_t PortablePathIndex::findOrAddChild(uint32_t parent, std::size_t name_offset) {
+	const std::string_view name = std::string_view(names_).substr(name_offset);
+	const auto hash = static_cast<uint32_t>(hashComponent(parent, name));
+	const std::size_t mask = slots_.size() - 1;
+	std::size_t index = hash & mask;
+	for (; slots_[index].node != 0; index = (index + 1) & mask) {
+		const Slot& slot = slots_[index];
+		if (slot.hash != hash || slot.parent != parent) {
+			continue;
+		}
+		const Node& candidate = nodes_[slot.node];
+		if (std::string_view(names_).substr(candidate.name_offset, candidate.name_length) == name) {
+			names_.resize(name_offset);
+			return slot.node;
+		}
 	}
 
-public:
-	void reserve(std::size_t entry_count) {
-		// This is only a small starting reservation. Nodes are added once per
-		// distinct normalized path byte, rather than once per full path prefix.
-		nodes_.reserve(entry_count + 1);
+	if (nodes_.size() > std::numeric_limits<uint32_t>::max()) {
+		throw std::runtime_error("Archive File Error: Too many distinct archive path components.");
 	}
+	const auto node = static_cast<uint32_t>(nodes_.size());
+	nodes_.push_back(Node{
+		.name_offset = name_offset,
+		.name_length = static_cast<uint32_t>(name.size())
+	});
+	slots_[index] = Slot{ .hash = hash, .parent = parent, .node = node };
+	// Keep the load factor at or below one half.
+	if ((nodes_.size() - 1) * 2 > slots_.size()) {
+		grow();
+	}
+	return node;
+}
 
-	void insert(std::string_view entry_name, std::size_t entry_number) {
-		const bool directory_entry = entry_name.ends_with('/');
-		const std::size_t key_size = entry_name.size() - static_cast<std::size_t>(directory_entry);
-		if (key_size == 0) {
-			throw std::runtime_error(std::format(
-				"Archive Security Error: Empty normalized path for archive entry {}.", entry_number));
-		}
+void PortablePathIndex::reserve(std::size_t entry_count) {
+	// A starting reservation only: most entries add one or two components.
+	nodes_.reserve(entry_count + 1);
+	while (slots_.size() < entry_count * 2) {
+		grow();
+	}
+}
 
-		std::size_t node = 0;
-		for (std::size_t i = 0; i < key_size; ++i) {
-			const char ch = entry_name[i];
-			if (ch == '/') {
-				if (nodes_[node].is_file) {
-					throw std::runtime_error(std::format(
-						"Archive Security Error: Archive entry {} conflicts with an existing file path.",
-						entry_number));
-				}
-				nodes_[node].is_directory = true;
-			}
+void PortablePathIndex::insert(std::string_view entry_name, std::size_t entry_number) {
+	const bool directory_entry = entry_name.ends_with('/');
+	const std::size_t key_size = entry_name.size() - static_cast<std::size_t>(directory_entry);
+	if (key_size == 0) {
+		throw std::runtime_error(std::format(
+			"Archive Security Error: Empty normalized path for archive entry {}.", entry_number));
+	}
 
-			const char normalized = ch == '\\' ? '/' : toLowerAscii(ch);
-			node = findOrAddChild(node, static_cast<Byte>(normalized));
-		}
+	const std::size_t shared = static_cast<std::size_t>(
+		std::ranges::mismatch(entry_name, previous_name_).in1 - entry_name.begin());
+	std::size_t reusable = 0;
+	current_prefixes_.clear();
 
-		Node& terminal = nodes_[node];
-		if (terminal.has_explicit_entry) {
-			throw std::runtime_error(std::format(
-				"Archive Security Error: Duplicate or case-conflicting archive entry path detected: \"{}\".",
-				entry_name));
+	uint32_t node = 0;
+	std::size_t component_start = 0;
+	for (std::size_t i = 0; i <= key_size; ++i) {
+		const bool at_end = i == key_size;
+		if (!at_end && entry_name[i] != '/' && entry_name[i] != '\\') {
+			continue;
 		}
-
-		if (directory_entry) {
-			if (terminal.is_file) {
-				throw std::runtime_error(std::format(
-					"Archive Security Error: Directory entry {} conflicts with an existing file path.",
-					entry_number));
+		// A leading separator leaves the first component empty; that
+		// prefix is the root itself.
+		if (i > component_start) {
+			if (i <= shared && reusable < previous_prefixes_.size()
+				&& previous_prefixes_[reusable].first == i) {
+				node = previous_prefixes_[reusable++].second;
 			}
-			terminal.is_directory = true;
-		} else {
-			if (terminal.is_directory) {
+			else {
+				reusable = previous_prefixes_.size();
+				const std::size_t name_offset = names_.size();
+				for (std::size_t j = component_start; j < i; ++j) {
+					const char ch = entry_name[j];
+					names_.push_back(ch == '\\' ? '/' : toLowerAscii(ch));
+				}
+				node = findOrAddChild(node, name_offset);
+			}
+			current_prefixes_.emplace_back(i, node);
+		}
+		if (!at_end && entry_name[i] == '/') {
+			if (nodes_[node].is_file) {
 				throw std::runtime_error(std::format(
-					"Archive Security Error: File entry {} conflicts with an existing directory path.",
+					"Archive Security Error: Archive entry {} conflicts with an existing file path.",
 					entry_number));
 			}
-			terminal.is_file = true;
+			nodes_[node].is_directory = true;
 		}
-		terminal.has_explicit_entry = true;
+		component_start = i;
 	}
-};
+
+	Node& terminal = nodes_[node];
+	if (terminal.has_explicit_entry) {
+		throw std::runtime_error(std::format(
+			"Archive Security Error: Duplicate or case-conflicting archive entry path detected: \"{}\".",
+			entry_name));
+	}
+
+	if (directory_entry) {
+		if (terminal.is_file) {
+			throw std::runtime_error(std::format(
+				"Archive Security Error: Directory entry {} conflicts with an existing file path.",
+				entry_number));
+		}
+		terminal.is_directory = true;
+	} else {
+		if (terminal.is_directory) {
+			throw std::runtime_error(std::format(
+				"Archive Security Error: File entry {} conflicts with an existing directory path.",
+				entry_number));
+		}
+		terminal.is_file = true;
+	}
+	terminal.has_explicit_entry = true;
+	previous_name_.assign(entry_name.substr(0, key_size));
+	std::swap(previous_prefixes_, current_prefixes_);
+}
+
+void setVerifyThreadCount(unsigned thread_count) noexcept {
+	verify_thread_count.store(thread_count, std::memory_order_relaxed);
+}
+
+}  // namespace archive_analysis_internal
+
+namespace {
+
+using archive_analysis_internal::PortablePathIndex;
 
 struct ArchiveEntryTracking {
 	std::uint64_t total_declared_uncompressed = 0;
-	std::uint64_t total_verified_uncompressed = 0;
-	PortablePathTrie paths;
-	std::vector<LocalEntrySpan> local_spans;
+	PortablePathIndex paths;
+	std::vector<CentralEntryMetadata> entries;
 
 	void reserve(std::size_t total_records) {
 		paths.reserve(total_records);
-		local_spans.reserve(total_records);
+		entries.reserve(total_records);
 	}
 };
 
 void validateZipExtraFields(std::span<const Byte> extra, std::string_view location,
 							std::optional<std::size_t> entry_number = std::nullopt) {
 	std::size_t cursor = 0;
+	bool has_zip64_field = false;
 	while (cursor < extra.size()) {
 		if (extra.size() - cursor < 4) {
 			throw std::runtime_error(entry_number
@@ -276,10 +414,14 @@ void validateZipExtraFields(std::span<const Byte> extra, std::string_view locati
 				: std::format("Archive File Error: Malformed {} extra field.", location));
 		}
 
+		// Readers disagree on which of two ZIP64 fields wins.
 		if (field_id == ZIP_EXTRA_ZIP64) {
-			throw std::runtime_error(entry_number
-				? std::format("Archive File Error: ZIP64 extra field is not supported on entry {}.", *entry_number)
-				: "Archive File Error: ZIP64 extra field is not supported.");
+			if (has_zip64_field) {
+				throw std::runtime_error(entry_number
+					? std::format("Archive File Error: Duplicate ZIP64 extra field on entry {}.", *entry_number)
+					: "Archive File Error: Duplicate ZIP64 extra field.");
+			}
+			has_zip64_field = true;
 		}
 		if (field_id == ZIP_EXTRA_INFOZIP_UNICODE_PATH
 			|| field_id == ZIP_EXTRA_EXTENDED_LANGUAGE) {
@@ -296,6 +438,69 @@ void validateZipExtraFields(std::span<const Byte> extra, std::string_view locati
 	}
 }
 
+// The ZIP64 extended-information extra field of one record, already checked
+// by validateZipExtraFields. It holds a value for each saturated header field
+// only, in a fixed order: uncompressed size, compressed size, local header
+// offset (8 bytes each), then disk number (4 bytes). Callers resolve their
+// fields in that order. Archives pdvzip accepts stay far below 4 GiB, so an
+// extended value that does not fit 32 bits is rejected.
+class Zip64ExtendedInfo {
+public:
+	Zip64ExtendedInfo(std::span<const Byte> extra, std::size_t extra_start, std::string_view location,
+	                  std::size_t entry_number)
+		: location_(location), entry_number_(entry_number) {
+		for (std::size_t cursor = 0; cursor + 4 <= extra.size();) {
+			const std::size_t field_size = readLe16(extra, cursor + 2);
+			if (readLe16(extra, cursor) == ZIP_EXTRA_ZIP64) {
+				values_ = extra.subspan(cursor + 4, field_size);
+				values_start_ = extra_start + cursor + 4;
+				present_ = true;
+				return;
+			}
+			cursor += 4 + field_size;
+		}
+	}
+
+	[[nodiscard]] bool present() const noexcept { return present_; }
+	// Archive offset of the value the next resolve() would read.
+	[[nodiscard]] std::size_t nextValueOffset() const noexcept { return values_start_ + cursor_; }
+
+	[[nodiscard]] uint32_t resolve(uint32_t header_value, std::string_view field_name) {
+		return header_value == UINT32_MAX ? take(8, field_name) : header_value;
+	}
+
+	[[nodiscard]] uint16_t resolveDisk(uint16_t header_value) {
+		if (header_value != UINT16_MAX) {
+			return header_value;
+		}
+		const uint32_t disk = take(4, "disk number");
+		return disk > UINT16_MAX ? UINT16_MAX : static_cast<uint16_t>(disk);
+	}
+
+private:
+	[[nodiscard]] uint32_t take(std::size_t width, std::string_view field_name) {
+		if (width > values_.size() - cursor_) {
+			throw std::runtime_error(std::format(
+				"Archive File Error: {} ZIP64 extra field on entry {} lacks the {}.",
+				location_, entry_number_, field_name));
+		}
+		const std::uint64_t value = width == 8 ? readLe64(values_, cursor_) : readLe32(values_, cursor_);
+		cursor_ += width;
+		if (value > UINT32_MAX) {
+			throw std::runtime_error(std::format(
+				"Archive File Error: ZIP64 {} of entry {} exceeds 4 GiB.", field_name, entry_number_));
+		}
+		return static_cast<uint32_t>(value);
+	}
+
+	std::string_view location_;
+	std::size_t entry_number_;
+	std::span<const Byte> values_;
+	std::size_t values_start_ = 0;
+	std::size_t cursor_ = 0;
+	bool present_ = false;
+};
+
 void validateEntryName(std::string_view entry_name, std::string_view control_label, std::string_view unsafe_error,
                        std::optional<std::size_t> entry_number = std::nullopt) {
 	if (containsControlCharacters(entry_name)) {
@@ -358,12 +563,8 @@ void validateEntryAttributes(uint16_t version_made_by, uint16_t flags, uint32_t
 	}
 }
 
-void validateEntrySizeMetadata(uint32_t compressed_size, uint32_t uncompressed_size, std::uint64_t& total_uncompressed,
+void validateEntrySizeMetadata(uint32_t uncompressed_size, std::uint64_t& total_uncompressed,
                                bool is_directory, std::size_t entry_number) {
-	if (compressed_size == UINT32_MAX || uncompressed_size == UINT32_MAX) {
-		throw std::runtime_error(std::format(
-			"Archive File Error: ZIP64 size metadata is not supported for entry {}.", entry_number));
-	}
 	if (is_directory) {
 		// A directory entry must have no actual content (uncompressed_size == 0).
 		// compressed_size may legitimately be non-zero — Java's jar tool deflates
@@ -389,21 +590,6 @@ void validateCompressionMethod(uint16_t method, std::size_t entry_number) {
 	}
 }
 
-[[nodiscard]] uLong updatePayloadCrc(uLong crc, std::span<const Byte> data) {
-	std::size_t cursor = 0;
-	while (cursor < data.size()) {
-		const std::size_t chunk_size = std::min<std::size_t>(
-			data.size() - cursor,
-			std::numeric_limits<uInt>::max());
-		crc = ::crc32(
-			crc,
-			reinterpret_cast<const Bytef*>(data.data() + cursor),
-			static_cast<uInt>(chunk_size));
-		cursor += chunk_size;
-	}
-	return crc;
-}
-
 struct InflateEndGuard {
 	z_stream* stream;
 
@@ -412,12 +598,131 @@ struct InflateEndGuard {
 	}
 };
 
-[[nodiscard]] std::uint64_t verifyDeflatedPayload(
+// Result of checking one entry's payload. compressed_crc is the CRC-32 of the
+// payload bytes as stored in the archive, kept for the embedded-region CRC.
+struct VerifiedPayload {
+	std::uint64_t uncompressed_size;
+	uint32_t compressed_crc;
+};
+
+// Adds the time from construction to destruction to *total. Profiling is
+// the only caller that passes a total; otherwise the clock is never read.
+class ScopedTimer {
+public:
+	explicit ScopedTimer(std::chrono::nanoseconds* total) noexcept
+		: total_(total), start_(total != nullptr ? Clock::now() : Clock::time_point{}) {}
+	~ScopedTimer() {
+		if (total_ != nullptr) {
+			*total_ += Clock::now() - start_;
+		}
+	}
+
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+	using Clock = std::chrono::steady_clock;
+	std::chrono::nanoseconds* total_;
+	Clock::time_point start_;
+};
+
+[[nodiscard]] std::chrono::nanoseconds* inflateClock(EntryTiming* timing) noexcept {
+	return timing != nullptr ? &timing->inflate : nullptr;
+}
+
+[[nodiscard]] std::chrono::nanoseconds* crcClock(EntryTiming* timing) noexcept {
+	return timing != nullptr ? &timing->crc : nullptr;
+}
+
+// Output buffer for one whole-buffer inflate. Small ones are kept per thread
+// and reused across entries; larger ones are freed with the scratch.
+class InflateScratch {
+public:
+	explicit InflateScratch(std::size_t size) {
+		thread_local std::unique_ptr<Byte[]> kept;
+		thread_local std::size_t kept_size = 0;
+		if (size > INFLATE_SCRATCH_KEEP) {
+			owned_ = std::make_unique_for_overwrite<Byte[]>(size);
+			bytes_ = std::span<Byte>(owned_.get(), size);
+			return;
+		}
+		if (kept_size < size) {
+			kept = std::make_unique_for_overwrite<Byte[]>(INFLATE_SCRATCH_KEEP);
+			kept_size = INFLATE_SCRATCH_KEEP;
+		}
+		bytes_ = std::span<Byte>(kept.get(), size);
+	}
+
+	[[nodiscard]] std::span<Byte> bytes() const noexcept { return bytes_; }
+
+private:
+	std::unique_ptr<Byte[]> owned_;
+	std::span<Byte> bytes_;
+};
+
+// The declared size bounds the output, so the whole stream decodes in one
+// call into a buffer of exactly that size; producing more is caught as the
+// buffer filling up.
+[[nodiscard]] VerifiedPayload verifyDeflatedPayloadWhole(
+	std::span<const Byte> compressed,
+	uint32_t expected_uncompressed_size,
+	uint32_t expected_crc32,
+	std::size_t entry_number,
+	EntryTiming* timing) {
+
+	const InflateScratch scratch(expected_uncompressed_size);
+	const InflateResult result = [&] {
+		const ScopedTimer timer(inflateClock(timing));
+		return inflateWholeBuffer(compressed, scratch.bytes());
+	}();
+	switch (result.status) {
+		case InflateStatus::ok:
+			break;
+		case InflateStatus::output_full:
+			throw std::runtime_error(std::format(
+				"Archive Security Error: Actual output for entry {} exceeds its permitted size.",
+				entry_number));
+		case InflateStatus::truncated:
+			throw std::runtime_error(std::format(
+				"Archive File Error: Truncated DEFLATE stream on entry {}.", entry_number));
+		case InflateStatus::corrupt:
+			throw std::runtime_error(std::format(
+				"Archive File Error: Corrupt DEFLATE stream on entry {}.", entry_number));
+	}
+
+	if (result.consumed != compressed.size()) {
+		throw std::runtime_error(std::format(
+			"Archive File Error: DEFLATE stream on entry {} has trailing compressed bytes.",
+			entry_number));
+	}
+	if (result.produced != expected_uncompressed_size) {
+		throw std::runtime_error(std::format(
+			"Archive File Error: Actual uncompressed size differs from metadata on entry {}.",
+			entry_number));
+	}
+	const ScopedTimer timer(crcClock(timing));
+	Crc32 payload_crc;
+	payload_crc.update(scratch.bytes());
+	if (payload_crc.value() != expected_crc32) {
+		throw std::runtime_error(std::format(
+			"Archive File Error: CRC-32 verification failed on entry {}.", entry_number));
+	}
+
+	Crc32 compressed_crc;
+	compressed_crc.update(compressed);
+	return VerifiedPayload{
+		.uncompressed_size = result.produced,
+		.compressed_crc = compressed_crc.value()
+	};
+}
+
+[[nodiscard]] VerifiedPayload verifyDeflatedPayloadStreaming(
 	std::span<const Byte> compressed,
 	uint32_t expected_uncompressed_size,
 	uint32_t expected_crc32,
 	std::uint64_t output_limit,
-	std::size_t entry_number) {
+	std::size_t entry_number,
+	EntryTiming* timing) {
 
 	z_stream stream{};
 	const int init_status = ::inflateInit2(&stream, -MAX_WBITS);
@@ -429,7 +734,9 @@ struct InflateEndGuard {
 	std::array<Byte, 64 * 1024> output_buffer{};
 	std::size_t supplied_input = 0;
 	std::uint64_t output_size = 0;
-	uLong payload_crc = ::crc32(0L, Z_NULL, 0);
+	Crc32 payload_crc;
+	Crc32 compressed_crc;
+	std::size_t compressed_crc_end = 0;
 	int status = Z_OK;
 
 	while (status != Z_STREAM_END) {
@@ -445,17 +752,25 @@ struct InflateEndGuard {
 
 		stream.next_out = reinterpret_cast<Bytef*>(output_buffer.data());
 		stream.avail_out = static_cast<uInt>(output_buffer.size());
-		status = ::inflate(&stream, Z_NO_FLUSH);
+		{
+			const ScopedTimer timer(inflateClock(timing));
+			status = ::inflate(&stream, Z_NO_FLUSH);
+		}
 
+		const std::size_t consumed_so_far = supplied_input - stream.avail_in;
 		const std::size_t produced = output_buffer.size() - stream.avail_out;
 		if (output_size > output_limit || produced > output_limit - output_size) {
 			throw std::runtime_error(std::format(
 				"Archive Security Error: Actual output for entry {} exceeds its permitted size.",
 				entry_number));
 		}
-		payload_crc = updatePayloadCrc(
-			payload_crc,
-			std::span<const Byte>(output_buffer.data(), produced));
+		{
+			// CRC the input inflate just consumed while it is still in cache.
+			const ScopedTimer timer(crcClock(timing));
+			compressed_crc.update(compressed.subspan(compressed_crc_end, consumed_so_far - compressed_crc_end));
+			payload_crc.update(std::span<const Byte>(output_buffer.data(), produced));
+		}
+		compressed_crc_end = consumed_so_far;
 		output_size += produced;
 
 		if (status == Z_STREAM_END) {
@@ -485,35 +800,47 @@ struct InflateEndGuard {
 			"Archive File Error: Actual uncompressed size differs from metadata on entry {}.",
 			entry_number));
 	}
-	if (static_cast<uint32_t>(payload_crc) != expected_crc32) {
+	if (payload_crc.value() != expected_crc32) {
 		throw std::runtime_error(std::format(
 			"Archive File Error: CRC-32 verification failed on entry {}.", entry_number));
 	}
 
-	return output_size;
+	return VerifiedPayload{
+		.uncompressed_size = output_size,
+		.compressed_crc = compressed_crc.value()
+	};
 }
 
-[[nodiscard]] std::uint64_t verifyEntryPayload(
+[[nodiscard]] VerifiedPayload verifyEntryPayload(
 	uint16_t compression_method,
 	std::span<const Byte> compressed,
 	uint32_t expected_uncompressed_size,
 	uint32_t expected_crc32,
-	std::uint64_t total_verified_uncompressed,
-	std::size_t entry_number) {
+	UncompressedBudget& budget,
+	std::size_t entry_number,
+	EntryTiming* timing) {
 
-	if (total_verified_uncompressed > MAX_TOTAL_UNCOMPRESSED_SIZE) {
+	if (!budget.tryReserve(expected_uncompressed_size)) {
 		throw std::runtime_error("Archive Security Error: Actual uncompressed archive size exceeds the safety limit.");
 	}
-	const std::uint64_t remaining_output = MAX_TOTAL_UNCOMPRESSED_SIZE - total_verified_uncompressed;
-	const std::uint64_t output_limit = std::min<std::uint64_t>(expected_uncompressed_size, remaining_output);
+	const std::uint64_t output_limit = expected_uncompressed_size;
 
 	if (compression_method == 8) {
-		return verifyDeflatedPayload(
+		if (expected_uncompressed_size <= WHOLE_BUFFER_INFLATE_LIMIT) {
+			return verifyDeflatedPayloadWhole(
+				compressed,
+				expected_uncompressed_size,
+				expected_crc32,
+				entry_number,
+				timing);
+		}
+		return verifyDeflatedPayloadStreaming(
 			compressed,
 			expected_uncompressed_size,
 			expected_crc32,
 			output_limit,
-			entry_number);
+			entry_number,
+			timing);
 	}
 	if (compression_method != 0) {
 		validateCompressionMethod(compression_method, entry_number);
@@ -525,12 +852,19 @@ struct InflateEndGuard {
 			"Archive File Error: Stored payload size differs from metadata on entry {}.",
 			entry_number));
 	}
-	const uLong payload_crc = updatePayloadCrc(::crc32(0L, Z_NULL, 0), compressed);
-	if (static_cast<uint32_t>(payload_crc) != expected_crc32) {
+	// Stored payloads can run to gigabytes; crc32Update slices those across
+	// threads when the entries are not already being verified on a pool.
+	const ScopedTimer timer(crcClock(timing));
+	if (crc32Update(0, compressed) != expected_crc32) {
 		throw std::runtime_error(std::format(
 			"Archive File Error: CRC-32 verification failed on entry {}.", entry_number));
 	}
-	return compressed.size();
+	// Stored data is its own uncompressed form, so the verified CRC doubles as
+	// the CRC of the raw payload bytes.
+	return VerifiedPayload{
+		.uncompressed_size = compressed.size(),
+		.compressed_crc = expected_crc32
+	};
 }
 
 [[nodiscard]] bool descriptor32Matches(std::span<const Byte> archive_data, std::size_t offset,
@@ -540,13 +874,22 @@ struct InflateEndGuard {
 		&& readLe32(archive_data, offset + 8) == uncompressed_size;
 }
 
+[[nodiscard]] bool descriptor64Matches(std::span<const Byte> archive_data, std::size_t offset,
+                                       uint32_t crc32, uint32_t compressed_size, uint32_t uncompressed_size) {
+	return readLe32(archive_data, offset) == crc32
+		&& readLe64(archive_data, offset + 4) == compressed_size
+		&& readLe64(archive_data, offset + 12) == uncompressed_size;
+}
+
+// An entry whose local header carries a ZIP64 field records 8-byte sizes in
+// its data descriptor; any other entry records 4-byte sizes.
 [[nodiscard]] std::size_t readDataDescriptorLength(std::span<const Byte> archive_data, std::size_t descriptor_start,
                                                    std::size_t central_start, uint32_t crc32,
                                                    uint32_t compressed_size, uint32_t uncompressed_size,
-                                                   std::size_t entry_number) {
-	constexpr std::size_t
-		DESCRIPTOR_WITHOUT_SIGNATURE_SIZE = 12,
-		DESCRIPTOR_WITH_SIGNATURE_SIZE    = 16;
+                                                   bool zip64_sizes, std::size_t entry_number) {
+	const std::size_t descriptor_without_signature_size = zip64_sizes ? 20 : 12;
+	const std::size_t descriptor_with_signature_size = descriptor_without_signature_size + 4;
+	const auto descriptorMatches = zip64_sizes ? descriptor64Matches : descriptor32Matches;
 
 	if (descriptor_start > central_start) {
 		throw std::runtime_error(std::format(
@@ -554,26 +897,26 @@ struct InflateEndGuard {
 	}
 
 	const std::size_t available = central_start - descriptor_start;
-	if (available >= DESCRIPTOR_WITH_SIGNATURE_SIZE
+	if (available >= descriptor_with_signature_size
 		&& hasLe32Signature(archive_data, descriptor_start, ZIP_DATA_DESCRIPTOR_SIGNATURE)
-		&& descriptor32Matches(archive_data, descriptor_start + 4, crc32, compressed_size, uncompressed_size)) {
-		return DESCRIPTOR_WITH_SIGNATURE_SIZE;
+		&& descriptorMatches(archive_data, descriptor_start + 4, crc32, compressed_size, uncompressed_size)) {
+		return descriptor_with_signature_size;
 	}
-	if (available >= DESCRIPTOR_WITHOUT_SIGNATURE_SIZE
-		&& descriptor32Matches(archive_data, descriptor_start, crc32, compressed_size, uncompressed_size)) {
-		return DESCRIPTOR_WITHOUT_SIGNATURE_SIZE;
+	if (available >= descriptor_without_signature_size
+		&& descriptorMatches(archive_data, descriptor_start, crc32, compressed_size, uncompressed_size)) {
+		return descriptor_without_signature_size;
 	}
 
 	throw std::runtime_error(std::format(
 		"Archive File Error: Data descriptor for entry {} is missing or inconsistent.", entry_number));
 }
 
-void validateLocalEntryPayload(std::span<const Byte> archive_data, std::size_t local_header_start,
-                               std::size_t local_record_end, std::size_t central_start,
-                               uint16_t central_flags, uint16_t central_compression_method, uint32_t crc32,
-                               uint32_t compressed_size, uint32_t uncompressed_size,
-                               std::uint64_t& total_verified_uncompressed,
-                               std::vector<LocalEntrySpan>& local_spans, std::size_t entry_number) {
+[[nodiscard]] PendingPayload validateLocalEntryMetadata(std::span<const Byte> archive_data, std::size_t local_header_start,
+                                                      std::size_t local_record_end, std::size_t central_start,
+                                                      uint16_t central_flags, uint16_t central_compression_method,
+                                                      uint32_t crc32, uint32_t compressed_size,
+                                                      uint32_t uncompressed_size, Zip64ExtendedInfo& local_zip64,
+                                                      std::size_t entry_number) {
 	constexpr uint16_t GENERAL_PURPOSE_DATA_DESCRIPTOR = 1u << 3;
 
 	const uint16_t local_flags = readZipField<uint16_t>(archive_data, local_header_start + 6, "Archive File Error");
@@ -591,8 +934,10 @@ void validateLocalEntryPayload(std::span<const Byte> archive_data, std::size_t l
 
 	const bool has_data_descriptor = (central_flags & GENERAL_PURPOSE_DATA_DESCRIPTOR) != 0;
 	const uint32_t local_crc32 = readZipField<uint32_t>(archive_data, local_header_start + 14, "Archive File Error");
-	const uint32_t local_compressed_size = readZipField<uint32_t>(archive_data, local_header_start + 18, "Archive File Error");
-	const uint32_t local_uncompressed_size = readZipField<uint32_t>(archive_data, local_header_start + 22, "Archive File Error");
+	const uint32_t local_uncompressed_size = local_zip64.resolve(
+		readZipField<uint32_t>(archive_data, local_header_start + 22, "Archive File Error"), "uncompressed size");
+	const uint32_t local_compressed_size = local_zip64.resolve(
+		readZipField<uint32_t>(archive_data, local_header_start + 18, "Archive File Error"), "compressed size");
 	const bool local_metadata_matches = local_crc32 == crc32
 		&& local_compressed_size == compressed_size
 		&& local_uncompressed_size == uncompressed_size;
@@ -613,42 +958,69 @@ void validateLocalEntryPayload(std::span<const Byte> archive_data, std::size_t l
 		throw std::runtime_error(std::format(
 			"Archive File Error: Compressed data for entry {} extends into the central directory.", entry_number));
 	}
-	const std::span<const Byte> compressed_payload = archive_data.subspan(local_record_end, compressed_size);
-	const std::uint64_t verified_size = verifyEntryPayload(
-		central_compression_method,
-		compressed_payload,
-		uncompressed_size,
-		crc32,
-		total_verified_uncompressed,
-		entry_number);
-	if (verified_size > MAX_TOTAL_UNCOMPRESSED_SIZE - total_verified_uncompressed) {
-		throw std::runtime_error("Archive Security Error: Actual uncompressed archive size exceeds the safety limit.");
-	}
-	total_verified_uncompressed += verified_size;
 
-	std::size_t local_payload_end = compressed_end;
-	if (has_data_descriptor) {
+	return PendingPayload{
+		.entry_number = entry_number,
+		.local_header_start = local_header_start,
+		.local_record_end = local_record_end,
+		.compressed_end = compressed_end,
+		.has_data_descriptor = has_data_descriptor,
+		.has_zip64_descriptor = local_zip64.present(),
+		.compression_method = central_compression_method,
+		.crc32 = crc32,
+		.compressed_size = compressed_size,
+		.uncompressed_size = uncompressed_size
+	};
+}
+
+[[nodiscard]] VerifiedLocalEntry verifyLocalEntryPayload(std::span<const Byte> archive_data, std::size_t central_start,
+                                                         const PendingPayload& entry, UncompressedBudget& budget,
+                                                         EntryTiming* timing) {
+	const VerifiedPayload verified = verifyEntryPayload(
+		entry.compression_method,
+		archive_data.subspan(entry.local_record_end, entry.compressed_size),
+		entry.uncompressed_size,
+		entry.crc32,
+		budget,
+		entry.entry_number,
+		timing);
+
+	std::size_t local_payload_end = entry.compressed_end;
+	if (entry.has_data_descriptor) {
 		local_payload_end = checkedAdd(
-			compressed_end,
+			entry.compressed_end,
 			readDataDescriptorLength(
 				archive_data,
-				compressed_end,
+				entry.compressed_end,
 				central_start,
-				crc32,
-				compressed_size,
-				uncompressed_size,
-				entry_number),
+				entry.crc32,
+				entry.compressed_size,
+				entry.uncompressed_size,
+				entry.has_zip64_descriptor,
+				entry.entry_number),
 			"Archive File Error: Local data descriptor size overflow.");
 		if (local_payload_end > central_start) {
 			throw std::runtime_error(std::format(
-				"Archive File Error: Data descriptor for entry {} extends into the central directory.", entry_number));
+				"Archive File Error: Data descriptor for entry {} extends into the central directory.",
+				entry.entry_number));
 		}
 	}
 
-	local_spans.push_back(LocalEntrySpan{
-		.begin = local_header_start,
-		.end   = local_payload_end
-	});
+	// Header and descriptor are CRC'd directly; the payload CRC came from
+	// verification, so the entry's bytes are not read a second time.
+	Crc32 entry_crc;
+	entry_crc.update(archive_data.subspan(entry.local_header_start, entry.local_record_end - entry.local_header_start));
+	entry_crc.combine(verified.compressed_crc, entry.compressed_size);
+	entry_crc.update(archive_data.subspan(entry.compressed_end, local_payload_end - entry.compressed_end));
+
+	return VerifiedLocalEntry{
+		.span = LocalEntrySpan{
+			.begin = entry.local_header_start,
+			.end   = local_payload_end,
+			.crc   = entry_crc.value()
+		},
+		.uncompressed_size = verified.uncompressed_size
+	};
 }
 
 void validateLocalEntrySpans(std::vector<LocalEntrySpan>& local_spans) {
@@ -663,14 +1035,107 @@ void validateLocalEntrySpans(std::vector<LocalEntrySpan>& local_spans) {
 	}
 }
 
+// CRC of archive[0, central_start), stitched together from the sorted,
+// non-overlapping entry spans plus any bytes between them.
+[[nodiscard]] uint32_t combineLocalRegionCrc(std::span<const Byte> archive_data,
+                                                     const std::vector<LocalEntrySpan>& local_spans,
+                                                     std::size_t central_start) {
+	Crc32 crc;
+	std::size_t cursor = 0;
+	for (const LocalEntrySpan& span : local_spans) {
+		crc.update(archive_data.subspan(cursor, span.begin - cursor));
+		crc.combine(span.crc, span.end - span.begin);
+		cursor = span.end;
+	}
+	crc.update(archive_data.subspan(cursor, central_start - cursor));
+	return crc.value();
+}
+
+struct Zip64EndOfCentralDirectory {
+	std::size_t offset;
+	uint32_t disk_number;
+	uint32_t central_dir_disk;
+	std::uint64_t records_on_disk;
+	std::uint64_t total_records;
+	std::uint64_t central_size;
+	std::uint64_t central_offset;
+};
+
+// The ZIP64 end-of-central-directory record, when a locator sits directly
+// before the EOCD record. The record must end exactly where its locator
+// begins, so nothing can hide between the two.
+[[nodiscard]] std::optional<Zip64EndOfCentralDirectory> readZip64EndOfCentralDirectory(
+	std::span<const Byte> archive_data, std::size_t eocd_index) {
+	constexpr std::size_t
+		ZIP64_LOCATOR_SIZE     = 20,
+		ZIP64_EOCD_MIN_SIZE    = 56,
+		ZIP64_EOCD_LEADER_SIZE = 12;   // signature and size field, which the size excludes
+
+	if (eocd_index < ZIP64_LOCATOR_SIZE
+		|| !hasLe32Signature(archive_data, eocd_index - ZIP64_LOCATOR_SIZE, ZIP64_END_CENTRAL_LOCATOR_SIGNATURE)) {
+		return std::nullopt;
+	}
+	const std::size_t locator = eocd_index - ZIP64_LOCATOR_SIZE;
+	const uint32_t record_disk = readLe32(archive_data, locator + 4);
+	const std::uint64_t record_offset = readLe64(archive_data, locator + 8);
+	const uint32_t total_disks = readLe32(archive_data, locator + 16);
+	if (record_disk != 0 || total_disks > 1) {
+		throw std::runtime_error("Archive File Error: Multi-disk ZIP archives are not supported.");
+	}
+	if (record_offset > locator || locator - record_offset < ZIP64_EOCD_MIN_SIZE
+		|| !hasLe32Signature(archive_data, static_cast<std::size_t>(record_offset), ZIP64_END_CENTRAL_DIRECTORY_SIGNATURE)
+		|| readLe64(archive_data, static_cast<std::size_t>(record_offset) + 4)
+			!= locator - record_offset - ZIP64_EOCD_LEADER_SIZE) {
+		throw std::runtime_error("Archive File Error: Invalid ZIP64 end of central directory record.");
+	}
+
+	const auto record = static_cast<std::size_t>(record_offset);
+	return Zip64EndOfCentralDirectory{
+		.offset = record,
+		.disk_number = readLe32(archive_data, record + 16),
+		.central_dir_disk = readLe32(archive_data, record + 20),
+		.records_on_disk = readLe64(archive_data, record + 24),
+		.total_records = readLe64(archive_data, record + 32),
+		.central_size = readLe64(archive_data, record + 40),
+		.central_offset = readLe64(archive_data, record + 48)
+	};
+}
+
+// An EOCD field next to its ZIP64 counterpart. The classic field may be
+// saturated; otherwise the two must agree, so every reader sees the same
+// directory.
+[[nodiscard]] std::uint64_t reconcileEocdField(std::uint64_t classic, std::uint64_t saturated, std::uint64_t zip64) {
+	if (classic != saturated && classic != zip64) {
+		throw std::runtime_error("Archive File Error: EOCD and ZIP64 end of central directory records disagree.");
+	}
+	return zip64;
+}
+
 [[nodiscard]] CentralDirectoryBounds readCentralDirectoryBounds(std::span<const Byte> archive_data,
                                                                 std::size_t eocd_index) {
-	const uint16_t disk_number = readZipField<uint16_t>(archive_data, eocd_index + 4, "Archive File Error");
-	const uint16_t central_dir_disk = readZipField<uint16_t>(archive_data, eocd_index + 6, "Archive File Error");
-	const uint16_t records_on_disk = readZipField<uint16_t>(archive_data, eocd_index + 8, "Archive File Error");
-	const uint16_t total_records = readZipField<uint16_t>(archive_data, eocd_index + 10, "Archive File Error");
-	const uint32_t central_size = readZipField<uint32_t>(archive_data, eocd_index + 12, "Archive File Error");
-	const uint32_t central_offset = readZipField<uint32_t>(archive_data, eocd_index + 16, "Archive File Error");
+	std::uint64_t disk_number = readZipField<uint16_t>(archive_data, eocd_index + 4, "Archive File Error");
+	std::uint64_t central_dir_disk = readZipField<uint16_t>(archive_data, eocd_index + 6, "Archive File Error");
+	std::uint64_t records_on_disk = readZipField<uint16_t>(archive_data, eocd_index + 8, "Archive File Error");
+	std::uint64_t total_records = readZipField<uint16_t>(archive_data, eocd_index + 10, "Archive File Error");
+	std::uint64_t central_size = readZipField<uint32_t>(archive_data, eocd_index + 12, "Archive File Error");
+	std::uint64_t central_offset = readZipField<uint32_t>(archive_data, eocd_index + 16, "Archive File Error");
+
+	// Without a ZIP64 record the central directory runs up to the EOCD record;
+	// with one, up to that record.
+	std::size_t directory_end = eocd_index;
+	const std::optional<Zip64EndOfCentralDirectory> zip64 = readZip64EndOfCentralDirectory(archive_data, eocd_index);
+	if (zip64) {
+		disk_number = reconcileEocdField(disk_number, UINT16_MAX, zip64->disk_number);
+		central_dir_disk = reconcileEocdField(central_dir_disk, UINT16_MAX, zip64->central_dir_disk);
+		records_on_disk = reconcileEocdField(records_on_disk, UINT16_MAX, zip64->records_on_disk);
+		total_records = reconcileEocdField(total_records, UINT16_MAX, zip64->total_records);
+		central_size = reconcileEocdField(central_size, UINT32_MAX, zip64->central_size);
+		central_offset = reconcileEocdField(central_offset, UINT32_MAX, zip64->central_offset);
+		directory_end = zip64->offset;
+	}
+	else if (total_records == UINT16_MAX || central_size == UINT32_MAX || central_offset == UINT32_MAX) {
+		throw std::runtime_error("Archive File Error: ZIP64 end of central directory record is missing.");
+	}
 
 	if (disk_number != 0 || central_dir_disk != 0 || records_on_disk != total_records) {
 		throw std::runtime_error("Archive File Error: Multi-disk ZIP archives are not supported.");
@@ -678,30 +1143,33 @@ void validateLocalEntrySpans(std::vector<LocalEntrySpan>& local_spans) {
 	if (total_records == 0) {
 		throw std::runtime_error("Archive File Error: Archive contains no central directory entries.");
 	}
-	if (total_records == UINT16_MAX || central_size == UINT32_MAX || central_offset == UINT32_MAX) {
-		throw std::runtime_error("Archive File Error: ZIP64 archives are not supported.");
+	if (central_offset > archive_data.size() || central_size > archive_data.size()) {
+		throw std::runtime_error("Archive File Error: Central directory bounds are invalid.");
 	}
 
-	const std::size_t central_start = checkedAdd(
-		ZIP_WRAP_PREFIX_SIZE,
-		static_cast<std::size_t>(central_offset),
-		"Archive File Error: Central directory offset overflow.");
+	const auto central_start = static_cast<std::size_t>(central_offset);
 	const std::size_t central_end = checkedAdd(
 		central_start,
 		static_cast<std::size_t>(central_size),
 		"Archive File Error: Central directory size overflow.");
 
-	if (central_start > archive_data.size() || central_end > archive_data.size() || central_end > eocd_index) {
+	if (central_end > archive_data.size() || central_end > directory_end) {
 		throw std::runtime_error("Archive File Error: Central directory bounds are invalid.");
 	}
-	if (central_end != eocd_index) {
-		throw std::runtime_error("Archive File Error: Central directory does not end at the EOCD record.");
+	if (central_end != directory_end) {
+		throw std::runtime_error(zip64
+			? "Archive File Error: Central directory does not end at the ZIP64 end of central directory record."
+			: "Archive File Error: Central directory does not end at the EOCD record.");
+	}
+	if (total_records > (central_end - central_start) / CENTRAL_RECORD_MIN_SIZE) {
+		throw std::runtime_error("Archive File Error: Central directory record count exceeds its size.");
 	}
 
 	return CentralDirectoryBounds{
 		.start = central_start,
 		.end = central_end,
-		.total_records = total_records
+		.total_records = static_cast<std::size_t>(total_records),
+		.zip64_eocd_offset = zip64 ? std::optional<std::size_t>(zip64->offset) : std::nullopt
 	};
 }
 
@@ -764,8 +1232,10 @@ void validateLocalEntrySpans(std::vector<LocalEntrySpan>& local_spans) {
 		.disk_start = disk_start,
 		.external_attributes = external_attributes,
 		.local_header_offset = local_header_offset,
+		.zip64_offset_field = std::nullopt,
 		.name = name,
 		.extra = extra,
+		.extra_start = extra_start,
 		.record_size = record_size
 	};
 }
@@ -780,24 +1250,33 @@ void validateCentralRecordSpan(std::size_t cursor, std::size_t record_size, std:
 	}
 }
 
-void validateCentralEntryMetadata(const CentralEntryMetadata& entry, ArchiveEntryTracking& tracking) {
-	if (entry.disk_start != 0) {
-		throw std::runtime_error(std::format(
-			"Archive File Error: Multi-disk local header reference on entry {} is not supported.",
-			entry.entry_number));
-	}
+// Replace saturated sizes, local header offset and disk number with the
+// values from the record's ZIP64 extra field.
+void resolveCentralZip64Fields(CentralEntryMetadata& entry) {
+	Zip64ExtendedInfo zip64(entry.extra, entry.extra_start, "Central-directory", entry.entry_number);
+	entry.uncompressed_size = zip64.resolve(entry.uncompressed_size, "uncompressed size");
+	entry.compressed_size = zip64.resolve(entry.compressed_size, "compressed size");
 	if (entry.local_header_offset == UINT32_MAX) {
-		throw std::runtime_error(std::format(
-			"Archive File Error: ZIP64 local-header offset is not supported on entry {}.",
-			entry.entry_number));
+		entry.zip64_offset_field = zip64.nextValueOffset();
+		entry.local_header_offset = zip64.resolve(UINT32_MAX, "local header offset");
 	}
+	entry.disk_start = zip64.resolveDisk(entry.disk_start);
+}
 
+void validateCentralEntryMetadata(CentralEntryMetadata& entry, ArchiveEntryTracking& tracking) {
 	validateEntryName(
 		entry.name,
 		"Archive File Error: Entry",
 		"Archive Security Error: Unsafe archive entry path detected",
 		entry.entry_number);
 	validateZipExtraFields(entry.extra, "central-directory", entry.entry_number);
+	resolveCentralZip64Fields(entry);
+	if (entry.disk_start != 0) {
+		throw std::runtime_error(std::format(
+			"Archive File Error: Multi-disk local header reference on entry {} is not supported.",
+			entry.entry_number));
+	}
+
 	validateCompressionMethod(entry.compression_method, entry.entry_number);
 	validateEntryAttributes(
 		entry.version_made_by,
@@ -806,7 +1285,6 @@ void validateCentralEntryMetadata(const CentralEntryMetadata& entry, ArchiveEntr
 		entry.name,
 		entry.entry_number);
 	validateEntrySizeMetadata(
-		entry.compressed_size,
 		entry.uncompressed_size,
 		tracking.total_declared_uncompressed,
 		entry.name.ends_with('/'),
@@ -814,14 +1292,10 @@ void validateCentralEntryMetadata(const CentralEntryMetadata& entry, ArchiveEntr
 	tracking.paths.insert(entry.name, entry.entry_number);
 }
 
-void validateLocalEntryForCentralEntry(std::span<const Byte> archive_data, std::size_t central_start,
-                                       const CentralEntryMetadata& entry,
-                                       std::uint64_t& total_verified_uncompressed,
-                                       std::vector<LocalEntrySpan>& local_spans) {
-	const std::size_t local_header_start = checkedAdd(
-		ZIP_WRAP_PREFIX_SIZE,
-		entry.local_header_offset,
-		"Archive File Error: Local file header offset overflow.");
+[[nodiscard]] PendingPayload validateLocalEntryForCentralEntry(std::span<const Byte> archive_data,
+                                                              std::size_t central_start,
+                                                              const CentralEntryMetadata& entry) {
+	const std::size_t local_header_start = entry.local_header_offset;
 	if (local_header_start >= central_start) {
 		throw std::runtime_error("Archive File Error: Local file header points inside the central directory.");
 	}
@@ -869,8 +1343,9 @@ void validateLocalEntryForCentralEntry(std::span<const Byte> archive_data, std::
 		throw std::runtime_error(std::format(
 			"Archive Security Error: Local and central directory names differ for entry {}.", entry.entry_number));
 	}
+	Zip64ExtendedInfo local_zip64(local_extra, local_extra_start, "Local-header", entry.entry_number);
 
-	validateLocalEntryPayload(
+	return validateLocalEntryMetadata(
 		archive_data,
 		local_header_start,
 		local_record_end,
@@ -880,11 +1355,97 @@ void validateLocalEntryForCentralEntry(std::span<const Byte> archive_data, std::
 		entry.crc32,
 		entry.compressed_size,
 		entry.uncompressed_size,
-		total_verified_uncompressed,
-		local_spans,
+		local_zip64,
 		entry.entry_number);
 }
 
+// Wait for the start of the entry at begin, whose span runs at most to end.
+void awaitEntryBytes(const ArchiveLoadProgress* load_progress, std::size_t begin, std::size_t end) {
+	if (load_progress != nullptr && begin < end) {
+		load_progress->waitFor(begin, begin + std::min(end - begin, ENTRY_LOAD_WAIT_LIMIT));
+	}
+}
+
+// Check every entry whose central record passed: local header, then payload,
+// on a pool when there is enough data to be worth it. Entries are claimed in
+// physical order from a shared counter, so checks follow an archive that is
+// still loading front to back, and a few large entries do not hold up the
+// many small ones behind them. On failure the error of the lowest-numbered
+// failing entry is rethrown, as a sequential check would report; entries
+// after a known failure are skipped. timings, when not empty, receives each
+// entry's payload check times.
+[[nodiscard]] std::vector<VerifiedLocalEntry> verifyLocalEntries(
+	std::span<const Byte> archive_data,
+	std::size_t central_start,
+	std::span<const CentralEntryMetadata> entries,
+	const ArchiveLoadProgress* load_progress,
+	std::span<EntryTiming> timings) {
+
+	std::vector<std::size_t> physical_order(entries.size());
+	std::iota(physical_order.begin(), physical_order.end(), std::size_t{0});
+	std::ranges::stable_sort(physical_order, std::less{}, [&](std::size_t i) {
+		return entries[i].local_header_offset;
+	});
+
+	std::vector<VerifiedLocalEntry> verified(entries.size());
+	std::vector<std::exception_ptr> errors(entries.size());
+	std::atomic<std::size_t> next_claim{0};
+	std::atomic<std::size_t> first_failure{entries.size()};
+	UncompressedBudget budget;
+
+	const auto verifyClaimed = [&] {
+		for (std::size_t claim = next_claim.fetch_add(1, std::memory_order_relaxed); claim < entries.size();
+			 claim = next_claim.fetch_add(1, std::memory_order_relaxed)) {
+			const std::size_t i = physical_order[claim];
+			if (i > first_failure.load(std::memory_order_relaxed)) {
+				continue;
+			}
+			try {
+				const std::size_t next_start = claim + 1 < entries.size()
+					? std::min(entries[physical_order[claim + 1]].local_header_offset, central_start)
+					: central_start;
+				awaitEntryBytes(load_progress, entries[i].local_header_offset, next_start);
+				verified[i] = verifyLocalEntryPayload(
+					archive_data,
+					central_start,
+					validateLocalEntryForCentralEntry(archive_data, central_start, entries[i]),
+					budget,
+					timings.empty() ? nullptr : &timings[i]);
+			}
+			catch (...) {
+				errors[i] = std::current_exception();
+				std::size_t lowest = first_failure.load(std::memory_order_relaxed);
+				while (i < lowest && !first_failure.compare_exchange_weak(lowest, i, std::memory_order_relaxed)) {
+				}
+			}
+		}
+	};
+
+	std::uint64_t total_compressed = 0;
+	for (const CentralEntryMetadata& entry : entries) {
+		total_compressed += entry.compressed_size;
+	}
+	// Inside a batch the archives themselves already occupy the workers.
+	const unsigned requested_threads = verify_thread_count.load(std::memory_order_relaxed);
+	const unsigned thread_count = static_cast<unsigned>(std::min<std::size_t>(
+		requested_threads != 0 ? requested_threads : ThreadPool::defaultThreadCount(), entries.size()));
+	if (thread_count < 2 || total_compressed < PARALLEL_VERIFY_MIN_BYTES || ThreadPool::onWorkerThread()) {
+		verifyClaimed();
+	}
+	else {
+		ThreadPool pool(thread_count);
+		for (unsigned i = 0; i < thread_count; ++i) {
+			pool.submit(verifyClaimed);
+		}
+		pool.wait();
+	}
+
+	if (const std::size_t failed = first_failure.load(); failed < entries.size()) {
+		std::rethrow_exception(errors[failed]);
+	}
+	return verified;
+}
+
 [[nodiscard]] bool isUnsafeEntryPath(std::string_view path) {
 	if (path.empty()) {
 		return true;
@@ -922,15 +1483,15 @@ void validateLocalEntryForCentralEntry(std::span<const Byte> archive_data, std::
 	return false;
 }
 
-[[nodiscard]] std::size_t findEndOfCentralDirectory(std::span<const Byte> archive_data) {
+[[nodiscard]] ZipEocdLocator findEndOfCentralDirectory(std::span<const Byte> archive_data) {
 	constexpr std::size_t EOCD_MIN_SIZE = 22;
 
-	if (archive_data.size() < ZIP_WRAP_PREFIX_SIZE + ZIP_WRAP_TRAILER_SIZE + EOCD_MIN_SIZE) {
+	if (archive_data.size() < EOCD_MIN_SIZE) {
 		throw std::runtime_error("Archive File Error: Archive is too small.");
 	}
 
-	if (const auto eocd = findZipEocdLocator(archive_data, ZIP_WRAP_PREFIX_SIZE, archive_data.size() - ZIP_WRAP_TRAILER_SIZE)) {
-		return eocd->index;
+	if (const auto eocd = findZipEocdLocator(archive_data, 0, archive_data.size())) {
+		return *eocd;
 	}
 
 	throw std::runtime_error("Archive File Error: End of central directory record not found.");
@@ -940,6 +1501,7 @@ struct ValidatedArchiveSummary {
 	std::string first_referenced_filename;
 	std::size_t first_referenced_local_offset = std::numeric_limits<std::size_t>::max();
 	bool has_jar_manifest_file = false;
+	ZipDirectoryIndex directory;
 };
 
 [[nodiscard]] bool isRegularFileEntry(const CentralEntryMetadata& entry) {
@@ -959,65 +1521,161 @@ struct ValidatedArchiveSummary {
 	return (entry.external_attributes & DOS_DIRECTORY_ATTRIBUTE) == 0;
 }
 
-[[nodiscard]] ValidatedArchiveSummary validateAndSummarizeArchive(std::span<const Byte> archive_data) {
-	const std::size_t eocd_index = findEndOfCentralDirectory(archive_data);
-	const CentralDirectoryBounds central_directory = readCentralDirectoryBounds(archive_data, eocd_index);
+// profile, when given, receives one record per entry with its payload check
+// times; only the profiling report asks for this.
+[[nodiscard]] ValidatedArchiveSummary validateAndSummarizeArchive(std::span<const Byte> archive_data,
+                                                                  const ArchiveLoadProgress* load_progress,
+                                                                  std::vector<EntryProfile>* profile = nullptr) {
+	constexpr std::size_t EOCD_SEARCH_SPAN = 22 + UINT16_MAX;
+
+	if (load_progress != nullptr) {
+		load_progress->waitFor(archive_data.size() - std::min(archive_data.size(), EOCD_SEARCH_SPAN),
+			archive_data.size());
+	}
+	const ZipEocdLocator eocd = findEndOfCentralDirectory(archive_data);
+	const CentralDirectoryBounds central_directory = readCentralDirectoryBounds(archive_data, eocd.index);
+	if (load_progress != nullptr) {
+		load_progress->waitFor(central_directory.start, central_directory.end);
+	}
 
 	std::size_t cursor = central_directory.start;
 	ArchiveEntryTracking tracking;
 	tracking.reserve(central_directory.total_records);
 	ValidatedArchiveSummary summary;
+	ZipDirectoryIndex& directory = summary.directory;
+	directory.central_start = central_directory.start;
+	directory.eocd_offset = eocd.index;
+	directory.eocd_comment_length = eocd.comment_length;
+	directory.zip64_eocd_offset = central_directory.zip64_eocd_offset;
+	directory.local_header_offsets.reserve(central_directory.total_records);
+	directory.central_record_offsets.reserve(central_directory.total_records);
+
+	// Central records are checked here in entry order; local headers and
+	// payloads are checked together afterwards, as their bytes arrive. A
+	// central record error stops the walk, but is reported only if no earlier
+	// entry turns out to be bad.
+	std::exception_ptr header_error;
+	for (std::size_t i = 0; i < central_directory.total_records; ++i) {
+		try {
+			CentralEntryMetadata entry = readCentralEntryMetadata(
+				archive_data,
+				cursor,
+				i + 1);
+
+			validateCentralRecordSpan(cursor, entry.record_size, central_directory.end, archive_data.size());
+			validateCentralEntryMetadata(entry, tracking);
+			tracking.entries.push_back(entry);
+
+			// Both offsets lie inside the archive, which file_io caps below 2 GiB.
+			directory.local_header_offsets.push_back(static_cast<uint32_t>(entry.local_header_offset));
+			directory.central_record_offsets.push_back(static_cast<uint32_t>(cursor));
+			if (entry.zip64_offset_field) {
+				directory.zip64_offset_slots.push_back(ZipDirectoryIndex::Zip64OffsetSlot{
+					.record = static_cast<uint32_t>(i),
+					.field_offset = static_cast<uint32_t>(*entry.zip64_offset_field)
+				});
+			}
 
-	for (uint16_t i = 0; i < central_directory.total_records; ++i) {
-		const CentralEntryMetadata entry = readCentralEntryMetadata(
-			archive_data,
-			cursor,
-			i + 1);
+			if (entry.local_header_offset < summary.first_referenced_local_offset) {
+				summary.first_referenced_local_offset = entry.local_header_offset;
+				summary.first_referenced_filename = entry.name;
+			}
+			if (entry.name == "META-INF/MANIFEST.MF"sv && isRegularFileEntry(entry)) {
+				summary.has_jar_manifest_file = true;
+			}
 
-		validateCentralRecordSpan(cursor, entry.record_size, central_directory.end, archive_data.size());
-		validateCentralEntryMetadata(entry, tracking);
-		validateLocalEntryForCentralEntry(
-			archive_data,
-			central_directory.start,
-			entry,
-			tracking.total_verified_uncompressed,
-			tracking.local_spans);
-
-		if (entry.local_header_offset < summary.first_referenced_local_offset) {
-			summary.first_referenced_local_offset = entry.local_header_offset;
-			summary.first_referenced_filename = entry.name;
+			cursor = checkedAdd(
+				cursor,
+				entry.record_size,
+				"Archive File Error: Central directory cursor overflow.");
 		}
-		if (entry.name == "META-INF/MANIFEST.MF"sv && isRegularFileEntry(entry)) {
-			summary.has_jar_manifest_file = true;
+		catch (...) {
+			header_error = std::current_exception();
+			break;
 		}
+	}
 
-		cursor = checkedAdd(
-			cursor,
-			entry.record_size,
-			"Archive File Error: Central directory cursor overflow.");
+	std::vector<EntryTiming> timings;
+	if (profile != nullptr) {
+		timings.resize(tracking.entries.size());
+	}
+	const std::vector<VerifiedLocalEntry> verified_entries = verifyLocalEntries(
+		archive_data, central_directory.start, tracking.entries, load_progress, timings);
+	if (profile != nullptr) {
+		profile->reserve(tracking.entries.size());
+		for (std::size_t i = 0; i < tracking.entries.size(); ++i) {
+			const CentralEntryMetadata& entry = tracking.entries[i];
+			profile->push_back(EntryProfile{
+				.entry_number = entry.entry_number,
+				.name = std::string(entry.name),
+				.compression_method = entry.compression_method,
+				.compressed_size = entry.compressed_size,
+				.uncompressed_size = entry.uncompressed_size,
+				.timing = timings[i]
+			});
+		}
+	}
+	if (header_error) {
+		std::rethrow_exception(header_error);
 	}
 
 	if (cursor != central_directory.end) {
 		throw std::runtime_error("Archive File Error: Central directory size does not match parsed records.");
 	}
-	if (tracking.total_verified_uncompressed != tracking.total_declared_uncompressed) {
+	std::vector<LocalEntrySpan> local_spans;
+	local_spans.reserve(verified_entries.size());
+	std::uint64_t total_verified_uncompressed = 0;
+	for (const VerifiedLocalEntry& verified : verified_entries) {
+		local_spans.push_back(verified.span);
+		total_verified_uncompressed += verified.uncompressed_size;
+	}
+	if (total_verified_uncompressed != tracking.total_declared_uncompressed) {
 		throw std::runtime_error("Archive File Error: Verified archive size differs from declared metadata.");
 	}
-	validateLocalEntrySpans(tracking.local_spans);
+	validateLocalEntrySpans(local_spans);
+	directory.local_records_crc = combineLocalRegionCrc(archive_data, local_spans, central_directory.start);
 	if (summary.first_referenced_filename.empty()) {
 		throw std::runtime_error("Archive File Error: No referenced local ZIP entry was found.");
 	}
 	return summary;
 }
 
+// Validate the archive, or reuse the result of validating these exact bytes
+// before when the cache is enabled. Only successful validations are stored.
+[[nodiscard]] ValidatedArchiveSummary validateOrRecallArchive(std::span<const Byte> archive_data,
+                                                              const ArchiveLoadProgress* load_progress) {
+	namespace cache = validation_cache_internal;
+	const std::optional<cache::CacheKey> key = cache::keyFor(archive_data);
+	if (key) {
+		if (std::optional<cache::CachedValidation> cached = cache::lookup(*key)) {
+			return ValidatedArchiveSummary{
+				.first_referenced_filename = std::move(cached->first_referenced_filename),
+				.has_jar_manifest_file = cached->has_jar_manifest_file,
+				.directory = std::move(cached->directory)
+			};
+		}
+	}
+	ValidatedArchiveSummary summary = validateAndSummarizeArchive(archive_data, load_progress);
+	if (key) {
+		cache::store(*key, cache::CachedValidation{
+			.first_referenced_filename = summary.first_referenced_filename,
+			.has_jar_manifest_file = summary.has_jar_manifest_file,
+			.directory = summary.directory
+		});
+	}
+	return summary;
+}
+
 } // anonymous namespace
 
-ArchiveMetadata analyzeArchive(std::span<const Byte> archive_data, bool is_zip_file) {
+ArchiveMetadata analyzeArchive(std::span<const Byte> archive_data, bool is_zip_file,
+                               const ArchiveLoadProgress* load_progress) {
 	constexpr std::size_t FIRST_FILENAME_MIN_LENGTH = 4;
-	ValidatedArchiveSummary summary = validateAndSummarizeArchive(archive_data);
+	ValidatedArchiveSummary summary = validateOrRecallArchive(archive_data, load_progress);
 	ArchiveMetadata metadata{
 		.file_type = FileType::UNKNOWN_FILE_TYPE,
-		.first_filename = std::move(summary.first_referenced_filename)
+		.first_filename = std::move(summary.first_referenced_filename),
+		.directory = std::move(summary.directory)
 	};
 	const std::string_view filename = metadata.first_filename;
 
@@ -1070,5 +1728,26 @@ ArchiveMetadata analyzeArchive(std::span<const Byte> archive_data, bool is_zip_f
 }
 
 void validateArchiveEntryPaths(std::span<const Byte> archive_data) {
-	(void)validateAndSummarizeArchive(archive_data);
+	(void)validateAndSummarizeArchive(archive_data, nullptr);
+}
+
+void validateNewEntryNames(std::span<const std::string> entry_names) {
+	PortablePathIndex paths;
+	paths.reserve(entry_names.size());
+	for (std::size_t i = 0; i < entry_names.size(); ++i) {
+		validateEntryName(
+			entry_names[i],
+			"Archive File Error: Entry",
+			"Archive Security Error: Unsafe archive entry path detected",
+			i + 1);
+		paths.insert(entry_names[i], i + 1);
+	}
+}
+
+ArchiveProfile profileArchive(std::span<const Byte> archive_data) {
+	ArchiveProfile profile;
+	const auto start = std::chrono::steady_clock::now();
+	(void)validateAndSummarizeArchive(archive_data, nullptr, &profile.entries);
+	profile.wall_time = std::chrono::steady_clock::now() - start;
+	return profile;
 }
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "pdvzip.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace archive_analysis_internal {
+
+// Archive names are compared without regard to ASCII case only; other bytes
+// are left alone, whatever encoding they are in.
+[[nodiscard]] constexpr char toLowerAscii(char ch) noexcept {
+	return (ch >= 'A' && ch <= 'Z') ? static_cast<char>(ch - 'A' + 'a') : ch;
+}
+
+constexpr std::uint64_t MAX_TOTAL_UNCOMPRESSED_SIZE = 2ULL * 1024 * 1024 * 1024;
+
+// Caps the actual (not declared) output of all payload checks together. Each
+// entry reserves its declared size before inflating and may not produce more,
+// so checks running concurrently can never jointly exceed the limit.
+class UncompressedBudget {
+public:
+	[[nodiscard]] bool tryReserve(std::uint64_t bytes) noexcept {
+		std::uint64_t used = used_.load(std::memory_order_relaxed);
+		do {
+			if (bytes > MAX_TOTAL_UNCOMPRESSED_SIZE - used) {
+				return false;
+			}
+		} while (!used_.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+		return true;
+	}
+
+private:
+	std::atomic<std::uint64_t> used_{0};
+};
+
+// Threads analyzeArchive checks entries on once an archive is big enough to
+// be worth a pool; 0 (the default) means ThreadPool::defaultThreadCount().
+// Lets tests run the parallel path on any machine.
+void setVerifyThreadCount(unsigned thread_count) noexcept;
+
+// Index of every normalized entry path, used to reject duplicates, case
+// conflicts and file/directory conflicts. Paths are interned a component at a
+// time: each node is keyed by (parent node, component), where a component
+// keeps its leading separator, so nodes correspond exactly to the path
+// prefixes that end just before a separator, plus each full path. Lookups go
+// through one open-addressing table whose component bytes live in a single
+// arena, so memory is linear in the number of distinct components and a
+// wide directory costs one probe per component rather than a sibling walk.
+class PortablePathIndex {
+private:
+	struct Node {
+		std::size_t name_offset = 0;    // component bytes in names_
+		uint32_t name_length = 0;
+		bool has_explicit_entry = false;
+		bool is_file = false;
+		bool is_directory = false;
+	};
+
+	struct Slot {
+		uint32_t hash = 0;
+		uint32_t parent = 0;
+		uint32_t node = 0;              // 0 marks an empty slot; the root is never a child
+	};
+
+	static constexpr std::size_t MIN_CAPACITY = 64;
+
+	std::vector<Node> nodes_{1}; // index zero is the root
+	std::vector<Slot> slots_ = std::vector<Slot>(MIN_CAPACITY);
+	std::string names_;
+
+	// Node reached at the end of each component of the previous path, by end
+	// position. Archives usually list entries directory by directory, so a
+	// path's leading components mostly match the previous path's and need no
+	// lookup at all.
+	using PrefixNode = std::pair<std::size_t, uint32_t>;
+	std::string previous_name_;
+	std::vector<PrefixNode> previous_prefixes_;
+	std::vector<PrefixNode> current_prefixes_;
+
+	// Archive names are attacker-chosen, so the hash is seeded per process to
+	// keep crafted collisions from turning probes into a linear scan.
+	[[nodiscard]] static std::uint64_t hashSeed();
+	[[nodiscard]] static std::uint64_t mix(std::uint64_t lhs, std::uint64_t rhs) noexcept;
+	[[nodiscard]] static std::uint64_t hashComponent(uint32_t parent, std::string_view name);
+
+	void grow();
+
+	// The component is the text appended to names_ from name_offset on. It
+	// stays there only if it turns out to be new.
+	[[nodiscard]] uint32_t findOrAddChild(uint32_t parent, std::size_t name_offset);
+
+public:
+	void reserve(std::size_t entry_count);
+
+	// Record one entry name; '\\' counts as a separator and ASCII case is
+	// ignored. Throws on an empty name, a duplicate or case-only duplicate,
+	// and a file that clashes with a directory, listed or implied.
+	void insert(std::string_view entry_name, std::size_t entry_number);
+};
+
+}  // namespace archive_analysis_internal
@@ -0,0 +1,414 @@
+#include "pdvzip.h"
+#include "thread_pool.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <ctime>
+#include <exception>
+#include <format>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t
+	LOCAL_HEADER_SIZE   = 30,
+	CENTRAL_HEADER_SIZE = 46,
+	EOCD_SIZE           = 22;
+
+constexpr uint16_t
+	METHOD_STORED      = 0,
+	METHOD_DEFLATED    = 8,
+	VERSION_MADE_BY    = (3u << 8) | 30,   // UNIX host, spec 3.0
+	VERSION_NEEDED     = 20,
+	UTF8_NAME_FLAG     = 1u << 11,
+	MAX_ENTRY_COUNT    = UINT16_MAX - 1;   // 0xFFFF in the EOCD is the ZIP64 sentinel
+
+constexpr uint32_t DOS_DIRECTORY_ATTRIBUTE = 0x10;
+
+// The same cap analyzeArchive puts on an archive's total uncompressed size.
+constexpr std::uint64_t MAX_FOLDER_BYTES = 2ULL * 1024 * 1024 * 1024;
+
+// One file or directory found under the folder, before it is read.
+struct FolderItem {
+	fs::path path;
+	std::string name;          // entry name, under the folder's own name
+	bool is_directory = false;
+	uint32_t mode = 0;
+	std::time_t modified = 0;
+	std::uint64_t size = 0;
+};
+
+// A file's payload as it will be written, with the CRC of those exact bytes
+// for the IDAT CRC.
+struct CompressedPayload {
+	uint16_t method = METHOD_STORED;
+	uint32_t crc32 = 0;
+	uint32_t uncompressed_size = 0;
+	uint32_t payload_crc = 0;
+	vBytes data;
+};
+
+[[nodiscard]] FolderItem describeItem(const fs::path& path, std::string name) {
+	struct stat st{};
+	if (::lstat(path.c_str(), &st) != 0) {
+		const std::error_code ec(errno, std::generic_category());
+		throw std::runtime_error(std::format(
+			"Folder Error: Failed to stat \"{}\": {}", path.string(), ec.message()));
+	}
+	if (S_ISLNK(st.st_mode)) {
+		throw std::runtime_error(std::format(
+			"Folder Error: Symlinks cannot be archived: \"{}\".", path.string()));
+	}
+	if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) {
+		throw std::runtime_error(std::format(
+			"Folder Error: Only regular files and folders can be archived: \"{}\".", path.string()));
+	}
+
+	FolderItem item{
+		.path = path,
+		.name = std::move(name),
+		.is_directory = S_ISDIR(st.st_mode),
+		.mode = static_cast<uint32_t>(st.st_mode),
+		.modified = st.st_mtime,
+		.size = S_ISREG(st.st_mode) ? static_cast<std::uint64_t>(st.st_size) : 0
+	};
+	if (item.is_directory) {
+		item.name += '/';
+	}
+	return item;
+}
+
+// Everything under the folder, named as `zip -r` run beside it would name
+// it: the folder itself comes first, then its contents sorted by name, which
+// keeps every directory ahead of what it holds.
+[[nodiscard]] std::vector<FolderItem> collectFolderItems(const fs::path& folder) {
+	const fs::path root = fs::canonical(folder);
+	const std::string root_name = root.filename().string();
+	if (root_name.empty()) {
+		throw std::runtime_error("Folder Error: The folder to archive needs a name.");
+	}
+
+	std::vector<FolderItem> items;
+	items.push_back(describeItem(root, root_name));
+	for (const fs::directory_entry& entry : fs::recursive_directory_iterator(root)) {
+		items.push_back(describeItem(entry.path(),
+			root_name + '/' + entry.path().lexically_relative(root).generic_string()));
+	}
+	std::ranges::sort(items, {}, &FolderItem::name);
+
+	if (items.size() > MAX_ENTRY_COUNT) {
+		throw std::runtime_error(std::format(
+			"Folder Error: The folder holds more than {} files and folders.", MAX_ENTRY_COUNT));
+	}
+	std::uint64_t total_size = 0;
+	for (const FolderItem& item : items) {
+		total_size += item.size;
+		if (total_size > MAX_FOLDER_BYTES) {
+			throw std::runtime_error("Folder Error: The folder's files exceed the 2 GiB size limit.");
+		}
+	}
+	return items;
+}
+
+// MS-DOS date and time fields, clamped to the range they can hold.
+[[nodiscard]] std::pair<uint16_t, uint16_t> dosDateTime(std::time_t time) {
+	constexpr int
+		DOS_EPOCH_YEAR = 80,
+		DOS_LAST_YEAR  = DOS_EPOCH_YEAR + 127;
+	constexpr uint16_t DOS_EPOCH_DATE = (1u << 5) | 1;   // 1980-01-01
+
+	std::tm local{};
+	if (::localtime_r(&time, &local) == nullptr || local.tm_year < DOS_EPOCH_YEAR) {
+		return { 0, DOS_EPOCH_DATE };
+	}
+	if (local.tm_year > DOS_LAST_YEAR) {
+		return { static_cast<uint16_t>((23u << 11) | (59u << 5) | 29u),
+		         static_cast<uint16_t>((127u << 9) | (12u << 5) | 31u) };
+	}
+	return {
+		static_cast<uint16_t>((local.tm_hour << 11) | (local.tm_min << 5) | (local.tm_sec / 2)),
+		static_cast<uint16_t>(((local.tm_year - DOS_EPOCH_YEAR) << 9) | ((local.tm_mon + 1) << 5) | local.tm_mday)
+	};
+}
+
+[[nodiscard]] uint16_t entryFlags(std::string_view name) {
+	const bool ascii = std::ranges::all_of(name, [](char c) { return static_cast<unsigned char>(c) < 0x80; });
+	return ascii ? 0 : UTF8_NAME_FLAG;
+}
+
+// Read one file and pick its smaller form: deflated at the highest effort,
+// or stored when deflating does not help or the file is compressed media.
+[[nodiscard]] CompressedPayload compressFile(const FolderItem& item, std::size_t entry_number) {
+	vBytes contents = readFolderFile(item.path);
+	if (contents.size() > UINT32_MAX) {
+		throw std::runtime_error(std::format(
+			"Folder Error: \"{}\" exceeds the 4 GiB ZIP entry limit.", item.path.string()));
+	}
+
+	CompressedPayload payload{
+		.method = METHOD_STORED,
+		.crc32 = crc32Update(0, contents),
+		.uncompressed_size = static_cast<uint32_t>(contents.size()),
+		.payload_crc = 0,
+		.data = {}
+	};
+	std::optional<vBytes> deflated;
+	if (!contents.empty() && !isCompressedMedia(item.name)) {
+		deflated = deflateAtBestEffort(contents, contents.size(), entry_number);
+	}
+	if (deflated) {
+		payload.method = METHOD_DEFLATED;
+		payload.data = std::move(*deflated);
+		payload.payload_crc = crc32Update(0, payload.data);
+	} else {
+		payload.data = std::move(contents);
+		payload.payload_crc = payload.crc32;
+	}
+	return payload;
+}
+
+// Compress the folder's files on the pool and hand each payload to consume
+// in item order, as soon as it and every payload before it are ready. Workers
+// claim items in order from a shared counter and stay at most a few items
+// ahead of consume, so only those few payloads are ever held besides the one
+// being consumed. The first failure, in item order, is rethrown.
+void compressFolderFiles(std::span<const FolderItem> items, const auto& consume) {
+	struct Slot {
+		std::optional<CompressedPayload> payload;
+		std::exception_ptr error;
+	};
+	const unsigned thread_count = static_cast<unsigned>(
+		std::min<std::size_t>(ThreadPool::defaultThreadCount(), items.size()));
+	const std::size_t max_ahead = 2 * static_cast<std::size_t>(thread_count);
+
+	std::vector<Slot> slots(items.size());
+	std::mutex mutex;
+	std::condition_variable changed_cv;
+	std::size_t consumed = 0;
+	bool abandoned = false;
+	std::atomic<std::size_t> next_claim{0};
+
+	const auto compressClaimed = [&] {
+		for (std::size_t i = next_claim.fetch_add(1, std::memory_order_relaxed); i < items.size();
+			 i = next_claim.fetch_add(1, std::memory_order_relaxed)) {
+			{
+				std::unique_lock lock(mutex);
+				changed_cv.wait(lock, [&] { return abandoned || i < consumed + max_ahead; });
+				if (abandoned) {
+					return;
+				}
+			}
+			Slot done;
+			try {
+				done.payload = items[i].is_directory ? CompressedPayload{} : compressFile(items[i], i + 1);
+			}
+			catch (...) {
+				done.error = std::current_exception();
+			}
+			{
+				const std::lock_guard lock(mutex);
+				slots[i] = std::move(done);
+			}
+			changed_cv.notify_all();
+		}
+	};
+
+	ThreadPool pool(thread_count);
+	for (unsigned t = 0; t < thread_count; ++t) {
+		pool.submit(compressClaimed);
+	}
+	try {
+		for (std::size_t i = 0; i < items.size(); ++i) {
+			CompressedPayload payload;
+			{
+				std::unique_lock lock(mutex);
+				changed_cv.wait(lock, [&] { return slots[i].payload || slots[i].error; });
+				if (slots[i].error) {
+					std::rethrow_exception(slots[i].error);
+				}
+				payload = std::move(*slots[i].payload);
+				slots[i].payload.reset();
+				consumed = i + 1;
+			}
+			changed_cv.notify_all();
+			consume(i, payload);
+		}
+	}
+	catch (...) {
+		{
+			const std::lock_guard lock(mutex);
+			abandoned = true;
+		}
+		changed_cv.notify_all();
+		throw;
+	}
+	pool.wait();
+}
+
+void appendLe16(vBytes& out, uint16_t value) {
+	const std::size_t at = out.size();
+	out.resize(at + 2);
+	writeLe16(out, at, value);
+}
+
+void appendLe32(vBytes& out, uint32_t value) {
+	const std::size_t at = out.size();
+	out.resize(at + 4);
+	writeLe32(out, at, value);
+}
+
+void appendName(vBytes& out, std::string_view name) {
+	out.insert(out.end(), name.begin(), name.end());
+}
+
+// The central directory is written here rather than taken from a zip tool,
+// so the finished archive goes through analyzeArchive like any other: with
+// a directory for it standing alone appended to the local records for the
+// check, then dropped again. The capacity reserved for it avoids a copy.
+void validateBuiltArchive(BuiltArchive& archive) {
+	const std::size_t records_size = archive.local_records.size();
+	const vBytes directory = writeBuiltCentralDirectory(archive, 0, 0);
+	archive.local_records.insert(archive.local_records.end(), directory.begin(), directory.end());
+	(void)analyzeArchive(archive.local_records, true);
+	archive.local_records.resize(records_size);
+}
+
+} // anonymous namespace
+
+BuiltArchive buildFolderArchive(const fs::path& folder) {
+	const std::vector<FolderItem> items = collectFolderItems(folder);
+	std::vector<std::string> names;
+	names.reserve(items.size());
+	for (const FolderItem& item : items) {
+		names.push_back(item.name);
+	}
+	validateNewEntryNames(names);
+
+	BuiltArchive archive;
+	archive.first_filename = items.front().name;
+	archive.entries.reserve(items.size());
+
+	// A payload is never larger than its file (the deflated form is kept only
+	// when smaller), so this bounds the local records plus the stand-alone
+	// directory validateBuiltArchive appends, and no reallocation copies the
+	// records while they grow. Capacity never written stays address space.
+	std::size_t capacity_bound = EOCD_SIZE;
+	for (const FolderItem& item : items) {
+		capacity_bound += LOCAL_HEADER_SIZE + CENTRAL_HEADER_SIZE + 2 * item.name.size()
+			+ static_cast<std::size_t>(item.size);
+	}
+	archive.local_records.reserve(capacity_bound);
+
+	// Local records are position-independent, so each is written once, as its
+	// payload arrives, and the payload freed; their CRC is assembled from the
+	// per-payload CRCs computed on the pool.
+	Crc32 records_crc;
+	compressFolderFiles(items, [&](std::size_t i, CompressedPayload& payload) {
+		const FolderItem& item = items[i];
+		vBytes& out = archive.local_records;
+		if (LOCAL_HEADER_SIZE + item.name.size() + payload.data.size()
+				> static_cast<std::size_t>(INT32_MAX) - out.size()) {
+			throw std::runtime_error("Folder Error: The archive would exceed the maximum size limit.");
+		}
+		const auto [dos_time, dos_date] = dosDateTime(item.modified);
+		BuiltArchive::Entry entry{
+			.name = item.name,
+			.flags = entryFlags(item.name),
+			.compression_method = payload.method,
+			.dos_time = dos_time,
+			.dos_date = dos_date,
+			.crc32 = payload.crc32,
+			.compressed_size = static_cast<uint32_t>(payload.data.size()),
+			.uncompressed_size = payload.uncompressed_size,
+			.external_attributes = (item.mode << 16) | (item.is_directory ? DOS_DIRECTORY_ATTRIBUTE : 0),
+			.local_header_offset = static_cast<uint32_t>(out.size())
+		};
+
+		const std::size_t header = out.size();
+		appendLe32(out, ZIP_LOCAL_FILE_HEADER_SIGNATURE);
+		appendLe16(out, VERSION_NEEDED);
+		appendLe16(out, entry.flags);
+		appendLe16(out, entry.compression_method);
+		appendLe16(out, entry.dos_time);
+		appendLe16(out, entry.dos_date);
+		appendLe32(out, entry.crc32);
+		appendLe32(out, entry.compressed_size);
+		appendLe32(out, entry.uncompressed_size);
+		appendLe16(out, static_cast<uint16_t>(entry.name.size()));
+		appendLe16(out, 0);
+		appendName(out, entry.name);
+		records_crc.update(std::span<const Byte>(out).subspan(header));
+
+		out.insert(out.end(), payload.data.begin(), payload.data.end());
+		records_crc.combine(payload.payload_crc, payload.data.size());
+		vBytes().swap(payload.data);
+		archive.entries.push_back(std::move(entry));
+	});
+	archive.local_records_crc = records_crc.value();
+	validateBuiltArchive(archive);
+	return archive;
+}
+
+vBytes writeBuiltCentralDirectory(const BuiltArchive& archive, std::size_t base_offset,
+                                  uint16_t trailing_comment_length) {
+	const std::size_t central_offset = checkedAdd(
+		base_offset,
+		archive.local_records.size(),
+		"ZIP Error: Central directory offset overflow.");
+	if (central_offset > UINT32_MAX) {
+		throw std::runtime_error("ZIP Error: Central directory offset exceeds ZIP32 limits.");
+	}
+
+	vBytes out;
+	std::size_t directory_size = EOCD_SIZE;
+	for (const BuiltArchive::Entry& entry : archive.entries) {
+		directory_size += CENTRAL_HEADER_SIZE + entry.name.size();
+	}
+	out.reserve(directory_size);
+
+	for (const BuiltArchive::Entry& entry : archive.entries) {
+		appendLe32(out, ZIP_CENTRAL_DIRECTORY_SIGNATURE);
+		appendLe16(out, VERSION_MADE_BY);
+		appendLe16(out, VERSION_NEEDED);
+		appendLe16(out, entry.flags);
+		appendLe16(out, entry.compression_method);
+		appendLe16(out, entry.dos_time);
+		appendLe16(out, entry.dos_date);
+		appendLe32(out, entry.crc32);
+		appendLe32(out, entry.compressed_size);
+		appendLe32(out, entry.uncompressed_size);
+		appendLe16(out, static_cast<uint16_t>(entry.name.size()));
+		appendLe16(out, 0);   // extra field length
+		appendLe16(out, 0);   // comment length
+		appendLe16(out, 0);   // disk number start
+		appendLe16(out, 0);   // internal attributes
+		appendLe32(out, entry.external_attributes);
+		// Every local header lies below the central directory, so this fits too.
+		appendLe32(out, static_cast<uint32_t>(base_offset + entry.local_header_offset));
+		appendName(out, entry.name);
+	}
+
+	if (archive.entries.size() > MAX_ENTRY_COUNT) {
+		throw std::runtime_error("ZIP Error: Too many entries for a ZIP32 central directory.");
+	}
+	const auto entry_count = static_cast<uint16_t>(archive.entries.size());
+	const auto central_size = static_cast<uint32_t>(out.size());
+	appendLe32(out, ZIP_END_CENTRAL_DIRECTORY_SIGNATURE);
+	appendLe16(out, 0);
+	appendLe16(out, 0);
+	appendLe16(out, entry_count);
+	appendLe16(out, entry_count);
+	appendLe32(out, central_size);
+	appendLe32(out, static_cast<uint32_t>(central_offset));
+	appendLe16(out, trailing_comment_length);
+	return out;
+}
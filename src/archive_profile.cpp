@@ -0,0 +1,217 @@
+#include "archive_profile_internal.h"
+#include "pdvzip.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <print>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+// Length of the well-formed UTF-8 sequence text starts with, or 0 when it
+// does not start with one: overlong forms, surrogates and code points past
+// U+10FFFF are not well-formed (RFC 3629).
+[[nodiscard]] std::size_t utf8SequenceLength(std::string_view text) noexcept {
+	const auto byteAt = [text](std::size_t i) { return static_cast<unsigned char>(text[i]); };
+	const unsigned char lead = byteAt(0);
+	std::size_t length = 0;
+	unsigned char second_min = 0x80;
+	unsigned char second_max = 0xBF;
+	if (lead < 0x80) {
+		return 1;
+	} else if (lead >= 0xC2 && lead <= 0xDF) {
+		length = 2;
+	} else if (lead >= 0xE0 && lead <= 0xEF) {
+		length = 3;
+		second_min = lead == 0xE0 ? 0xA0 : 0x80;
+		second_max = lead == 0xED ? 0x9F : 0xBF;
+	} else if (lead >= 0xF0 && lead <= 0xF4) {
+		length = 4;
+		second_min = lead == 0xF0 ? 0x90 : 0x80;
+		second_max = lead == 0xF4 ? 0x8F : 0xBF;
+	} else {
+		return 0;
+	}
+	if (text.size() < length || byteAt(1) < second_min || byteAt(1) > second_max) {
+		return 0;
+	}
+	for (std::size_t i = 2; i < length; ++i) {
+		if (byteAt(i) < 0x80 || byteAt(i) > 0xBF) {
+			return 0;
+		}
+	}
+	return length;
+}
+
+} // anonymous namespace
+
+namespace archive_profile_internal {
+
+std::string jsonString(std::string_view text) {
+	std::string out = "\"";
+	while (!text.empty()) {
+		const char c = text.front();
+		const std::size_t length = utf8SequenceLength(text);
+		if (length > 1) {
+			out += text.substr(0, length);
+			text.remove_prefix(length);
+			continue;
+		}
+		switch (c) {
+			case '"':  out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20 || length == 0) {
+					out += std::format("\\u{:04x}", static_cast<unsigned char>(c));
+				} else {
+					out += c;
+				}
+		}
+		text.remove_prefix(1);
+	}
+	out += '"';
+	return out;
+}
+
+}  // namespace archive_profile_internal
+
+namespace {
+
+using archive_profile_internal::jsonString;
+using std::chrono::nanoseconds;
+
+[[nodiscard]] nanoseconds totalTime(const EntryTiming& timing) noexcept {
+	return timing.inflate + timing.crc;
+}
+
+[[nodiscard]] double milliseconds(nanoseconds duration) noexcept {
+	return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Uncompressed throughput in decimal megabytes per second, or 0 when the
+// check took too little time to measure.
+[[nodiscard]] double megabytesPerSecond(std::uint64_t bytes, nanoseconds duration) noexcept {
+	const double seconds = std::chrono::duration<double>(duration).count();
+	return seconds > 0.0 ? static_cast<double>(bytes) / seconds / 1e6 : 0.0;
+}
+
+[[nodiscard]] std::string methodName(uint16_t method) {
+	constexpr uint16_t
+		STORED = 0,
+		DEFLATED = 8;
+	switch (method) {
+		case STORED:   return "stored";
+		case DEFLATED: return "deflate";
+		default:       return std::format("method {}", method);
+	}
+}
+
+struct ProfileTotals {
+	std::uint64_t compressed_size = 0;
+	std::uint64_t uncompressed_size = 0;
+	EntryTiming timing;
+};
+
+[[nodiscard]] ProfileTotals sumEntries(const std::vector<EntryProfile>& entries) {
+	ProfileTotals totals;
+	for (const EntryProfile& entry : entries) {
+		totals.compressed_size += entry.compressed_size;
+		totals.uncompressed_size += entry.uncompressed_size;
+		totals.timing.inflate += entry.timing.inflate;
+		totals.timing.crc += entry.timing.crc;
+	}
+	return totals;
+}
+
+void printTable(const fs::path& archive_path, const ArchiveProfile& profile,
+                std::span<const EntryProfile* const> slowest, const ProfileTotals& totals) {
+	std::println("\nArchive: {} ({} entries)\n", archive_path.string(), profile.entries.size());
+	std::println("Slowest {} of {} entries:\n", slowest.size(), profile.entries.size());
+	std::println("{:>7}  {:<8}  {:>12}  {:>12}  {:>10}  {:>9}  {:>9}  {}",
+		"Entry", "Method", "Compressed", "Uncompressed", "Inflate ms", "CRC ms", "MB/s", "Name");
+	for (const EntryProfile* entry : slowest) {
+		std::println("{:>7}  {:<8}  {:>12}  {:>12}  {:>10.3f}  {:>9.3f}  {:>9.1f}  {}",
+			entry->entry_number,
+			methodName(entry->compression_method),
+			entry->compressed_size,
+			entry->uncompressed_size,
+			milliseconds(entry->timing.inflate),
+			milliseconds(entry->timing.crc),
+			megabytesPerSecond(entry->uncompressed_size, totalTime(entry->timing)),
+			entry->name);
+	}
+	std::println("\nTotals: {} bytes compressed, {} bytes uncompressed.", totals.compressed_size, totals.uncompressed_size);
+	std::println("        {:.3f} ms inflating, {:.3f} ms checking CRC-32, {:.1f} MB/s per thread.",
+		milliseconds(totals.timing.inflate),
+		milliseconds(totals.timing.crc),
+		megabytesPerSecond(totals.uncompressed_size, totalTime(totals.timing)));
+	std::println("        {:.3f} ms wall time, with entries checked in parallel.\n", milliseconds(profile.wall_time));
+}
+
+void printJson(const fs::path& archive_path, const ArchiveProfile& profile,
+               std::span<const EntryProfile* const> slowest, const ProfileTotals& totals) {
+	std::println("{{");
+	std::println("  \"archive\": {},", jsonString(archive_path.string()));
+	std::println("  \"entries\": {},", profile.entries.size());
+	std::println("  \"wall_time_ns\": {},", profile.wall_time.count());
+	std::println("  \"totals\": {{\"compressed_size\": {}, \"uncompressed_size\": {}, "
+		"\"inflate_ns\": {}, \"crc_ns\": {}, \"mb_per_s\": {:.3f}}},",
+		totals.compressed_size,
+		totals.uncompressed_size,
+		totals.timing.inflate.count(),
+		totals.timing.crc.count(),
+		megabytesPerSecond(totals.uncompressed_size, totalTime(totals.timing)));
+	std::println("  \"slowest\": [");
+	for (std::size_t i = 0; i < slowest.size(); ++i) {
+		const EntryProfile& entry = *slowest[i];
+		std::println("    {{\"entry\": {}, \"name\": {}, \"method\": {}, \"compressed_size\": {}, "
+			"\"uncompressed_size\": {}, \"inflate_ns\": {}, \"crc_ns\": {}, \"mb_per_s\": {:.3f}}}{}",
+			entry.entry_number,
+			jsonString(entry.name),
+			jsonString(methodName(entry.compression_method)),
+			entry.compressed_size,
+			entry.uncompressed_size,
+			entry.timing.inflate.count(),
+			entry.timing.crc.count(),
+			megabytesPerSecond(entry.uncompressed_size, totalTime(entry.timing)),
+			i + 1 < slowest.size() ? "," : "");
+	}
+	std::println("  ]");
+	std::println("}}");
+}
+
+} // anonymous namespace
+
+int runArchiveProfile(const fs::path& archive_path, bool as_json, std::size_t top_entries) {
+	const MappedFile archive_file = mapArchiveFile(archive_path);
+	const ArchiveProfile profile = profileArchive(archive_file.bytes());
+
+	std::vector<const EntryProfile*> slowest;
+	slowest.reserve(profile.entries.size());
+	for (const EntryProfile& entry : profile.entries) {
+		slowest.push_back(&entry);
+	}
+	const std::size_t shown = std::min(top_entries, slowest.size());
+	std::ranges::partial_sort(slowest, slowest.begin() + static_cast<std::ptrdiff_t>(shown),
+		[](const EntryProfile* lhs, const EntryProfile* rhs) {
+			return totalTime(lhs->timing) > totalTime(rhs->timing);
+		});
+	slowest.resize(shown);
+
+	const ProfileTotals totals = sumEntries(profile.entries);
+	if (as_json) {
+		printJson(archive_path, profile, slowest, totals);
+	} else {
+		printTable(archive_path, profile, slowest, totals);
+	}
+	return 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace archive_profile_internal {
+
+// text as a quoted JSON string. Entry names need not be UTF-8 (older tools
+// write CP437), so any byte that is not part of a well-formed UTF-8 sequence
+// is escaped as \u00XX, its Latin-1 reading, and the output is always valid
+// JSON.
+[[nodiscard]] std::string jsonString(std::string_view text);
+
+}  // namespace archive_profile_internal
@@ -0,0 +1,342 @@
+#include "pdvzip.h"
+#include "archive_analysis_internal.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <format>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <zlib.h>
+
+namespace {
+
+using archive_analysis_internal::toLowerAscii;
+
+constexpr std::size_t
+	LOCAL_HEADER_SIZE              = 30,
+	LOCAL_VERSION_OFFSET           = 4,
+	LOCAL_FLAGS_OFFSET             = 6,
+	LOCAL_METHOD_OFFSET            = 8,
+	LOCAL_CRC_OFFSET               = 14,
+	LOCAL_COMPRESSED_SIZE_OFFSET   = 18,
+	LOCAL_UNCOMPRESSED_SIZE_OFFSET = 22,
+	LOCAL_NAME_LENGTH_OFFSET       = 26,
+	LOCAL_EXTRA_LENGTH_OFFSET      = 28,
+	CENTRAL_HEADER_SIZE            = 46,
+	CENTRAL_VERSION_OFFSET         = 6,
+	CENTRAL_FLAGS_OFFSET           = 8,
+	CENTRAL_METHOD_OFFSET          = 10,
+	CENTRAL_CRC_OFFSET             = 16,
+	CENTRAL_COMPRESSED_SIZE_OFFSET = 20,
+	CENTRAL_UNCOMPRESSED_OFFSET    = 24,
+	CENTRAL_NAME_LENGTH_OFFSET     = 28,
+	CENTRAL_EXTRA_LENGTH_OFFSET    = 30,
+	CENTRAL_COMMENT_LENGTH_OFFSET  = 32,
+	CENTRAL_LOCAL_OFFSET_OFFSET    = 42,
+	EOCD_CENTRAL_SIZE_OFFSET       = 12,
+	EOCD_CENTRAL_OFFSET            = 16;
+
+constexpr uint16_t
+	METHOD_STORED   = 0,
+	METHOD_DEFLATED = 8,
+	VERSION_NEEDED_FOR_DEFLATE = 20,
+	// Data descriptor, plus the two bits recording the deflate effort used.
+	// Rebuilt entries carry their sizes in the local header.
+	REWRITTEN_FLAG_BITS = (1u << 1) | (1u << 2) | (1u << 3);
+
+// Formats whose content is already compressed: deflating them again costs
+// time and rarely saves a byte, so they are stored instead.
+constexpr auto COMPRESSED_MEDIA_EXTENSIONS = std::to_array<std::string_view>({
+	"7z", "aac", "apk", "avi", "avif", "br", "bz2", "docx", "epub", "flac", "gif", "gz",
+	"heic", "jar", "jpeg", "jpg", "m4a", "m4v", "mkv", "mov", "mp3", "mp4", "odt", "ogg",
+	"opus", "png", "pptx", "rar", "tgz", "webm", "webp", "wma", "wmv", "xlsx", "xz", "zip", "zst"
+});
+
+// One entry as the validator left it: where its records are and what its
+// payload currently is.
+struct SourceEntry {
+	std::size_t local_offset;
+	std::size_t central_offset;
+	std::size_t data_offset;
+	uint16_t method;
+	uint32_t compressed_size;
+	uint32_t uncompressed_size;
+	std::string_view name;
+};
+
+// The payload an entry will be written with, when it differs from its source.
+struct Replacement {
+	uint16_t method;
+	vBytes data;
+};
+
+// analyzeArchive has validated every record the index points at, so fields
+// are read from it directly. nullopt when any record relies on ZIP64, which
+// this stage leaves untouched.
+[[nodiscard]] std::optional<std::vector<SourceEntry>> readSourceEntries(std::span<const Byte> archive_data,
+                                                                         const ZipDirectoryIndex& directory) {
+	if (directory.zip64_eocd_offset || !directory.zip64_offset_slots.empty()) {
+		return std::nullopt;
+	}
+	std::vector<SourceEntry> entries;
+	entries.reserve(directory.central_record_offsets.size());
+	for (std::size_t i = 0; i < directory.central_record_offsets.size(); ++i) {
+		const std::size_t central = directory.central_record_offsets[i];
+		const std::size_t local = directory.local_header_offsets[i];
+		const uint32_t compressed_size = readLe32(archive_data, central + CENTRAL_COMPRESSED_SIZE_OFFSET);
+		const uint32_t uncompressed_size = readLe32(archive_data, central + CENTRAL_UNCOMPRESSED_OFFSET);
+		if (compressed_size == UINT32_MAX || uncompressed_size == UINT32_MAX
+			|| readLe32(archive_data, local + LOCAL_COMPRESSED_SIZE_OFFSET) == UINT32_MAX
+			|| readLe32(archive_data, local + LOCAL_UNCOMPRESSED_SIZE_OFFSET) == UINT32_MAX) {
+			return std::nullopt;
+		}
+		const uint16_t name_length = readLe16(archive_data, central + CENTRAL_NAME_LENGTH_OFFSET);
+		entries.push_back(SourceEntry{
+			.local_offset = local,
+			.central_offset = central,
+			.data_offset = local + LOCAL_HEADER_SIZE
+				+ readLe16(archive_data, local + LOCAL_NAME_LENGTH_OFFSET)
+				+ readLe16(archive_data, local + LOCAL_EXTRA_LENGTH_OFFSET),
+			.method = readLe16(archive_data, central + CENTRAL_METHOD_OFFSET),
+			.compressed_size = compressed_size,
+			.uncompressed_size = uncompressed_size,
+			.name = std::string_view(
+				reinterpret_cast<const char*>(archive_data.data() + central + CENTRAL_HEADER_SIZE), name_length)
+		});
+	}
+	return entries;
+}
+
+[[nodiscard]] vBytes inflateEntry(std::span<const Byte> compressed, const SourceEntry& entry,
+                                  std::size_t entry_number) {
+	vBytes output(entry.uncompressed_size);
+	const InflateResult result = inflateWholeBuffer(compressed, output);
+	if (result.status != InflateStatus::ok || result.produced != output.size()) {
+		throw std::runtime_error(std::format(
+			"Archive File Error: Entry {} could not be decompressed for recompression.", entry_number));
+	}
+	return output;
+}
+
+struct DeflateEndGuard {
+	z_stream* stream;
+
+	~DeflateEndGuard() {
+		(void)::deflateEnd(stream);
+	}
+};
+
+// The smallest payload for one entry that beats its current one: stored for
+// compressed media, otherwise the better of stored and a fresh deflate.
+[[nodiscard]] std::optional<Replacement> recompressEntry(std::span<const Byte> archive_data,
+                                                         const SourceEntry& entry, std::size_t entry_number) {
+	const std::span<const Byte> current = archive_data.subspan(entry.data_offset, entry.compressed_size);
+	const bool is_stored = entry.method == METHOD_STORED;
+	const bool store_only = isCompressedMedia(entry.name);
+	if (store_only && (is_stored || entry.uncompressed_size >= entry.compressed_size)) {
+		return std::nullopt;
+	}
+
+	vBytes inflated = is_stored ? vBytes{} : inflateEntry(current, entry, entry_number);
+	const std::span<const Byte> uncompressed = is_stored ? current : std::span<const Byte>(inflated);
+	if (!store_only) {
+		// Beating both the current payload and a stored copy is the only way
+		// a fresh deflate gets used.
+		const std::size_t limit = std::min<std::size_t>(entry.compressed_size, uncompressed.size());
+		if (std::optional<vBytes> deflated = deflateAtBestEffort(uncompressed, limit, entry_number)) {
+			return Replacement{ .method = METHOD_DEFLATED, .data = std::move(*deflated) };
+		}
+	}
+	if (!is_stored && inflated.size() < entry.compressed_size) {
+		return Replacement{ .method = METHOD_STORED, .data = std::move(inflated) };
+	}
+	return std::nullopt;
+}
+
+// Work through the entries largest first on the pool, until the projected
+// archive size fits the budget. Entries already being recompressed when it
+// does are still finished and kept.
+[[nodiscard]] std::vector<std::optional<Replacement>> recompressUntilWithinBudget(
+	std::span<const Byte> archive_data,
+	std::span<const SourceEntry> entries,
+	std::size_t archive_budget) {
+
+	std::vector<std::size_t> order(entries.size());
+	for (std::size_t i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	std::ranges::stable_sort(order, [&](std::size_t lhs, std::size_t rhs) {
+		return entries[lhs].compressed_size > entries[rhs].compressed_size;
+	});
+
+	std::vector<std::optional<Replacement>> replacements(entries.size());
+	std::atomic<std::size_t> projected_size{archive_data.size()};
+	std::atomic<std::size_t> next{0};
+	const auto work = [&] {
+		for (std::size_t claimed = next.fetch_add(1); claimed < order.size(); claimed = next.fetch_add(1)) {
+			if (projected_size.load() <= archive_budget) {
+				return;
+			}
+			const std::size_t index = order[claimed];
+			std::optional<Replacement> replacement = recompressEntry(archive_data, entries[index], index + 1);
+			if (replacement) {
+				projected_size.fetch_sub(entries[index].compressed_size - replacement->data.size());
+				replacements[index] = std::move(replacement);
+			}
+		}
+	};
+
+	const std::size_t thread_count = ThreadPool::onWorkerThread()
+		? 1
+		: std::min<std::size_t>(ThreadPool::defaultThreadCount(), entries.size());
+	if (thread_count <= 1) {
+		work();
+		return replacements;
+	}
+	ThreadPool pool(static_cast<unsigned>(thread_count));
+	for (std::size_t i = 0; i < thread_count; ++i) {
+		pool.submit(work);
+	}
+	pool.wait();
+	return replacements;
+}
+
+void appendRange(vBytes& out, std::span<const Byte> bytes) {
+	out.insert(out.end(), bytes.begin(), bytes.end());
+}
+
+// Lay the archive out again: local entries in their original physical order,
+// each with a fresh local header and no data descriptor, then the central
+// directory in its original order and the EOCD record with its comment.
+[[nodiscard]] vBytes rebuildArchive(std::span<const Byte> archive_data,
+                                    const ZipDirectoryIndex& directory,
+                                    std::span<const SourceEntry> entries,
+                                    std::span<const std::optional<Replacement>> replacements) {
+	std::vector<std::size_t> physical_order(entries.size());
+	for (std::size_t i = 0; i < physical_order.size(); ++i) {
+		physical_order[i] = i;
+	}
+	std::ranges::sort(physical_order, {}, [&](std::size_t i) { return entries[i].local_offset; });
+
+	vBytes archive;
+	archive.reserve(archive_data.size());
+	std::vector<std::size_t> new_local_offsets(entries.size());
+	std::vector<uint16_t> new_methods(entries.size());
+	std::vector<uint32_t> new_sizes(entries.size());
+
+	for (const std::size_t i : physical_order) {
+		const SourceEntry& entry = entries[i];
+		const std::optional<Replacement>& replacement = replacements[i];
+		const std::span<const Byte> payload = replacement
+			? std::span<const Byte>(replacement->data)
+			: archive_data.subspan(entry.data_offset, entry.compressed_size);
+		new_local_offsets[i] = archive.size();
+		new_methods[i] = replacement ? replacement->method : entry.method;
+		new_sizes[i] = static_cast<uint32_t>(payload.size());
+
+		const std::size_t header = archive.size();
+		appendRange(archive, archive_data.subspan(entry.local_offset, entry.data_offset - entry.local_offset));
+		const uint16_t flags = readLe16(archive, header + LOCAL_FLAGS_OFFSET);
+		writeLe16(archive, header + LOCAL_FLAGS_OFFSET, static_cast<uint16_t>(flags & ~REWRITTEN_FLAG_BITS));
+		writeLe16(archive, header + LOCAL_METHOD_OFFSET, new_methods[i]);
+		if (new_methods[i] == METHOD_DEFLATED && readLe16(archive, header + LOCAL_VERSION_OFFSET) < VERSION_NEEDED_FOR_DEFLATE) {
+			writeLe16(archive, header + LOCAL_VERSION_OFFSET, VERSION_NEEDED_FOR_DEFLATE);
+		}
+		writeLe32(archive, header + LOCAL_CRC_OFFSET, readLe32(archive_data, entry.central_offset + CENTRAL_CRC_OFFSET));
+		writeLe32(archive, header + LOCAL_COMPRESSED_SIZE_OFFSET, new_sizes[i]);
+		writeLe32(archive, header + LOCAL_UNCOMPRESSED_SIZE_OFFSET, entry.uncompressed_size);
+		appendRange(archive, payload);
+	}
+
+	const std::size_t central_start = archive.size();
+	if (central_start > UINT32_MAX) {
+		throw std::runtime_error("Archive File Error: Recompressed archive exceeds ZIP32 limits.");
+	}
+	for (std::size_t i = 0; i < entries.size(); ++i) {
+		const SourceEntry& entry = entries[i];
+		const std::size_t record_size = CENTRAL_HEADER_SIZE
+			+ readLe16(archive_data, entry.central_offset + CENTRAL_NAME_LENGTH_OFFSET)
+			+ readLe16(archive_data, entry.central_offset + CENTRAL_EXTRA_LENGTH_OFFSET)
+			+ readLe16(archive_data, entry.central_offset + CENTRAL_COMMENT_LENGTH_OFFSET);
+		const std::size_t record = archive.size();
+		appendRange(archive, archive_data.subspan(entry.central_offset, record_size));
+		const uint16_t flags = readLe16(archive, record + CENTRAL_FLAGS_OFFSET);
+		writeLe16(archive, record + CENTRAL_FLAGS_OFFSET, static_cast<uint16_t>(flags & ~REWRITTEN_FLAG_BITS));
+		writeLe16(archive, record + CENTRAL_METHOD_OFFSET, new_methods[i]);
+		if (new_methods[i] == METHOD_DEFLATED && readLe16(archive, record + CENTRAL_VERSION_OFFSET) < VERSION_NEEDED_FOR_DEFLATE) {
+			writeLe16(archive, record + CENTRAL_VERSION_OFFSET, VERSION_NEEDED_FOR_DEFLATE);
+		}
+		writeLe32(archive, record + CENTRAL_COMPRESSED_SIZE_OFFSET, new_sizes[i]);
+		writeLe32(archive, record + CENTRAL_LOCAL_OFFSET_OFFSET, static_cast<uint32_t>(new_local_offsets[i]));
+	}
+
+	const std::size_t central_size = archive.size() - central_start;
+	const std::size_t eocd = archive.size();
+	appendRange(archive, archive_data.subspan(directory.eocd_offset));
+	writeLe32(archive, eocd + EOCD_CENTRAL_SIZE_OFFSET, static_cast<uint32_t>(central_size));
+	writeLe32(archive, eocd + EOCD_CENTRAL_OFFSET, static_cast<uint32_t>(central_start));
+	return archive;
+}
+
+} // anonymous namespace
+
+bool isCompressedMedia(std::string_view name) {
+	const std::size_t dot = name.rfind('.');
+	if (dot == std::string_view::npos || name.find('/', dot) != std::string_view::npos) {
+		return false;
+	}
+	const std::string_view extension = name.substr(dot + 1);
+	return std::ranges::any_of(COMPRESSED_MEDIA_EXTENSIONS, [&](std::string_view known) {
+		return std::ranges::equal(known, extension, [](char lhs, char rhs) {
+			return lhs == toLowerAscii(rhs);
+		});
+	});
+}
+
+std::optional<vBytes> deflateAtBestEffort(std::span<const Byte> input, std::size_t limit,
+                                          std::size_t entry_number) {
+	constexpr int
+		RAW_DEFLATE_WINDOW_BITS = -15,
+		DEFLATE_MEM_LEVEL = 9;
+
+	z_stream stream{};
+	if (::deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, RAW_DEFLATE_WINDOW_BITS,
+			DEFLATE_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+		throw std::runtime_error(std::format(
+			"Archive File Error: Could not start compressing entry {}.", entry_number));
+	}
+	const DeflateEndGuard guard{&stream};
+
+	// Entries are ZIP32, so both sizes fit zlib's 32-bit counters.
+	vBytes output(std::min<std::size_t>(::deflateBound(&stream, static_cast<uLong>(input.size())), limit));
+	stream.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(input.data()));
+	stream.avail_in = static_cast<uInt>(input.size());
+	stream.next_out = reinterpret_cast<Bytef*>(output.data());
+	stream.avail_out = static_cast<uInt>(output.size());
+	if (::deflate(&stream, Z_FINISH) != Z_STREAM_END || stream.total_out >= limit) {
+		return std::nullopt;
+	}
+	output.resize(stream.total_out);
+	return output;
+}
+
+std::optional<vBytes> recompressArchive(std::span<const Byte> archive_data,
+                                        const ZipDirectoryIndex& directory,
+                                        std::size_t archive_budget) {
+	const std::optional<std::vector<SourceEntry>> entries = readSourceEntries(archive_data, directory);
+	if (!entries || archive_data.size() <= archive_budget) {
+		return std::nullopt;
+	}
+	const std::vector<std::optional<Replacement>> replacements =
+		recompressUntilWithinBudget(archive_data, *entries, archive_budget);
+	if (std::ranges::none_of(replacements, [](const auto& replacement) { return replacement.has_value(); })) {
+		return std::nullopt;
+	}
+	return rebuildArchive(archive_data, directory, *entries, replacements);
+}
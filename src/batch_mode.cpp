@@ -0,0 +1,288 @@
+#include "batch_mode_internal.h"
+#include "thread_pool.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <print>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using batch_mode_internal::BatchJob;
+
+// Optimized covers keyed by path. The first job to need a cover optimizes it;
+// jobs sharing that cover wait for and then borrow the same bytes, and share
+// its failure if it has one.
+class CoverCache {
+public:
+	[[nodiscard]] const vBytes& get(const fs::path& image_path) {
+		std::promise<vBytes> promise;
+		std::shared_future<vBytes> future;
+		bool owner = false;
+		{
+			const std::lock_guard lock(mutex_);
+			auto [it, inserted] = covers_.try_emplace(image_path.string());
+			if (inserted) {
+				it->second = promise.get_future().share();
+				owner = true;
+			}
+			future = it->second;
+		}
+
+		if (owner) {
+			try {
+				vBytes image_vec = readFile(image_path, FileTypeCheck::cover_image);
+				optimizeImage(image_vec);
+				promise.set_value(std::move(image_vec));
+			}
+			catch (...) {
+				promise.set_exception(std::current_exception());
+			}
+		}
+		// The map keeps the shared state, and so the bytes, alive.
+		return future.get();
+	}
+
+private:
+	std::mutex mutex_;
+	std::map<std::string, std::shared_future<vBytes>> covers_;
+};
+
+// Caps the combined size of archives being worked on at once. Archives are
+// mapped rather than read, but validation and output still pull each one
+// through the page cache; without a cap, a batch of large archives competes
+// for memory and evicts its own pages before they are written.
+class ByteBudget {
+public:
+	explicit ByteBudget(std::uint64_t capacity) : available_(capacity), capacity_(capacity) {}
+
+	// An archive larger than the whole budget runs alone rather than never.
+	[[nodiscard]] std::uint64_t acquire(std::uint64_t bytes) {
+		const std::uint64_t amount = std::min(bytes, capacity_);
+		std::unique_lock lock(mutex_);
+		released_.wait(lock, [&] { return available_ >= amount; });
+		available_ -= amount;
+		return amount;
+	}
+
+	void release(std::uint64_t amount) {
+		{
+			const std::lock_guard lock(mutex_);
+			available_ += amount;
+		}
+		released_.notify_all();
+	}
+
+private:
+	std::mutex mutex_;
+	std::condition_variable released_;
+	std::uint64_t available_;
+	const std::uint64_t capacity_;
+};
+
+class BudgetLease {
+public:
+	BudgetLease(ByteBudget& budget, std::uint64_t bytes) : budget_(budget), amount_(budget.acquire(bytes)) {}
+	~BudgetLease() { budget_.release(amount_); }
+
+	BudgetLease(const BudgetLease&) = delete;
+	BudgetLease& operator=(const BudgetLease&) = delete;
+
+private:
+	ByteBudget& budget_;
+	std::uint64_t amount_;
+};
+
+// A quarter of physical memory, but never below one maximum-size archive.
+[[nodiscard]] std::uint64_t defaultArchiveBudget() {
+	constexpr std::uint64_t MIN_BUDGET = 2ULL * 1024 * 1024 * 1024;
+	const long pages = ::sysconf(_SC_PHYS_PAGES);
+	const long page_size = ::sysconf(_SC_PAGESIZE);
+	if (pages <= 0 || page_size <= 0) {
+		return MIN_BUDGET;
+	}
+	return std::max(MIN_BUDGET, static_cast<std::uint64_t>(pages) * static_cast<std::uint64_t>(page_size) / 4);
+}
+
+// Returns the path of the polyglot written.
+[[nodiscard]] fs::path runJob(const BatchJob& job, CoverCache& covers, ByteBudget& budget) {
+	const MappedFile archive_file = mapArchiveFile(job.archive_path);
+	const std::span<const Byte> archive_data = archive_file.bytes();
+	const BudgetLease lease(budget, archive_data.size());
+	const bool is_zip_file = hasFileExtension(job.archive_path, {".zip"});
+
+	const ArchiveMetadata archive_metadata = analyzeArchive(archive_data, is_zip_file);
+	requireArgumentsApply(archive_metadata.file_type, job.user_args);
+	const vBytes& optimized_image = covers.get(job.image_path);
+	vBytes script_vec = buildExtractionScript(
+		archive_metadata.file_type, archive_metadata.first_filename, job.user_args);
+
+	const PolyglotSegments polyglot = embedChunks(
+		optimized_image, std::move(script_vec), archive_data,
+		archive_metadata.directory, archive_file.fd());
+	return writePolyglotFile(polyglot.segments(), is_zip_file, job.output_path);
+}
+
+[[nodiscard]] std::string describeJob(const BatchJob& job) {
+	return job.line != 0
+		? std::format("Line {} ({})", job.line, job.archive_path.string())
+		: job.archive_path.string();
+}
+
+// Run every job on the pool and report each outcome, with the file it
+// wrote, in submission order; a failed job never stops the others.
+[[nodiscard]] int runJobs(std::span<const BatchJob> jobs) {
+	CoverCache covers;
+	ByteBudget budget(defaultArchiveBudget());
+	std::vector<fs::path> outputs(jobs.size());
+	std::vector<std::string> errors(jobs.size());
+
+	{
+		ThreadPool pool(static_cast<unsigned>(std::min<std::size_t>(
+			ThreadPool::defaultThreadCount(), jobs.size())));
+		for (std::size_t i = 0; i < jobs.size(); ++i) {
+			pool.submit([&, i] {
+				try {
+					outputs[i] = runJob(jobs[i], covers, budget);
+				}
+				catch (const std::exception& e) {
+					errors[i] = e.what();
+				}
+			});
+		}
+		pool.wait();
+	}
+
+	std::size_t failed = 0;
+	for (std::size_t i = 0; i < jobs.size(); ++i) {
+		if (errors[i].empty()) {
+			std::println("OK      {} -> {}", describeJob(jobs[i]), outputs[i].string());
+		}
+		else {
+			++failed;
+			std::println(std::cerr, "FAILED  {}: {}", describeJob(jobs[i]), errors[i]);
+		}
+	}
+	std::println("\nBatch complete: {} of {} jobs succeeded.\n", jobs.size() - failed, jobs.size());
+	return failed == 0 ? 0 : 1;
+}
+
+[[nodiscard]] std::vector<std::string_view> splitTabs(std::string_view line) {
+	std::vector<std::string_view> fields;
+	for (;;) {
+		const std::size_t tab = line.find('\t');
+		fields.push_back(line.substr(0, tab));
+		if (tab == std::string_view::npos) {
+			return fields;
+		}
+		line.remove_prefix(tab + 1);
+	}
+}
+
+} // anonymous namespace
+
+namespace batch_mode_internal {
+
+std::vector<BatchJob> parseManifest(const fs::path& manifest_path) {
+	constexpr std::size_t
+		MIN_FIELDS     = 2,
+		MAX_FIELDS     = 5,
+		MAX_ARG_LENGTH = 1024;
+
+	std::ifstream manifest(manifest_path);
+	if (!manifest) {
+		throw std::runtime_error(std::format(
+			"Batch Error: Unable to open manifest file: {}", manifest_path.string()));
+	}
+
+	std::vector<BatchJob> jobs;
+	std::set<fs::path> output_paths;
+	std::string line;
+	for (std::size_t line_number = 1; std::getline(manifest, line); ++line_number) {
+		std::string_view text = line;
+		if (text.ends_with('\r')) {
+			text.remove_suffix(1);
+		}
+		if (text.empty() || text.front() == '#') {
+			continue;
+		}
+
+		const std::vector<std::string_view> fields = splitTabs(text);
+		if (fields.size() < MIN_FIELDS || fields.size() > MAX_FIELDS
+			|| fields[0].empty() || fields[1].empty()) {
+			throw std::runtime_error(std::format(
+				"Batch Error: Manifest line {}: expected cover<TAB>archive"
+				"[<TAB>linux args[<TAB>windows args[<TAB>output]]].", line_number));
+		}
+		for (std::size_t i = 2; i < std::min<std::size_t>(fields.size(), 4); ++i) {
+			if (fields[i].size() > MAX_ARG_LENGTH) {
+				throw std::runtime_error(std::format(
+					"Batch Error: Manifest line {}: arguments exceed maximum length of {} bytes.",
+					line_number, MAX_ARG_LENGTH));
+			}
+		}
+
+		BatchJob job{
+			.line = line_number,
+			.image_path = fs::path(fields[0]),
+			.archive_path = fs::path(fields[1]),
+		};
+		if (fields.size() > 2) {
+			job.user_args.linux_args = fields[2];
+		}
+		if (fields.size() > 3) {
+			job.user_args.windows_args = fields[3];
+		}
+		if (fields.size() > 4 && !fields[4].empty()) {
+			job.output_path = fs::path(fields[4]);
+			// Two jobs writing one file would race, and whichever lost would fail.
+			if (!output_paths.insert(fs::absolute(*job.output_path).lexically_normal()).second) {
+				throw std::runtime_error(std::format(
+					"Batch Error: Manifest line {}: output path is already used by an earlier line: {}",
+					line_number, job.output_path->string()));
+			}
+		}
+		jobs.push_back(std::move(job));
+	}
+	if (manifest.bad()) {
+		throw std::runtime_error(std::format(
+			"Batch Error: Failed while reading manifest file: {}", manifest_path.string()));
+	}
+	if (jobs.empty()) {
+		throw std::runtime_error("Batch Error: Manifest contains no jobs.");
+	}
+	return jobs;
+}
+
+}  // namespace batch_mode_internal
+
+int runBatch(const fs::path& image_path, std::span<const std::string> archive_paths) {
+	std::vector<BatchJob> jobs;
+	jobs.reserve(archive_paths.size());
+	for (const std::string& archive_path : archive_paths) {
+		jobs.push_back(BatchJob{
+			.image_path = image_path,
+			.archive_path = archive_path,
+		});
+	}
+	return runJobs(jobs);
+}
+
+int runManifestBatch(const fs::path& manifest_path) {
+	return runJobs(batch_mode_internal::parseManifest(manifest_path));
+}
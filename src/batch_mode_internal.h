@@ -0,0 +1,28 @@
+#pragma once
+
+#include "pdvzip.h"
+
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+namespace batch_mode_internal {
+
+// One polyglot to produce: a cover, an archive, the arguments that would
+// otherwise be prompted for, and optionally where to write the result.
+struct BatchJob {
+	std::size_t line = 0;                 // manifest line, 0 for command-line jobs
+	fs::path image_path;
+	fs::path archive_path;
+	UserArguments user_args{};
+	std::optional<fs::path> output_path{};
+};
+
+// Manifest format: one job per line, tab-separated
+//   cover <TAB> archive [<TAB> linux args [<TAB> windows args [<TAB> output]]]
+// Blank lines and lines starting with '#' are ignored. Throws on the first
+// malformed line, on an output path named twice, and on a manifest with no
+// jobs.
+[[nodiscard]] std::vector<BatchJob> parseManifest(const fs::path& manifest_path);
+
+}  // namespace batch_mode_internal
@@ -0,0 +1,81 @@
+#pragma once
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define PDVZIP_HAS_X86_CPUID 1
+#include <cpuid.h>
+#include <cstdint>
+#else
+#define PDVZIP_HAS_X86_CPUID 0
+#endif
+
+#if PDVZIP_HAS_X86_CPUID
+
+namespace cpu_features_internal {
+
+// Instruction-set extensions the SIMD checksum kernels dispatch on. The AVX
+// entries are only set when the OS also saves the matching register state, so
+// a true flag means the kernel can actually run.
+struct X86Features {
+	bool sse2       = false;
+	bool ssse3      = false;
+	bool pclmul     = false;
+	bool avx2       = false;
+	bool avx512f    = false;
+	bool vpclmulqdq = false;
+};
+
+// Read XCR0 directly; _xgetbv would need the xsave target on the caller.
+[[nodiscard]] inline std::uint64_t readXcr0() noexcept {
+	std::uint32_t eax = 0;
+	std::uint32_t edx = 0;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return (std::uint64_t{edx} << 32U) | eax;
+}
+
+[[nodiscard]] inline X86Features detectX86Features() noexcept {
+	constexpr unsigned int
+		SSE2_BIT       = 1U << 26U,  // leaf 1 EDX
+		PCLMULQDQ_BIT  = 1U << 1U,   // leaf 1 ECX
+		SSSE3_BIT      = 1U << 9U,   // leaf 1 ECX
+		OSXSAVE_BIT    = 1U << 27U,  // leaf 1 ECX
+		AVX_BIT        = 1U << 28U,  // leaf 1 ECX
+		AVX2_BIT       = 1U << 5U,   // leaf 7 EBX
+		AVX512F_BIT    = 1U << 16U,  // leaf 7 EBX
+		VPCLMULQDQ_BIT = 1U << 10U;  // leaf 7 ECX
+	constexpr std::uint64_t
+		XCR0_YMM_STATE = 0x06U,      // SSE + AVX
+		XCR0_ZMM_STATE = 0xE6U;      // + opmask, ZMM_Hi256, Hi16_ZMM
+
+	X86Features features;
+	unsigned int eax = 0;
+	unsigned int ebx = 0;
+	unsigned int ecx = 0;
+	unsigned int edx = 0;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0) {
+		return features;
+	}
+	features.sse2   = (edx & SSE2_BIT) != 0U;
+	features.ssse3  = (ecx & SSSE3_BIT) != 0U;
+	features.pclmul = (ecx & PCLMULQDQ_BIT) != 0U;
+
+	if ((ecx & OSXSAVE_BIT) == 0U || (ecx & AVX_BIT) == 0U
+		|| __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0) {
+		return features;
+	}
+	const std::uint64_t xcr0 = readXcr0();
+	const bool ymm_state = (xcr0 & XCR0_YMM_STATE) == XCR0_YMM_STATE;
+	const bool zmm_state = (xcr0 & XCR0_ZMM_STATE) == XCR0_ZMM_STATE;
+	features.avx2       = ymm_state && (ebx & AVX2_BIT) != 0U;
+	features.avx512f    = zmm_state && (ebx & AVX512F_BIT) != 0U;
+	features.vpclmulqdq = ymm_state && (ecx & VPCLMULQDQ_BIT) != 0U;
+	return features;
+}
+
+[[nodiscard]] inline const X86Features& x86Features() noexcept {
+	static const X86Features features = detectX86Features();
+	return features;
+}
+
+}  // namespace cpu_features_internal
+
+#endif // PDVZIP_HAS_X86_CPUID
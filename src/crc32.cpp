@@ -1,22 +1,48 @@
+#include "pdvzip.h"
+#include "cpu_features_internal.h"
+#include "crc32_internal.h"
+#include "thread_pool.h"
+
+#include <algorithm>
 #include <array>
 #include <cstddef>
 #include <cstdint>
+#include <system_error>
+#include <thread>
+#include <vector>
 
-#if !defined(PDVZIP_CRC32_DISABLE_PCLMUL) &&                              \
-    (defined(__x86_64__) || defined(__i386__)) &&                         \
-    (defined(__GNUC__) || defined(__clang__))
-#include <cpuid.h>
+#if !defined(PDVZIP_CRC32_DISABLE_PCLMUL) && PDVZIP_HAS_X86_CPUID
 #include <immintrin.h>
 #define PDVZIP_HAS_X86_PCLMUL 1
 #else
 #define PDVZIP_HAS_X86_PCLMUL 0
 #endif
 
+#if PDVZIP_HAS_X86_PCLMUL && !defined(PDVZIP_CRC32_DISABLE_VPCLMUL)
+#define PDVZIP_HAS_X86_VPCLMUL 1
+#else
+#define PDVZIP_HAS_X86_VPCLMUL 0
+#endif
+
+// Inputs at least this large are CRC'd in slices on worker threads; 0 keeps
+// every CRC on the calling thread. Set through the PDVZIP_CRC32_PARALLEL_THRESHOLD
+// CMake cache variable.
+#ifndef PDVZIP_CRC32_PARALLEL_THRESHOLD
+#define PDVZIP_CRC32_PARALLEL_THRESHOLD 67108864
+#endif
+
 namespace {
 
 constexpr std::uint32_t CRC32_POLY = 0xEDB88320U;
 constexpr std::uint32_t CRC32_INITIAL = 0xFFFFFFFFU;
-constexpr std::size_t CRC32_PCLMUL_MIN_BYTES = 64;
+constexpr std::size_t
+	CRC32_PCLMUL_MIN_BYTES    = 64,
+	CRC32_VPCLMUL256_MIN_BYTES = 128,
+	CRC32_VPCLMUL512_MIN_BYTES = 256;
+
+constexpr std::uint64_t CRC32_PARALLEL_THRESHOLD = PDVZIP_CRC32_PARALLEL_THRESHOLD;
+// Below this a slice finishes before a thread would start paying for itself.
+constexpr std::size_t CRC32_MIN_SLICE_BYTES = 16 * 1024 * 1024;
 
 [[nodiscard]] constexpr std::uint32_t makeCrcTableEntry(std::uint32_t value) {
 	for (int bit = 0; bit < 8; ++bit) {
@@ -41,6 +67,109 @@ constexpr std::size_t CRC32_PCLMUL_MIN_BYTES = 64;
 
 alignas(64) constexpr auto CRC_TABLES = makeCrcTables();
 
+// Multiply two polynomials modulo the reflected CRC-32 polynomial. Used by
+// crc32Combine to shift a CRC forward over bytes it never has to read.
+[[nodiscard]] constexpr std::uint32_t multiplyModPoly(std::uint32_t a, std::uint32_t b) noexcept {
+	std::uint32_t product = 0;
+	for (std::uint32_t bit = 1U << 31U; bit != 0U; bit >>= 1U) {
+		if ((a & bit) != 0U) {
+			product ^= b;
+		}
+		b = (b & 1U) != 0U ? (b >> 1U) ^ CRC32_POLY : b >> 1U;
+	}
+	return product;
+}
+
+// X_POW_2N_TABLE[n] = x^(2^n) mod P, in reflected bit order.
+[[nodiscard]] constexpr auto makeXPow2nTable() {
+	std::array<std::uint32_t, 32> table{};
+	std::uint32_t power = 1U << 30U; // x^1
+	for (std::uint32_t& entry : table) {
+		entry = power;
+		power = multiplyModPoly(power, power);
+	}
+	return table;
+}
+
+constexpr auto X_POW_2N_TABLE = makeXPow2nTable();
+
+// x^(8 * length) mod P: the operator that appends length zero bytes to a CRC.
+[[nodiscard]] constexpr std::uint32_t xPowBytesModPoly(std::uint64_t length) noexcept {
+	std::uint32_t power = 1U << 31U; // x^0
+	for (std::size_t k = 3; length != 0; length >>= 1U, ++k) {
+		if ((length & 1U) != 0U) {
+			power = multiplyModPoly(X_POW_2N_TABLE[k & 31U], power);
+		}
+	}
+	return power;
+}
+
+// x^bits mod P, in reflected bit order.
+[[nodiscard]] constexpr std::uint32_t xPowBitsModPoly(std::uint64_t bits) noexcept {
+	std::uint32_t power = 1U << 31U; // x^0
+	for (std::size_t k = 0; bits != 0; bits >>= 1U, ++k) {
+		if ((bits & 1U) != 0U) {
+			power = multiplyModPoly(X_POW_2N_TABLE[k & 31U], power);
+		}
+	}
+	return power;
+}
+
+// Carry-less folding constant for a lane that moves forward by distance_bits:
+// x^(distance_bits + 32) mod P for the low qword and x^(distance_bits - 32)
+// mod P for the high qword, each reflected and shifted into the 33-bit form
+// PCLMULQDQ expects.
+struct FoldConstants {
+	std::uint64_t low;
+	std::uint64_t high;
+};
+
+[[nodiscard]] constexpr FoldConstants makeFoldConstants(std::uint64_t distance_bits) noexcept {
+	return {
+		.low  = std::uint64_t{xPowBitsModPoly(distance_bits + 32)} << 1U,
+		.high = std::uint64_t{xPowBitsModPoly(distance_bits - 32)} << 1U,
+	};
+}
+
+// floor(x^64 / P), reflected to 33 bits: the Barrett quotient estimate.
+[[nodiscard]] constexpr std::uint64_t makeBarrettQuotient() noexcept {
+	constexpr std::uint64_t POLY_NORMAL = 0x104C11DB7ULL;
+	std::uint64_t remainder = 0;
+	std::uint64_t quotient = 0;
+	for (int bit = 64; bit >= 0; --bit) {
+		remainder = (remainder << 1U) | (bit == 64 ? 1U : 0U);
+		quotient <<= 1U;
+		if ((remainder & (1ULL << 32U)) != 0U) {
+			remainder ^= POLY_NORMAL;
+			quotient |= 1U;
+		}
+	}
+	std::uint64_t reflected = 0;
+	for (int bit = 0; bit < 33; ++bit) {
+		reflected |= ((quotient >> bit) & 1U) << (32 - bit);
+	}
+	return reflected;
+}
+
+constexpr FoldConstants
+	FOLD_16_BYTES  = makeFoldConstants(128),
+	FOLD_32_BYTES  = makeFoldConstants(256),
+	FOLD_48_BYTES  = makeFoldConstants(384),
+	FOLD_64_BYTES  = makeFoldConstants(512),
+	FOLD_128_BYTES = makeFoldConstants(1024),
+	FOLD_256_BYTES = makeFoldConstants(2048);
+
+constexpr std::uint64_t
+	FOLD_TO_64_BITS  = std::uint64_t{xPowBitsModPoly(64)} << 1U,
+	BARRETT_POLY     = (std::uint64_t{CRC32_POLY} << 1U) | 1U,
+	BARRETT_QUOTIENT = makeBarrettQuotient();
+
+// Published values (Intel white paper, zlib/Chromium crc32_simd).
+static_assert(FOLD_64_BYTES.low == 0x154442BD4ULL && FOLD_64_BYTES.high == 0x1C6E41596ULL);
+static_assert(FOLD_16_BYTES.low == 0x1751997D0ULL && FOLD_16_BYTES.high == 0x0CCAA009EULL);
+static_assert(FOLD_TO_64_BITS == 0x163CD6124ULL);
+static_assert(BARRETT_POLY == 0x1DB710641ULL && BARRETT_QUOTIENT == 0x1F7011641ULL);
+
 [[nodiscard]] std::uint32_t crc32UpdateScalar(std::uint32_t crc,
                                               const unsigned char *data,
                                               std::size_t length) noexcept {
@@ -63,82 +192,241 @@ alignas(64) constexpr auto CRC_TABLES = makeCrcTables();
 	return crc;
 }
 
-[[nodiscard]] std::uint32_t crc32Scalar(const unsigned char *data,
+// Implementations take and return the raw (pre-inversion) CRC register, so the
+// same kernels serve both one-shot chunk CRCs and running CRCs over segments.
+[[nodiscard]] std::uint32_t crc32Scalar(std::uint32_t crc,
+                                        const unsigned char *data,
                                         std::size_t length) noexcept {
-	return crc32UpdateScalar(CRC32_INITIAL, data, length) ^ CRC32_INITIAL;
+	return crc32UpdateScalar(crc, data, length);
 }
 
 #if PDVZIP_HAS_X86_PCLMUL
 
-[[nodiscard]] bool cpuHasPclmul() noexcept {
-	unsigned int eax = 0;
-	unsigned int ebx = 0;
-	unsigned int ecx = 0;
-	unsigned int edx = 0;
-	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0) {
-		return false;
-	}
-	constexpr unsigned int SSE2_BIT = 1U << 26U;
-	constexpr unsigned int PCLMULQDQ_BIT = 1U << 1U;
-	return (edx & SSE2_BIT) != 0U && (ecx & PCLMULQDQ_BIT) != 0U;
-}
-
 [[nodiscard]] __attribute__((target("sse2,pclmul"))) inline __m128i
 loadBlock128(const unsigned char *data) noexcept {
 	return _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
 }
 
 [[nodiscard]] __attribute__((target("sse2,pclmul"))) inline __m128i
-foldAcross128Bits(__m128i state, __m128i constants) noexcept {
+foldConstants128(FoldConstants constants) noexcept {
+	return _mm_set_epi64x(static_cast<long long>(constants.high), static_cast<long long>(constants.low));
+}
+
+// state * x^k (high and low halves folded with separate constants), plus data.
+[[nodiscard]] __attribute__((target("sse2,pclmul"))) inline __m128i
+foldBlock128(__m128i state, __m128i constants, __m128i data) noexcept {
 	const __m128i folded_low = _mm_clmulepi64_si128(state, constants, 0x00);
 	const __m128i folded_high = _mm_clmulepi64_si128(state, constants, 0x11);
-	return _mm_xor_si128(folded_low, folded_high);
+	return _mm_xor_si128(_mm_xor_si128(folded_high, folded_low), data);
+}
+
+// Absorb the remaining whole 16-byte blocks into a single folded lane, reduce
+// it 128 -> 96 -> 64 bits, and Barrett-reduce to the 32-bit register; the
+// sub-block tail goes through the table. Shared by every folding kernel.
+[[nodiscard]] __attribute__((target("sse2,pclmul"))) inline std::uint32_t
+finishFolded128(__m128i state, const unsigned char *data, std::size_t length) noexcept {
+	const __m128i fold_by_1  = foldConstants128(FOLD_16_BYTES);
+	const __m128i fold_to_64 = _mm_set_epi64x(0, static_cast<long long>(FOLD_TO_64_BITS));
+	const __m128i barrett    = _mm_set_epi64x(static_cast<long long>(BARRETT_QUOTIENT),
+	                                           static_cast<long long>(BARRETT_POLY));
+	const __m128i low32_mask = _mm_setr_epi32(-1, 0, -1, 0);
+
+	for (; length >= 16; data += 16, length -= 16) {
+		state = foldBlock128(state, fold_by_1, loadBlock128(data));
+	}
+
+	state = _mm_xor_si128(_mm_srli_si128(state, 8), _mm_clmulepi64_si128(state, fold_by_1, 0x10));
+	state = _mm_xor_si128(
+		_mm_srli_si128(state, 4),
+		_mm_clmulepi64_si128(_mm_and_si128(state, low32_mask), fold_to_64, 0x00));
+
+	// Barrett reduction: 64 -> 32 bits without a division.
+	__m128i quotient = _mm_clmulepi64_si128(_mm_and_si128(state, low32_mask), barrett, 0x10);
+	quotient = _mm_clmulepi64_si128(_mm_and_si128(quotient, low32_mask), barrett, 0x00);
+	state = _mm_xor_si128(state, quotient);
+	const auto crc = static_cast<std::uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(state, 4)));
+
+	return crc32UpdateScalar(crc, data, length);
 }
 
+// Reflected IEEE CRC-32 folding (Intel, "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ"). Four independent 128-bit lanes cover 64
+// bytes per iteration, hiding the carry-less multiply latency that a single
+// lane serialises on; the lanes are then merged into one and finished by
+// finishFolded128.
 [[nodiscard]] __attribute__((target("sse2,pclmul"))) std::uint32_t
-crc32Pclmul(const unsigned char *data, std::size_t length) noexcept {
+crc32Pclmul(std::uint32_t crc, const unsigned char *data,
+            std::size_t length) noexcept {
 	if (length < CRC32_PCLMUL_MIN_BYTES) {
-		return crc32Scalar(data, length);
+		return crc32Scalar(crc, data, length);
 	}
 
-	const std::size_t folded_length = length & ~std::size_t{15};
-	__m128i state =
-	    _mm_xor_si128(loadBlock128(data), _mm_set_epi64x(0, CRC32_INITIAL));
+	const __m128i fold_by_4 = foldConstants128(FOLD_64_BYTES);
+	const __m128i fold_by_1 = foldConstants128(FOLD_16_BYTES);
 
-	// Constants generated for reflected IEEE CRC-32.  The vector order is
-	// chosen so imm8 0x00 multiplies low64 by HI64_TERMS and imm8 0x11
-	// multiplies high64 by LO64_TERMS.
-	const __m128i fold128_constants =
-	    _mm_set_epi64x(0x00000000CCAA009EULL, 0x00000000AE689191ULL);
+	__m128i lane0 = _mm_xor_si128(loadBlock128(data), _mm_cvtsi32_si128(static_cast<int>(crc)));
+	__m128i lane1 = loadBlock128(data + 16);
+	__m128i lane2 = loadBlock128(data + 32);
+	__m128i lane3 = loadBlock128(data + 48);
+	data += 64;
+	length -= 64;
 
-	for (std::size_t offset = 16; offset < folded_length; offset += 16) {
-		state = _mm_xor_si128(foldAcross128Bits(state, fold128_constants),
-		                      loadBlock128(data + offset));
+	for (; length >= 64; data += 64, length -= 64) {
+		lane0 = foldBlock128(lane0, fold_by_4, loadBlock128(data));
+		lane1 = foldBlock128(lane1, fold_by_4, loadBlock128(data + 16));
+		lane2 = foldBlock128(lane2, fold_by_4, loadBlock128(data + 32));
+		lane3 = foldBlock128(lane3, fold_by_4, loadBlock128(data + 48));
 	}
 
-	// Reduce the 128-bit folded state to a 32-bit CRC. Rather than a Barrett
-	// reduction, we exploit the folding invariant: the running state is
-	// congruent (mod the CRC polynomial) to the data consumed so far, so the
-	// CRC of those 16 bytes equals the CRC of that data. We therefore store the
-	// state and run the scalar table CRC over it (init 0, no final inversion).
-	// Correct because the initial inversion was already injected into the first
-	// dword above; the final inversion is applied once at the end. Slower than
-	// Barrett but only 16 bytes, so the cost is negligible.
-	alignas(16) std::array<unsigned char, 16> folded{};
-	_mm_store_si128(reinterpret_cast<__m128i*>(folded.data()), state);
+	__m128i state = foldBlock128(lane0, fold_by_1, lane1);
+	state = foldBlock128(state, fold_by_1, lane2);
+	state = foldBlock128(state, fold_by_1, lane3);
+	return finishFolded128(state, data, length);
+}
 
-	std::uint32_t crc = crc32UpdateScalar(0, folded.data(), folded.size());
-	crc = crc32UpdateScalar(crc, data + folded_length, length - folded_length);
-	return crc ^ CRC32_INITIAL;
+#if PDVZIP_HAS_X86_VPCLMUL
+
+#define PDVZIP_TARGET_VPCLMUL256 __attribute__((target("avx2,pclmul,vpclmulqdq")))
+#define PDVZIP_TARGET_VPCLMUL512 __attribute__((target("avx512f,avx2,pclmul,vpclmulqdq")))
+
+[[nodiscard]] PDVZIP_TARGET_VPCLMUL256 inline __m256i
+foldBlock256(__m256i state, __m256i constants, __m256i data) noexcept {
+	const __m256i folded_low = _mm256_clmulepi64_epi128(state, constants, 0x00);
+	const __m256i folded_high = _mm256_clmulepi64_epi128(state, constants, 0x11);
+	return _mm256_xor_si256(_mm256_xor_si256(folded_high, folded_low), data);
+}
+
+[[nodiscard]] PDVZIP_TARGET_VPCLMUL256 inline __m256i
+loadBlock256(const unsigned char *data) noexcept {
+	return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+}
+
+[[nodiscard]] PDVZIP_TARGET_VPCLMUL256 inline __m256i
+foldConstants256(FoldConstants constants) noexcept {
+	return _mm256_broadcastsi128_si256(foldConstants128(constants));
+}
+
+// Same folding as crc32Pclmul, two 128-bit lanes per YMM register: four
+// registers cover 128 bytes per iteration.
+[[nodiscard]] PDVZIP_TARGET_VPCLMUL256 std::uint32_t
+crc32Vpclmul256(std::uint32_t crc, const unsigned char *data,
+                std::size_t length) noexcept {
+	if (length < CRC32_VPCLMUL256_MIN_BYTES) {
+		return crc32Pclmul(crc, data, length);
+	}
+
+	const __m256i fold_by_4 = foldConstants256(FOLD_128_BYTES);
+	const __m256i fold_by_1 = foldConstants256(FOLD_32_BYTES);
+
+	__m256i lane0 = _mm256_xor_si256(
+		loadBlock256(data), _mm256_zextsi128_si256(_mm_cvtsi32_si128(static_cast<int>(crc))));
+	__m256i lane1 = loadBlock256(data + 32);
+	__m256i lane2 = loadBlock256(data + 64);
+	__m256i lane3 = loadBlock256(data + 96);
+	data += 128;
+	length -= 128;
+
+	for (; length >= 128; data += 128, length -= 128) {
+		lane0 = foldBlock256(lane0, fold_by_4, loadBlock256(data));
+		lane1 = foldBlock256(lane1, fold_by_4, loadBlock256(data + 32));
+		lane2 = foldBlock256(lane2, fold_by_4, loadBlock256(data + 64));
+		lane3 = foldBlock256(lane3, fold_by_4, loadBlock256(data + 96));
+	}
+
+	__m256i state = foldBlock256(lane0, fold_by_1, lane1);
+	state = foldBlock256(state, fold_by_1, lane2);
+	state = foldBlock256(state, fold_by_1, lane3);
+
+	// Two 128-bit lanes, 16 bytes apart.
+	const __m128i folded = foldBlock128(
+		_mm256_castsi256_si128(state), foldConstants128(FOLD_16_BYTES),
+		_mm256_extracti128_si256(state, 1));
+	return finishFolded128(folded, data, length);
 }
 
+[[nodiscard]] PDVZIP_TARGET_VPCLMUL512 inline __m512i
+foldBlock512(__m512i state, __m512i constants, __m512i data) noexcept {
+	const __m512i folded_low = _mm512_clmulepi64_epi128(state, constants, 0x00);
+	const __m512i folded_high = _mm512_clmulepi64_epi128(state, constants, 0x11);
+	return _mm512_xor_si512(_mm512_xor_si512(folded_high, folded_low), data);
+}
+
+[[nodiscard]] PDVZIP_TARGET_VPCLMUL512 inline __m512i
+loadBlock512(const unsigned char *data) noexcept {
+	return _mm512_loadu_si512(data);
+}
+
+[[nodiscard]] PDVZIP_TARGET_VPCLMUL512 inline __m512i
+foldConstants512(FoldConstants constants) noexcept {
+	return _mm512_broadcast_i32x4(foldConstants128(constants));
+}
+
+// Four ZMM registers of four 128-bit lanes each: 256 bytes per iteration.
+[[nodiscard]] PDVZIP_TARGET_VPCLMUL512 std::uint32_t
+crc32Vpclmul512(std::uint32_t crc, const unsigned char *data,
+                std::size_t length) noexcept {
+	if (length < CRC32_VPCLMUL512_MIN_BYTES) {
+		return crc32Pclmul(crc, data, length);
+	}
+
+	const __m512i fold_by_4 = foldConstants512(FOLD_256_BYTES);
+	const __m512i fold_by_1 = foldConstants512(FOLD_64_BYTES);
+
+	__m512i lane0 = _mm512_xor_si512(
+		loadBlock512(data), _mm512_zextsi128_si512(_mm_cvtsi32_si128(static_cast<int>(crc))));
+	__m512i lane1 = loadBlock512(data + 64);
+	__m512i lane2 = loadBlock512(data + 128);
+	__m512i lane3 = loadBlock512(data + 192);
+	data += 256;
+	length -= 256;
+
+	for (; length >= 256; data += 256, length -= 256) {
+		lane0 = foldBlock512(lane0, fold_by_4, loadBlock512(data));
+		lane1 = foldBlock512(lane1, fold_by_4, loadBlock512(data + 64));
+		lane2 = foldBlock512(lane2, fold_by_4, loadBlock512(data + 128));
+		lane3 = foldBlock512(lane3, fold_by_4, loadBlock512(data + 192));
+	}
+
+	__m512i state = foldBlock512(lane0, fold_by_1, lane1);
+	state = foldBlock512(state, fold_by_1, lane2);
+	state = foldBlock512(state, fold_by_1, lane3);
+
+	// Four 128-bit lanes, 48, 32 and 16 bytes ahead of the last one. Fold the
+	// first three forward in one multiply; the last lane joins unshifted.
+	const __m512i lane_shift = _mm512_inserti32x4(
+		_mm512_inserti32x4(
+			_mm512_inserti32x4(_mm512_setzero_si512(), foldConstants128(FOLD_48_BYTES), 0),
+			foldConstants128(FOLD_32_BYTES), 1),
+		foldConstants128(FOLD_16_BYTES), 2);
+	const __m512i shifted = foldBlock512(state, lane_shift, _mm512_setzero_si512());
+	const __m128i folded = _mm_xor_si128(
+		_mm_xor_si128(_mm512_castsi512_si128(shifted), _mm512_extracti32x4_epi32(shifted, 1)),
+		_mm_xor_si128(_mm512_extracti32x4_epi32(shifted, 2), _mm512_extracti32x4_epi32(state, 3)));
+	return finishFolded128(folded, data, length);
+}
+
+#undef PDVZIP_TARGET_VPCLMUL256
+#undef PDVZIP_TARGET_VPCLMUL512
+
+#endif // PDVZIP_HAS_X86_VPCLMUL
+
 #endif
 
-using Crc32Impl = std::uint32_t (*)(const unsigned char *, std::size_t) noexcept;
+using Crc32Impl = std::uint32_t (*)(std::uint32_t, const unsigned char *, std::size_t) noexcept;
 
+// VPCLMULQDQ on YMM needs AVX2; on ZMM it also needs AVX-512F.
 [[nodiscard]] Crc32Impl resolveCrc32Impl() noexcept {
 #if PDVZIP_HAS_X86_PCLMUL
-	if (cpuHasPclmul()) {
+	const cpu_features_internal::X86Features& cpu = cpu_features_internal::x86Features();
+	if (cpu.sse2 && cpu.pclmul) {
+#if PDVZIP_HAS_X86_VPCLMUL
+		if (cpu.vpclmulqdq && cpu.avx512f) {
+			return crc32Vpclmul512;
+		}
+		if (cpu.vpclmulqdq && cpu.avx2) {
+			return crc32Vpclmul256;
+		}
+#endif
 		return crc32Pclmul;
 	}
 #endif
@@ -147,7 +435,125 @@ using Crc32Impl = std::uint32_t (*)(const unsigned char *, std::size_t) noexcept
 
 } // namespace
 
-unsigned lodepng_crc32(const unsigned char *data, std::size_t length) {
+namespace {
+
+[[nodiscard]] Crc32Impl crc32Impl() noexcept {
 	static const Crc32Impl impl = resolveCrc32Impl();
-	return impl(data, length);
+	return impl;
+}
+
+} // namespace
+
+namespace {
+
+// CRC each slice on its own thread (the first on the caller's), then chain
+// the slice CRCs together with crc32Combine. A slice whose thread cannot be
+// started is simply CRC'd inline. Takes and returns the raw register.
+[[nodiscard]] std::uint32_t crc32InSlices(std::uint32_t crc, std::span<const Byte> data, std::size_t slice_count) {
+	// Equal slices rounded to a cache line; the last takes the remainder.
+	const std::size_t slice_size = (data.size() / slice_count) & ~std::size_t{63};
+	const auto slice = [&](std::size_t index) {
+		const std::size_t begin = index * slice_size;
+		return data.subspan(begin, index + 1 == slice_count ? data.size() - begin : slice_size);
+	};
+	const auto sliceCrc = [&](std::size_t index) {
+		const std::span<const Byte> bytes = slice(index);
+		return crc32Impl()(CRC32_INITIAL, bytes.data(), bytes.size()) ^ CRC32_INITIAL;
+	};
+
+	std::vector<std::uint32_t> slice_crcs(slice_count);
+	{
+		std::vector<std::jthread> workers;
+		workers.reserve(slice_count - 1);
+		for (std::size_t i = 1; i < slice_count; ++i) {
+			try {
+				workers.emplace_back([&, i] { slice_crcs[i] = sliceCrc(i); });
+			}
+			catch (const std::system_error&) {
+				slice_crcs[i] = sliceCrc(i);
+			}
+		}
+		const std::span<const Byte> first = slice(0);
+		crc = crc32Impl()(crc, first.data(), first.size());
+	}
+
+	crc ^= CRC32_INITIAL;
+	for (std::size_t i = 1; i < slice_count; ++i) {
+		crc = crc32Combine(crc, slice_crcs[i], slice(i).size());
+	}
+	return crc ^ CRC32_INITIAL;
+}
+
+[[nodiscard]] std::uint32_t crc32Sliced(std::uint32_t crc, std::span<const Byte> data) {
+	const std::size_t slice_count = std::min<std::size_t>(
+		std::max(1U, std::thread::hardware_concurrency()),
+		data.size() / CRC32_MIN_SLICE_BYTES);
+	// On a pool worker (batch jobs, parallel entry verification, the folder
+	// builder) the other cores are already busy, so slicing would only
+	// oversubscribe them.
+	if (slice_count < 2 || ThreadPool::onWorkerThread()) {
+		return crc32Impl()(crc, data.data(), data.size());
+	}
+	return crc32InSlices(crc, data, slice_count);
+}
+
+} // namespace
+
+void Crc32::update(std::span<const Byte> data) {
+	if (CRC32_PARALLEL_THRESHOLD != 0 && data.size() >= CRC32_PARALLEL_THRESHOLD) {
+		register_ = crc32Sliced(register_, data);
+		return;
+	}
+	register_ = crc32Impl()(register_, data.data(), data.size());
+}
+
+void Crc32::combine(uint32_t block_crc, std::uint64_t block_length) noexcept {
+	register_ = crc32Combine(value(), block_crc, block_length) ^ CRC32_INITIAL;
+}
+
+unsigned lodepng_crc32(const unsigned char *data, std::size_t length) {
+	Crc32 crc;
+	crc.update(std::span<const Byte>(data, length));
+	return crc.value();
+}
+
+uint32_t crc32Update(uint32_t crc, std::span<const Byte> data) {
+	Crc32 running(crc);
+	running.update(data);
+	return running.value();
+}
+
+uint32_t crc32Combine(uint32_t crc1, uint32_t crc2, std::uint64_t length2) {
+	return multiplyModPoly(xPowBytesModPoly(length2), crc1) ^ crc2;
+}
+
+namespace crc32_internal {
+
+std::vector<NamedKernel> availableKernels() {
+	std::vector<NamedKernel> kernels{ { "scalar", crc32Scalar } };
+#if PDVZIP_HAS_X86_PCLMUL
+	const cpu_features_internal::X86Features& cpu = cpu_features_internal::x86Features();
+	if (cpu.sse2 && cpu.pclmul) {
+		kernels.push_back({ "pclmul", crc32Pclmul });
+#if PDVZIP_HAS_X86_VPCLMUL
+		if (cpu.vpclmulqdq && cpu.avx2) {
+			kernels.push_back({ "vpclmul256", crc32Vpclmul256 });
+		}
+		if (cpu.vpclmulqdq && cpu.avx512f) {
+			kernels.push_back({ "vpclmul512", crc32Vpclmul512 });
+		}
+#endif
+	}
+#endif
+	return kernels;
 }
+
+uint32_t crc32UpdateInSlices(uint32_t crc, std::span<const Byte> data, std::size_t slice_count) {
+	// Slices are rounded down to a cache line, so each needs at least one.
+	if (slice_count < 2 || data.size() / slice_count < 64) {
+		return crc32Update(crc, data);
+	}
+	return crc32InSlices(crc ^ CRC32_INITIAL, data, slice_count) ^ CRC32_INITIAL;
+}
+
+}  // namespace crc32_internal
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "pdvzip.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace crc32_internal {
+
+// One CRC-32 kernel, on the raw (pre-inverted) register.
+using Kernel = std::uint32_t (*)(std::uint32_t, const unsigned char*, std::size_t) noexcept;
+
+struct NamedKernel {
+	std::string_view name;
+	Kernel kernel;
+};
+
+// Every kernel this build and CPU can run, scalar first. crc32Update
+// dispatches to the last one.
+[[nodiscard]] std::vector<NamedKernel> availableKernels();
+
+// crc32Update with data cut into slice_count slices, each CRC'd on its own
+// thread and chained with crc32Combine, whatever the input size.
+[[nodiscard]] uint32_t crc32UpdateInSlices(uint32_t crc, std::span<const Byte> data, std::size_t slice_count);
+
+}  // namespace crc32_internal
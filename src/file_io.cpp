@@ -1,20 +1,29 @@
 #include "pdvzip.h"
+#include "io_ring_internal.h"
 
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <algorithm>
 #include <array>
 #include <cerrno>
 #include <cctype>
+#include <climits>
 #include <format>
-#include <fstream>
+#include <functional>
 #include <limits>
+#include <memory>
 #include <print>
 #include <random>
 #include <stdexcept>
 #include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace {
 
@@ -60,6 +69,24 @@ struct ScopedFd {
 	}
 
 	[[nodiscard]] int get() const noexcept { return fd; }
+
+	[[nodiscard]] int release() noexcept {
+		return std::exchange(fd, -1);
+	}
+
+	void reset(int file_descriptor) noexcept {
+		if (fd >= 0) {
+			::close(fd);
+		}
+		fd = file_descriptor;
+	}
+
+	// Close explicitly so the caller can observe deferred write errors.
+	[[nodiscard]] int close() noexcept {
+		const int rc = ::close(fd);
+		fd = -1;
+		return rc;
+	}
 };
 
 [[nodiscard]] ScopedFd openFileForReadOrThrow(const fs::path& path) {
@@ -150,29 +177,15 @@ void validateTypeSpecificConstraints(const fs::path& path, std::size_t file_size
 	throw std::runtime_error("Internal Error: Unknown file type check.");
 }
 
-[[nodiscard]] vBytes makeReadBuffer(std::size_t file_size, bool wrap_archive) {
-	const std::size_t buffer_size = wrap_archive
-		? checkedAdd(file_size, CHUNK_FIELDS_COMBINED_LENGTH, "Archive File Error: Wrapped archive size overflow.")
-		: file_size;
-
-	vBytes vec(buffer_size, 0);
-	if (wrap_archive) {
-		constexpr auto IDAT_MARKER_BYTES = std::to_array<Byte>({ 0x00, 0x00, 0x00, 0x00, 0x49, 0x44, 0x41, 0x54 });
-		std::copy(IDAT_MARKER_BYTES.begin(), IDAT_MARKER_BYTES.end(), vec.begin());
-	}
-
-	return vec;
-}
-
-void readFileContents(int fd, const fs::path& path, vBytes& vec, std::size_t file_size, bool wrap_archive) {
-	const std::size_t prefix_size = wrap_archive ? 8 : 0;
+// Fill dest from the descriptor's current file position.
+void readFileContents(int fd, const fs::path& path, std::span<Byte> dest) {
 	std::size_t total_read = 0;
-	while (total_read < file_size) {
-		const std::size_t remaining = file_size - total_read;
+	while (total_read < dest.size()) {
+		const std::size_t remaining = dest.size() - total_read;
 		const std::size_t chunk = std::min<std::size_t>(
 			remaining,
 			static_cast<std::size_t>(std::numeric_limits<ssize_t>::max()));
-		const ssize_t rc = ::read(fd, vec.data() + prefix_size + total_read, chunk);
+		const ssize_t rc = ::read(fd, dest.data() + total_read, chunk);
 		if (rc < 0) {
 			if (errno == EINTR) {
 				continue;
@@ -188,108 +201,713 @@ void readFileContents(int fd, const fs::path& path, vBytes& vec, std::size_t fil
 	}
 }
 
-void validateWrappedArchiveSignature(const vBytes& vec, bool wrap_archive) {
-	if (wrap_archive && !hasLe32Signature(vec, 8, ZIP_LOCAL_FILE_HEADER_SIGNATURE)) {
+struct CheckedInput {
+	ScopedFd handle;
+	std::size_t size;
+};
+
+// Open the file first, then validate via fstat on the resulting fd. This
+// avoids a TOCTOU race where a stat-then-open pair could observe a different
+// file than the one ultimately read.
+[[nodiscard]] CheckedInput openCheckedInput(const fs::path& path, FileTypeCheck check_type) {
+	if (!hasValidFilename(path)) {
+		throw std::runtime_error("Invalid Input Error: Filename contains unsupported control characters.");
+	}
+
+	ScopedFd handle = openFileForReadOrThrow(path);
+	const std::size_t file_size = fdFileSizeChecked(handle.get(), path);
+	validateTypeSpecificConstraints(path, file_size, check_type);
+	return CheckedInput{
+		.handle = std::move(handle),
+		.size = file_size
+	};
+}
+
+void validateArchiveSignature(std::span<const Byte> archive) {
+	if (!hasLe32Signature(archive, 0, ZIP_LOCAL_FILE_HEADER_SIGNATURE)) {
 		throw std::runtime_error("Archive File Error: Signature check failure. Not a valid archive file.");
 	}
 }
 
+// Gather-write a run of in-memory segments with writev, so the output is
+// emitted straight from the segment buffers without first being joined into
+// one contiguous image.
+[[nodiscard]] bool writeMemorySegments(int fd, std::span<const OutputSegment> segments) {
+	std::vector<iovec> iov;
+	iov.reserve(segments.size());
+	for (const auto& segment : segments) {
+		if (!segment.bytes.empty()) {
+			iov.push_back(iovec{
+				.iov_base = const_cast<Byte*>(segment.bytes.data()),
+				.iov_len  = segment.bytes.size()
+			});
+		}
+	}
+
+	const auto max_iov = static_cast<std::size_t>(IOV_MAX);
+	std::size_t next = 0;
+	while (next < iov.size()) {
+		const std::size_t count = std::min(iov.size() - next, max_iov);
+		const ssize_t rc = ::writev(fd, iov.data() + next, static_cast<int>(count));
+		if (rc < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		if (rc == 0) {
+			return false;
+		}
+
+		// Advance past fully written vectors, then trim a partially written one.
+		auto written = static_cast<std::size_t>(rc);
+		while (next < iov.size() && written >= iov[next].iov_len) {
+			written -= iov[next].iov_len;
+			++next;
+		}
+		if (written != 0) {
+			iov[next].iov_base = static_cast<Byte*>(iov[next].iov_base) + written;
+			iov[next].iov_len -= written;
+		}
+	}
+	return true;
+}
+
+// Errors meaning "this copy mechanism cannot serve this pair of files", as
+// opposed to a genuine I/O failure; the caller then tries the next mechanism.
+// Before a mechanism has copied anything, EINVAL, EBADF, ETXTBSY and ESPIPE
+// mean the same: they are how copy_file_range and sendfile refuse a pipe, an
+// append-only output or a source on a filesystem that cannot be copied from.
+// Part-way through a copy they are real failures.
+[[nodiscard]] bool isCopyUnsupported(int error, bool started) {
+	if (error == ENOSYS || error == EXDEV || error == EOPNOTSUPP) {
+		return true;
+	}
+	return !started && (error == EINVAL || error == EBADF || error == ETXTBSY || error == ESPIPE);
+}
+
+enum class KernelCopyResult { complete, unsupported, failed };
+
+// Copy a file-backed segment from its source descriptor to the output's
+// current position entirely inside the kernel: copy_file_range first (which
+// may share extents on reflink-capable filesystems), then sendfile. Returns
+// unsupported, with `copied` set to the bytes already written, when neither
+// mechanism can serve the files, so the rest can be written from memory.
+[[nodiscard]] KernelCopyResult copySegmentInKernel(int out_fd, const OutputSegment& segment, std::size_t& copied) {
+	constexpr std::size_t MAX_KERNEL_COPY_CHUNK = 1U << 30;
+	const std::size_t length = segment.bytes.size();
+
+	copied = 0;
+	bool use_copy_file_range = true;
+	std::size_t mechanism_start = 0;   // bytes copied before the current mechanism
+	while (copied < length) {
+		const std::size_t chunk = std::min(length - copied, MAX_KERNEL_COPY_CHUNK);
+		auto in_offset = static_cast<off_t>(segment.source_offset + copied);
+		const ssize_t rc = use_copy_file_range
+			? ::copy_file_range(segment.source_fd, &in_offset, out_fd, nullptr, chunk, 0)
+			: ::sendfile(out_fd, segment.source_fd, &in_offset, chunk);
+		if (rc < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (!isCopyUnsupported(errno, copied != mechanism_start)) {
+				return KernelCopyResult::failed;
+			}
+			if (!use_copy_file_range) {
+				return KernelCopyResult::unsupported;
+			}
+			use_copy_file_range = false;
+			mechanism_start = copied;
+			continue;
+		}
+		if (rc == 0) {
+			// The source is shorter than its mapping claimed (truncated
+			// underneath us); never pad the output with missing bytes.
+			return KernelCopyResult::failed;
+		}
+		copied += static_cast<std::size_t>(rc);
+	}
+	return KernelCopyResult::complete;
+}
+
+// A kernel copy reads the archive file as it is now, not as it was mapped and
+// validated, and a private mapping still shows later changes to pages it has
+// not copied. Read the written range back from the output (still in the page
+// cache) and check it against the CRC validation computed, so an archive
+// changed in between cannot leave unvalidated bytes behind a stale IDAT CRC.
+[[nodiscard]] bool writtenRangeMatches(int fd, off_t start, std::size_t length, uint32_t expected_crc) {
+	constexpr std::size_t READ_BACK_CHUNK = 1U << 20;
+
+	vBytes buffer(std::min(length, READ_BACK_CHUNK));
+	Crc32 crc;
+	std::size_t checked = 0;
+	while (checked < length) {
+		const ssize_t rc = ::pread(fd, buffer.data(), std::min(buffer.size(), length - checked),
+			start + static_cast<off_t>(checked));
+		if (rc < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		if (rc == 0) {
+			return false;
+		}
+		crc.update(std::span<const Byte>(buffer).first(static_cast<std::size_t>(rc)));
+		checked += static_cast<std::size_t>(rc);
+	}
+	return crc.value() == expected_crc;
+}
+
+enum class WriteResult { complete, failed, source_changed };
+
+// Write all segments in order. Runs of in-memory segments are gathered into
+// writev calls; file-backed segments (the unchanged archive region) are copied
+// kernel-side, so only the small patched pieces pass through user space.
+[[nodiscard]] WriteResult writeSegments(int fd, std::span<const OutputSegment> segments) {
+	std::size_t run_start = 0;
+	for (std::size_t i = 0; i <= segments.size(); ++i) {
+		const bool file_backed = i < segments.size() && segments[i].source_fd >= 0 && !segments[i].bytes.empty();
+		if (i < segments.size() && !file_backed) {
+			continue;
+		}
+		if (!writeMemorySegments(fd, segments.subspan(run_start, i - run_start))) {
+			return WriteResult::failed;
+		}
+		run_start = i + 1;
+		if (!file_backed) {
+			continue;
+		}
+
+		const off_t segment_start = ::lseek(fd, 0, SEEK_CUR);
+		if (segment_start < 0) {
+			return WriteResult::failed;
+		}
+		std::size_t copied = 0;
+		switch (copySegmentInKernel(fd, segments[i], copied)) {
+			case KernelCopyResult::complete:
+				break;
+			case KernelCopyResult::failed:
+				return WriteResult::failed;
+			case KernelCopyResult::unsupported: {
+				const OutputSegment remainder{ .bytes = segments[i].bytes.subspan(copied) };
+				if (!writeMemorySegments(fd, std::span(&remainder, 1))) {
+					return WriteResult::failed;
+				}
+				break;
+			}
+		}
+		if (!writtenRangeMatches(fd, segment_start, segments[i].bytes.size(), segments[i].source_crc)) {
+			return WriteResult::source_changed;
+		}
+	}
+	return WriteResult::complete;
+}
+
+constexpr mode_t OUTPUT_FILE_MODE = 0755;
+
+// O_TMPFILE needs both kernel and filesystem support; these are the errors
+// that report its absence rather than a problem with the directory itself.
+[[nodiscard]] bool isTmpfileUnsupported(int error) {
+	return error == EOPNOTSUPP || error == EISDIR || error == EINVAL || error == ENOENT;
+}
+
+// Give an O_TMPFILE descriptor its final name. linkat fails with EEXIST rather
+// than replacing an existing file, so the name claim is atomic. The /proc link
+// works unprivileged; AT_EMPTY_PATH covers systems without /proc mounted.
+[[nodiscard]] bool linkAnonymousFile(int fd, const std::string& filename) {
+	const std::string proc_path = std::format("/proc/self/fd/{}", fd);
+	if (::linkat(AT_FDCWD, proc_path.c_str(), AT_FDCWD, filename.c_str(), AT_SYMLINK_FOLLOW) == 0) {
+		return true;
+	}
+	if (errno != ENOENT) {
+		return false;
+	}
+	return ::linkat(fd, "", AT_FDCWD, filename.c_str(), AT_EMPTY_PATH) == 0;
+}
+
 } // anonymous namespace
 
 vBytes readFile(const fs::path& path, FileTypeCheck check_type) {
-	if (!hasValidFilename(path)) {
-		throw std::runtime_error("Invalid Input Error: Filename contains unsupported control characters.");
+	const CheckedInput input = openCheckedInput(path, check_type);
+
+	vBytes vec(input.size);
+	readFileContents(input.handle.get(), path, vec);
+	if (check_type == FileTypeCheck::archive_file) {
+		validateArchiveSignature(vec);
 	}
 
-	// Open the file first, then validate via fstat on the resulting fd. This
-	// avoids a TOCTOU race where a stat-then-open pair could observe a
-	// different file than the one ultimately read.
-	const ScopedFd handle = openFileForReadOrThrow(path);
-	const std::size_t file_size = fdFileSizeChecked(handle.get(), path);
-	validateTypeSpecificConstraints(path, file_size, check_type);
+	return vec;
+}
 
-	const bool wrap_archive = (check_type == FileTypeCheck::archive_file);
-	vBytes vec = makeReadBuffer(file_size, wrap_archive);
-	readFileContents(handle.get(), path, vec, file_size, wrap_archive);
-	validateWrappedArchiveSignature(vec, wrap_archive);
+vBytes readFolderFile(const fs::path& path) {
+	const ScopedFd handle = openFileForReadOrThrow(path);
+	struct stat st{};
+	if (::fstat(handle.get(), &st) != 0) {
+		const std::error_code ec(errno, std::generic_category());
+		throw std::runtime_error(std::format(
+			"Error: Failed to stat \"{}\": {}", path.string(), ec.message()));
+	}
+	if (!S_ISREG(st.st_mode) || st.st_size < 0) {
+		throw std::runtime_error(std::format(
+			"Error: File \"{}\" not found or not a regular file.", path.string()));
+	}
 
+	vBytes vec(static_cast<std::size_t>(st.st_size));
+	readFileContents(handle.get(), path, vec);
 	return vec;
 }
 
-void writePolyglotFile(const vBytes& image_vec, bool is_zip_file) {
-	if (image_vec.size() > static_cast<std::size_t>(std::numeric_limits<std::streamsize>::max())) {
-		throw std::runtime_error("Write File Error: Output exceeds maximum writable size.");
+MappedFile::MappedFile(int fd, const Byte* data, std::size_t size) noexcept
+	: fd_(fd), data_(data), size_(size) {}
+
+MappedFile::~MappedFile() {
+	release();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+	: fd_(std::exchange(other.fd_, -1)),
+	  data_(std::exchange(other.data_, nullptr)),
+	  size_(std::exchange(other.size_, 0)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+	if (this != &other) {
+		release();
+		fd_ = std::exchange(other.fd_, -1);
+		data_ = std::exchange(other.data_, nullptr);
+		size_ = std::exchange(other.size_, 0);
+	}
+	return *this;
+}
+
+void MappedFile::release() noexcept {
+	if (data_ != nullptr) {
+		::munmap(const_cast<Byte*>(data_), size_);
+		data_ = nullptr;
+	}
+	if (fd_ >= 0) {
+		::close(fd_);
+		fd_ = -1;
+	}
+	size_ = 0;
+}
+
+namespace {
+
+// Map an opened, size-checked archive. With kernel_readahead the whole file is
+// handed to the kernel's WILLNEED readahead; otherwise the caller populates the
+// mapping itself.
+[[nodiscard]] MappedFile mapCheckedArchive(CheckedInput input, const fs::path& path, bool kernel_readahead) {
+	// MAP_PRIVATE keeps the view read-only from our side; the pages stay in the
+	// page cache rather than being copied into anonymous memory.
+	void* addr = ::mmap(nullptr, input.size, PROT_READ, MAP_PRIVATE, input.handle.get(), 0);
+	if (addr == MAP_FAILED) {
+		const std::error_code ec(errno, std::generic_category());
+		throw std::runtime_error(std::format(
+			"Failed to map file: {} ({})", path.string(), ec.message()));
+	}
+	MappedFile mapping(input.handle.release(), static_cast<const Byte*>(addr), input.size);
+
+	// Validation walks local entries front to back, then assembly streams the
+	// same bytes out once more. Both hints are advisory; failure is harmless.
+	(void)::madvise(addr, input.size, MADV_SEQUENTIAL);
+	if (kernel_readahead) {
+		(void)::madvise(addr, input.size, MADV_WILLNEED);
+	}
+
+	validateArchiveSignature(mapping.bytes());
+	return mapping;
+}
+
+} // anonymous namespace
+
+MappedFile mapArchiveFile(const fs::path& path) {
+	return mapCheckedArchive(openCheckedInput(path, FileTypeCheck::archive_file), path, true);
+}
+
+// ============================================================================
+// Concurrent input loading
+// ============================================================================
+
+void ArchiveLoadProgress::beginLoading(std::size_t archive_size, std::size_t window_size) {
+	const std::lock_guard lock(mutex_);
+	archive_size_ = archive_size;
+	window_size_ = window_size;
+	loaded_.assign((archive_size + window_size - 1) / window_size, false);
+	loaded_prefix_.store(0, std::memory_order_release);
+}
+
+void ArchiveLoadProgress::markLoaded(std::size_t window_index) {
+	{
+		const std::lock_guard lock(mutex_);
+		loaded_[window_index] = true;
+		std::size_t first_missing = loaded_prefix_.load(std::memory_order_relaxed) / window_size_;
+		while (first_missing < loaded_.size() && loaded_[first_missing]) {
+			++first_missing;
+		}
+		loaded_prefix_.store(first_missing == loaded_.size() ? SIZE_MAX : first_missing * window_size_,
+			std::memory_order_release);
+	}
+	loaded_cv_.notify_all();
+}
+
+void ArchiveLoadProgress::markAllLoaded() {
+	{
+		const std::lock_guard lock(mutex_);
+		loaded_.assign(loaded_.size(), true);
+		loaded_prefix_.store(SIZE_MAX, std::memory_order_release);
+	}
+	loaded_cv_.notify_all();
+}
+
+void ArchiveLoadProgress::markFailed(std::string reason) {
+	{
+		const std::lock_guard lock(mutex_);
+		failure_ = std::move(reason);
+	}
+	loaded_cv_.notify_all();
+}
+
+void ArchiveLoadProgress::waitFor(std::size_t begin, std::size_t end) const {
+	if (end <= loaded_prefix_.load(std::memory_order_acquire)) {
+		return;
+	}
+	std::unique_lock lock(mutex_);
+	end = std::min(end, archive_size_);
+	if (begin >= end) {
+		return;
+	}
+	const auto first = static_cast<std::ptrdiff_t>(begin / window_size_);
+	const auto last = static_cast<std::ptrdiff_t>((end - 1) / window_size_);
+	const auto allLoaded = [&] {
+		return std::all_of(loaded_.begin() + first, loaded_.begin() + last + 1, std::identity{});
+	};
+	loaded_cv_.wait(lock, [&] { return failure_ || allLoaded(); });
+	if (!allLoaded()) {
+		throw std::runtime_error(*failure_);
+	}
+}
+
+namespace {
+
+constexpr std::uint64_t
+	COVER_READ_TAG     = 0,
+	ARCHIVE_WINDOW_TAG = 1;   // plus the window index
+
+// The archive is split into at most MAX_PREFETCH_WINDOWS windows and streamed
+// with up to MAX_WINDOWS_IN_FLIGHT of them queued at once: enough for io-wq
+// to keep a fast device busy, few enough that spinning or network storage
+// still sees a front-to-back read.
+constexpr std::size_t
+	MAX_PREFETCH_WINDOWS  = 64,
+	MAX_WINDOWS_IN_FLIGHT = 4,
+	MIN_PREFETCH_WINDOW   = 8 * 1024 * 1024;
+
+[[nodiscard]] std::size_t prefetchWindowSize(std::size_t archive_size) {
+	const auto page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+	const std::size_t even_split = (archive_size + MAX_PREFETCH_WINDOWS - 1) / MAX_PREFETCH_WINDOWS;
+	const std::size_t window = std::max(MIN_PREFETCH_WINDOW, even_split);
+	return (window + page_size - 1) / page_size * page_size;
+}
+
+// MADV_POPULATE_READ results meaning the bytes themselves are bad (past a
+// truncated end, an I/O error, poisoned memory), where touching the mapping
+// would raise SIGBUS. Other failures only mean the window was not prefetched.
+[[nodiscard]] bool isUnreadableWindow(std::int32_t result) noexcept {
+	return result == -EFAULT || result == -EIO || result == -EHWPOISON;
+}
+
+} // anonymous namespace
+
+struct InputLoader::Prefetch {
+	io_ring_internal::IoRing ring;
+	ScopedFd cover_fd;
+	fs::path cover_path;
+
+	// Published by whichever thread reaps the cover read. A missing result
+	// means the ring failed and nothing is in flight.
+	std::mutex cover_mutex;
+	std::condition_variable cover_cv;
+	bool cover_pending = true;
+	std::optional<std::int32_t> cover_result;
+
+	std::jthread loader;   // last: joined before the ring and buffers go away
+
+	Prefetch(io_ring_internal::IoRing&& io_ring, ScopedFd&& cover, fs::path path)
+		: ring(std::move(io_ring)), cover_fd(std::move(cover)), cover_path(std::move(path)) {}
+
+	// The kernel may still be writing into the cover buffer or populating the
+	// mapping; never let either be released under an in-flight request. A
+	// running loader drains both before it exits.
+	~Prefetch() {
+		if (loader.joinable()) {
+			loader.request_stop();
+			loader.join();
+			return;
+		}
+		while (cover_pending) {
+			const auto completion = ring.waitCompletion();
+			if (!completion || completion->user_data == COVER_READ_TAG) {
+				cover_pending = false;
+			}
+		}
+	}
+
+	Prefetch(const Prefetch&) = delete;
+	Prefetch& operator=(const Prefetch&) = delete;
+
+	void settleCover(std::optional<std::int32_t> result) {
+		{
+			const std::lock_guard lock(cover_mutex);
+			cover_pending = false;
+			cover_result = result;
+		}
+		cover_cv.notify_all();
+	}
+
+	[[nodiscard]] std::optional<std::int32_t> waitForCover() {
+		std::unique_lock lock(cover_mutex);
+		cover_cv.wait(lock, [this] { return !cover_pending; });
+		return cover_result;
+	}
+
+	// Populate the central directory's window first, then the rest in file
+	// order, reaping the cover read along the way. Once stop is requested no
+	// new windows are queued. Anything not populated by the end (ring failure,
+	// a kernel without MADV_POPULATE_READ) is left to kernel readahead, unless
+	// a window proved unreadable: then loading is marked failed, so readers
+	// get an error rather than a SIGBUS.
+	void streamArchive(std::stop_token stop, std::span<const Byte> archive, std::size_t window,
+	                   const fs::path& archive_path, ArchiveLoadProgress& progress) {
+		const std::size_t window_count = (archive.size() + window - 1) / window;
+		std::size_t next = 0;
+		std::size_t in_flight = 0;
+		bool cover_outstanding = true;
+		bool degraded = false;
+		bool failed = false;
+
+		auto queueNext = [&] {
+			const std::size_t index = next == 0 ? window_count - 1 : next - 1;
+			const std::size_t begin = index * window;
+			const std::size_t length = std::min(window, archive.size() - begin);
+			if (!ring.queueMadvise(archive.data() + begin, static_cast<std::uint32_t>(length),
+					MADV_POPULATE_READ, ARCHIVE_WINDOW_TAG + index)) {
+				return false;
+			}
+			++next;
+			++in_flight;
+			return true;
+		};
+		while (next < window_count && in_flight < MAX_WINDOWS_IN_FLIGHT && queueNext()) {
+		}
+
+		while (cover_outstanding || in_flight > 0) {
+			const auto completion = ring.waitCompletion();
+			if (!completion) {
+				degraded = true;
+				break;
+			}
+			if (completion->user_data == COVER_READ_TAG) {
+				settleCover(completion->result);
+				cover_outstanding = false;
+				continue;
+			}
+			--in_flight;
+			if (isUnreadableWindow(completion->result)) {
+				if (!failed) {
+					const std::error_code ec(-completion->result, std::generic_category());
+					progress.markFailed(std::format(
+						"Failed to read file: {} ({})", archive_path.string(), ec.message()));
+				}
+				failed = true;
+			}
+			else {
+				progress.markLoaded(static_cast<std::size_t>(completion->user_data - ARCHIVE_WINDOW_TAG));
+			}
+			degraded = degraded || completion->result < 0;
+			if (!degraded && !stop.stop_requested() && next < window_count) {
+				degraded = !queueNext();
+			}
+		}
+
+		if (cover_outstanding) {
+			settleCover(std::nullopt);
+		}
+		if (!failed && (next < window_count || degraded)) {
+			progress.markAllLoaded();
+			(void)::madvise(const_cast<Byte*>(archive.data()), archive.size(), MADV_WILLNEED);
+		}
+	}
+};
+
+InputLoader::InputLoader(const fs::path& image_path, const fs::path& archive_path) {
+	CheckedInput cover = openCheckedInput(image_path, FileTypeCheck::cover_image);
+	CheckedInput archive = openCheckedInput(archive_path, FileTypeCheck::archive_file);
+	cover_.resize(cover.size);
+
+	const std::size_t window = prefetchWindowSize(archive.size);
+	const std::size_t window_count = (archive.size + window - 1) / window;
+	auto ring = io_ring_internal::IoRing::create(
+		static_cast<unsigned>(std::min(window_count, MAX_WINDOWS_IN_FLIGHT) + 1));
+
+	if (!ring || !ring->queueRead(cover.handle.get(), cover_.data(),
+			static_cast<std::uint32_t>(cover.size), 0, COVER_READ_TAG)) {
+		readFileContents(cover.handle.get(), image_path, cover_);
+		archive_ = mapCheckedArchive(std::move(archive), archive_path, true);
+		return;
+	}
+	prefetch_ = std::make_unique<Prefetch>(std::move(*ring), std::move(cover.handle), image_path);
+
+	archive_ = mapCheckedArchive(std::move(archive), archive_path, false);
+	archive_progress_.beginLoading(archive_.bytes().size(), window);
+	prefetch_->loader = std::jthread([prefetch = prefetch_.get(), bytes = archive_.bytes(), window,
+			archive_path, progress = &archive_progress_](std::stop_token stop) {
+		prefetch->streamArchive(stop, bytes, window, archive_path, *progress);
+	});
+}
+
+InputLoader::~InputLoader() = default;
+
+vBytes InputLoader::takeCoverImage() {
+	if (prefetch_) {
+		const std::optional<std::int32_t> result = prefetch_->waitForCover();
+
+		// A ring failure leaves nothing in flight; read whatever is missing
+		// through the ordinary path, resuming after any bytes already read.
+		const std::size_t already_read = result && *result > 0
+			? static_cast<std::size_t>(*result) : 0;
+		if (result && *result < 0) {
+			const std::error_code ec(-*result, std::generic_category());
+			throw std::runtime_error(std::format(
+				"Failed to read file: {} ({})", prefetch_->cover_path.string(), ec.message()));
+		}
+		if (already_read < cover_.size()) {
+			const int fd = prefetch_->cover_fd.get();
+			if (::lseek(fd, static_cast<off_t>(already_read), SEEK_SET) < 0) {
+				throw std::runtime_error("Failed to read full file: partial read");
+			}
+			readFileContents(fd, prefetch_->cover_path, std::span<Byte>(cover_).subspan(already_read));
+		}
+	}
+	return std::move(cover_);
+}
+
+fs::path writePolyglotFile(std::span<const OutputSegment> segments, bool is_zip_file,
+                           const std::optional<fs::path>& output_path) {
+	// Refuse an output too large to describe before creating anything.
+	std::size_t output_size = 0;
+	for (const auto& segment : segments) {
+		output_size = checkedAdd(output_size, segment.bytes.size(), "Write File Error: Output exceeds maximum writable size.");
 	}
 
 	std::random_device rd;
 	std::mt19937 gen(rd());
 	std::uniform_int_distribution<> dist(10000, 99999);
 
+	// A caller-chosen output name gets exactly one attempt and must not
+	// already exist; otherwise pick random names in the current directory.
 	const std::string_view prefix = is_zip_file ? "pzip_" : "pjar_";
-
-	constexpr std::size_t MAX_NAME_ATTEMPTS = 256;
+	auto nextFilename = [&] {
+		return output_path ? output_path->string() : std::format("{}{}.png", prefix, dist(gen));
+	};
+	const std::size_t max_name_attempts = output_path ? 1 : 256;
+	const std::string name_error = output_path
+		? std::format("Write File Error: Output file already exists or cannot be created: {}", output_path->string())
+		: std::string("Write File Error: Unable to create a unique output file.");
+
+	fs::path output_dir = output_path ? output_path->parent_path() : fs::path();
+	if (output_dir.empty()) {
+		output_dir = ".";
+	}
 	std::string filename;
-	std::ofstream ofs;
 
-	for (std::size_t i = 0; i < MAX_NAME_ATTEMPTS; ++i) {
-		filename = std::format("{}{}.png", prefix, dist(gen));
+	// Preferred path: write an anonymous O_TMPFILE in the output directory
+	// and only give it a name once it is complete and synced, so no reader
+	// ever sees a partial polyglot and a failed write leaves nothing behind.
+	// Read-write so kernel-copied ranges can be read back and checked.
+	ScopedFd output(::open(output_dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, OUTPUT_FILE_MODE));
+	const bool anonymous_output = output.get() >= 0;
+	if (!anonymous_output && !isTmpfileUnsupported(errno)) {
+		const std::error_code ec(errno, std::generic_category());
+		throw std::runtime_error(std::format(
+			"Write File Error: Unable to create output file ({}).", ec.message()));
+	}
 
-		// noreplace (C++23) atomically fails if the file already exists,
-		// eliminating the TOCTOU race between exists() and open().
-		ofs.open(filename, std::ios::binary | std::ios::out | std::ios::noreplace);
-		if (ofs) {
-			break;
-		}
-		ofs.clear();
+	// Fallback for filesystems without O_TMPFILE: claim a unique name up front.
+	for (std::size_t i = 0; !anonymous_output && i < max_name_attempts && output.get() < 0; ++i) {
+		filename = nextFilename();
+
+		// O_EXCL atomically fails if the file already exists, eliminating the
+		// TOCTOU race between exists() and open().
+		output.reset(::open(filename.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, OUTPUT_FILE_MODE));
 	}
 
-	if (!ofs) {
-		throw std::runtime_error("Write File Error: Unable to create a unique output file.");
+	if (output.get() < 0) {
+		throw std::runtime_error(name_error);
 	}
 
-	auto abandonOutputAndThrow = [&](const char* message) {
-		ofs.close();
-		ofs.clear();
-		std::error_code remove_ec;
-		fs::remove(filename, remove_ec);
+	auto abandonOutputAndThrow = [&](const std::string& message) {
+		output.reset(-1);
+		if (!anonymous_output) {
+			std::error_code remove_ec;
+			fs::remove(filename, remove_ec);
+		}
 		throw std::runtime_error(message);
 	};
 
-	ofs.write(reinterpret_cast<const char*>(image_vec.data()),
-		static_cast<std::streamsize>(image_vec.size()));
-	if (!ofs) {
-		abandonOutputAndThrow("Write File Error: Failed while writing output file.");
+	switch (writeSegments(output.get(), segments)) {
+		case WriteResult::complete:
+			break;
+		case WriteResult::failed:
+			abandonOutputAndThrow("Write File Error: Failed while writing output file.");
+			break;
+		case WriteResult::source_changed:
+			abandonOutputAndThrow("Write File Error: The archive file changed after it was validated.");
+			break;
 	}
-	ofs.close();
-	if (!ofs) {
+
+	// 0755 so ./pzip_….png is runnable. Documented in --info; multi-user hosts
+	// may tighten with chmod 700 after creation. Set on the descriptor so the
+	// mode is already final when the file becomes visible.
+	const bool permissions_set = ::fchmod(output.get(), OUTPUT_FILE_MODE) == 0;
+
+	// Sync the data (and the size metadata needed to read it back) on the very
+	// descriptor that wrote it, so the polyglot survives a power loss between
+	// here and the kernel's writeback.
+	if (::fdatasync(output.get()) != 0 && errno != EINVAL) {
 		abandonOutputAndThrow("Write File Error: Failed while finalizing output file.");
 	}
 
-	// Fsync the output to disk so the polyglot survives a power loss between
-	// here and the kernel's writeback. The fd is reopened just for the sync —
-	// std::ofstream doesn't expose its underlying descriptor portably.
-	{
-		ScopedFd sync_fd(::open(filename.c_str(), O_RDONLY | O_CLOEXEC));
-		if (sync_fd.get() >= 0) {
-			::fsync(sync_fd.get());
+	if (anonymous_output) {
+		for (std::size_t i = 0; i < max_name_attempts; ++i) {
+			std::string candidate = nextFilename();
+			if (linkAnonymousFile(output.get(), candidate)) {
+				filename = std::move(candidate);
+				break;
+			}
+			if (errno != EEXIST) {
+				abandonOutputAndThrow("Write File Error: Unable to link the completed output file.");
+			}
+		}
+		if (filename.empty()) {
+			abandonOutputAndThrow(name_error);
 		}
 	}
 
-	std::print("\nCreated {} polyglot image file: {} ({} bytes).\n\nComplete!\n\n",
-		is_zip_file ? "PNG-ZIP" : "PNG-JAR", filename, image_vec.size());
+	if (output.close() != 0) {
+		if (anonymous_output) {
+			// Already linked, so this is a committed file with a deferred error.
+			std::error_code remove_ec;
+			fs::remove(filename, remove_ec);
+		}
+		abandonOutputAndThrow("Write File Error: Failed while finalizing output file.");
+	}
 
-	// 0755 so ./pzip_….png is runnable. Documented in --info; multi-user hosts
-	// may tighten with chmod 700 after creation.
-	std::error_code ec;
-	fs::permissions(
-		filename,
-		fs::perms::owner_all | fs::perms::group_read | fs::perms::group_exec
-			| fs::perms::others_read | fs::perms::others_exec,
-		ec);
-	if (ec) {
+	if (!permissions_set) {
 		std::println(stderr,
 			"\nWarning: Could not set executable permissions for {}.\n"
 			"You may need to do this manually with: chmod +x \"{}\"",
 			filename, filename);
 	}
+	return filename;
 }
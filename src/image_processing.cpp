@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cstring>
 #include <format>
 #include <limits>
@@ -10,6 +11,8 @@
 #include <stdexcept>
 #include <utility>
 
+#include <zlib.h>
+
 using image_processing_internal::copyPalette;
 using image_processing_internal::resizeImage;
 using image_processing_internal::throwLodepngError;
@@ -18,6 +21,8 @@ namespace {
 
 constexpr std::size_t RGBA_COMPONENTS = image_processing_internal::RGBA_COMPONENTS;
 
+std::atomic<bool> cover_pixel_check_enabled{ false };
+
 [[nodiscard]] constexpr std::uint32_t pngChunkType(char a, char b, char c, char d) {
 	return (static_cast<std::uint32_t>(static_cast<Byte>(a)) << 24)
 		| (static_cast<std::uint32_t>(static_cast<Byte>(b)) << 16)
@@ -30,6 +35,35 @@ constexpr std::size_t RGBA_COMPONENTS = image_processing_internal::RGBA_COMPONEN
 		| (static_cast<std::uint32_t>(blue) << 8) | static_cast<std::uint32_t>(alpha);
 }
 
+constexpr std::uint32_t
+	IHDR_TYPE = pngChunkType('I', 'H', 'D', 'R'),
+	PLTE_TYPE = pngChunkType('P', 'L', 'T', 'E'),
+	TRNS_TYPE = pngChunkType('t', 'R', 'N', 'S'),
+	IDAT_TYPE = pngChunkType('I', 'D', 'A', 'T'),
+	IEND_TYPE = pngChunkType('I', 'E', 'N', 'D');
+
+constexpr std::size_t
+	PNG_SIGNATURE_SIZE = 8,
+	CHUNK_OVERHEAD     = 12,  // length(4) + name(4) + crc(4)
+	LENGTH_FIELD_SIZE  = 4,
+	TYPE_FIELD_SIZE    = 4,
+	CRC_FIELD_SIZE     = 4;
+
+// Data length of the chunk at read_pos, after checking that its header and
+// the whole chunk lie within png_data.
+[[nodiscard]] std::size_t checkedChunkLength(std::span<const Byte> png_data, std::size_t read_pos) {
+	if (CHUNK_OVERHEAD > png_data.size() - read_pos) {
+		throw std::runtime_error("PNG Error: Truncated chunk header.");
+	}
+	const std::size_t data_length = readValueAt(png_data, read_pos, LENGTH_FIELD_SIZE);
+	if (data_length > png_data.size() - read_pos - CHUNK_OVERHEAD) {
+		throw std::runtime_error(std::format(
+			"PNG Error: Chunk at offset 0x{:X} exceeds file size.",
+			read_pos));
+	}
+	return data_length;
+}
+
 struct PngIhdr {
 	std::size_t width;
 	std::size_t height;
@@ -265,20 +299,6 @@ void convertToPalette(
 // ============================================================================
 
 void stripAndCopyChunks(vBytes& image_file_vec, Byte color_type) {
-
-	constexpr std::uint32_t
-		IHDR_TYPE = pngChunkType('I', 'H', 'D', 'R'),
-		PLTE_TYPE = pngChunkType('P', 'L', 'T', 'E'),
-		TRNS_TYPE = pngChunkType('t', 'R', 'N', 'S'),
-		IDAT_TYPE = pngChunkType('I', 'D', 'A', 'T'),
-		IEND_TYPE = pngChunkType('I', 'E', 'N', 'D');
-
-	constexpr std::size_t
-		PNG_SIGNATURE_SIZE       = 8,
-		CHUNK_OVERHEAD           = 12,  // length(4) + name(4) + crc(4)
-		LENGTH_FIELD_SIZE        = 4,
-		TYPE_FIELD_SIZE          = 4;
-
 	// In-place memmove compaction: walk chunks once, shifting kept chunks toward
 	// the front. Avoids allocating a second image-sized buffer.
 	std::size_t read_pos = PNG_SIGNATURE_SIZE;
@@ -287,17 +307,7 @@ void stripAndCopyChunks(vBytes& image_file_vec, Byte color_type) {
 	bool saw_iend = false;
 
 	while (read_pos < image_file_vec.size()) {
-		if (CHUNK_OVERHEAD > image_file_vec.size() - read_pos) {
-			throw std::runtime_error("PNG Error: Truncated chunk header.");
-		}
-
-		const std::size_t data_length = readValueAt(image_file_vec, read_pos, LENGTH_FIELD_SIZE);
-		if (data_length > image_file_vec.size() - read_pos - CHUNK_OVERHEAD) {
-			throw std::runtime_error(std::format(
-				"PNG Error: Chunk at offset 0x{:X} exceeds file size.",
-				read_pos));
-		}
-
+		const std::size_t data_length = checkedChunkLength(image_file_vec, read_pos);
 		const std::size_t name_index = read_pos + LENGTH_FIELD_SIZE;
 		const std::uint32_t chunk_type = static_cast<std::uint32_t>(
 			readValueAt(image_file_vec, name_index, TYPE_FIELD_SIZE));
@@ -339,6 +349,168 @@ void stripAndCopyChunks(vBytes& image_file_vec, Byte color_type) {
 	image_file_vec.resize(write_pos);
 }
 
+// ============================================================================
+// Internal: Check an indexed cover without decoding its pixels
+// ============================================================================
+
+struct InflateEndGuard {
+	z_stream* stream;
+
+	~InflateEndGuard() {
+		(void)::inflateEnd(stream);
+	}
+};
+
+} // anonymous namespace
+
+namespace image_processing_internal {
+
+// An indexed cover is already in the form pdvzip embeds, and only its chunks
+// change, so its pixels are never decoded. This checks what decoding would
+// otherwise have caught outside the image data: the IHDR methods, every
+// chunk's CRC, a PLTE the bit depth can index ahead of the image data, the
+// zlib header that starts that data, and the IEND that ends the file.
+void validateIndexedPngChunks(std::span<const Byte> png_data) {
+	constexpr std::size_t
+		MIN_IHDR_SIZE       = 29,
+		BIT_DEPTH_INDEX     = 24,
+		COMPRESSION_INDEX   = 26,
+		FILTER_INDEX        = 27,
+		INTERLACE_INDEX     = 28,
+		RGB_COMPONENTS      = 3,
+		MAX_PALETTE_ENTRIES = 256;
+
+	if (png_data.size() < MIN_IHDR_SIZE) {
+		throw std::runtime_error("PNG Error: IHDR chunk is truncated.");
+	}
+	if (png_data[COMPRESSION_INDEX] != 0 || png_data[FILTER_INDEX] != 0 || png_data[INTERLACE_INDEX] > 1) {
+		throw std::runtime_error("PNG Error: Unsupported IHDR compression, filter or interlace method.");
+	}
+	const std::size_t max_entries = std::min<std::size_t>(
+		MAX_PALETTE_ENTRIES, std::size_t{1} << std::min<unsigned>(png_data[BIT_DEPTH_INDEX], 8));
+
+	std::size_t palette_entries = 0;
+	std::array<Byte, 2> zlib_header{};
+	std::size_t zlib_header_bytes = 0;
+	bool saw_idat = false;
+	bool saw_iend = false;
+	std::size_t read_pos = PNG_SIGNATURE_SIZE;
+	while (read_pos < png_data.size() && !saw_iend) {
+		const std::size_t data_length = checkedChunkLength(png_data, read_pos);
+		const std::size_t name_index = read_pos + LENGTH_FIELD_SIZE;
+		const std::size_t data_index = name_index + TYPE_FIELD_SIZE;
+		const std::size_t crc_index = data_index + data_length;
+		if (crc32Update(0, png_data.subspan(name_index, TYPE_FIELD_SIZE + data_length))
+			!= readValueAt(png_data, crc_index, CRC_FIELD_SIZE)) {
+			throw std::runtime_error(std::format(
+				"PNG Error: CRC mismatch in chunk at offset 0x{:X}.", read_pos));
+		}
+
+		const auto chunk_type = static_cast<std::uint32_t>(readValueAt(png_data, name_index, TYPE_FIELD_SIZE));
+		if (chunk_type == PLTE_TYPE) {
+			if (data_length == 0 || data_length % RGB_COMPONENTS != 0 || data_length / RGB_COMPONENTS > max_entries) {
+				throw std::runtime_error(std::format(
+					"PNG Error: PLTE chunk must hold 1 to {} entries.", max_entries));
+			}
+			palette_entries = data_length / RGB_COMPONENTS;
+		} else if (chunk_type == TRNS_TYPE) {
+			if (palette_entries == 0 || data_length > palette_entries) {
+				throw std::runtime_error("PNG Error: tRNS chunk does not match the palette.");
+			}
+		} else if (chunk_type == IDAT_TYPE) {
+			if (palette_entries == 0) {
+				throw std::runtime_error("PNG Error: Indexed image has no PLTE chunk before its image data.");
+			}
+			saw_idat = true;
+			// The header may itself be split across the first IDAT chunks.
+			for (std::size_t i = 0; i < data_length && zlib_header_bytes < zlib_header.size(); ++i) {
+				zlib_header[zlib_header_bytes++] = png_data[data_index + i];
+			}
+		} else if (chunk_type == IEND_TYPE) {
+			saw_iend = true;
+		}
+		read_pos = crc_index + CRC_FIELD_SIZE;
+	}
+
+	if (!saw_idat) {
+		throw std::runtime_error("PNG Error: No IDAT chunk found.");
+	}
+	if (!saw_iend) {
+		throw std::runtime_error("PNG Error: Missing IEND chunk.");
+	}
+	// Deflate with at most a 32 KiB window, no preset dictionary, and a
+	// header check that holds (RFC 1950).
+	const unsigned cmf = zlib_header[0];
+	const unsigned flg = zlib_header[1];
+	if (zlib_header_bytes < zlib_header.size() || (cmf & 0x0FU) != 8 || (cmf >> 4U) > 7
+		|| (flg & 0x20U) != 0 || ((cmf << 8U) | flg) % 31 != 0) {
+		throw std::runtime_error("PNG Error: Image data does not start with a valid zlib header.");
+	}
+}
+
+// Opt-in check of the pixel data the fast path leaves undecoded: inflate the
+// IDAT stream into a scratch buffer that is overwritten as it goes, and
+// require a complete zlib stream (Adler-32 included) of exactly the size the
+// IHDR implies. Nothing image-sized is allocated.
+void verifyIndexedPixelData(std::span<const Byte> png_data) {
+	constexpr std::size_t SCRATCH_SIZE = 64 * 1024;
+
+	const std::size_t expected_size = pngInflatedScanlineSize(png_data);
+
+	z_stream stream{};
+	if (::inflateInit(&stream) != Z_OK) {
+		throw std::runtime_error("PNG Error: Failed to initialize inflate for the image data check.");
+	}
+	const InflateEndGuard guard{&stream};
+
+	std::array<Byte, SCRATCH_SIZE> scratch;
+	std::size_t produced = 0;
+	int status = Z_OK;
+	for (std::size_t read_pos = PNG_SIGNATURE_SIZE; read_pos < png_data.size() && status != Z_STREAM_END;) {
+		const std::size_t data_length = checkedChunkLength(png_data, read_pos);
+		const auto chunk_type = static_cast<std::uint32_t>(
+			readValueAt(png_data, read_pos + LENGTH_FIELD_SIZE, TYPE_FIELD_SIZE));
+		if (chunk_type == IEND_TYPE) {
+			break;
+		}
+		if (chunk_type == IDAT_TYPE) {
+			// PNG chunk lengths are 31-bit, so each fits zlib's counters.
+			stream.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(
+				png_data.data() + read_pos + LENGTH_FIELD_SIZE + TYPE_FIELD_SIZE));
+			stream.avail_in = static_cast<uInt>(data_length);
+			// Keep going while input remains or a full scratch buffer may have
+			// left output pending; Z_BUF_ERROR means this chunk is used up.
+			do {
+				stream.next_out = reinterpret_cast<Bytef*>(scratch.data());
+				stream.avail_out = static_cast<uInt>(scratch.size());
+				status = ::inflate(&stream, Z_NO_FLUSH);
+				if (status == Z_BUF_ERROR) {
+					break;
+				}
+				if (status != Z_OK && status != Z_STREAM_END) {
+					throw std::runtime_error("PNG Error: Image data is corrupt.");
+				}
+				produced += scratch.size() - stream.avail_out;
+				if (produced > expected_size) {
+					throw std::runtime_error("PNG Error: Image data is larger than its dimensions allow.");
+				}
+			} while (status != Z_STREAM_END && (stream.avail_in != 0 || stream.avail_out == 0));
+		}
+		read_pos += CHUNK_OVERHEAD + data_length;
+	}
+
+	if (status != Z_STREAM_END) {
+		throw std::runtime_error("PNG Error: Image data is truncated.");
+	}
+	if (produced != expected_size) {
+		throw std::runtime_error("PNG Error: Image data is smaller than its dimensions require.");
+	}
+}
+
+}  // namespace image_processing_internal
+
+namespace {
+
 [[nodiscard]] bool canConvertToPalette(Byte input_color_type, const LodePNGColorStats& stats) {
 	return (input_color_type == TRUECOLOR_RGB || input_color_type == TRUECOLOR_RGBA)
 		&& (stats.numcolors < MIN_RGB_COLORS);
@@ -495,15 +667,9 @@ void validateFinalImageCompatibility(const PngIhdr& ihdr) {
 	throw std::runtime_error("Incompatible image. Aborting.");
 }
 
-} // anonymous namespace
-
-// ============================================================================
-// Public: Optimize image for polyglot embedding
-// ============================================================================
-
-void optimizeImage(vBytes& image_file_vec) {
-	validateInputPngForDecode(readPngIhdr(image_file_vec));
-
+// Decode a non-indexed cover and re-encode it as a palette image when its
+// colors allow, otherwise keep its own colour type and strip its chunks.
+void reduceTruecolorImage(vBytes& image_file_vec) {
 	lodepng::State state;
 	image_processing_internal::configurePngInflateLimit(state, image_file_vec);
 
@@ -527,6 +693,28 @@ void optimizeImage(vBytes& image_file_vec) {
 	} else {
 		stripAndCopyChunks(image_file_vec, input_color_type);
 	}
+}
+
+} // anonymous namespace
+
+// ============================================================================
+// Public: Optimize image for polyglot embedding
+// ============================================================================
+
+void optimizeImage(vBytes& image_file_vec) {
+	const PngIhdr input_ihdr = readPngIhdr(image_file_vec);
+	validateInputPngForDecode(input_ihdr);
+
+	if (input_ihdr.color_type == INDEXED_PLTE) {
+		// Already indexed, so only the chunks change; see validateIndexedPngChunks.
+		image_processing_internal::validateIndexedPngChunks(image_file_vec);
+		if (cover_pixel_check_enabled.load(std::memory_order_relaxed)) {
+			image_processing_internal::verifyIndexedPixelData(image_file_vec);
+		}
+		stripAndCopyChunks(image_file_vec, INDEXED_PLTE);
+	} else {
+		reduceTruecolorImage(image_file_vec);
+	}
 
 	// Problem metacharacters can appear in IHDR width/height bytes or the IHDR CRC
 	// and break the Linux extraction script. Compute safe dimensions analytically
@@ -536,3 +724,7 @@ void optimizeImage(vBytes& image_file_vec) {
 	ensureLinuxSafeIhdr(image_file_vec);
 	validateFinalImageCompatibility(readPngIhdr(image_file_vec));
 }
+
+void enableCoverPixelCheck() noexcept {
+	cover_pixel_check_enabled.store(true, std::memory_order_relaxed);
+}
@@ -145,4 +145,11 @@ inline void configurePngInflateLimit(lodepng::State& state, std::span<const Byte
 
 void resizeImage(vBytes& image_file_vec, unsigned new_width, unsigned new_height);
 
+// The fast path for indexed covers (image_processing.cpp). The first checks
+// chunk structure, CRCs and the palette without inflating anything; the
+// second, run for --verify-cover, streams the image data through zlib and
+// throws unless it is complete and exactly the size the IHDR implies.
+void validateIndexedPngChunks(std::span<const Byte> png_data);
+void verifyIndexedPixelData(std::span<const Byte> png_data);
+
 }  // namespace image_processing_internal
@@ -0,0 +1,690 @@
+#include "pdvzip.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+using BitBuffer = std::uint64_t;
+
+constexpr unsigned
+	LITLEN_TABLE_BITS   = 11,
+	DIST_TABLE_BITS     = 8,
+	PRECODE_TABLE_BITS  = 7,
+	MAX_CODEWORD_BITS   = 15,
+	NUM_LITLEN_SYMBOLS  = 288,
+	NUM_DIST_SYMBOLS    = 32,
+	NUM_PRECODE_SYMBOLS = 19,
+	MAX_MATCH_LENGTH    = 258,
+	MAX_PAIR_BITS       = 48;   // length code + extra + distance code + extra
+
+// Worst case for a main table plus one subtable per over-long prefix, each
+// prefix holding at least one symbol.
+constexpr std::size_t
+	LITLEN_TABLE_SIZE  = (1U << LITLEN_TABLE_BITS) + NUM_LITLEN_SYMBOLS * (1U << (MAX_CODEWORD_BITS - LITLEN_TABLE_BITS)),
+	DIST_TABLE_SIZE    = (1U << DIST_TABLE_BITS) + NUM_DIST_SYMBOLS * (1U << (MAX_CODEWORD_BITS - DIST_TABLE_BITS)),
+	PRECODE_TABLE_SIZE = 1U << PRECODE_TABLE_BITS;
+
+// The fast loop refills with one unaligned 8-byte load and may overwrite up
+// to 8 bytes past the end of a match, so it runs only while both buffers
+// have this much room; the careful loop finishes the stream.
+constexpr std::size_t
+	FAST_INPUT_MARGIN  = 16,
+	FAST_OUTPUT_MARGIN = MAX_MATCH_LENGTH + 16;
+
+// Reading past the input supplies zero bits. A valid stream never consumes
+// them, and a bit buffer's worth of them is all a valid stream can hold, so
+// this many is proof of truncation.
+constexpr std::size_t MAX_OVERREAD_BYTES = sizeof(BitBuffer) + 1;
+
+// Decode table entry:
+//   bits  0-3   codeword bits to consume (both codewords for a literal pair)
+//   bits  4-7   extra bits after the codeword, or a subtable's index bits
+//   bits  8-10  kind
+//   bits 16-31  value: literal(s), length/distance base, or subtable offset
+enum EntryKind : std::uint32_t {
+	KIND_LITERAL      = 0,
+	KIND_LITERAL_PAIR = 1,   // two literals decoded by one lookup
+	KIND_BASE         = 2,   // length or distance base plus extra bits
+	KIND_END_OF_BLOCK = 3,
+	KIND_SUBTABLE     = 4,
+	KIND_INVALID      = 5
+};
+
+[[nodiscard]] constexpr std::uint32_t makeEntry(std::uint32_t kind, std::uint32_t value,
+                                                std::uint32_t extra = 0, std::uint32_t bits = 0) noexcept {
+	return (value << 16U) | (kind << 8U) | (extra << 4U) | bits;
+}
+[[nodiscard]] constexpr unsigned entryBits(std::uint32_t entry) noexcept { return entry & 0xFU; }
+[[nodiscard]] constexpr unsigned entryExtra(std::uint32_t entry) noexcept { return (entry >> 4U) & 0xFU; }
+[[nodiscard]] constexpr std::uint32_t entryKind(std::uint32_t entry) noexcept { return (entry >> 8U) & 0x7U; }
+[[nodiscard]] constexpr std::uint32_t entryValue(std::uint32_t entry) noexcept { return entry >> 16U; }
+
+constexpr std::uint32_t INVALID_ENTRY = makeEntry(KIND_INVALID, 0);
+
+constexpr std::array<std::uint16_t, 29> LENGTH_BASE{
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+constexpr std::array<std::uint8_t, 29> LENGTH_EXTRA{
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+constexpr std::array<std::uint16_t, 30> DIST_BASE{
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+constexpr std::array<std::uint8_t, 30> DIST_EXTRA{
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+constexpr std::array<std::uint8_t, NUM_PRECODE_SYMBOLS> PRECODE_ORDER{
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+// What each symbol decodes to, before its codeword length is known.
+[[nodiscard]] constexpr std::array<std::uint32_t, NUM_LITLEN_SYMBOLS> makeLitlenSymbolEntries() {
+	std::array<std::uint32_t, NUM_LITLEN_SYMBOLS> entries{};
+	for (std::uint32_t symbol = 0; symbol < NUM_LITLEN_SYMBOLS; ++symbol) {
+		if (symbol < 256) {
+			entries[symbol] = makeEntry(KIND_LITERAL, symbol);
+		}
+		else if (symbol == 256) {
+			entries[symbol] = makeEntry(KIND_END_OF_BLOCK, 0);
+		}
+		else if (symbol - 257 < LENGTH_BASE.size()) {
+			entries[symbol] = makeEntry(KIND_BASE, LENGTH_BASE[symbol - 257], LENGTH_EXTRA[symbol - 257]);
+		}
+		else {
+			entries[symbol] = INVALID_ENTRY;
+		}
+	}
+	return entries;
+}
+
+[[nodiscard]] constexpr std::array<std::uint32_t, NUM_DIST_SYMBOLS> makeDistSymbolEntries() {
+	std::array<std::uint32_t, NUM_DIST_SYMBOLS> entries{};
+	for (std::uint32_t symbol = 0; symbol < NUM_DIST_SYMBOLS; ++symbol) {
+		entries[symbol] = symbol < DIST_BASE.size()
+			? makeEntry(KIND_BASE, DIST_BASE[symbol], DIST_EXTRA[symbol])
+			: INVALID_ENTRY;
+	}
+	return entries;
+}
+
+[[nodiscard]] constexpr std::array<std::uint32_t, NUM_PRECODE_SYMBOLS> makePrecodeSymbolEntries() {
+	std::array<std::uint32_t, NUM_PRECODE_SYMBOLS> entries{};
+	for (std::uint32_t symbol = 0; symbol < NUM_PRECODE_SYMBOLS; ++symbol) {
+		entries[symbol] = makeEntry(KIND_LITERAL, symbol);
+	}
+	return entries;
+}
+
+constexpr auto LITLEN_SYMBOL_ENTRIES = makeLitlenSymbolEntries();
+constexpr auto DIST_SYMBOL_ENTRIES = makeDistSymbolEntries();
+constexpr auto PRECODE_SYMBOL_ENTRIES = makePrecodeSymbolEntries();
+
+[[nodiscard]] constexpr std::uint32_t reverseBits(std::uint32_t code, unsigned length) noexcept {
+	std::uint32_t reversed = 0;
+	for (unsigned i = 0; i < length; ++i) {
+		reversed = (reversed << 1U) | ((code >> i) & 1U);
+	}
+	return reversed;
+}
+
+enum class CodeCompleteness { complete, allow_single_code };
+
+// Build a canonical Huffman decode table indexed by the next table_bits
+// input bits (DEFLATE codes are read LSB first, so codewords are stored
+// bit-reversed). Codes longer than table_bits continue in a subtable sized
+// for the longest code sharing its prefix. Returns false for an
+// over-subscribed code, or an incomplete one unless it is the single
+// one-bit code DEFLATE permits.
+[[nodiscard]] bool buildDecodeTable(std::uint32_t* table, unsigned table_bits,
+                                    const std::uint8_t* lengths, std::size_t num_symbols,
+                                    const std::uint32_t* symbol_entries,
+                                    CodeCompleteness completeness) noexcept {
+	std::array<unsigned, MAX_CODEWORD_BITS + 1> counts{};
+	for (std::size_t symbol = 0; symbol < num_symbols; ++symbol) {
+		++counts[lengths[symbol]];
+	}
+	counts[0] = 0;
+
+	int remaining = 1;
+	unsigned total_codes = 0;
+	for (unsigned length = 1; length <= MAX_CODEWORD_BITS; ++length) {
+		remaining = remaining * 2 - static_cast<int>(counts[length]);
+		if (remaining < 0) {
+			return false;
+		}
+		total_codes += counts[length];
+	}
+	const std::size_t main_size = std::size_t{1} << table_bits;
+	std::fill_n(table, main_size, INVALID_ENTRY);
+	if (total_codes == 0) {
+		return completeness == CodeCompleteness::allow_single_code;
+	}
+	if (remaining != 0
+		&& !(completeness == CodeCompleteness::allow_single_code && total_codes == 1 && counts[1] == 1)) {
+		return false;
+	}
+
+	std::array<std::uint32_t, MAX_CODEWORD_BITS + 1> next_code{};
+	std::uint32_t code = 0;
+	for (unsigned length = 1; length <= MAX_CODEWORD_BITS; ++length) {
+		code = (code + counts[length - 1]) << 1U;
+		next_code[length] = code;
+	}
+
+	std::array<std::uint16_t, NUM_LITLEN_SYMBOLS> reversed_codes{};
+	std::array<std::uint8_t, 1U << LITLEN_TABLE_BITS> longest_for_prefix{};
+	const std::uint32_t prefix_mask = static_cast<std::uint32_t>(main_size - 1);
+	for (std::size_t symbol = 0; symbol < num_symbols; ++symbol) {
+		const unsigned length = lengths[symbol];
+		if (length == 0) {
+			continue;
+		}
+		const std::uint32_t reversed = reverseBits(next_code[length]++, length);
+		reversed_codes[symbol] = static_cast<std::uint16_t>(reversed);
+		if (length <= table_bits) {
+			const std::uint32_t entry = symbol_entries[symbol] | length;
+			for (std::size_t i = reversed; i < main_size; i += std::size_t{1} << length) {
+				table[i] = entry;
+			}
+		}
+		else {
+			std::uint8_t& longest = longest_for_prefix[reversed & prefix_mask];
+			longest = static_cast<std::uint8_t>(std::max<unsigned>(longest, length));
+		}
+	}
+
+	std::size_t used = main_size;
+	for (std::size_t prefix = 0; prefix < main_size; ++prefix) {
+		if (longest_for_prefix[prefix] == 0) {
+			continue;
+		}
+		const unsigned subtable_bits = longest_for_prefix[prefix] - table_bits;
+		table[prefix] = makeEntry(KIND_SUBTABLE, static_cast<std::uint32_t>(used), subtable_bits, table_bits);
+		std::fill_n(table + used, std::size_t{1} << subtable_bits, INVALID_ENTRY);
+		used += std::size_t{1} << subtable_bits;
+	}
+	for (std::size_t symbol = 0; symbol < num_symbols; ++symbol) {
+		const unsigned length = lengths[symbol];
+		if (length <= table_bits) {
+			continue;
+		}
+		const std::uint32_t pointer = table[reversed_codes[symbol] & prefix_mask];
+		const std::size_t subtable_size = std::size_t{1} << entryExtra(pointer);
+		const unsigned sub_length = length - table_bits;
+		const std::uint32_t entry = symbol_entries[symbol] | sub_length;
+		for (std::size_t i = reversed_codes[symbol] >> table_bits; i < subtable_size; i += std::size_t{1} << sub_length) {
+			table[entryValue(pointer) + i] = entry;
+		}
+	}
+	return true;
+}
+
+// Merge literal runs into the main literal/length table: where a literal's
+// codeword leaves enough index bits to fully determine a second literal, the
+// entry yields both, so literal-heavy data needs half the lookups.
+void addLiteralPairs(std::uint32_t* table) noexcept {
+	constexpr std::size_t MAIN_SIZE = std::size_t{1} << LITLEN_TABLE_BITS;
+	std::array<std::uint32_t, MAIN_SIZE> single{};
+	std::memcpy(single.data(), table, sizeof(single));
+	for (std::size_t index = 0; index < MAIN_SIZE; ++index) {
+		const std::uint32_t first = single[index];
+		if (entryKind(first) != KIND_LITERAL) {
+			continue;
+		}
+		const unsigned first_bits = entryBits(first);
+		const std::uint32_t second = single[index >> first_bits];
+		if (entryKind(second) != KIND_LITERAL || entryBits(second) > LITLEN_TABLE_BITS - first_bits) {
+			continue;
+		}
+		table[index] = makeEntry(
+			KIND_LITERAL_PAIR,
+			entryValue(first) | (entryValue(second) << 8U),
+			0,
+			first_bits + entryBits(second));
+	}
+}
+
+struct HuffmanTables {
+	std::array<std::uint32_t, LITLEN_TABLE_SIZE> litlen;
+	std::array<std::uint32_t, DIST_TABLE_SIZE> dist;
+};
+
+[[nodiscard]] HuffmanTables makeFixedTables() noexcept {
+	HuffmanTables tables{};
+	std::array<std::uint8_t, NUM_LITLEN_SYMBOLS> litlen_lengths{};
+	std::fill_n(litlen_lengths.begin(), 144, std::uint8_t{8});
+	std::fill_n(litlen_lengths.begin() + 144, 112, std::uint8_t{9});
+	std::fill_n(litlen_lengths.begin() + 256, 24, std::uint8_t{7});
+	std::fill_n(litlen_lengths.begin() + 280, 8, std::uint8_t{8});
+	std::array<std::uint8_t, NUM_DIST_SYMBOLS> dist_lengths{};
+	dist_lengths.fill(5);
+	(void)buildDecodeTable(tables.litlen.data(), LITLEN_TABLE_BITS, litlen_lengths.data(), NUM_LITLEN_SYMBOLS,
+	                       LITLEN_SYMBOL_ENTRIES.data(), CodeCompleteness::complete);
+	addLiteralPairs(tables.litlen.data());
+	(void)buildDecodeTable(tables.dist.data(), DIST_TABLE_BITS, dist_lengths.data(), NUM_DIST_SYMBOLS,
+	                       DIST_SYMBOL_ENTRIES.data(), CodeCompleteness::complete);
+	return tables;
+}
+
+[[nodiscard]] const HuffmanTables& fixedTables() noexcept {
+	static const HuffmanTables tables = makeFixedTables();
+	return tables;
+}
+
+[[nodiscard]] inline BitBuffer loadLe64(const Byte* data) noexcept {
+	BitBuffer value = 0;
+	std::memcpy(&value, data, sizeof(value));
+	if constexpr (std::endian::native == std::endian::big) {
+		value = std::byteswap(value);
+	}
+	return value;
+}
+
+[[nodiscard]] constexpr BitBuffer lowBits(BitBuffer value, unsigned count) noexcept {
+	return value & ((BitBuffer{1} << count) - 1);
+}
+
+class Inflater {
+public:
+	Inflater(std::span<const Byte> input, std::span<Byte> output) noexcept
+		: in_begin_(input.data()), in_next_(input.data()), in_end_(input.data() + input.size()),
+		  out_begin_(output.data()), out_next_(output.data()), out_end_(output.data() + output.size()) {}
+
+	[[nodiscard]] InflateResult run() noexcept {
+		const InflateStatus status = decodeStream();
+		const std::size_t produced = static_cast<std::size_t>(out_next_ - out_begin_);
+		if (status != InflateStatus::ok) {
+			return InflateResult{ .status = status, .consumed = 0, .produced = produced };
+		}
+		// Whole unconsumed bytes still in the bit buffer go back to the input.
+		const std::size_t read = static_cast<std::size_t>(in_next_ - in_begin_);
+		const std::size_t unread = bitsleft_ / 8 - overread_;
+		return InflateResult{ .status = status, .consumed = read - unread, .produced = produced };
+	}
+
+private:
+	// Byte-at-a-time refill for the ends of the input; bytes past the end
+	// read as zero and are counted.
+	void refillSlow() noexcept {
+		while (bitsleft_ <= sizeof(BitBuffer) * 8 - 8) {
+			if (in_next_ != in_end_) {
+				bitbuf_ |= BitBuffer{*in_next_++} << bitsleft_;
+			}
+			else {
+				++overread_;
+			}
+			bitsleft_ += 8;
+		}
+	}
+
+	[[nodiscard]] bool overranInput() const noexcept {
+		return overread_ * 8 > bitsleft_ || overread_ > MAX_OVERREAD_BYTES;
+	}
+
+	// Symbols decoded from padding past the input are not real output.
+	[[nodiscard]] InflateStatus outputFull() const noexcept {
+		return overranInput() ? InflateStatus::truncated : InflateStatus::output_full;
+	}
+
+	[[nodiscard]] std::uint32_t takeBits(unsigned count) noexcept {
+		const auto value = static_cast<std::uint32_t>(lowBits(bitbuf_, count));
+		bitbuf_ >>= count;
+		bitsleft_ -= count;
+		return value;
+	}
+
+	// Look up the entry for the next codeword and consume it; the buffer must
+	// hold at least MAX_CODEWORD_BITS bits.
+	[[nodiscard]] std::uint32_t decodeEntry(const std::uint32_t* table, unsigned table_bits) noexcept {
+		std::uint32_t entry = table[lowBits(bitbuf_, table_bits)];
+		if (entryKind(entry) == KIND_SUBTABLE) {
+			bitbuf_ >>= table_bits;
+			bitsleft_ -= table_bits;
+			entry = table[entryValue(entry) + lowBits(bitbuf_, entryExtra(entry))];
+		}
+		bitbuf_ >>= entryBits(entry);
+		bitsleft_ -= entryBits(entry);
+		return entry;
+	}
+
+	[[nodiscard]] InflateStatus decodeStream() noexcept {
+		bool final_block = false;
+		while (!final_block) {
+			refillSlow();
+			final_block = takeBits(1) != 0;
+			const std::uint32_t block_type = takeBits(2);
+			InflateStatus status = InflateStatus::ok;
+			if (block_type == 0) {
+				status = copyStoredBlock();
+			}
+			else if (block_type == 1) {
+				status = decodeHuffmanBlock(fixedTables());
+			}
+			else if (block_type == 2) {
+				status = readDynamicTables();
+				if (status == InflateStatus::ok) {
+					status = decodeHuffmanBlock(dynamic_tables_);
+				}
+			}
+			else {
+				status = InflateStatus::corrupt;
+			}
+			if (status != InflateStatus::ok) {
+				return status;
+			}
+		}
+		return overranInput() ? InflateStatus::truncated : InflateStatus::ok;
+	}
+
+	[[nodiscard]] InflateStatus copyStoredBlock() noexcept {
+		// Drop to the byte boundary and hand the buffered whole bytes back.
+		(void)takeBits(bitsleft_ & 7U);
+		if (overread_ > bitsleft_ / 8) {
+			return InflateStatus::truncated;
+		}
+		in_next_ -= bitsleft_ / 8 - overread_;
+		bitbuf_ = 0;
+		bitsleft_ = 0;
+		overread_ = 0;
+
+		if (in_end_ - in_next_ < 4) {
+			return InflateStatus::truncated;
+		}
+		const unsigned length = in_next_[0] | (in_next_[1] << 8U);
+		const unsigned complement = in_next_[2] | (in_next_[3] << 8U);
+		in_next_ += 4;
+		if (length != (~complement & 0xFFFFU)) {
+			return InflateStatus::corrupt;
+		}
+		if (static_cast<std::size_t>(in_end_ - in_next_) < length) {
+			return InflateStatus::truncated;
+		}
+		if (static_cast<std::size_t>(out_end_ - out_next_) < length) {
+			return InflateStatus::output_full;
+		}
+		std::memcpy(out_next_, in_next_, length);
+		in_next_ += length;
+		out_next_ += length;
+		return InflateStatus::ok;
+	}
+
+	[[nodiscard]] InflateStatus readDynamicTables() noexcept {
+		refillSlow();
+		const unsigned num_litlen = takeBits(5) + 257;
+		const unsigned num_dist = takeBits(5) + 1;
+		const unsigned num_precode = takeBits(4) + 4;
+		if (num_litlen > 286 || num_dist > 30) {
+			return InflateStatus::corrupt;
+		}
+
+		std::array<std::uint8_t, NUM_PRECODE_SYMBOLS> precode_lengths{};
+		for (unsigned i = 0; i < num_precode; ++i) {
+			if (bitsleft_ < 3) {
+				refillSlow();
+			}
+			precode_lengths[PRECODE_ORDER[i]] = static_cast<std::uint8_t>(takeBits(3));
+		}
+		std::array<std::uint32_t, PRECODE_TABLE_SIZE> precode_table{};
+		if (!buildDecodeTable(precode_table.data(), PRECODE_TABLE_BITS, precode_lengths.data(),
+		                      NUM_PRECODE_SYMBOLS, PRECODE_SYMBOL_ENTRIES.data(), CodeCompleteness::complete)) {
+			return InflateStatus::corrupt;
+		}
+
+		std::array<std::uint8_t, NUM_LITLEN_SYMBOLS + NUM_DIST_SYMBOLS> lengths{};
+		const unsigned total = num_litlen + num_dist;
+		for (unsigned i = 0; i < total;) {
+			// Precode (7) plus the longest repeat count (7).
+			if (bitsleft_ < 14) {
+				refillSlow();
+			}
+			const std::uint32_t entry = decodeEntry(precode_table.data(), PRECODE_TABLE_BITS);
+			if (entryKind(entry) != KIND_LITERAL) {
+				return InflateStatus::corrupt;
+			}
+			const std::uint32_t symbol = entryValue(entry);
+			if (symbol < 16) {
+				lengths[i++] = static_cast<std::uint8_t>(symbol);
+				continue;
+			}
+			std::uint8_t repeated = 0;
+			unsigned count = 0;
+			if (symbol == 16) {
+				if (i == 0) {
+					return InflateStatus::corrupt;
+				}
+				repeated = lengths[i - 1];
+				count = 3 + takeBits(2);
+			}
+			else if (symbol == 17) {
+				count = 3 + takeBits(3);
+			}
+			else {
+				count = 11 + takeBits(7);
+			}
+			if (count > total - i) {
+				return InflateStatus::corrupt;
+			}
+			std::fill_n(lengths.begin() + i, count, repeated);
+			i += count;
+		}
+		if (overranInput()) {
+			return InflateStatus::truncated;
+		}
+		if (lengths[256] == 0) {
+			return InflateStatus::corrupt;
+		}
+
+		std::array<std::uint8_t, NUM_DIST_SYMBOLS> dist_lengths{};
+		std::copy_n(lengths.begin() + num_litlen, num_dist, dist_lengths.begin());
+		std::fill(lengths.begin() + num_litlen, lengths.begin() + NUM_LITLEN_SYMBOLS, std::uint8_t{0});
+		if (!buildDecodeTable(dynamic_tables_.litlen.data(), LITLEN_TABLE_BITS, lengths.data(), NUM_LITLEN_SYMBOLS,
+		                      LITLEN_SYMBOL_ENTRIES.data(), CodeCompleteness::allow_single_code)
+			|| !buildDecodeTable(dynamic_tables_.dist.data(), DIST_TABLE_BITS, dist_lengths.data(), NUM_DIST_SYMBOLS,
+		                         DIST_SYMBOL_ENTRIES.data(), CodeCompleteness::allow_single_code)) {
+			return InflateStatus::corrupt;
+		}
+		addLiteralPairs(dynamic_tables_.litlen.data());
+		return InflateStatus::ok;
+	}
+
+	// Copy a match whose source lies inside the output, in whole words that may
+	// run up to 15 bytes past its end. Short distances repeat a pattern, so
+	// once one word of it exists, every later word can be read from a multiple
+	// of the distance back.
+	static void copyMatchFast(Byte* dst, std::size_t distance, std::size_t length) noexcept {
+		constexpr std::size_t WORD = sizeof(BitBuffer);
+		Byte* const end = dst + length;
+		if (distance >= 2 * WORD) {
+			const Byte* src = dst - distance;
+			do {
+				std::memcpy(dst, src, 2 * WORD);
+				dst += 2 * WORD;
+				src += 2 * WORD;
+			} while (dst < end);
+			return;
+		}
+		if (distance == 1) {
+			std::memset(dst, dst[-1], length);
+			return;
+		}
+		std::size_t stride = distance;
+		if (distance < WORD) {
+			const Byte* const src = dst - distance;
+			for (std::size_t i = 0; i < WORD; ++i) {
+				dst[i] = src[i];
+			}
+			dst += WORD;
+			stride = (WORD + distance - 1) / distance * distance;
+		}
+		while (dst < end) {
+			std::memcpy(dst, dst - stride, WORD);
+			dst += WORD;
+		}
+	}
+
+	[[nodiscard]] InflateStatus decodeHuffmanBlock(const HuffmanTables& tables) noexcept {
+		const std::uint32_t* const litlen = tables.litlen.data();
+		const std::uint32_t* const dist = tables.dist.data();
+
+		// Fast loop: a refill leaves at least 56 bits, enough for the longest
+		// length/distance pair (15 + 5 + 15 + 13 bits) without per-field
+		// checks, so literal runs only refill once that margin is gone. The
+		// state lives in locals because output stores could otherwise alias
+		// the members and force reloads after every byte.
+		BitBuffer bitbuf = bitbuf_;
+		unsigned bitsleft = bitsleft_;
+		const Byte* in_next = in_next_;
+		Byte* out_next = out_next_;
+		const auto consume = [&](unsigned count) noexcept {
+			bitbuf >>= count;
+			bitsleft -= count;
+		};
+		const auto decode = [&](const std::uint32_t* table, unsigned table_bits) noexcept {
+			std::uint32_t entry = table[lowBits(bitbuf, table_bits)];
+			if (entryKind(entry) == KIND_SUBTABLE) {
+				consume(table_bits);
+				entry = table[entryValue(entry) + lowBits(bitbuf, entryExtra(entry))];
+			}
+			consume(entryBits(entry));
+			return entry;
+		};
+		const auto extra = [&](std::uint32_t entry) noexcept {
+			const auto value = static_cast<std::uint32_t>(lowBits(bitbuf, entryExtra(entry)));
+			consume(entryExtra(entry));
+			return entryValue(entry) + value;
+		};
+		const auto save = [&] {
+			bitbuf_ = bitbuf;
+			bitsleft_ = bitsleft;
+			in_next_ = in_next;
+			out_next_ = out_next;
+		};
+
+		while (in_end_ - in_next >= static_cast<std::ptrdiff_t>(FAST_INPUT_MARGIN)
+			&& out_end_ - out_next >= static_cast<std::ptrdiff_t>(FAST_OUTPUT_MARGIN)) {
+			if (bitsleft < MAX_PAIR_BITS) {
+				// Top up to at least 56 bits with one unaligned load: the bytes
+				// whose bits did not fit are simply read again next time.
+				bitbuf |= loadLe64(in_next) << bitsleft;
+				in_next += sizeof(BitBuffer) - 1 - (bitsleft >> 3U);
+				bitsleft |= 56U;
+			}
+			const std::uint32_t entry = decode(litlen, LITLEN_TABLE_BITS);
+			const std::uint32_t kind = entryKind(entry);
+			if (kind <= KIND_LITERAL_PAIR) {
+				// Both bytes are always stored; a single literal only keeps one.
+				out_next[0] = static_cast<Byte>(entryValue(entry));
+				out_next[1] = static_cast<Byte>(entryValue(entry) >> 8U);
+				out_next += kind + 1;
+				continue;
+			}
+			if (kind != KIND_BASE) {
+				save();
+				return kind == KIND_END_OF_BLOCK ? InflateStatus::ok : InflateStatus::corrupt;
+			}
+			const std::size_t length = extra(entry);
+			const std::uint32_t dist_entry = decode(dist, DIST_TABLE_BITS);
+			const std::size_t distance = extra(dist_entry);
+			if (entryKind(dist_entry) != KIND_BASE
+				|| distance > static_cast<std::size_t>(out_next - out_begin_)) {
+				save();
+				return InflateStatus::corrupt;
+			}
+			copyMatchFast(out_next, distance, length);
+			out_next += length;
+		}
+		save();
+
+		// Careful loop for the last few bytes of input or output.
+		for (;;) {
+			refillSlow();
+			if (overread_ > MAX_OVERREAD_BYTES) {
+				return InflateStatus::truncated;
+			}
+			const std::uint32_t entry = decodeEntry(litlen, LITLEN_TABLE_BITS);
+			const std::uint32_t kind = entryKind(entry);
+			if (kind == KIND_LITERAL_PAIR || kind == KIND_LITERAL) {
+				const std::ptrdiff_t count = kind == KIND_LITERAL_PAIR ? 2 : 1;
+				if (out_end_ - out_next_ < count) {
+					return outputFull();
+				}
+				out_next_[0] = static_cast<Byte>(entryValue(entry));
+				if (count == 2) {
+					out_next_[1] = static_cast<Byte>(entryValue(entry) >> 8U);
+				}
+				out_next_ += count;
+				continue;
+			}
+			if (kind == KIND_END_OF_BLOCK) {
+				return overranInput() ? InflateStatus::truncated : InflateStatus::ok;
+			}
+			if (kind != KIND_BASE) {
+				return InflateStatus::corrupt;
+			}
+			const std::size_t length = entryValue(entry) + takeBits(entryExtra(entry));
+			const std::uint32_t dist_entry = decodeEntry(dist, DIST_TABLE_BITS);
+			if (entryKind(dist_entry) != KIND_BASE) {
+				return InflateStatus::corrupt;
+			}
+			const std::size_t distance = entryValue(dist_entry) + takeBits(entryExtra(dist_entry));
+			if (distance > static_cast<std::size_t>(out_next_ - out_begin_)) {
+				return InflateStatus::corrupt;
+			}
+			if (static_cast<std::size_t>(out_end_ - out_next_) < length) {
+				return outputFull();
+			}
+			const Byte* src = out_next_ - distance;
+			for (std::size_t i = 0; i < length; ++i) {
+				out_next_[i] = src[i];
+			}
+			out_next_ += length;
+		}
+	}
+
+	const Byte* const in_begin_;
+	const Byte* in_next_;
+	const Byte* const in_end_;
+	Byte* const out_begin_;
+	Byte* out_next_;
+	Byte* const out_end_;
+
+	BitBuffer bitbuf_ = 0;
+	unsigned bitsleft_ = 0;
+	std::size_t overread_ = 0;
+
+	HuffmanTables dynamic_tables_;
+};
+
+} // namespace
+
+InflateResult inflateWholeBuffer(std::span<const Byte> input, std::span<Byte> output) noexcept {
+	Inflater inflater(input, output);
+	return inflater.run();
+}
+
+// Linked into lodepng as its raw DEFLATE decoder (LODEPNG_EXTERNAL_INFLATE).
+// Returns 0 on success, 1 for a corrupt or truncated stream, and 2 when the
+// stream decodes to more than out_capacity bytes.
+unsigned lodepng_inflate_external(unsigned char* out, std::size_t out_capacity, const unsigned char* in,
+                                  std::size_t insize, std::size_t* produced) {
+	const InflateResult result = inflateWholeBuffer(
+		std::span<const Byte>(in, insize), std::span<Byte>(out, out_capacity));
+	*produced = result.produced;
+	switch (result.status) {
+		case InflateStatus::ok:
+			return 0;
+		case InflateStatus::output_full:
+			return 2;
+		default:
+			return 1;
+	}
+}
@@ -0,0 +1,231 @@
+#include "io_ring_internal.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+namespace io_ring_internal {
+
+namespace {
+
+[[nodiscard]] int ioUringSetup(unsigned entries, io_uring_params& params) noexcept {
+	return static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+}
+
+[[nodiscard]] int ioUringEnter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) noexcept {
+	return static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+[[nodiscard]] unsigned* ringField(void* ring, std::uint32_t offset) noexcept {
+	return reinterpret_cast<unsigned*>(static_cast<Byte*>(ring) + offset);
+}
+
+// The kernel updates the ring indices concurrently; access them with the
+// acquire/release pairing the io_uring ABI specifies.
+[[nodiscard]] unsigned loadAcquire(unsigned* field) noexcept {
+	return std::atomic_ref<unsigned>(*field).load(std::memory_order_acquire);
+}
+
+void storeRelease(unsigned* field, unsigned value) noexcept {
+	std::atomic_ref<unsigned>(*field).store(value, std::memory_order_release);
+}
+
+[[nodiscard]] void* mapRing(int ring_fd, std::size_t size, off_t offset) noexcept {
+	void* addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+	return addr == MAP_FAILED ? nullptr : addr;
+}
+
+} // anonymous namespace
+
+std::optional<IoRing> IoRing::create(unsigned entries) noexcept {
+	io_uring_params params{};
+	params.flags = IORING_SETUP_CLAMP;
+
+	IoRing ring;
+	ring.ring_fd_ = ioUringSetup(entries, params);
+	if (ring.ring_fd_ < 0) {
+		ring.ring_fd_ = -1;
+		return std::nullopt;
+	}
+
+	ring.sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring.cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single_mmap) {
+		ring.sq_ring_size_ = ring.cq_ring_size_ = std::max(ring.sq_ring_size_, ring.cq_ring_size_);
+	}
+
+	ring.sq_ring_ = mapRing(ring.ring_fd_, ring.sq_ring_size_, IORING_OFF_SQ_RING);
+	if (ring.sq_ring_ == nullptr) {
+		return std::nullopt;
+	}
+	ring.cq_ring_ = single_mmap ? ring.sq_ring_ : mapRing(ring.ring_fd_, ring.cq_ring_size_, IORING_OFF_CQ_RING);
+	if (ring.cq_ring_ == nullptr) {
+		return std::nullopt;
+	}
+	ring.sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+	ring.sqes_ = mapRing(ring.ring_fd_, ring.sqes_size_, static_cast<off_t>(IORING_OFF_SQES));
+	if (ring.sqes_ == nullptr) {
+		return std::nullopt;
+	}
+
+	ring.sq_head_  = ringField(ring.sq_ring_, params.sq_off.head);
+	ring.sq_tail_  = ringField(ring.sq_ring_, params.sq_off.tail);
+	ring.sq_array_ = ringField(ring.sq_ring_, params.sq_off.array);
+	ring.sq_mask_  = *ringField(ring.sq_ring_, params.sq_off.ring_mask);
+	ring.sq_entries_ = params.sq_entries;
+	ring.cq_head_  = ringField(ring.cq_ring_, params.cq_off.head);
+	ring.cq_tail_  = ringField(ring.cq_ring_, params.cq_off.tail);
+	ring.cq_mask_  = *ringField(ring.cq_ring_, params.cq_off.ring_mask);
+	ring.cqes_     = static_cast<Byte*>(ring.cq_ring_) + params.cq_off.cqes;
+
+	return std::optional<IoRing>(std::move(ring));
+}
+
+IoRing::IoRing(IoRing&& other) noexcept {
+	*this = std::move(other);
+}
+
+IoRing& IoRing::operator=(IoRing&& other) noexcept {
+	if (this != &other) {
+		release();
+		ring_fd_        = std::exchange(other.ring_fd_, -1);
+		sq_ring_        = std::exchange(other.sq_ring_, nullptr);
+		sq_ring_size_   = std::exchange(other.sq_ring_size_, 0);
+		cq_ring_        = std::exchange(other.cq_ring_, nullptr);
+		cq_ring_size_   = std::exchange(other.cq_ring_size_, 0);
+		sqes_           = std::exchange(other.sqes_, nullptr);
+		sqes_size_      = std::exchange(other.sqes_size_, 0);
+		sq_head_        = std::exchange(other.sq_head_, nullptr);
+		sq_tail_        = std::exchange(other.sq_tail_, nullptr);
+		sq_array_       = std::exchange(other.sq_array_, nullptr);
+		sq_mask_        = std::exchange(other.sq_mask_, 0);
+		sq_entries_     = std::exchange(other.sq_entries_, 0);
+		cq_head_        = std::exchange(other.cq_head_, nullptr);
+		cq_tail_        = std::exchange(other.cq_tail_, nullptr);
+		cq_mask_        = std::exchange(other.cq_mask_, 0);
+		cqes_           = std::exchange(other.cqes_, nullptr);
+		pending_submit_ = std::exchange(other.pending_submit_, 0);
+	}
+	return *this;
+}
+
+IoRing::~IoRing() {
+	release();
+}
+
+void IoRing::release() noexcept {
+	if (sqes_ != nullptr) {
+		::munmap(sqes_, sqes_size_);
+	}
+	if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+		::munmap(cq_ring_, cq_ring_size_);
+	}
+	if (sq_ring_ != nullptr) {
+		::munmap(sq_ring_, sq_ring_size_);
+	}
+	// Closing the ring cancels whatever is still queued in io-wq.
+	if (ring_fd_ >= 0) {
+		::close(ring_fd_);
+	}
+	sqes_ = cq_ring_ = sq_ring_ = nullptr;
+	ring_fd_ = -1;
+}
+
+namespace {
+
+[[nodiscard]] io_uring_sqe* nextSqe(void* sqes, unsigned* sq_head, unsigned* sq_tail, unsigned* sq_array,
+                                    unsigned sq_mask, unsigned sq_entries) noexcept {
+	const unsigned tail = *sq_tail;
+	if (tail - loadAcquire(sq_head) >= sq_entries) {
+		return nullptr;
+	}
+	const unsigned index = tail & sq_mask;
+	auto* sqe = static_cast<io_uring_sqe*>(sqes) + index;
+	std::memset(sqe, 0, sizeof(*sqe));
+	sq_array[index] = index;
+	return sqe;
+}
+
+} // anonymous namespace
+
+bool IoRing::queueRead(int fd, void* buffer, std::uint32_t length,
+                       std::uint64_t offset, std::uint64_t user_data) noexcept {
+	io_uring_sqe* sqe = nextSqe(sqes_, sq_head_, sq_tail_, sq_array_, sq_mask_, sq_entries_);
+	if (sqe == nullptr) {
+		return false;
+	}
+	sqe->opcode    = IORING_OP_READ;
+	sqe->fd        = fd;
+	sqe->addr      = reinterpret_cast<std::uint64_t>(buffer);
+	sqe->len       = length;
+	sqe->off       = offset;
+	sqe->user_data = user_data;
+	storeRelease(sq_tail_, *sq_tail_ + 1);
+	++pending_submit_;
+	return true;
+}
+
+bool IoRing::queueMadvise(const void* address, std::uint32_t length, int advice,
+                          std::uint64_t user_data) noexcept {
+	io_uring_sqe* sqe = nextSqe(sqes_, sq_head_, sq_tail_, sq_array_, sq_mask_, sq_entries_);
+	if (sqe == nullptr) {
+		return false;
+	}
+	sqe->opcode         = IORING_OP_MADVISE;
+	sqe->fd             = -1;
+	sqe->addr           = reinterpret_cast<std::uint64_t>(address);
+	sqe->len            = length;
+	sqe->fadvise_advice = static_cast<std::uint32_t>(advice);
+	sqe->user_data      = user_data;
+	// madvise always blocks; go straight to an io-wq worker instead of first
+	// attempting it inline on the submitting thread.
+	sqe->flags          = IOSQE_ASYNC;
+	storeRelease(sq_tail_, *sq_tail_ + 1);
+	++pending_submit_;
+	return true;
+}
+
+bool IoRing::submit() noexcept {
+	while (pending_submit_ != 0) {
+		const int rc = ioUringEnter(ring_fd_, pending_submit_, 0, 0);
+		if (rc < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			return false;
+		}
+		pending_submit_ -= std::min(pending_submit_, static_cast<unsigned>(rc));
+	}
+	return true;
+}
+
+std::optional<IoRing::Completion> IoRing::waitCompletion() noexcept {
+	for (;;) {
+		const unsigned head = *cq_head_;
+		if (head != loadAcquire(cq_tail_)) {
+			const auto* cqe = static_cast<const io_uring_cqe*>(cqes_) + (head & cq_mask_);
+			const Completion completion{ .user_data = cqe->user_data, .result = cqe->res };
+			storeRelease(cq_head_, head + 1);
+			return completion;
+		}
+
+		const int rc = ioUringEnter(ring_fd_, pending_submit_, 1, IORING_ENTER_GETEVENTS);
+		if (rc < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			return std::nullopt;
+		}
+		pending_submit_ -= std::min(pending_submit_, static_cast<unsigned>(rc));
+	}
+}
+
+}  // namespace io_ring_internal
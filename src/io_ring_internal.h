@@ -0,0 +1,70 @@
+#pragma once
+
+#include "pdvzip.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace io_ring_internal {
+
+// Minimal io_uring submission/completion ring driven through the raw system
+// calls, so no liburing dependency is needed. Only the operations pdvzip uses
+// are exposed. Every queue/submit call reports failure instead of throwing;
+// callers treat an unusable ring as "fall back to plain read()".
+class IoRing {
+public:
+	struct Completion {
+		std::uint64_t user_data;
+		std::int32_t result;     // bytes transferred, 0, or -errno
+	};
+
+	// nullopt when the kernel, seccomp policy or io_uring_disabled sysctl
+	// does not permit io_uring.
+	[[nodiscard]] static std::optional<IoRing> create(unsigned entries) noexcept;
+
+	IoRing(const IoRing&) = delete;
+	IoRing& operator=(const IoRing&) = delete;
+	IoRing(IoRing&& other) noexcept;
+	IoRing& operator=(IoRing&& other) noexcept;
+	~IoRing();
+
+	// Queue (but do not yet submit) a request. False when the SQ is full.
+	[[nodiscard]] bool queueRead(int fd, void* buffer, std::uint32_t length,
+	                             std::uint64_t offset, std::uint64_t user_data) noexcept;
+	// madvise() executed by the kernel's io-wq workers, so several windows of
+	// one mapping can be faulted in concurrently.
+	[[nodiscard]] bool queueMadvise(const void* address, std::uint32_t length, int advice,
+	                                std::uint64_t user_data) noexcept;
+
+	// Submit everything queued. Returns false on a ring-level error.
+	[[nodiscard]] bool submit() noexcept;
+	// Submit anything queued and block for the next completion.
+	[[nodiscard]] std::optional<Completion> waitCompletion() noexcept;
+
+private:
+	IoRing() = default;
+	void release() noexcept;
+
+	int ring_fd_ = -1;
+	void* sq_ring_ = nullptr;
+	std::size_t sq_ring_size_ = 0;
+	void* cq_ring_ = nullptr;      // aliases sq_ring_ with IORING_FEAT_SINGLE_MMAP
+	std::size_t cq_ring_size_ = 0;
+	void* sqes_ = nullptr;
+	std::size_t sqes_size_ = 0;
+
+	unsigned* sq_head_ = nullptr;
+	unsigned* sq_tail_ = nullptr;
+	unsigned* sq_array_ = nullptr;
+	unsigned sq_mask_ = 0;
+	unsigned sq_entries_ = 0;
+	unsigned* cq_head_ = nullptr;
+	unsigned* cq_tail_ = nullptr;
+	unsigned cq_mask_ = 0;
+	void* cqes_ = nullptr;
+
+	unsigned pending_submit_ = 0;
+};
+
+}  // namespace io_ring_internal
@@ -1401,6 +1401,35 @@ unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
   return error;
 }
 
+#ifdef LODEPNG_EXTERNAL_INFLATE
+/*pdvzip: the external inflater decodes into a fixed buffer, so decode into the spare capacity
+(zlib_decompress reserves the expected size up front, making one pass the norm) and, only if
+that overflows, grow and decode again*/
+static unsigned external_inflatev(ucvector* out, const unsigned char* in, size_t insize,
+                                  const LodePNGDecompressSettings* settings) {
+  size_t start = out->size;
+  size_t min_capacity = insize * 4u + 65536u;
+  if(settings->max_output_size && start > settings->max_output_size) return 109;
+  if(out->allocsize - start < min_capacity && !ucvector_reserve(out, start + min_capacity)) return 83; /*alloc fail*/
+  for(;;) {
+    size_t capacity = out->allocsize - start;
+    size_t produced = 0;
+    unsigned status;
+    if(settings->max_output_size && capacity > settings->max_output_size - start) {
+      capacity = settings->max_output_size - start;
+    }
+    status = lodepng_inflate_external(out->data + start, capacity, in, insize, &produced);
+    if(status == 0) {
+      out->size = start + produced;
+      return 0;
+    }
+    if(status != 2) return 110;
+    if(settings->max_output_size && start + capacity >= settings->max_output_size) return 109;
+    if(!ucvector_reserve(out, start + capacity * 2u)) return 83; /*alloc fail*/
+  }
+}
+#endif /*LODEPNG_EXTERNAL_INFLATE*/
+
 static unsigned inflatev(ucvector* out, const unsigned char* in, size_t insize,
                         const LodePNGDecompressSettings* settings) {
   if(settings->custom_inflate) {
@@ -1414,7 +1443,11 @@ static unsigned inflatev(ucvector* out, const unsigned char* in, size_t insize,
     }
     return error;
   } else {
+#ifdef LODEPNG_EXTERNAL_INFLATE
+    return external_inflatev(out, in, insize, settings);
+#else
     return lodepng_inflatev(out, in, insize, settings);
+#endif
   }
 }
 
@@ -2165,6 +2198,7 @@ static unsigned deflate(unsigned char** out, size_t* outsize,
 /* / Adler32                                                                / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
+#ifdef LODEPNG_COMPILE_ADLER32
 static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len) {
   unsigned s1 = adler & 0xffffu;
   unsigned s2 = (adler >> 16u) & 0xffffu;
@@ -2189,6 +2223,12 @@ static unsigned update_adler32(unsigned adler, const unsigned char* data, unsign
 static unsigned adler32(const unsigned char* data, unsigned len) {
   return update_adler32(1u, data, len);
 }
+#else /* !LODEPNG_COMPILE_ADLER32 */
+/*pdvzip: SIMD implementation linked in from adler32.cpp*/
+static unsigned adler32(const unsigned char* data, unsigned len) {
+  return lodepng_adler32(data, len);
+}
+#endif /* !LODEPNG_COMPILE_ADLER32 */
 
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Zlib                                                                   / */
@@ -101,6 +101,13 @@ in a comment in the lodepng.c(pp) file in the 'else' case of the searchable LODE
 or comment out LODEPNG_COMPILE_CRC below*/
 #define LODEPNG_COMPILE_CRC
 #endif
+/*pdvzip: likewise, -DLODEPNG_NO_COMPILE_ADLER32 replaces the built-in scalar zlib
+Adler-32 with an externally linked lodepng_adler32*/
+#ifndef LODEPNG_NO_COMPILE_ADLER32
+#define LODEPNG_COMPILE_ADLER32
+#endif
+/*pdvzip: -DLODEPNG_EXTERNAL_INFLATE decodes DEFLATE data with an externally linked
+lodepng_inflate_external instead of the built-in inflater (custom_inflate still wins)*/
 
 /*compile the C++ version (you can disable the C++ wrapper here even when compiling for C++)*/
 #ifdef __cplusplus
@@ -1114,6 +1121,9 @@ unsigned lodepng_crc32(const unsigned char* buf, size_t len);
 
 
 #ifdef LODEPNG_COMPILE_ZLIB
+/*Calculate Adler-32 of buffer, as used by the zlib container*/
+unsigned lodepng_adler32(const unsigned char* buf, size_t len);
+
 /*
 This zlib part can be used independently to zlib compress and decompress a
 buffer. It cannot be used to create gzip files however, and it only supports the
@@ -1121,6 +1131,13 @@ part of zlib that is required for PNG, it does not support dictionaries.
 */
 
 #ifdef LODEPNG_COMPILE_DECODER
+#ifdef LODEPNG_EXTERNAL_INFLATE
+/*pdvzip: decode raw DEFLATE data into out[0..out_capacity-1], setting *produced. Returns 0 on
+success, 1 if the data is corrupt or truncated, 2 if it decodes to more than out_capacity bytes.*/
+unsigned lodepng_inflate_external(unsigned char* out, size_t out_capacity,
+                                  const unsigned char* in, size_t insize, size_t* produced);
+#endif /*LODEPNG_EXTERNAL_INFLATE*/
+
 /*Inflate a buffer. Inflate is the decompression step of deflate. Out buffer must be freed after use.*/
 unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
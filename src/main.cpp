@@ -1,12 +1,77 @@
 #include "pdvzip.h"
 
 #include <exception>
+#include <future>
 #include <iostream>
+#include <optional>
 #include <print>
+#include <span>
+#include <stdexcept>
 #include <utility>
 
 namespace {
 
+// The archive actually embedded: the input as mapped, or a smaller rebuild of
+// it when --fit asked for one.
+struct EmbeddedArchive {
+	std::span<const Byte> bytes;
+	ZipDirectoryIndex directory;
+	int fd = -1;
+	vBytes rebuilt{};
+};
+
+// --fit: when the finished image would exceed the budget, recompress the
+// archive toward what the budget leaves after the cover and script, then
+// analyze the rebuild so it is embedded exactly like any other archive.
+void fitArchiveToBudget(EmbeddedArchive& archive, std::size_t output_budget, std::size_t overhead,
+                        bool is_zip_file) {
+	const std::size_t archive_budget = output_budget > overhead ? output_budget - overhead : 0;
+	if (archive.bytes.size() <= archive_budget) {
+		return;
+	}
+	std::optional<vBytes> rebuilt = recompressArchive(archive.bytes, archive.directory, archive_budget);
+	if (!rebuilt) {
+		return;
+	}
+	std::println("\nRecompressed archive: {} -> {} bytes.", archive.bytes.size(), rebuilt->size());
+	archive.rebuilt = std::move(*rebuilt);
+	archive.bytes = archive.rebuilt;
+	archive.directory = analyzeArchive(archive.bytes, is_zip_file).directory;
+	archive.fd = -1;
+}
+
+void announceOutput(const fs::path& output_path, bool is_zip_file, std::size_t output_size) {
+	std::print("\nCreated {} polyglot image file: {} ({} bytes).\n\nComplete!\n\n",
+		is_zip_file ? "PNG-ZIP" : "PNG-JAR", output_path.string(), output_size);
+}
+
+void warnIfOverBudget(std::size_t output_size, std::optional<std::size_t> output_budget) {
+	if (output_budget && output_size > *output_budget) {
+		std::println(std::cerr, "Warning: The image is {} bytes, over the --fit budget of {} bytes.\n",
+			output_size, *output_budget);
+	}
+}
+
+// pdvzip <cover> <folder>/: the folder is archived here instead of by a zip
+// run beforehand, its files compressed and the result validated while the
+// cover is optimized.
+int embedFolder(const fs::path& image_path, const fs::path& folder) {
+	auto folder_archive = std::async(std::launch::async, [&folder] {
+		return buildFolderArchive(folder);
+	});
+
+	vBytes image_vec = readFile(image_path, FileTypeCheck::cover_image);
+	optimizeImage(image_vec);
+	const BuiltArchive archive = folder_archive.get();
+
+	const UserArguments user_args = promptForArguments(FileType::FOLDER);
+	vBytes script_vec = buildExtractionScript(FileType::FOLDER, archive.first_filename, user_args);
+	const PolyglotSegments polyglot = embedBuiltArchive(image_vec, std::move(script_vec), archive);
+
+	announceOutput(writePolyglotFile(polyglot.segments(), true), true, polyglot.size());
+	return 0;
+}
+
 int run(int argc, char** argv) {
 	auto args = ProgramArgs::parse(argc, argv);
 
@@ -15,22 +80,56 @@ int run(int argc, char** argv) {
 		return 0;
 	}
 
-	vBytes image_vec   = readFile(*args.image_file_path, FileTypeCheck::cover_image);
-	vBytes archive_vec = readFile(*args.archive_file_path);
+	if (args.profile_archive_path) {
+		return runArchiveProfile(*args.profile_archive_path, args.profile_as_json, args.profile_top_entries);
+	}
 
-	optimizeImage(image_vec);
+	if (args.use_validation_cache) {
+		enableValidationCache();
+	}
+	if (args.verify_cover_pixels) {
+		enableCoverPixelCheck();
+	}
 
-	const std::size_t image_size_before_embed = image_vec.size();
-	const std::size_t archive_file_size       = archive_vec.size();
+	if (args.batch_manifest_path) {
+		return runManifestBatch(*args.batch_manifest_path);
+	}
+	if (args.archive_file_paths.size() > 1) {
+		return runBatch(*args.image_file_path, args.archive_file_paths);
+	}
+	const std::string& archive_file_path = args.archive_file_paths.front();
+	if (fs::is_directory(archive_file_path)) {
+		// A folder is archived afresh each run, so there is nothing to cache,
+		// and its files are already compressed at the highest effort.
+		if (args.use_validation_cache || args.output_size_budget) {
+			throw std::runtime_error("Folder Error: --cache and --fit do not apply when embedding a folder.");
+		}
+		return embedFolder(*args.image_file_path, archive_file_path);
+	}
 
-	const bool is_zip_file = hasFileExtension(*args.archive_file_path, {".zip"});
+	// Both inputs are opened and validated up front; the archive keeps loading
+	// in the background while the cover image is optimized.
+	InputLoader inputs(*args.image_file_path, archive_file_path);
+	vBytes image_vec = inputs.takeCoverImage();
+	const MappedFile& archive_file = inputs.archive();
+	const std::span<const Byte> archive_data = archive_file.bytes();
+	const ArchiveLoadProgress* load_progress = &inputs.archiveLoadProgress();
 
-	// Update the IDAT chunk length to include the archive.
-	writeValueAt(archive_vec, 0, archive_file_size - CHUNK_FIELDS_COMBINED_LENGTH, 4);
+	const bool is_zip_file = hasFileExtension(archive_file_path, {".zip"});
 
 	// Validate the referenced ZIP entries, then classify the first one in
 	// physical local-header order without decompressing the archive twice.
-	const ArchiveMetadata archive_metadata = analyzeArchive(archive_vec, is_zip_file);
+	// This shares nothing with cover optimization until embedding, so it runs
+	// on its own thread while the image is processed here, checking each
+	// entry as soon as the loader has brought it in.
+	auto archive_analysis = std::async(std::launch::async, [archive_data, is_zip_file, load_progress] {
+		return analyzeArchive(archive_data, is_zip_file, load_progress);
+	});
+
+	// An image error propagates first, as it did when the steps ran in order;
+	// the future's destructor still joins the analysis thread on the way out.
+	optimizeImage(image_vec);
+	ArchiveMetadata archive_metadata = archive_analysis.get();
 
 	// Prompt for optional arguments (scripts, executables, JAR).
 	const UserArguments user_args = promptForArguments(archive_metadata.file_type);
@@ -38,10 +137,22 @@ int run(int argc, char** argv) {
 	// Build the iCCP chunk containing the extraction script.
 	vBytes script_vec = buildExtractionScript(archive_metadata.file_type, archive_metadata.first_filename, user_args);
 
+	EmbeddedArchive archive{
+		.bytes = archive_data,
+		.directory = std::move(archive_metadata.directory),
+		.fd = archive_file.fd()
+	};
+	if (args.output_size_budget) {
+		fitArchiveToBudget(archive, *args.output_size_budget, polyglotOverhead(image_vec, script_vec), is_zip_file);
+	}
+
 	// Assemble the polyglot: embed script + archive, fix offsets, finalize CRC.
-	embedChunks(image_vec, std::move(script_vec), std::move(archive_vec), image_size_before_embed);
+	const PolyglotSegments polyglot = embedChunks(
+		image_vec, std::move(script_vec), archive.bytes,
+		archive.directory, archive.fd);
 
-	writePolyglotFile(image_vec, is_zip_file);
+	announceOutput(writePolyglotFile(polyglot.segments(), is_zip_file), is_zip_file, polyglot.size());
+	warnIfOverBudget(polyglot.size(), args.output_size_budget);
 	return 0;
 }
 
@@ -15,10 +15,16 @@
 #  error "pdvzip requires Clang >= 18 with a C++23 standard library (libc++ 18+ or libstdc++ 14+). Please upgrade your compiler."
 #endif
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
 #include <filesystem>
 #include <initializer_list>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <span>
 #include <string>
@@ -65,6 +71,8 @@ constexpr uint32_t
 	ZIP_LOCAL_FILE_HEADER_SIGNATURE   = 0x04034B50,
 	ZIP_CENTRAL_DIRECTORY_SIGNATURE   = 0x02014B50,
 	ZIP_END_CENTRAL_DIRECTORY_SIGNATURE = 0x06054B50,
+	ZIP64_END_CENTRAL_DIRECTORY_SIGNATURE = 0x06064B50,
+	ZIP64_END_CENTRAL_LOCATOR_SIGNATURE   = 0x07064B50,
 	ZIP_DATA_DESCRIPTOR_SIGNATURE     = 0x08074B50;
 
 struct UserArguments {
@@ -74,8 +82,15 @@ struct UserArguments {
 
 struct ProgramArgs {
 	std::optional<std::string> image_file_path;
-	std::optional<std::string> archive_file_path;
+	std::vector<std::string> archive_file_paths;   // more than one selects batch mode
+	std::optional<std::string> batch_manifest_path{};
+	std::optional<std::string> profile_archive_path{};   // selects --profile-archive
+	bool profile_as_json = false;
+	std::size_t profile_top_entries = 10;
+	std::optional<std::size_t> output_size_budget{};    // --fit, single-archive form only
 	bool info_mode = false;
+	bool use_validation_cache = false;
+	bool verify_cover_pixels = false;                   // --verify-cover
 
 	static ProgramArgs parse(int argc, char** argv);
 };
@@ -87,7 +102,114 @@ void displayInfo();
 [[nodiscard]] bool hasValidFilename(const fs::path& p);
 [[nodiscard]] bool hasFileExtension(const fs::path& p, std::initializer_list<std::string_view> exts);
 [[nodiscard]] vBytes readFile(const fs::path& path, FileTypeCheck check_type = FileTypeCheck::archive_file);
-void writePolyglotFile(const vBytes& image_vec, bool is_zip_file);
+// Read a file gathered from a folder being archived: any regular file,
+// including an empty one, with no type checks. A symlink is refused.
+[[nodiscard]] vBytes readFolderFile(const fs::path& path);
+
+// Read-only view of an archive mapped straight from the page cache. The PNG
+// IDAT length/name prefix and CRC trailer are emitted separately at assembly
+// time, so a large archive is never copied into anonymous memory just to be
+// wrapped. The descriptor stays open so the output stage can copy the archive
+// kernel-side instead of through the mapping.
+class MappedFile {
+public:
+	MappedFile() = default;
+	MappedFile(int fd, const Byte* data, std::size_t size) noexcept;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	[[nodiscard]] std::span<const Byte> bytes() const noexcept { return { data_, size_ }; }
+	[[nodiscard]] int fd() const noexcept { return fd_; }
+
+private:
+	void release() noexcept;
+
+	int fd_ = -1;
+	const Byte* data_ = nullptr;
+	std::size_t size_ = 0;
+};
+
+[[nodiscard]] MappedFile mapArchiveFile(const fs::path& path);
+
+// Which fixed-size windows of an archive mapping a background loader has
+// brought in so far. Readers wait here before touching a region, so they can
+// work on the front of the archive while the rest is still being read. A
+// window the loader merely could not prefetch still counts as loaded: the
+// mapping faults it in on first touch. Until beginLoading() is called
+// everything counts as loaded.
+class ArchiveLoadProgress {
+public:
+	void beginLoading(std::size_t archive_size, std::size_t window_size);
+	void markLoaded(std::size_t window_index);
+	void markAllLoaded();
+	// The archive's bytes cannot be read (touching them would fault): windows
+	// not yet loaded never will be, and waiting for them throws reason.
+	void markFailed(std::string reason);
+
+	// Blocks until every byte of [begin, end) is loaded. Throws if loading
+	// failed before that.
+	void waitFor(std::size_t begin, std::size_t end) const;
+
+private:
+	mutable std::mutex mutex_;
+	mutable std::condition_variable loaded_cv_;
+	std::vector<bool> loaded_;
+	std::optional<std::string> failure_;
+	std::size_t archive_size_ = 0;
+	std::size_t window_size_ = 1;
+	// Every byte below this offset is loaded; checked without the lock.
+	std::atomic<std::size_t> loaded_prefix_{SIZE_MAX};
+};
+
+// Opens and validates the cover image and archive together, then loads both
+// concurrently. Where io_uring is available the cover read and population of
+// the archive mapping go to the kernel from a loader thread: the window
+// holding the central directory first, then the rest front to back with a
+// few windows in flight, so archive I/O overlaps cover processing and
+// validation can follow the read. Otherwise this falls back to a plain
+// read() of the cover and kernel readahead.
+class InputLoader {
+public:
+	InputLoader(const fs::path& image_path, const fs::path& archive_path);
+	~InputLoader();
+
+	InputLoader(const InputLoader&) = delete;
+	InputLoader& operator=(const InputLoader&) = delete;
+
+	// Waits for the cover read to finish; call once.
+	[[nodiscard]] vBytes takeCoverImage();
+	[[nodiscard]] const MappedFile& archive() const noexcept { return archive_; }
+	[[nodiscard]] const ArchiveLoadProgress& archiveLoadProgress() const noexcept { return archive_progress_; }
+
+private:
+	struct Prefetch;
+
+	vBytes cover_;
+	MappedFile archive_;
+	ArchiveLoadProgress archive_progress_;
+	std::unique_ptr<Prefetch> prefetch_;   // destroyed first: settles all in-flight reads
+};
+
+// One contiguous piece of the output file. bytes is always readable; when
+// source_fd is valid the same bytes also live in that file at source_offset,
+// and the writer may copy them kernel-side instead of from memory. source_crc
+// is then the CRC-32 of bytes, which the written output must reproduce
+// however it was copied.
+struct OutputSegment {
+	std::span<const Byte> bytes;
+	int source_fd = -1;
+	std::size_t source_offset = 0;
+	uint32_t source_crc = 0;
+};
+// Writes to output_path when given (which must not exist yet), otherwise to a
+// fresh pzip_/pjar_NNNNN.png in the current directory, and returns the path
+// written. Announcing the new file is left to the caller.
+[[nodiscard]] fs::path writePolyglotFile(std::span<const OutputSegment> segments, bool is_zip_file,
+                       const std::optional<fs::path>& output_path = std::nullopt);
 
 // binary_utils.cpp
 void writeValueAt(
@@ -127,6 +249,14 @@ namespace binary_utils_detail {
 	     | (static_cast<uint32_t>(data[offset + 3]) << 24);
 }
 
+[[nodiscard]] inline std::uint64_t readLe64(std::span<const Byte> data, std::size_t offset) {
+	if (offset > data.size() || data.size() - offset < 8) {
+		binary_utils_detail::throwOutOfRange("readLe64");
+	}
+	return static_cast<std::uint64_t>(readLe32(data, offset))
+	     | (static_cast<std::uint64_t>(readLe32(data, offset + 4)) << 32);
+}
+
 inline void writeLe16(std::span<Byte> data, std::size_t offset, uint16_t value) {
 	if (offset > data.size() || data.size() - offset < 2) {
 		binary_utils_detail::throwOutOfRange("writeLe16");
@@ -145,6 +275,14 @@ inline void writeLe32(std::span<Byte> data, std::size_t offset, uint32_t value)
 	data[offset + 3] = static_cast<Byte>((value >> 24) & 0xFF);
 }
 
+inline void writeLe64(std::span<Byte> data, std::size_t offset, std::uint64_t value) {
+	if (offset > data.size() || data.size() - offset < 8) {
+		binary_utils_detail::throwOutOfRange("writeLe64");
+	}
+	writeLe32(data, offset, static_cast<uint32_t>(value & 0xFFFFFFFF));
+	writeLe32(data, offset + 4, static_cast<uint32_t>(value >> 32));
+}
+
 [[nodiscard]] inline bool hasLe32Signature(std::span<const Byte> data, std::size_t offset, uint32_t signature) {
 	return offset <= data.size() && data.size() - offset >= 4 && readLe32(data, offset) == signature;
 }
@@ -188,22 +326,209 @@ struct ZipEocdLocator {
 	std::size_t archive_begin,
 	std::size_t archive_end);
 
+// crc32.cpp
+// Incremental CRC-32: feed segments in order with update(), splice in blocks
+// whose CRC is already known with combine(), read the result with value().
+// Every CRC in pdvzip, lodepng's chunk CRCs included, goes through this engine.
+class Crc32 {
+public:
+	// Resume from a finished CRC (zlib convention, 0 for an empty prefix).
+	explicit Crc32(uint32_t resume_from = 0) noexcept : register_(resume_from ^ 0xFFFFFFFFU) {}
+
+	void update(std::span<const Byte> data);
+	// Extend by a block of block_length bytes whose CRC is block_crc, without
+	// reading it.
+	void combine(uint32_t block_crc, std::uint64_t block_length) noexcept;
+	[[nodiscard]] uint32_t value() const noexcept { return register_ ^ 0xFFFFFFFFU; }
+
+private:
+	uint32_t register_;
+};
+
+// Running CRC-32 (zlib convention): start from 0 and feed each result back in
+// to extend the CRC across non-contiguous segments.
+[[nodiscard]] uint32_t crc32Update(uint32_t crc, std::span<const Byte> data);
+// CRC of A followed by B, given crc(A), crc(B) and B's length, without reading
+// either block again.
+[[nodiscard]] uint32_t crc32Combine(uint32_t crc1, uint32_t crc2, std::uint64_t length2);
+
+// inflate.cpp
+// Raw DEFLATE decoder for streams whose output fits a caller-sized buffer:
+// ZIP entry verification and lodepng's IDAT decode both know the size up
+// front, so no window or streaming state is kept.
+enum class InflateStatus {
+	ok,
+	corrupt,      // invalid block header, code or back-reference
+	truncated,    // input ended before the final block did
+	output_full   // stream decodes to more than output.size() bytes
+};
+
+struct InflateResult {
+	InflateStatus status;
+	std::size_t consumed;   // input bytes up to the end of the final block (ok only)
+	std::size_t produced;   // bytes written to output
+};
+
+[[nodiscard]] InflateResult inflateWholeBuffer(std::span<const Byte> input, std::span<Byte> output) noexcept;
+
 // image_processing.cpp
 void optimizeImage(vBytes& image_file_vec);
 
+// Opt in (--verify-cover) to inflating an indexed cover's image data, which
+// optimizeImage otherwise leaves undecoded, to check it is complete and intact.
+void enableCoverPixelCheck() noexcept;
+
+// batch_mode.cpp
+// Both batch entry points run their jobs on a work-stealing pool without
+// argument prompts, optimize each distinct cover once, cap the archive bytes
+// in flight, and report every job's outcome without stopping on a failure.
+// They return the process exit status.
+
+// Embed each archive into its own copy of one cover image.
+[[nodiscard]] int runBatch(const fs::path& image_path, std::span<const std::string> archive_paths);
+// Run the jobs listed in a tab-separated manifest (see batch_mode.cpp).
+[[nodiscard]] int runManifestBatch(const fs::path& manifest_path);
+
 // archive_analysis.cpp
+// Layout of a validated archive, kept so embedding can relocate it without
+// parsing the central directory again. Per-entry data is held as parallel
+// arrays in central-directory order.
+struct ZipDirectoryIndex {
+	std::size_t central_start = 0;       // first central record; everything before is embedded verbatim
+	std::size_t eocd_offset = 0;
+	uint16_t eocd_comment_length = 0;
+	// ZIP64 end-of-central-directory record, when the archive has one. Its
+	// locator sits directly before the EOCD record.
+	std::optional<std::size_t> zip64_eocd_offset;
+	// CRC-32 of archive[0, central_start). Assembled from per-entry CRCs
+	// gathered while validating, so the final IDAT CRC needs no further pass.
+	uint32_t local_records_crc = 0;
+	std::vector<uint32_t> local_header_offsets;   // each record's local header offset
+	std::vector<uint32_t> central_record_offsets; // archive offset of each central record
+
+	// A record whose local header offset is held in its ZIP64 extra field;
+	// its fixed offset field then reads 0xFFFFFFFF.
+	struct Zip64OffsetSlot {
+		uint32_t record;         // index into the arrays above
+		uint32_t field_offset;   // archive offset of the 8-byte value
+	};
+	std::vector<Zip64OffsetSlot> zip64_offset_slots;   // ascending record order; usually empty
+};
+
 struct ArchiveMetadata {
 	FileType file_type;
 	std::string first_filename;
+	ZipDirectoryIndex directory;
 };
 
 // Fully validates referenced ZIP entries and returns classification metadata.
-ArchiveMetadata analyzeArchive(std::span<const Byte> archive_data, bool is_zip_file);
+// archive_data is the raw ZIP file, without the PNG chunk wrapper. When
+// load_progress is given the archive may still be arriving: the central
+// directory is read once the tail is in, and each entry is checked as soon
+// as its own bytes are.
+ArchiveMetadata analyzeArchive(std::span<const Byte> archive_data, bool is_zip_file,
+                               const ArchiveLoadProgress* load_progress = nullptr);
 // Validation-only compatibility wrapper for focused callers/tests.
 void validateArchiveEntryPaths(std::span<const Byte> archive_data);
 
+// Apply analyzeArchive's entry path rules to the names of an archive about
+// to be built: unsafe or non-portable paths, control characters, duplicates,
+// and case or file/directory conflicts. Throws on the first name that fails.
+void validateNewEntryNames(std::span<const std::string> entry_names);
+
+// Time spent checking one entry's payload: decompression, and the CRC-32
+// passes over its compressed and uncompressed bytes.
+struct EntryTiming {
+	std::chrono::nanoseconds inflate{};
+	std::chrono::nanoseconds crc{};
+};
+
+struct EntryProfile {
+	std::size_t entry_number = 0;      // 1-based, central-directory order
+	std::string name;
+	uint16_t compression_method = 0;
+	std::uint64_t compressed_size = 0;
+	std::uint64_t uncompressed_size = 0;
+	EntryTiming timing;
+};
+
+struct ArchiveProfile {
+	std::vector<EntryProfile> entries;      // central-directory order
+	std::chrono::nanoseconds wall_time{};   // whole validation; entries are checked in parallel
+};
+
+// Runs the same validation as analyzeArchive, never from the validation
+// cache, and records where each entry's check spent its time.
+[[nodiscard]] ArchiveProfile profileArchive(std::span<const Byte> archive_data);
+
+// archive_recompress.cpp
+// Shrink an analyzed archive toward archive_budget bytes (--fit). Entries are
+// re-deflated at zlib's highest effort across the thread pool, largest first,
+// until the archive fits; a new payload is kept only when it is smaller, and
+// entries that are already compressed media are stored rather than deflated.
+// The rebuilt archive keeps every entry's metadata and order and needs
+// analyzing again before embedding. Returns nothing if no entry got smaller,
+// or if the archive uses ZIP64.
+[[nodiscard]] std::optional<vBytes> recompressArchive(std::span<const Byte> archive_data,
+                                                      const ZipDirectoryIndex& directory,
+                                                      std::size_t archive_budget);
+// Whether an entry name's extension marks content that is already compressed
+// (images, audio, video, archives), which is stored rather than deflated.
+[[nodiscard]] bool isCompressedMedia(std::string_view entry_name);
+// Raw DEFLATE at zlib's highest effort, or nothing when the result would not
+// come in under limit bytes. entry_number only labels errors.
+[[nodiscard]] std::optional<vBytes> deflateAtBestEffort(std::span<const Byte> input, std::size_t limit,
+                                                        std::size_t entry_number);
+
+// archive_builder.cpp
+// A ZIP archive built in memory from a folder (pdvzip <cover> <folder>/).
+// Entries are named under the folder's own name, which is the first entry,
+// and files are compressed across the thread pool. The local records are
+// final; the central directory is written by writeBuiltCentralDirectory once
+// the archive's place in the output is known, so nothing is relocated later.
+struct BuiltArchive {
+	struct Entry {
+		std::string name;
+		uint16_t flags = 0;
+		uint16_t compression_method = 0;
+		uint16_t dos_time = 0;
+		uint16_t dos_date = 0;
+		uint32_t crc32 = 0;
+		uint32_t compressed_size = 0;
+		uint32_t uncompressed_size = 0;
+		uint32_t external_attributes = 0;
+		uint32_t local_header_offset = 0;   // from the start of local_records
+	};
+
+	std::string first_filename;       // the folder itself, e.g. "photos/"
+	std::vector<Entry> entries;
+	vBytes local_records;             // every local header and payload, in entry order
+	uint32_t local_records_crc = 0;   // CRC-32 of local_records
+};
+
+[[nodiscard]] BuiltArchive buildFolderArchive(const fs::path& folder);
+// Central directory and EOCD record for archive with its local records placed
+// base_offset bytes into the output. The EOCD comment length claims the
+// trailing_comment_length bytes the caller writes after the record.
+[[nodiscard]] vBytes writeBuiltCentralDirectory(const BuiltArchive& archive, std::size_t base_offset,
+                                                uint16_t trailing_comment_length);
+
+// archive_profile.cpp
+// Print profileArchive's report for one archive: the top_entries slowest
+// entries and the totals, as a table or as JSON (--profile-archive).
+[[nodiscard]] int runArchiveProfile(const fs::path& archive_path, bool as_json, std::size_t top_entries);
+
+// validation_cache.cpp
+// Opt in (--cache) to reusing analyzeArchive's validation of identical
+// archive bytes across runs. Results live under $XDG_CACHE_HOME/pdvzip
+// (default ~/.cache/pdvzip); a hit costs one keyed hash of the archive.
+void enableValidationCache() noexcept;
+
 // user_input.cpp
 UserArguments promptForArguments(FileType file_type);
+// Throw when args holds Linux or Windows arguments that promptForArguments
+// would never have asked for on this file type, and so would go unused.
+void requireArgumentsApply(FileType file_type, const UserArguments& args);
 
 // script_builder.cpp
 vBytes buildExtractionScript(
@@ -212,5 +537,34 @@ vBytes buildExtractionScript(
 	const UserArguments& user_args);
 
 // polyglot_assembly.cpp
-// image_size_before_embed is the optimized PNG size prior to iCCP/archive insertion.
-void embedChunks(vBytes& image_vec, vBytes script_vec, vBytes archive_vec, std::size_t image_size_before_embed);
+// The finished polyglot, described as the ordered byte ranges that make up the
+// output file rather than one contiguous buffer. The cover image and archive
+// are borrowed (the archive normally straight from its mapping); only the
+// small pieces that differ from the inputs are owned here.
+struct PolyglotSegments {
+	std::span<const Byte> image;             // optimized PNG, split around the iCCP chunk and IEND
+	vBytes script_chunk;                     // iCCP chunk holding the extraction script
+	std::array<Byte, 8> idat_header{};       // final IDAT length + name
+	std::span<const Byte> archive_unchanged; // archive bytes emitted verbatim (local entries)
+	int archive_fd = -1;                     // file backing archive_unchanged, from offset 0
+	uint32_t archive_crc = 0;                // CRC-32 of archive_unchanged
+	vBytes patched_directory;                // central directory + EOCD with relocated offsets
+	std::array<Byte, 4> idat_crc{};          // final IDAT CRC, followed by the image's IEND
+
+	[[nodiscard]] std::vector<OutputSegment> segments() const;
+	[[nodiscard]] std::size_t size() const;
+};
+
+// Bytes embedChunks adds around an archive for this cover and script, so
+// the output is this plus the archive size.
+[[nodiscard]] std::size_t polyglotOverhead(const vBytes& image_vec, const vBytes& script_vec) noexcept;
+
+// directory is ArchiveMetadata::directory from analyzeArchive on the same
+// archive_data. archive_fd, when valid, is the file archive_data was mapped from.
+[[nodiscard]] PolyglotSegments embedChunks(const vBytes& image_vec, vBytes script_vec,
+                                           std::span<const Byte> archive_data,
+                                           const ZipDirectoryIndex& directory, int archive_fd = -1);
+// Embed an archive from buildFolderArchive, writing its central directory
+// straight at its final offsets.
+[[nodiscard]] PolyglotSegments embedBuiltArchive(const vBytes& image_vec, vBytes script_vec,
+                                                 const BuiltArchive& archive);
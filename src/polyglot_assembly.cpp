@@ -1,254 +1,226 @@
 #include "pdvzip.h"
-#include "lodepng/lodepng.h"
 
+#include <array>
 #include <format>
+#include <optional>
 #include <stdexcept>
+#include <utility>
+#include <vector>
 
 namespace {
 
 constexpr std::size_t
 	ICCP_CHUNK_INDEX            = 0x21,
 	VALUE_BYTE_LENGTH_FOUR      = 4,
-	EXCLUDE_SIZE_AND_CRC_LENGTH = 8,
-	LAST_IDAT_INDEX_DIFF        = 4,
-	LAST_IDAT_CRC_INDEX_DIFF    = 16;
-
-struct ZipEocdInfo {
-	std::size_t index;
-	uint16_t total_records;
-	uint32_t central_size;
-	uint32_t central_offset;
-	uint16_t comment_length;
-};
+	IDAT_NAME_INDEX             = 4,
+	PNG_TRAILING_BYTES          = 16;
 
-[[nodiscard]] ZipEocdInfo findZipEocd(
-	std::span<const Byte> image_vec,
-	std::size_t zip_base_offset,
-	std::size_t zip_end_offset) {
+struct RelocatedDirectory {
+	std::size_t central_start;
+	vBytes patched;
+};
 
+// Copy the central directory and EOCD out of the archive and rewrite every ZIP
+// record offset so the archive stays valid once it sits zip_base_offset bytes
+// into the PNG. The local entries before the central directory are unchanged
+// and are emitted straight from the source bytes. analyzeArchive has already
+// validated every record, so its index is applied as a plain relocation table.
+// A ZIP64 archive also has its ZIP64 EOCD record, that record's locator and
+// any local offsets held in ZIP64 extra fields relocated.
+[[nodiscard]] RelocatedDirectory relocateCentralDirectory(std::span<const Byte> archive_data,
+                                                          const ZipDirectoryIndex& directory,
+                                                          std::size_t zip_base_offset) {
 	constexpr std::size_t
-		EOCD_MIN_SIZE             = 22,
-		EOCD_DISK_NUMBER_OFFSET   = 4,
-		EOCD_CENTRAL_DISK_OFFSET  = 6,
-		EOCD_RECORDS_ON_DISK      = 8,
-		EOCD_TOTAL_RECORDS_OFFSET = 10,
-		EOCD_CENTRAL_SIZE_OFFSET  = 12,
-		EOCD_CENTRAL_OFFSET       = 16;
-
-	if (zip_end_offset > image_vec.size() || zip_end_offset < zip_base_offset
-		|| zip_end_offset - zip_base_offset < EOCD_MIN_SIZE) {
-		throw std::runtime_error("ZIP Error: Archive is too small.");
-	}
-
-	const auto locator = findZipEocdLocator(image_vec, zip_base_offset, zip_end_offset);
-	if (!locator) {
-		throw std::runtime_error("ZIP Error: End of Central Directory signature not found.");
+		EOCD_MIN_SIZE                  = 22,
+		CENTRAL_LOCAL_OFFSET_OFFSET    = 42,
+		EOCD_CENTRAL_OFFSET            = 16,
+		EOCD_COMMENT_LENGTH_OFFSET     = 20,
+		ZIP64_EOCD_MIN_SIZE            = 56,
+		ZIP64_EOCD_CENTRAL_OFFSET      = 48,
+		ZIP64_LOCATOR_SIZE             = 20,
+		ZIP64_LOCATOR_EOCD_OFFSET      = 8;
+
+	const std::size_t central_start = directory.central_start;
+	const std::optional<std::size_t> zip64_eocd = directory.zip64_eocd_offset;
+	if (central_start > directory.eocd_offset
+		|| directory.eocd_offset > archive_data.size()
+		|| EOCD_MIN_SIZE + directory.eocd_comment_length != archive_data.size() - directory.eocd_offset
+		|| directory.local_header_offsets.size() != directory.central_record_offsets.size()
+		|| (zip64_eocd && (*zip64_eocd < central_start
+			|| directory.eocd_offset - central_start < ZIP64_EOCD_MIN_SIZE + ZIP64_LOCATOR_SIZE
+			|| *zip64_eocd > directory.eocd_offset - ZIP64_EOCD_MIN_SIZE - ZIP64_LOCATOR_SIZE))) {
+		throw std::runtime_error("Embed Error: Archive analysis does not match the archive being embedded.");
 	}
 
-	const std::size_t pos = locator->index;
-	const auto info = ZipEocdInfo{
-		.index          = pos,
-		.total_records  = readLe16(image_vec, pos + EOCD_TOTAL_RECORDS_OFFSET),
-		.central_size   = readLe32(image_vec, pos + EOCD_CENTRAL_SIZE_OFFSET),
-		.central_offset = readLe32(image_vec, pos + EOCD_CENTRAL_OFFSET),
-		.comment_length = locator->comment_length,
-	};
-
-	const uint16_t disk_number = readLe16(image_vec, pos + EOCD_DISK_NUMBER_OFFSET);
-	const uint16_t central_disk = readLe16(image_vec, pos + EOCD_CENTRAL_DISK_OFFSET);
-	const uint16_t records_on_disk = readLe16(image_vec, pos + EOCD_RECORDS_ON_DISK);
-
-	if (disk_number != 0 || central_disk != 0 || records_on_disk != info.total_records
-		|| info.total_records == UINT16_MAX || info.central_size == UINT32_MAX
-		|| info.central_offset == UINT32_MAX) {
-		throw std::runtime_error("ZIP Error: ZIP64 or multi-disk archives are not supported.");
-	}
-	if (info.total_records == 0) {
-		throw std::runtime_error("ZIP Error: Archive contains no records.");
-	}
-
-	const std::size_t central_start = checkedAdd(
+	// Every local header precedes the central directory, so checking the
+	// relocated directory start bounds every relocated offset as well.
+	const std::size_t relocated_central_start = checkedAdd(
 		zip_base_offset,
-		static_cast<std::size_t>(info.central_offset),
-		"ZIP Error: Central directory offset overflow.");
-	const std::size_t central_end = checkedAdd(
 		central_start,
-		static_cast<std::size_t>(info.central_size),
-		"ZIP Error: Central directory size overflow.");
-	if (central_start > zip_end_offset || central_end > zip_end_offset || central_end != pos) {
-		throw std::runtime_error("ZIP Error: Central directory bounds are invalid.");
-	}
-	return info;
-}
-
-// Fix all ZIP record offsets so the archive remains valid after being embedded
-// behind the PNG wrapper bytes.
-void fixZipOffsets(vBytes& image_vec, std::size_t image_size_before_embed, std::size_t script_data_size) {
-	constexpr std::size_t
-		ZIP_BASE_SHIFT                 = 8,
-		PNG_TRAILING_BYTES             = 16,
-		CENTRAL_RECORD_MIN_SIZE        = 46,
-		CENTRAL_NAME_LENGTH_OFFSET     = 28,
-		CENTRAL_EXTRA_LENGTH_OFFSET    = 30,
-		CENTRAL_COMMENT_LENGTH_OFFSET  = 32,
-		CENTRAL_DISK_START_OFFSET      = 34,
-		CENTRAL_LOCAL_OFFSET_OFFSET    = 42;
-
-	const std::size_t zip_base_offset = checkedAdd(
-		checkedAdd(image_size_before_embed, script_data_size, "ZIP Error: Base offset overflow."),
-		ZIP_BASE_SHIFT,
-		"ZIP Error: Base offset overflow.");
-	if (image_vec.size() < PNG_TRAILING_BYTES) {
-		throw std::runtime_error("ZIP Error: Embedded image is truncated.");
-	}
-	const std::size_t zip_end_offset = image_vec.size() - PNG_TRAILING_BYTES;
-	const ZipEocdInfo eocd = findZipEocd(image_vec, zip_base_offset, zip_end_offset);
-
-	// findZipEocd already validated central_start/central_end fit within
-	// zip_end_offset and that central_end == eocd.index. Recompute the offsets
-	// locally for use below.
-	const std::size_t central_start = zip_base_offset + static_cast<std::size_t>(eocd.central_offset);
-	const std::size_t central_end = eocd.index;
-
-	if (central_start > UINT32_MAX) {
+		"ZIP Error: Central directory offset overflow.");
+	if (relocated_central_start > UINT32_MAX) {
 		throw std::runtime_error("ZIP Error: Central directory offset exceeds ZIP32 limits.");
 	}
-	if (eocd.comment_length > UINT16_MAX - PNG_TRAILING_BYTES) {
+	if (directory.eocd_comment_length > UINT16_MAX - PNG_TRAILING_BYTES) {
 		throw std::runtime_error("ZIP Error: Comment length overflow.");
 	}
 
-	writeLe16(image_vec, eocd.index + 20, static_cast<uint16_t>(eocd.comment_length + PNG_TRAILING_BYTES));
-	writeLe32(image_vec, eocd.index + 16, static_cast<uint32_t>(central_start));
-
-	std::size_t cursor = central_start;
-	for (uint16_t i = 0; i < eocd.total_records; ++i) {
-		if (cursor > image_vec.size() || CENTRAL_RECORD_MIN_SIZE > image_vec.size() - cursor) {
-			throw std::runtime_error("ZIP Error: Truncated central directory file header.");
-		}
-
-		if (!hasLe32Signature(image_vec, cursor, ZIP_CENTRAL_DIRECTORY_SIGNATURE)) {
-			throw std::runtime_error(std::format(
-				"ZIP Error: Invalid central directory file header signature at record {}.", i + 1));
-		}
-
-		const std::size_t name_length = readLe16(image_vec, cursor + CENTRAL_NAME_LENGTH_OFFSET);
-		const std::size_t extra_length = readLe16(image_vec, cursor + CENTRAL_EXTRA_LENGTH_OFFSET);
-		const std::size_t comment_length = readLe16(image_vec, cursor + CENTRAL_COMMENT_LENGTH_OFFSET);
-		const uint16_t entry_disk_start = readLe16(image_vec, cursor + CENTRAL_DISK_START_OFFSET);
-		const std::size_t record_size = zipCentralDirectoryRecordSize(name_length, extra_length, comment_length);
+	vBytes patched(archive_data.begin() + static_cast<std::ptrdiff_t>(central_start), archive_data.end());
+	const std::size_t eocd_index = directory.eocd_offset - central_start;
 
-		if (entry_disk_start != 0) {
-			throw std::runtime_error(std::format(
-				"ZIP Error: Multi-disk local header reference on record {} is not supported.", i + 1));
-		}
-		if (record_size > image_vec.size() - cursor || cursor + record_size > central_end) {
-			throw std::runtime_error("ZIP Error: Central directory entry exceeds archive bounds.");
-		}
+	// The EOCD comment is extended to swallow the IDAT CRC and IEND chunk that
+	// follow the archive in the PNG.
+	writeLe16(patched, eocd_index + EOCD_COMMENT_LENGTH_OFFSET,
+		static_cast<uint16_t>(directory.eocd_comment_length + PNG_TRAILING_BYTES));
+	// A saturated EOCD offset defers to the ZIP64 record; leave it saturated.
+	if (readLe32(patched, eocd_index + EOCD_CENTRAL_OFFSET) != UINT32_MAX) {
+		writeLe32(patched, eocd_index + EOCD_CENTRAL_OFFSET, static_cast<uint32_t>(relocated_central_start));
+	}
+	if (zip64_eocd) {
+		writeLe64(patched, *zip64_eocd - central_start + ZIP64_EOCD_CENTRAL_OFFSET, relocated_central_start);
+		writeLe64(patched, eocd_index - ZIP64_LOCATOR_SIZE + ZIP64_LOCATOR_EOCD_OFFSET,
+			checkedAdd(zip_base_offset, *zip64_eocd, "ZIP Error: ZIP64 end of central directory offset overflow."));
+	}
 
-		const std::size_t local_offset = checkedAdd(
-			zip_base_offset,
-			static_cast<std::size_t>(readLe32(image_vec, cursor + CENTRAL_LOCAL_OFFSET_OFFSET)),
-			"ZIP Error: Local file header offset overflow.");
-		if (local_offset > UINT32_MAX) {
-			throw std::runtime_error("ZIP Error: Local file header offset exceeds ZIP32 limits.");
+	const auto base = static_cast<uint32_t>(zip_base_offset);
+	auto zip64_slot = directory.zip64_offset_slots.begin();
+	for (std::size_t i = 0; i < directory.local_header_offsets.size(); ++i) {
+		const uint32_t relocated = base + directory.local_header_offsets[i];
+		if (zip64_slot != directory.zip64_offset_slots.end() && zip64_slot->record == i) {
+			writeLe64(patched, zip64_slot->field_offset - central_start, relocated);
+			++zip64_slot;
+			continue;
 		}
-		if (local_offset >= central_start || 4 > image_vec.size() - local_offset) {
-			throw std::runtime_error("ZIP Error: Local file header offset is out of bounds.");
-		}
-		if (!hasLe32Signature(image_vec, local_offset, ZIP_LOCAL_FILE_HEADER_SIGNATURE)) {
-			throw std::runtime_error(std::format(
-				"ZIP Error: Local file header signature mismatch for record {}.", i + 1));
-		}
-
-		writeLe32(image_vec, cursor + CENTRAL_LOCAL_OFFSET_OFFSET, static_cast<uint32_t>(local_offset));
-		cursor += record_size;
+		const std::size_t field = directory.central_record_offsets[i] - central_start + CENTRAL_LOCAL_OFFSET_OFFSET;
+		writeLe32(patched, field, relocated);
 	}
 
-	if (cursor != central_end) {
-		throw std::runtime_error("ZIP Error: Central directory size does not match parsed records.");
-	}
+	return RelocatedDirectory{
+		.central_start = central_start,
+		.patched = std::move(patched)
+	};
 }
 
-void validateEmbedInputs(const vBytes& image_vec, const vBytes& script_vec, const vBytes& archive_vec) {
-	if (image_vec.size() < ICCP_CHUNK_INDEX) {
+void validateEmbedInputs(const vBytes& image_vec, const vBytes& script_vec, std::span<const Byte> archive_data) {
+	if (image_vec.size() < ICCP_CHUNK_INDEX + CHUNK_FIELDS_COMBINED_LENGTH) {
 		throw std::runtime_error("Embed Error: Optimized PNG is too small for chunk insertion.");
 	}
 	if (script_vec.size() < CHUNK_FIELDS_COMBINED_LENGTH) {
 		throw std::runtime_error("Embed Error: Script chunk is truncated.");
 	}
-	if (archive_vec.size() < CHUNK_FIELDS_COMBINED_LENGTH) {
+	if (archive_data.empty()) {
 		throw std::runtime_error("Embed Error: Archive chunk is truncated.");
 	}
 }
 
-void reserveEmbeddedImageSize(vBytes& image_vec, std::size_t script_size, std::size_t archive_size) {
-	const std::size_t output_size = checkedAdd(
-		checkedAdd(image_vec.size(), script_size, "Embed Error: Output image size overflow."),
-		archive_size,
-		"Embed Error: Output image size overflow.");
-	image_vec.reserve(output_size);
+[[nodiscard]] std::array<Byte, 8> makeIdatHeader(std::size_t archive_size) {
+	std::array<Byte, 8> idat_header{ 0x00, 0x00, 0x00, 0x00, 0x49, 0x44, 0x41, 0x54 };
+	writeValueAt(idat_header, 0, archive_size, VALUE_BYTE_LENGTH_FOUR);
+	return idat_header;
 }
 
-void insertScriptChunk(vBytes& image_vec, const vBytes& script_vec) {
-	image_vec.insert(image_vec.begin() + ICCP_CHUNK_INDEX, script_vec.begin(), script_vec.end());
+// Layout: PNG header | iCCP script | image body | IDAT header | archive |
+// IDAT CRC | IEND. The archive therefore begins after everything but the
+// optimized image's IEND chunk, plus the 8-byte IDAT length and name.
+[[nodiscard]] std::size_t archiveBaseOffset(const vBytes& image_vec, const vBytes& script_vec) {
+	return checkedAdd(
+		image_vec.size() - CHUNK_FIELDS_COMBINED_LENGTH,
+		checkedAdd(script_vec.size(), 8, "ZIP Error: Base offset overflow."),
+		"ZIP Error: Base offset overflow.");
 }
 
-void insertArchiveChunk(vBytes& image_vec, const vBytes& archive_vec) {
-	image_vec.insert(image_vec.end() - CHUNK_FIELDS_COMBINED_LENGTH, archive_vec.begin(), archive_vec.end());
+// The last IDAT CRC covers the chunk name, the verbatim archive bytes and the
+// relocated directory. The verbatim bytes were already CRC'd during archive
+// validation, so that CRC is spliced in rather than recomputed; only the chunk
+// name and the small patched directory are read here.
+void writeLastIdatCrc(PolyglotSegments& polyglot, uint32_t local_records_crc) {
+	Crc32 crc;
+	crc.update(std::span<const Byte>(polyglot.idat_header).subspan(IDAT_NAME_INDEX));
+	crc.combine(local_records_crc, polyglot.archive_unchanged.size());
+	crc.update(polyglot.patched_directory);
+
+	writeValueAt(polyglot.idat_crc, 0, crc.value(), VALUE_BYTE_LENGTH_FOUR);
 }
 
-void writeLastIdatCrc(
-	vBytes& image_vec,
-	std::size_t image_size_before_embed,
-	std::size_t script_data_size,
-	std::size_t archive_file_size) {
-
-	const std::size_t last_idat_index = checkedAdd(
-		checkedAdd(image_size_before_embed, script_data_size, "Embed Error: IDAT index overflow."),
-		LAST_IDAT_INDEX_DIFF,
-		"Embed Error: IDAT index overflow.");
-	const std::size_t complete_size = image_vec.size();
+} // anonymous namespace
 
-	if (archive_file_size < EXCLUDE_SIZE_AND_CRC_LENGTH) {
-		throw std::runtime_error("Embed Error: Archive too small for CRC computation.");
-	}
+std::vector<OutputSegment> PolyglotSegments::segments() const {
+	const std::size_t body_end = image.size() - CHUNK_FIELDS_COMBINED_LENGTH;
+	return {
+		{ .bytes = image.first(ICCP_CHUNK_INDEX) },
+		{ .bytes = script_chunk },
+		{ .bytes = image.subspan(ICCP_CHUNK_INDEX, body_end - ICCP_CHUNK_INDEX) },
+		{ .bytes = idat_header },
+		{ .bytes = archive_unchanged, .source_fd = archive_fd, .source_offset = 0, .source_crc = archive_crc },
+		{ .bytes = patched_directory },
+		{ .bytes = idat_crc },
+		{ .bytes = image.last(CHUNK_FIELDS_COMBINED_LENGTH) },
+	};
+}
 
-	const std::size_t crc_length = archive_file_size - EXCLUDE_SIZE_AND_CRC_LENGTH;
-	if (last_idat_index > complete_size || crc_length > complete_size - last_idat_index) {
-		throw std::runtime_error("Embed Error: IDAT CRC region exceeds image bounds.");
+std::size_t PolyglotSegments::size() const {
+	std::size_t total = 0;
+	for (const auto& segment : segments()) {
+		total = checkedAdd(total, segment.bytes.size(), "Embed Error: Output image size overflow.");
 	}
-
-	const uint32_t last_idat_crc = lodepng_crc32(&image_vec[last_idat_index], crc_length);
-	const std::size_t crc_index = complete_size - LAST_IDAT_CRC_INDEX_DIFF;
-	writeValueAt(image_vec, crc_index, last_idat_crc, VALUE_BYTE_LENGTH_FOUR);
+	return total;
 }
 
-} // anonymous namespace
-
 // ============================================================================
 // Public: Embed the script chunk and archive into the image
 // ============================================================================
 
-void embedChunks(vBytes& image_vec, vBytes script_vec, vBytes archive_vec, std::size_t image_size_before_embed) {
-	validateEmbedInputs(image_vec, script_vec, archive_vec);
-
-	const std::size_t script_data_size = script_vec.size() - CHUNK_FIELDS_COMBINED_LENGTH;
-	const std::size_t archive_file_size = archive_vec.size();
-
-	reserveEmbeddedImageSize(image_vec, script_vec.size(), archive_vec.size());
+std::size_t polyglotOverhead(const vBytes& image_vec, const vBytes& script_vec) noexcept {
+	// The archive's IDAT chunk: 8-byte length and name, then the 4-byte CRC.
+	constexpr std::size_t ARCHIVE_CHUNK_FIELDS = 12;
+	return image_vec.size() + script_vec.size() + ARCHIVE_CHUNK_FIELDS;
+}
 
-	// Insert iCCP script chunk after the PNG header.
-	insertScriptChunk(image_vec, script_vec);
-	script_vec = vBytes{}; // Release memory.
+PolyglotSegments embedChunks(const vBytes& image_vec, vBytes script_vec,
+                             std::span<const Byte> archive_data,
+                             const ZipDirectoryIndex& directory, int archive_fd) {
+	validateEmbedInputs(image_vec, script_vec, archive_data);
+	const std::size_t zip_base_offset = archiveBaseOffset(image_vec, script_vec);
+
+	// Fix ZIP internal offsets in a copy of the (small) central directory;
+	// the bulk of the archive is referenced, never copied.
+	RelocatedDirectory relocated = relocateCentralDirectory(archive_data, directory, zip_base_offset);
+
+	PolyglotSegments polyglot{
+		.image             = image_vec,
+		.script_chunk      = std::move(script_vec),
+		.idat_header       = makeIdatHeader(archive_data.size()),
+		.archive_unchanged = archive_data.first(relocated.central_start),
+		.archive_fd        = archive_fd,
+		.archive_crc       = directory.local_records_crc,
+		.patched_directory = std::move(relocated.patched),
+	};
 
-	// Insert archive data before the IEND chunk.
-	insertArchiveChunk(image_vec, archive_vec);
-	archive_vec = vBytes{}; // Release memory.
+	// Compute the last IDAT chunk CRC over the relocated archive.
+	writeLastIdatCrc(polyglot, polyglot.archive_crc);
+	return polyglot;
+}
 
-	// Fix ZIP internal offsets (must happen before CRC computation,
-	// since the offsets are within the CRC-covered region).
-	fixZipOffsets(image_vec, image_size_before_embed, script_data_size);
+PolyglotSegments embedBuiltArchive(const vBytes& image_vec, vBytes script_vec, const BuiltArchive& archive) {
+	validateEmbedInputs(image_vec, script_vec, archive.local_records);
+	const std::size_t zip_base_offset = archiveBaseOffset(image_vec, script_vec);
+	vBytes directory = writeBuiltCentralDirectory(archive, zip_base_offset, static_cast<uint16_t>(PNG_TRAILING_BYTES));
+	const std::size_t archive_size = checkedAdd(
+		archive.local_records.size(),
+		directory.size(),
+		"ZIP Error: Archive size overflow.");
+	if (archive_size > static_cast<std::size_t>(INT32_MAX)) {
+		throw std::runtime_error("Archive File Error: File exceeds maximum size limit.");
+	}
 
-	// Recompute the last IDAT chunk CRC.
-	writeLastIdatCrc(image_vec, image_size_before_embed, script_data_size, archive_file_size);
+	PolyglotSegments polyglot{
+		.image             = image_vec,
+		.script_chunk      = std::move(script_vec),
+		.idat_header       = makeIdatHeader(archive_size),
+		.archive_unchanged = archive.local_records,
+		.archive_crc       = archive.local_records_crc,
+		.patched_directory = std::move(directory),
+	};
+	writeLastIdatCrc(polyglot, polyglot.archive_crc);
+	return polyglot;
 }
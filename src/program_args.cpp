@@ -1,6 +1,9 @@
 #include "pdvzip.h"
 
+#include <charconv>
+#include <cstdint>
 #include <format>
+#include <optional>
 #include <stdexcept>
 
 namespace {
@@ -9,11 +12,78 @@ namespace {
 	return argc == 2 && argv[1] != nullptr && std::string_view(argv[1]) == "--info";
 }
 
+[[nodiscard]] bool isBatchModeRequest(int argc, char** argv) {
+	return argc == 3 && argv[1] != nullptr && argv[2] != nullptr && std::string_view(argv[1]) == "--batch";
+}
+
+[[nodiscard]] bool isProfileRequest(int argc, char** argv) {
+	return argc >= 2 && argv[1] != nullptr && std::string_view(argv[1]) == "--profile-archive";
+}
+
 [[nodiscard]] std::string usageFor(std::string_view program_name) {
 	return std::format(
-		"Usage: {} <cover_image> <zip/jar>\n"
+		"Usage: {} [--cache] [--verify-cover] <cover_image> <zip/jar> [<zip/jar> ...]\n"
+		"       {} <cover_image> <folder>/\n"
+		"       {} [--cache] --fit <size> <cover_image> <zip/jar>\n"
+		"       {} [--cache] --batch <manifest.tsv>\n"
+		"       {} --profile-archive [--json] [--top <n>] <zip/jar>\n"
 		"       {} --info",
-		program_name, program_name);
+		program_name, program_name, program_name, program_name, program_name, program_name);
+}
+
+// A byte count, optionally followed by K, M or G for binary multiples, so
+// X-Twitter's limit can be given as 5M (5,242,880 bytes).
+[[nodiscard]] std::size_t parseSizeBudget(std::string_view text) {
+	std::size_t value = 0;
+	const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+	const std::string_view suffix(end, static_cast<std::size_t>(text.data() + text.size() - end));
+	std::size_t shift = 0;
+	if (suffix == "K" || suffix == "k") {
+		shift = 10;
+	} else if (suffix == "M" || suffix == "m") {
+		shift = 20;
+	} else if (suffix == "G" || suffix == "g") {
+		shift = 30;
+	} else if (!suffix.empty()) {
+		value = 0;
+	}
+	if (ec != std::errc{} || value == 0 || value > (SIZE_MAX >> shift)) {
+		throw std::runtime_error(std::format(
+			"Invalid program invocation: --fit expects a size such as 5M or 5242880, not \"{}\".", text));
+	}
+	return value << shift;
+}
+
+// --profile-archive [--json] [--top <n>] <zip/jar>: the options may come in
+// either order, and the archive is always last.
+[[nodiscard]] ProgramArgs parseProfileRequest(int argc, char** argv, std::string_view program_name) {
+	ProgramArgs args;
+	args.profile_archive_path = std::string{};
+	int i = 2;
+	for (; i < argc - 1; ++i) {
+		const std::string_view option = argv[i] != nullptr ? argv[i] : "";
+		if (option == "--json") {
+			args.profile_as_json = true;
+			continue;
+		}
+		if (option == "--top" && i + 1 < argc - 1 && argv[i + 1] != nullptr) {
+			const std::string_view count = argv[++i];
+			std::size_t top = 0;
+			const auto [end, ec] = std::from_chars(count.data(), count.data() + count.size(), top);
+			if (ec != std::errc{} || end != count.data() + count.size() || top == 0) {
+				throw std::runtime_error(std::format(
+					"Invalid program invocation: --top expects a positive entry count, not \"{}\".", count));
+			}
+			args.profile_top_entries = top;
+			continue;
+		}
+		throw std::runtime_error(usageFor(program_name));
+	}
+	if (i != argc - 1 || argv[i] == nullptr) {
+		throw std::runtime_error(usageFor(program_name));
+	}
+	args.profile_archive_path = argv[i];
+	return args;
 }
 
 } // anonymous namespace
@@ -29,16 +99,66 @@ ProgramArgs ProgramArgs::parse(int argc, char** argv) {
 		return args;
 	}
 
-	if (argc != 3) {
-		const std::string prog = fs::path(argv[0]).filename().string();
+	const std::string prog = fs::path(argv[0]).filename().string();
+
+	// --cache, --verify-cover and --fit lead the other forms: step past them
+	// and parse the rest as usual. Only argv[1] onwards is read after this point.
+	bool use_cache = false;
+	bool verify_cover = false;
+	std::optional<std::size_t> size_budget;
+	while (argc >= 2 && argv[1] != nullptr) {
+		const std::string_view option = argv[1];
+		if (option == "--cache") {
+			use_cache = true;
+			--argc;
+			++argv;
+		} else if (option == "--verify-cover") {
+			verify_cover = true;
+			--argc;
+			++argv;
+		} else if (option == "--fit" && argc >= 3 && argv[2] != nullptr) {
+			size_budget = parseSizeBudget(argv[2]);
+			argc -= 2;
+			argv += 2;
+		} else {
+			break;
+		}
+	}
+
+	// Profiling always times a full validation of the archive alone.
+	if (isProfileRequest(argc, argv)) {
+		if (use_cache || verify_cover || size_budget) {
+			throw std::runtime_error(
+				"Invalid program invocation: --cache, --verify-cover and --fit do not apply to --profile-archive.");
+		}
+		return parseProfileRequest(argc, argv, prog);
+	}
+
+	if (isBatchModeRequest(argc, argv)) {
+		if (size_budget) {
+			throw std::runtime_error(usageFor(prog));
+		}
+		ProgramArgs args;
+		args.batch_manifest_path = argv[2];
+		args.use_validation_cache = use_cache;
+		args.verify_cover_pixels = verify_cover;
+		return args;
+	}
+
+	if (argc < 3 || (size_budget && argc != 3)) {
 		throw std::runtime_error(usageFor(prog));
 	}
-	if (argv[1] == nullptr || argv[2] == nullptr) {
-		throw std::runtime_error("Invalid program invocation: missing input path.");
+	for (int i = 1; i < argc; ++i) {
+		if (argv[i] == nullptr) {
+			throw std::runtime_error("Invalid program invocation: missing input path.");
+		}
 	}
 
 	return ProgramArgs{
-		.image_file_path   = argv[1],
-		.archive_file_path = argv[2],
+		.image_file_path      = argv[1],
+		.archive_file_paths   = std::vector<std::string>(argv + 2, argv + argc),
+		.output_size_budget   = size_budget,
+		.use_validation_cache = use_cache,
+		.verify_cover_pixels  = verify_cover,
 	};
 }
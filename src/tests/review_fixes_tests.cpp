@@ -1,20 +1,42 @@
-// Regression tests for the four review findings: reserved Windows device
-// names, Linux pwsh -File, leftover output on write failure, and version
-// string consistency.
+// Regression tests for pdvzip, by area:
+//   - entry names: reserved Windows device names, portable path conflicts
+//   - extraction scripts: Linux pwsh -File, the --info version banner
+//   - output: partial files removed on failure, kernel-copied and memory
+//     segments checked against their CRC, batch output paths
+//   - folders: building, compressing and validating an archive from a folder
+//   - codecs: inflate, CRC-32 and every Adler-32 kernel against zlib
+//   - covers: the indexed-PNG fast path
+//   - archives: ZIP64 relocation, the validation cache, recompression for
+//     --fit, parallel entry verification and the uncompressed budget,
+//     analysis while the archive is still loading
+//   - command line: the batch manifest, --profile-archive parsing
 //
 // g++ -std=c++23 -O0 -g -I.. -DLODEPNG_NO_COMPILE_DISK \
 //   -DLODEPNG_NO_COMPILE_ANCILLARY_CHUNKS -DLODEPNG_NO_COMPILE_CRC \
-//   review_fixes_tests.cpp ../archive_analysis.cpp ../binary_utils.cpp \
-//   ../crc32.cpp ../script_text_builder.cpp ../script_builder.cpp \
-//   ../file_io.cpp ../display_info.cpp ../program_args.cpp ../user_input.cpp \
+//   -DLODEPNG_NO_COMPILE_ADLER32 -DLODEPNG_EXTERNAL_INFLATE \
+//   review_fixes_tests.cpp ../archive_analysis.cpp ../archive_builder.cpp \
+//   ../archive_profile.cpp ../archive_recompress.cpp ../binary_utils.cpp \
+//   ../crc32.cpp ../adler32.cpp ../inflate.cpp ../script_text_builder.cpp ../script_builder.cpp \
+//   ../file_io.cpp ../io_ring.cpp ../display_info.cpp ../program_args.cpp ../user_input.cpp \
 //   ../image_processing.cpp ../image_resize.cpp ../polyglot_assembly.cpp \
+//   ../thread_pool.cpp ../batch_mode.cpp ../validation_cache.cpp \
 //   ../lodepng/lodepng.cpp -lz -o review_fixes_tests
 
 #include "pdvzip.h"
+#include "adler32_internal.h"
+#include "archive_analysis_internal.h"
+#include "archive_profile_internal.h"
+#include "batch_mode_internal.h"
+#include "crc32_internal.h"
+#include "image_processing_internal.h"
 #include "script_builder_internal.h"
+#include "validation_cache_internal.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cerrno>
+#include <chrono>
 #include <csignal>
 #include <cstdint>
 #include <cstdio>
@@ -24,13 +46,22 @@
 #include <fcntl.h>
 #include <filesystem>
 #include <format>
+#include <initializer_list>
 #include <iostream>
+#include <numeric>
+#include <optional>
 #include <print>
+#include <random>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <utility>
 #include <vector>
 
 #include <zlib.h>
@@ -67,6 +98,17 @@ void expectThrows(const auto& fn, std::string_view label) {
 	}
 }
 
+void expectThrowsWith(const auto& fn, std::string_view expected, std::string_view label) {
+	try {
+		fn();
+		std::println(std::cerr, "FAIL: {} (expected exception)", label);
+		++g_failures;
+	}
+	catch (const std::exception& e) {
+		expectContains(e.what(), expected, label);
+	}
+}
+
 void appendLe16(vBytes& out, uint16_t value) {
 	out.push_back(static_cast<Byte>(value & 0xFF));
 	out.push_back(static_cast<Byte>((value >> 8) & 0xFF));
@@ -79,11 +121,16 @@ void appendLe32(vBytes& out, uint32_t value) {
 	out.push_back(static_cast<Byte>((value >> 24) & 0xFF));
 }
 
+void appendLe64(vBytes& out, std::uint64_t value) {
+	appendLe32(out, static_cast<uint32_t>(value));
+	appendLe32(out, static_cast<uint32_t>(value >> 32));
+}
+
 void appendBytes(vBytes& out, std::string_view s) {
 	out.insert(out.end(), s.begin(), s.end());
 }
 
-vBytes makeWrappedSingleFileZip(std::string_view entry_name, std::string_view payload) {
+vBytes makeSingleFileZip(std::string_view entry_name, std::string_view payload) {
 	const uint32_t crc = static_cast<uint32_t>(::crc32(
 		::crc32(0L, Z_NULL, 0),
 		reinterpret_cast<const Bytef*>(payload.data()),
@@ -141,19 +188,11 @@ vBytes makeWrappedSingleFileZip(std::string_view entry_name, std::string_view pa
 	zip.insert(zip.end(), local.begin(), local.end());
 	zip.insert(zip.end(), central.begin(), central.end());
 	zip.insert(zip.end(), eocd.begin(), eocd.end());
-
-	vBytes wrapped(8 + zip.size() + 4, 0);
-	wrapped[4] = 'I';
-	wrapped[5] = 'D';
-	wrapped[6] = 'A';
-	wrapped[7] = 'T';
-	std::copy(zip.begin(), zip.end(), wrapped.begin() + 8);
-	writeValueAt(wrapped, 0, zip.size(), 4);
-	return wrapped;
+	return zip;
 }
 
 void testWindowsDeviceNamesAreRejected() {
-	const vBytes safe = makeWrappedSingleFileZip("docs/readme.txt", "hi");
+	const vBytes safe = makeSingleFileZip("docs/readme.txt", "hi");
 	try {
 		validateArchiveEntryPaths(safe);
 	}
@@ -171,7 +210,7 @@ void testWindowsDeviceNamesAreRejected() {
 		"clock$.dat",
 	};
 	for (const std::string_view name : reserved) {
-		const vBytes bad = makeWrappedSingleFileZip(name, "x");
+		const vBytes bad = makeSingleFileZip(name, "x");
 		expectThrows([&] {
 			validateArchiveEntryPaths(bad);
 		}, std::format("reject Windows device name \"{}\"", name));
@@ -303,7 +342,9 @@ void testWriteFailureRemovesPartialFile() {
 
 	bool threw = false;
 	try {
-		writePolyglotFile(vBytes(64 * 1024, Byte{0x41}), true);
+		const vBytes output(64 * 1024, Byte{0x41});
+		const std::array<OutputSegment, 1> segments{ OutputSegment{ .bytes = output } };
+		(void)writePolyglotFile(segments, true);
 	}
 	catch (const std::exception&) {
 		threw = true;
@@ -320,6 +361,1642 @@ void testWriteFailureRemovesPartialFile() {
 	expectTrue(!leftover, "writePolyglotFile removes the partial output file");
 }
 
+vBytes concatenateSegments(const PolyglotSegments& polyglot) {
+	vBytes out;
+	for (const OutputSegment& segment : polyglot.segments()) {
+		out.insert(out.end(), segment.bytes.begin(), segment.bytes.end());
+	}
+	return out;
+}
+
+void writeTextFile(const fs::path& path, std::string_view text) {
+	std::FILE* file = std::fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		throw std::runtime_error(std::format("cannot create {}", path.string()));
+	}
+	std::fwrite(text.data(), 1, text.size(), file);
+	std::fclose(file);
+}
+
+vBytes readBinaryFile(const fs::path& path) {
+	std::FILE* file = std::fopen(path.c_str(), "rb");
+	if (file == nullptr) {
+		throw std::runtime_error(std::format("cannot open {}", path.string()));
+	}
+	vBytes bytes(fs::file_size(path));
+	const std::size_t got = std::fread(bytes.data(), 1, bytes.size(), file);
+	std::fclose(file);
+	if (got != bytes.size()) {
+		throw std::runtime_error(std::format("short read from {}", path.string()));
+	}
+	return bytes;
+}
+
+void testFolderArchiveRoundTrip() {
+	const fs::path tmp = fs::temp_directory_path()
+		/ std::format("pdvzip-folder-test-{}", ::getpid());
+	const fs::path folder = tmp / "photos";
+	fs::create_directories(folder / "raw");
+	std::string notes;
+	for (int i = 0; i < 2000; ++i) {
+		notes += std::format("line {} of the notes\n", i);
+	}
+	writeTextFile(folder / "notes.txt", notes);
+	writeTextFile(folder / "raw" / "empty.dat", "");
+	writeTextFile(folder / "raw" / "shot.jpg", "not really a jpeg");
+
+	try {
+		const BuiltArchive archive = buildFolderArchive(folder);
+		expectTrue(archive.first_filename == "photos/", "folder archive starts with the folder itself");
+		expectTrue(archive.entries.size() == 5, "folder archive holds every file and folder");
+
+		// Embed it and read the archive back out of the finished image, where
+		// its offsets count from the start of the file.
+		const vBytes image(64, Byte{0x2A});
+		vBytes script(32, Byte{0x20});
+		const PolyglotSegments polyglot = embedBuiltArchive(image, std::move(script), archive);
+		const vBytes output = concatenateSegments(polyglot);
+		const ArchiveMetadata metadata = analyzeArchive(output, true);
+		expectTrue(metadata.file_type == FileType::FOLDER, "embedded folder archive is classified as a folder");
+		expectTrue(metadata.first_filename == "photos/", "embedded folder archive keeps its first entry");
+
+		// IDAT name, archive, IDAT CRC, IEND.
+		const std::size_t idat_start = output.size() - 16 - polyglot.archive_unchanged.size()
+			- polyglot.patched_directory.size() - 4;
+		const uint32_t expected_crc = static_cast<uint32_t>(::crc32(0L,
+			reinterpret_cast<const Bytef*>(output.data() + idat_start),
+			static_cast<uInt>(output.size() - 16 - idat_start)));
+		expectTrue(readValueAt(output, output.size() - 16, 4) == expected_crc,
+			"embedded folder archive has the right IDAT CRC");
+	}
+	catch (const std::exception& e) {
+		std::println(std::cerr, "FAIL: folder archive round trip: {}", e.what());
+		++g_failures;
+	}
+	fs::remove_all(tmp);
+
+	BuiltArchive oversized;
+	oversized.entries.resize(UINT16_MAX, BuiltArchive::Entry{ .name = "a" });
+	expectThrows([&] {
+		(void)writeBuiltCentralDirectory(oversized, 0, 0);
+	}, "central directory refuses 65535 entries without ZIP64");
+}
+
+// Raw DEFLATE from zlib, one stream per call.
+vBytes zlibDeflate(std::span<const Byte> input, int level, int strategy) {
+	z_stream stream{};
+	if (::deflateInit2(&stream, level, Z_DEFLATED, -15, 9, strategy) != Z_OK) {
+		throw std::runtime_error("deflateInit2 failed");
+	}
+	vBytes out(::deflateBound(&stream, static_cast<uLong>(input.size())));
+	stream.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(input.data()));
+	stream.avail_in = static_cast<uInt>(input.size());
+	stream.next_out = reinterpret_cast<Bytef*>(out.data());
+	stream.avail_out = static_cast<uInt>(out.size());
+	const int status = ::deflate(&stream, Z_FINISH);
+	out.resize(stream.total_out);
+	::deflateEnd(&stream);
+	if (status != Z_STREAM_END) {
+		throw std::runtime_error("deflate did not finish");
+	}
+	return out;
+}
+
+// Raw inflate with zlib as the reference decoder; nullopt when zlib rejects
+// the stream or it does not end.
+std::optional<vBytes> zlibInflate(std::span<const Byte> input, std::size_t output_size) {
+	z_stream stream{};
+	if (::inflateInit2(&stream, -15) != Z_OK) {
+		throw std::runtime_error("inflateInit2 failed");
+	}
+	vBytes out(output_size + 1);
+	stream.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(input.data()));
+	stream.avail_in = static_cast<uInt>(input.size());
+	stream.next_out = reinterpret_cast<Bytef*>(out.data());
+	stream.avail_out = static_cast<uInt>(out.size());
+	const int status = ::inflate(&stream, Z_FINISH);
+	out.resize(stream.total_out);
+	::inflateEnd(&stream);
+	if (status != Z_STREAM_END) {
+		return std::nullopt;
+	}
+	return out;
+}
+
+// Decode with inflateWholeBuffer and zlib, and require both to agree with
+// the original bytes, consume the same input, and reject the same cuts.
+void expectInflateMatchesZlib(std::span<const Byte> original, std::span<const Byte> stream, std::string_view label) {
+	vBytes output(original.size());
+	const InflateResult result = inflateWholeBuffer(stream, output);
+	expectTrue(result.status == InflateStatus::ok, std::format("{}: inflates", label));
+	expectTrue(result.consumed == stream.size(), std::format("{}: consumes the whole stream", label));
+	expectTrue(result.produced == original.size() && std::ranges::equal(output, original),
+		std::format("{}: output matches", label));
+	const std::optional<vBytes> reference = zlibInflate(stream, original.size());
+	expectTrue(reference && std::ranges::equal(*reference, output), std::format("{}: zlib agrees", label));
+
+	vBytes trailing(stream.begin(), stream.end());
+	trailing.insert(trailing.end(), { 0xDE, 0xAD, 0xBE, 0xEF, 0x00, 0xFF });
+	const InflateResult with_trailing = inflateWholeBuffer(trailing, output);
+	expectTrue(with_trailing.status == InflateStatus::ok && with_trailing.consumed == stream.size(),
+		std::format("{}: stops at the final block with input left over", label));
+
+	for (const std::size_t cut : { std::size_t{0}, std::size_t{1}, stream.size() / 2, stream.size() - 1 }) {
+		if (cut >= stream.size()) {
+			continue;
+		}
+		const InflateResult truncated = inflateWholeBuffer(stream.first(cut), output);
+		expectTrue(truncated.status == InflateStatus::truncated || truncated.status == InflateStatus::corrupt,
+			std::format("{}: rejects the stream cut to {} bytes", label, cut));
+		expectTrue(!zlibInflate(stream.first(cut), original.size()), std::format("{}: zlib rejects the same cut", label));
+	}
+
+	if (!original.empty()) {
+		vBytes short_output(original.size() - 1);
+		expectTrue(inflateWholeBuffer(stream, short_output).status == InflateStatus::output_full,
+			std::format("{}: reports a full output buffer", label));
+	}
+}
+
+// LSB-first bit writer for hand-built DEFLATE blocks. Huffman codes are
+// given MSB-first, as RFC 1951 defines them, and reversed on the way out.
+struct DeflateBitWriter {
+	vBytes bytes;
+	uint32_t buffer = 0;
+	unsigned count = 0;
+
+	void bits(uint32_t value, unsigned length) {
+		for (unsigned i = 0; i < length; ++i) {
+			buffer |= ((value >> i) & 1U) << count;
+			if (++count == 8) {
+				bytes.push_back(static_cast<Byte>(buffer));
+				buffer = 0;
+				count = 0;
+			}
+		}
+	}
+
+	void code(uint32_t value, unsigned length) {
+		for (unsigned i = length; i-- > 0;) {
+			bits((value >> i) & 1U, 1);
+		}
+	}
+
+	vBytes finish() {
+		if (count != 0) {
+			bytes.push_back(static_cast<Byte>(buffer));
+		}
+		return std::move(bytes);
+	}
+};
+
+// Canonical Huffman codes for a set of code lengths (RFC 1951 3.2.2).
+std::vector<uint32_t> canonicalCodes(std::span<const unsigned> lengths) {
+	std::array<uint32_t, 16> length_count{};
+	for (const unsigned length : lengths) {
+		++length_count[length];
+	}
+	length_count[0] = 0;
+	std::array<uint32_t, 16> next_code{};
+	uint32_t code = 0;
+	for (std::size_t bits = 1; bits < next_code.size(); ++bits) {
+		code = (code + length_count[bits - 1]) << 1;
+		next_code[bits] = code;
+	}
+	std::vector<uint32_t> codes(lengths.size());
+	for (std::size_t symbol = 0; symbol < lengths.size(); ++symbol) {
+		if (lengths[symbol] != 0) {
+			codes[symbol] = next_code[lengths[symbol]]++;
+		}
+	}
+	return codes;
+}
+
+// One dynamic block whose distance code needs the decoder's subtables (9 and
+// 10-bit codes against an 8-bit main table) and reaches back the full 32 KiB
+// window. The literals are pseudo-random 'a'..'h', so a wrong distance would
+// copy the wrong bytes. first_distance is 32768 for the valid stream.
+vBytes handBuiltDynamicBlock(std::size_t literal_count, uint32_t first_distance, vBytes& expected) {
+	// Literal/length code: 'a'..'h' at 4 bits, end-of-block and length 3 at 2.
+	std::vector<unsigned> litlen_lengths(258, 0);
+	for (unsigned c = 'a'; c <= 'h'; ++c) {
+		litlen_lengths[c] = 4;
+	}
+	litlen_lengths[256] = 2;
+	litlen_lengths[257] = 2;
+	// Distance code: symbols 0-7 at 1-8 bits, 8 at 9 bits, 9 and 29 at 10.
+	std::vector<unsigned> dist_lengths(30, 0);
+	for (unsigned symbol = 0; symbol < 8; ++symbol) {
+		dist_lengths[symbol] = symbol + 1;
+	}
+	dist_lengths[8] = 9;
+	dist_lengths[9] = 10;
+	dist_lengths[29] = 10;
+	// Code-length code: 0-13, 17 and 18 at 4 bits each, a complete code.
+	std::vector<unsigned> precode_lengths(19, 0);
+	for (unsigned symbol = 0; symbol <= 13; ++symbol) {
+		precode_lengths[symbol] = 4;
+	}
+	precode_lengths[17] = 4;
+	precode_lengths[18] = 4;
+
+	const std::vector<uint32_t> litlen_codes = canonicalCodes(litlen_lengths);
+	const std::vector<uint32_t> dist_codes = canonicalCodes(dist_lengths);
+	const std::vector<uint32_t> precodes = canonicalCodes(precode_lengths);
+
+	DeflateBitWriter out;
+	out.bits(1, 1);   // final block
+	out.bits(2, 2);   // dynamic Huffman
+	out.bits(static_cast<uint32_t>(litlen_lengths.size() - 257), 5);
+	out.bits(static_cast<uint32_t>(dist_lengths.size() - 1), 5);
+	out.bits(19 - 4, 4);
+	constexpr std::array<unsigned, 19> PRECODE_ORDER = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+	for (const unsigned symbol : PRECODE_ORDER) {
+		out.bits(precode_lengths[symbol], 3);
+	}
+
+	std::vector<unsigned> all_lengths = litlen_lengths;
+	all_lengths.insert(all_lengths.end(), dist_lengths.begin(), dist_lengths.end());
+	for (std::size_t i = 0; i < all_lengths.size();) {
+		std::size_t run = 1;
+		while (i + run < all_lengths.size() && all_lengths[i + run] == all_lengths[i]) {
+			++run;
+		}
+		if (all_lengths[i] == 0 && run >= 11) {
+			run = std::min<std::size_t>(run, 138);
+			out.code(precodes[18], 4);
+			out.bits(static_cast<uint32_t>(run - 11), 7);
+		} else if (all_lengths[i] == 0 && run >= 3) {
+			out.code(precodes[17], 4);
+			out.bits(static_cast<uint32_t>(run - 3), 3);
+		} else {
+			run = 1;
+			out.code(precodes[all_lengths[i]], 4);
+		}
+		i += run;
+	}
+
+	uint32_t seed = 12345;
+	expected.clear();
+	for (std::size_t i = 0; i < literal_count; ++i) {
+		seed = seed * 1103515245U + 12345U;
+		const auto literal = static_cast<unsigned>('a' + ((seed >> 16) & 7U));
+		out.code(litlen_codes[literal], litlen_lengths[literal]);
+		expected.push_back(static_cast<Byte>(literal));
+	}
+
+	// Length 3 (symbol 257) at each distance, by its distance symbol and extra bits.
+	struct Match { unsigned symbol; uint32_t base; unsigned extra_bits; uint32_t distance; };
+	const std::array<Match, 3> matches = {{
+		{ 29, 24577, 13, first_distance },
+		{ 8, 17, 3, 22 },
+		{ 9, 25, 3, 32 },
+	}};
+	for (const Match& match : matches) {
+		out.code(litlen_codes[257], litlen_lengths[257]);
+		out.code(dist_codes[match.symbol], dist_lengths[match.symbol]);
+		out.bits(match.distance - match.base, match.extra_bits);
+		for (int k = 0; k < 3; ++k) {
+			expected.push_back(match.distance <= expected.size() ? expected[expected.size() - match.distance] : Byte{0});
+		}
+	}
+	out.code(litlen_codes[256], litlen_lengths[256]);
+	return out.finish();
+}
+
+void testInflateMatchesZlib() {
+	// Text-like input: long matches and a dynamic block per chunk of symbols.
+	vBytes text;
+	for (int i = 0; i < 6000; ++i) {
+		appendBytes(text, std::format("entry {} of {}: {}\n", i, i % 97, i * 7919 % 10007));
+	}
+	// Random bytes around the stored-block size limit of 65,535 bytes.
+	vBytes noise(70000);
+	uint32_t seed = 1;
+	for (Byte& b : noise) {
+		seed = seed * 1103515245U + 12345U;
+		b = static_cast<Byte>(seed >> 24);
+	}
+	// Literals with Fibonacci frequencies over 20 symbols, shuffled: the
+	// Huffman-only code for them is as deep as zlib allows (15 bits), past
+	// the decoder's 11-bit main literal/length table.
+	vBytes skewed;
+	uint32_t fib_a = 1;
+	uint32_t fib_b = 1;
+	for (Byte symbol = 0; symbol < 20; ++symbol) {
+		skewed.insert(skewed.end(), fib_a, static_cast<Byte>('A' + symbol));
+		fib_a = std::exchange(fib_b, fib_a + fib_b);
+	}
+	for (std::size_t i = skewed.size() - 1; i > 0; --i) {
+		seed = seed * 1103515245U + 12345U;
+		std::swap(skewed[i], skewed[(seed >> 8) % (i + 1)]);
+	}
+
+	const vBytes empty;
+	expectInflateMatchesZlib(empty, zlibDeflate(empty, 6, Z_DEFAULT_STRATEGY), "empty input");
+	expectInflateMatchesZlib(noise, zlibDeflate(noise, 0, Z_DEFAULT_STRATEGY), "stored blocks");
+	expectInflateMatchesZlib(text, zlibDeflate(text, 6, Z_FIXED), "fixed Huffman blocks");
+	expectInflateMatchesZlib(text, zlibDeflate(text, 9, Z_DEFAULT_STRATEGY), "dynamic Huffman blocks");
+	expectInflateMatchesZlib(noise, zlibDeflate(noise, 9, Z_DEFAULT_STRATEGY), "dynamic blocks over random bytes");
+	expectInflateMatchesZlib(skewed, zlibDeflate(skewed, 9, Z_HUFFMAN_ONLY), "15-bit literal codes");
+	expectInflateMatchesZlib(text, zlibDeflate(text, 9, Z_RLE), "run-length matches");
+	for (const std::size_t size : { std::size_t{1}, std::size_t{2}, std::size_t{3}, std::size_t{258}, std::size_t{259} }) {
+		const vBytes run(size, Byte{'r'});
+		expectInflateMatchesZlib(run, zlibDeflate(run, 9, Z_DEFAULT_STRATEGY), std::format("{}-byte run", size));
+	}
+
+	vBytes expected;
+	const vBytes edge = handBuiltDynamicBlock(32768, 32768, expected);
+	expectInflateMatchesZlib(expected, edge, "32 KiB distance through distance subtables");
+
+	const vBytes too_far = handBuiltDynamicBlock(32767, 32768, expected);
+	vBytes output(expected.size());
+	expectTrue(inflateWholeBuffer(too_far, output).status == InflateStatus::corrupt,
+		"distance before the start of the output is corrupt");
+	expectTrue(!zlibInflate(too_far, expected.size()), "zlib rejects the same distance");
+}
+
+vBytes pseudoRandomBytes(std::size_t size, uint32_t seed) {
+	vBytes bytes(size);
+	for (Byte& b : bytes) {
+		seed = seed * 1103515245U + 12345U;
+		b = static_cast<Byte>(seed >> 23);
+	}
+	return bytes;
+}
+
+uint32_t zlibCrc32(std::span<const Byte> data, uint32_t crc = 0) {
+	// zlib's length is a uInt; feed it in pieces that fit.
+	while (!data.empty()) {
+		const std::size_t piece = std::min<std::size_t>(data.size(), 1U << 30);
+		crc = static_cast<uint32_t>(::crc32(crc, reinterpret_cast<const Bytef*>(data.data()), static_cast<uInt>(piece)));
+		data = data.subspan(piece);
+	}
+	return crc;
+}
+
+void testCrc32MatchesZlib() {
+	const vBytes data = pseudoRandomBytes(8 * 1024 + 64, 7);
+	std::vector<std::size_t> lengths;
+	for (std::size_t length = 0; length <= 600; ++length) {
+		lengths.push_back(length);
+	}
+	for (std::size_t length = 601; length <= 8 * 1024; length += 61) {
+		lengths.push_back(length);
+	}
+
+	// Each kernel on its own: every length from 0 up past the widest fold,
+	// at every start offset within a 64-byte line, fresh and resumed.
+	for (const crc32_internal::NamedKernel& kernel : crc32_internal::availableKernels()) {
+		int mismatches = 0;
+		for (std::size_t offset = 0; offset < 64; offset += (offset < 16 ? 1 : 16)) {
+			for (const std::size_t length : lengths) {
+				const std::span<const Byte> bytes = std::span<const Byte>(data).subspan(offset, length);
+				const uint32_t fresh = kernel.kernel(0xFFFFFFFFU, bytes.data(), bytes.size()) ^ 0xFFFFFFFFU;
+				const uint32_t resumed = kernel.kernel(0xDEADBEEFU ^ 0xFFFFFFFFU, bytes.data(), bytes.size()) ^ 0xFFFFFFFFU;
+				mismatches += fresh != zlibCrc32(bytes);
+				mismatches += resumed != zlibCrc32(bytes, 0xDEADBEEFU);
+			}
+		}
+		expectTrue(mismatches == 0, std::format("{} CRC-32 kernel matches zlib", kernel.name));
+	}
+
+	int mismatches = 0;
+	for (const std::size_t length : lengths) {
+		const std::span<const Byte> bytes = std::span<const Byte>(data).subspan(3, length);
+		mismatches += crc32Update(0, bytes) != zlibCrc32(bytes);
+	}
+	expectTrue(mismatches == 0, "crc32Update matches zlib");
+
+	// Combining the CRCs of two parts gives the single-pass CRC, at every
+	// kind of split: empty either side, short, and long.
+	mismatches = 0;
+	const std::span<const Byte> whole = std::span<const Byte>(data).first(5000);
+	const uint32_t whole_crc = zlibCrc32(whole);
+	for (const std::size_t split : std::to_array<std::size_t>({ 0, 1, 7, 64, 100, 1023, 4096, 4999, 5000 })) {
+		const uint32_t head = zlibCrc32(whole.first(split));
+		const uint32_t tail = zlibCrc32(whole.subspan(split));
+		mismatches += crc32Combine(head, tail, whole.size() - split) != whole_crc;
+		Crc32 running(head);
+		running.combine(tail, whole.size() - split);
+		mismatches += running.value() != whole_crc;
+	}
+	expectTrue(mismatches == 0, "crc32Combine matches a single pass");
+	expectTrue(crc32Combine(zlibCrc32(whole), 0, 0) == whole_crc, "combining an empty block changes nothing");
+
+	// Sliced CRCs, whatever the core count of the machine running the test.
+	const vBytes large = pseudoRandomBytes(3 * 1024 * 1024 + 37, 11);
+	const uint32_t large_crc = zlibCrc32(large);
+	mismatches = 0;
+	for (const std::size_t slices : std::to_array<std::size_t>({ 2, 3, 7, 16 })) {
+		mismatches += crc32_internal::crc32UpdateInSlices(0, large, slices) != large_crc;
+		mismatches += crc32_internal::crc32UpdateInSlices(0x12345678U, large, slices) != zlibCrc32(large, 0x12345678U);
+	}
+	expectTrue(mismatches == 0, "sliced CRC-32 matches a single pass");
+
+	// Past the default 64 MiB parallel threshold, through the public entry point.
+	const vBytes huge = pseudoRandomBytes(65 * 1024 * 1024 + 5, 13);
+	expectTrue(crc32Update(0, huge) == zlibCrc32(huge), "crc32Update above the slicing threshold matches zlib");
+}
+
+// The archive segment is copied from its file kernel-side. If that file no
+// longer holds the bytes that were validated, the copy must not be kept.
+void testKernelCopyChecksCopiedBytes() {
+	const fs::path tmp = fs::temp_directory_path()
+		/ std::format("pdvzip-copy-test-{}", ::getpid());
+	fs::create_directories(tmp);
+	const fs::path previous = fs::current_path();
+	fs::current_path(tmp);
+
+	const vBytes validated(256 * 1024, Byte{0x42});
+	const vBytes header(100, Byte{0x11});
+	const auto writeFromFile = [&](std::string_view file_contents) {
+		const fs::path source = tmp / "archive.zip";
+		writeTextFile(source, file_contents);
+		const int fd = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+		const std::array<OutputSegment, 2> segments{
+			OutputSegment{ .bytes = header },
+			OutputSegment{ .bytes = validated, .source_fd = fd, .source_offset = 0, .source_crc = zlibCrc32(validated) },
+		};
+		bool threw = false;
+		try {
+			(void)writePolyglotFile(segments, true);
+		}
+		catch (const std::exception&) {
+			threw = true;
+		}
+		::close(fd);
+		return threw;
+	};
+
+	const std::string same(validated.size(), '\x42');
+	std::string changed = same;
+	changed[validated.size() / 2] = '\x43';
+	expectTrue(!writeFromFile(same), "kernel copy of an unchanged archive is written");
+	expectTrue(directoryHasPolyglotOutput(tmp), "kernel copy of an unchanged archive leaves its output");
+	for (const auto& entry : fs::directory_iterator(tmp)) {
+		if (entry.path().filename() != "archive.zip") {
+			fs::remove(entry.path());
+		}
+	}
+	expectTrue(writeFromFile(changed), "kernel copy of an archive changed since validation is refused");
+	expectTrue(!directoryHasPolyglotOutput(tmp), "refused kernel copy leaves no output file");
+
+	// Neither copy_file_range nor sendfile reads from a pipe (EINVAL), so the
+	// segment is written from memory, and is still checked.
+	const auto writeFromMemory = [&](const vBytes& bytes) {
+		int pipe_fds[2];
+		if (::pipe(pipe_fds) != 0) {
+			throw std::runtime_error("pipe failed");
+		}
+		const std::array<OutputSegment, 2> segments{
+			OutputSegment{ .bytes = header },
+			OutputSegment{ .bytes = bytes, .source_fd = pipe_fds[0], .source_offset = 0, .source_crc = zlibCrc32(validated) },
+		};
+		bool threw = false;
+		try {
+			(void)writePolyglotFile(segments, true);
+		}
+		catch (const std::exception&) {
+			threw = true;
+		}
+		::close(pipe_fds[0]);
+		::close(pipe_fds[1]);
+		return threw;
+	};
+	vBytes changed_in_memory = validated;
+	changed_in_memory[7] ^= 1;
+	expectTrue(writeFromMemory(changed_in_memory), "memory fallback of a changed archive is refused");
+	expectTrue(!directoryHasPolyglotOutput(tmp), "refused memory fallback leaves no output file");
+	expectTrue(!writeFromMemory(validated), "memory fallback is used when the kernel cannot copy");
+	expectTrue(directoryHasPolyglotOutput(tmp), "memory fallback leaves its output");
+
+	fs::current_path(previous);
+	fs::remove_all(tmp);
+}
+
+void appendBe32(vBytes& out, uint32_t value) {
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		out.push_back(static_cast<Byte>(value >> shift));
+	}
+}
+
+void appendPngChunk(vBytes& png, std::string_view type, std::span<const Byte> data) {
+	appendBe32(png, static_cast<uint32_t>(data.size()));
+	const std::size_t type_index = png.size();
+	appendBytes(png, type);
+	png.insert(png.end(), data.begin(), data.end());
+	appendBe32(png, zlibCrc32(std::span<const Byte>(png).subspan(type_index)));
+}
+
+// Filtered scanlines (filter type 0) of an indexed image, all palette index 0
+// except a diagonal, so the stream has some content to it.
+vBytes indexedScanlines(uint32_t width, uint32_t height, unsigned bit_depth) {
+	const std::size_t row_bytes = (static_cast<std::size_t>(width) * bit_depth + 7) / 8;
+	vBytes rows;
+	for (uint32_t y = 0; y < height; ++y) {
+		rows.push_back(0);
+		for (std::size_t x = 0; x < row_bytes; ++x) {
+			rows.push_back(x == y % row_bytes ? Byte{1} : Byte{0});
+		}
+	}
+	return rows;
+}
+
+vBytes zlibCompress(std::span<const Byte> data) {
+	uLongf size = ::compressBound(static_cast<uLong>(data.size()));
+	vBytes out(size);
+	if (::compress2(out.data(), &size, data.data(), static_cast<uLong>(data.size()), 9) != Z_OK) {
+		throw std::runtime_error("compress2 failed");
+	}
+	out.resize(size);
+	return out;
+}
+
+struct IndexedPngParts {
+	uint32_t width = 68;
+	uint32_t height = 68;
+	Byte bit_depth = 8;
+	std::size_t palette_entries = 16;
+	std::vector<vBytes> idat_chunks{};   // empty: one IDAT of the compressed scanlines
+	bool plte_after_idat = false;
+	bool with_iend = true;
+};
+
+vBytes makeIndexedPng(const IndexedPngParts& parts) {
+	vBytes png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	vBytes ihdr;
+	appendBe32(ihdr, parts.width);
+	appendBe32(ihdr, parts.height);
+	ihdr.insert(ihdr.end(), { parts.bit_depth, 3, 0, 0, 0 });
+	appendPngChunk(png, "IHDR", ihdr);
+
+	vBytes palette;
+	for (std::size_t i = 0; i < parts.palette_entries; ++i) {
+		palette.insert(palette.end(), { static_cast<Byte>(i), static_cast<Byte>(255 - i), 0x80 });
+	}
+	const std::vector<vBytes> idats = parts.idat_chunks.empty()
+		? std::vector<vBytes>{ zlibCompress(indexedScanlines(parts.width, parts.height, parts.bit_depth)) }
+		: parts.idat_chunks;
+	if (!parts.plte_after_idat) {
+		appendPngChunk(png, "PLTE", palette);
+	}
+	for (const vBytes& idat : idats) {
+		appendPngChunk(png, "IDAT", idat);
+	}
+	if (parts.plte_after_idat) {
+		appendPngChunk(png, "PLTE", palette);
+	}
+	if (parts.with_iend) {
+		appendPngChunk(png, "IEND", {});
+	}
+	return png;
+}
+
+// The indexed-cover fast path never decodes pixels, so the chunk checks stand
+// in for the decoder and --verify-cover's streamed inflate for its pixel checks.
+void testIndexedCoverFastPath() {
+	using image_processing_internal::validateIndexedPngChunks;
+	using image_processing_internal::verifyIndexedPixelData;
+
+	const vBytes valid = makeIndexedPng({});
+	try {
+		validateIndexedPngChunks(valid);
+		verifyIndexedPixelData(valid);
+	}
+	catch (const std::exception& e) {
+		std::println(std::cerr, "FAIL: valid indexed cover rejected: {}", e.what());
+		++g_failures;
+	}
+
+	expectThrows([] { validateIndexedPngChunks(makeIndexedPng({ .with_iend = false })); },
+		"indexed cover without IEND is rejected");
+	expectThrows([] {
+		vBytes png = makeIndexedPng({ .with_iend = false });
+		appendPngChunk(png, "tEXt", std::span<const Byte>());
+		validateIndexedPngChunks(png);
+	}, "indexed cover ending before IEND is rejected");
+	expectThrows([] {
+		// Signature, IHDR, PLTE and IEND only: the archive would become its only IDAT.
+		const vBytes full = makeIndexedPng({});
+		vBytes png(full.begin(), full.begin() + 8 + 25 + 12 + 48);
+		appendPngChunk(png, "IEND", {});
+		validateIndexedPngChunks(png);
+	}, "indexed cover without IDAT is rejected");
+	expectThrows([] { validateIndexedPngChunks(makeIndexedPng({ .plte_after_idat = true })); },
+		"indexed cover with its PLTE after the image data is rejected");
+	expectThrows([] { validateIndexedPngChunks(makeIndexedPng({ .bit_depth = 2, .palette_entries = 5 })); },
+		"PLTE with more entries than the bit depth can index is rejected");
+	expectThrows([] { validateIndexedPngChunks(makeIndexedPng({ .palette_entries = 257 })); },
+		"PLTE with more than 256 entries is rejected");
+	try {
+		validateIndexedPngChunks(makeIndexedPng({ .bit_depth = 2, .palette_entries = 4 }));
+	}
+	catch (const std::exception& e) {
+		std::println(std::cerr, "FAIL: full 2-bit palette rejected: {}", e.what());
+		++g_failures;
+	}
+	expectThrows([&] {
+		vBytes png = valid;
+		png[8 + 25 + 12 + 10] ^= 0x01;   // a PLTE byte, CRC left as it was
+		validateIndexedPngChunks(png);
+	}, "chunk with a bad CRC is rejected");
+	expectThrows([] {
+		vBytes stream = zlibCompress(indexedScanlines(68, 68, 8));
+		stream[1] ^= 0x01;   // FCHECK no longer holds
+		validateIndexedPngChunks(makeIndexedPng({ .idat_chunks = { stream } }));
+	}, "image data without a valid zlib header is rejected");
+
+	const vBytes scanlines = indexedScanlines(68, 68, 8);
+	const vBytes stream = zlibCompress(scanlines);
+	expectThrows([&] {
+		const vBytes cut(stream.begin(), stream.end() - 10);
+		verifyIndexedPixelData(makeIndexedPng({ .idat_chunks = { cut } }));
+	}, "truncated image data fails --verify-cover");
+	expectThrows([] {
+		verifyIndexedPixelData(makeIndexedPng({ .idat_chunks = { zlibCompress(indexedScanlines(68, 69, 8)) } }));
+	}, "image data for more rows than the IHDR fails --verify-cover");
+	expectThrows([] {
+		verifyIndexedPixelData(makeIndexedPng({ .idat_chunks = { zlibCompress(indexedScanlines(68, 67, 8)) } }));
+	}, "image data for fewer rows than the IHDR fails --verify-cover");
+	expectThrows([&] {
+		vBytes damaged = stream;
+		damaged[damaged.size() - 1] ^= 0xFF;   // Adler-32
+		verifyIndexedPixelData(makeIndexedPng({ .idat_chunks = { damaged } }));
+	}, "image data with a bad Adler-32 fails --verify-cover");
+
+	try {
+		// The stream split into one-byte IDAT chunks.
+		std::vector<vBytes> pieces;
+		for (const Byte b : stream) {
+			pieces.push_back(vBytes{ b });
+		}
+		const vBytes split = makeIndexedPng({ .idat_chunks = pieces });
+		validateIndexedPngChunks(split);
+		verifyIndexedPixelData(split);
+
+		// Exactly 64 KiB of scanlines, filling the check's scratch buffer at the end.
+		const vBytes exact = makeIndexedPng({ .width = 255, .height = 256 });
+		verifyIndexedPixelData(exact);
+
+		// Sub-byte pixels pad each scanline to a whole byte.
+		verifyIndexedPixelData(makeIndexedPng({ .width = 70, .height = 69, .bit_depth = 1, .palette_entries = 2 }));
+	}
+	catch (const std::exception& e) {
+		std::println(std::cerr, "FAIL: valid indexed image data rejected: {}", e.what());
+		++g_failures;
+	}
+}
+
+// A two-entry stored archive closed by a ZIP64 end of central directory
+// record and locator. The second entry's local header offset lives in its
+// ZIP64 extra field; the EOCD fields are saturated unless overridden.
+struct Zip64Fixture {
+	vBytes zip;
+	std::size_t second_local = 0;
+	std::size_t offset_value = 0;    // the second entry's 8-byte extra-field offset
+	std::size_t central_start = 0;
+	std::size_t zip64_record = 0;
+	std::size_t locator = 0;
+};
+
+struct Zip64FixtureOptions {
+	uint16_t eocd_total_records = UINT16_MAX;
+	uint32_t eocd_central_offset = UINT32_MAX;
+	uint16_t extra_value_size = 8;
+	bool zip64_record = true;
+	bool zip64_size_matches = true;
+};
+
+Zip64Fixture makeZip64Fixture(const Zip64FixtureOptions& options = {}) {
+	constexpr std::array<std::pair<std::string_view, std::string_view>, 2> entries = {{
+		{ "a.txt", "first entry" },
+		{ "b.txt", "second entry" },
+	}};
+	Zip64Fixture fixture;
+	vBytes& zip = fixture.zip;
+	std::array<uint32_t, 2> crcs{};
+	std::array<std::size_t, 2> local_offsets{};
+	for (std::size_t i = 0; i < entries.size(); ++i) {
+		const auto [name, payload] = entries[i];
+		crcs[i] = zlibCrc32(std::span(reinterpret_cast<const Byte*>(payload.data()), payload.size()));
+		local_offsets[i] = zip.size();
+		appendLe32(zip, ZIP_LOCAL_FILE_HEADER_SIGNATURE);
+		appendLe16(zip, 20);
+		appendLe16(zip, 0);
+		appendLe16(zip, 0);
+		appendLe16(zip, 0);
+		appendLe16(zip, 0);
+		appendLe32(zip, crcs[i]);
+		appendLe32(zip, static_cast<uint32_t>(payload.size()));
+		appendLe32(zip, static_cast<uint32_t>(payload.size()));
+		appendLe16(zip, static_cast<uint16_t>(name.size()));
+		appendLe16(zip, 0);
+		appendBytes(zip, name);
+		appendBytes(zip, payload);
+	}
+	fixture.second_local = local_offsets[1];
+
+	fixture.central_start = zip.size();
+	for (std::size_t i = 0; i < entries.size(); ++i) {
+		const auto [name, payload] = entries[i];
+		const bool in_extra = i == 1;
+		appendLe32(zip, ZIP_CENTRAL_DIRECTORY_SIGNATURE);
+		appendLe16(zip, 0x0314);
+		appendLe16(zip, in_extra ? 45 : 20);
+		appendLe16(zip, 0);
+		appendLe16(zip, 0);
+		appendLe16(zip, 0);
+		appendLe16(zip, 0);
+		appendLe32(zip, crcs[i]);
+		appendLe32(zip, static_cast<uint32_t>(payload.size()));
+		appendLe32(zip, static_cast<uint32_t>(payload.size()));
+		appendLe16(zip, static_cast<uint16_t>(name.size()));
+		appendLe16(zip, in_extra ? static_cast<uint16_t>(4 + options.extra_value_size) : 0);
+		appendLe16(zip, 0);
+		appendLe16(zip, 0);
+		appendLe16(zip, 0);
+		appendLe32(zip, static_cast<uint32_t>(0100644) << 16);
+		appendLe32(zip, in_extra ? UINT32_MAX : static_cast<uint32_t>(local_offsets[i]));
+		appendBytes(zip, name);
+		if (in_extra) {
+			appendLe16(zip, 0x0001);
+			appendLe16(zip, options.extra_value_size);
+			fixture.offset_value = zip.size();
+			if (options.extra_value_size == 8) {
+				appendLe64(zip, local_offsets[i]);
+			}
+			else {
+				zip.resize(zip.size() + options.extra_value_size);
+			}
+		}
+	}
+	const std::size_t central_size = zip.size() - fixture.central_start;
+
+	if (options.zip64_record) {
+		fixture.zip64_record = zip.size();
+		appendLe32(zip, ZIP64_END_CENTRAL_DIRECTORY_SIGNATURE);
+		appendLe64(zip, options.zip64_size_matches ? 44 : 52);
+		appendLe16(zip, 0x0314);
+		appendLe16(zip, 45);
+		appendLe32(zip, 0);
+		appendLe32(zip, 0);
+		appendLe64(zip, entries.size());
+		appendLe64(zip, entries.size());
+		appendLe64(zip, central_size);
+		appendLe64(zip, fixture.central_start);
+
+		fixture.locator = zip.size();
+		appendLe32(zip, ZIP64_END_CENTRAL_LOCATOR_SIGNATURE);
+		appendLe32(zip, 0);
+		appendLe64(zip, fixture.zip64_record);
+		appendLe32(zip, 1);
+	}
+
+	appendLe32(zip, ZIP_END_CENTRAL_DIRECTORY_SIGNATURE);
+	appendLe16(zip, 0);
+	appendLe16(zip, 0);
+	appendLe16(zip, options.eocd_total_records);
+	appendLe16(zip, options.eocd_total_records);
+	appendLe32(zip, UINT32_MAX);
+	appendLe32(zip, options.eocd_central_offset);
+	appendLe16(zip, 0);
+	return fixture;
+}
+
+void testZip64ArchiveIsRelocated() {
+	try {
+		const Zip64Fixture fixture = makeZip64Fixture();
+		const ArchiveMetadata metadata = analyzeArchive(fixture.zip, true);
+		const ZipDirectoryIndex& directory = metadata.directory;
+		expectTrue(directory.zip64_eocd_offset == fixture.zip64_record, "ZIP64 record is found through its locator");
+		expectTrue(directory.central_start == fixture.central_start, "ZIP64 record supplies the central offset");
+		expectTrue(directory.local_header_offsets.size() == 2
+			&& directory.local_header_offsets[1] == fixture.second_local,
+			"ZIP64 extra field supplies the local header offset");
+		expectTrue(directory.zip64_offset_slots.size() == 1
+			&& directory.zip64_offset_slots[0].record == 1
+			&& directory.zip64_offset_slots[0].field_offset == fixture.offset_value,
+			"ZIP64 offset slot points at the extra-field value");
+
+		// The archive sits just before the final IDAT CRC and the IEND chunk.
+		const vBytes image(64, Byte{0x2A});
+		vBytes script(32, Byte{0x20});
+		const PolyglotSegments polyglot = embedChunks(image, std::move(script), fixture.zip, directory);
+		const vBytes output = concatenateSegments(polyglot);
+		const std::size_t base = output.size() - 16 - fixture.zip.size();
+
+		expectTrue(readLe64(output, base + fixture.offset_value) == base + fixture.second_local,
+			"relocated ZIP64 extra field holds the new local header offset");
+		expectTrue(readLe32(output, base + fixture.central_start + 42) == base,
+			"relocated classic local header offset");
+		expectTrue(readLe64(output, base + fixture.zip64_record + 48) == base + fixture.central_start,
+			"relocated ZIP64 record holds the new central offset");
+		expectTrue(readLe64(output, base + fixture.locator + 8) == base + fixture.zip64_record,
+			"relocated locator points at the moved ZIP64 record");
+		expectTrue(readLe32(output, output.size() - 16 - 6) == UINT32_MAX,
+			"saturated EOCD central offset stays saturated");
+
+		const ArchiveMetadata embedded = analyzeArchive(output, true);
+		expectTrue(embedded.directory.local_header_offsets.size() == 2
+			&& embedded.directory.local_header_offsets[0] == base
+			&& embedded.directory.local_header_offsets[1] == base + fixture.second_local,
+			"embedded ZIP64 archive reads back at its new offsets");
+	}
+	catch (const std::exception& e) {
+		std::println(std::cerr, "FAIL: ZIP64 archive relocation: {}", e.what());
+		++g_failures;
+	}
+
+	// A classic field may repeat the ZIP64 value instead of saturating.
+	try {
+		(void)analyzeArchive(makeZip64Fixture({ .eocd_total_records = 2 }).zip, true);
+	}
+	catch (const std::exception& e) {
+		std::println(std::cerr, "FAIL: ZIP64 archive with a matching EOCD count rejected: {}", e.what());
+		++g_failures;
+	}
+
+	const auto rejects = [](const Zip64FixtureOptions& options, std::string_view expected, std::string_view label) {
+		const vBytes zip = makeZip64Fixture(options).zip;
+		expectThrowsWith([&] { (void)analyzeArchive(zip, true); }, expected, label);
+	};
+	rejects({ .eocd_total_records = 3 }, "disagree", "EOCD count that contradicts the ZIP64 record");
+	rejects({ .eocd_central_offset = 0 }, "disagree", "EOCD central offset that contradicts the ZIP64 record");
+	rejects({ .zip64_record = false }, "ZIP64 end of central directory record is missing",
+		"saturated EOCD without a ZIP64 record");
+	rejects({ .zip64_size_matches = false }, "Invalid ZIP64 end of central directory record",
+		"ZIP64 record whose size does not reach the locator");
+	rejects({ .extra_value_size = 4 }, "lacks the", "ZIP64 extra field too short for the saturated offset");
+}
+
+void insertPaths(std::initializer_list<std::string_view> names) {
+	archive_analysis_internal::PortablePathIndex paths;
+	std::size_t entry_number = 0;
+	for (const std::string_view name : names) {
+		paths.insert(name, ++entry_number);
+	}
+}
+
+void testPortablePathIndex() {
+	try {
+		insertPaths({ "docs/", "docs/readme.txt", "docs/img/", "docs/img/a.png", "docs/img/b.png",
+			"docs/imgs", "docs-old/readme.txt", "readme.txt", "a/b/c/d.txt", "a/b/e.txt" });
+		// A leading separator names the root, not an empty component.
+		insertPaths({ "/top.txt", "top/nested.txt" });
+	}
+	catch (const std::exception& e) {
+		std::println(std::cerr, "FAIL: distinct archive paths rejected: {}", e.what());
+		++g_failures;
+	}
+
+	expectThrowsWith([] { insertPaths({ "docs/readme.txt", "docs/readme.txt" }); },
+		"Duplicate or case-conflicting", "exact duplicate path");
+	expectThrowsWith([] { insertPaths({ "docs/", "docs/" }); },
+		"Duplicate or case-conflicting", "exact duplicate directory");
+	expectThrowsWith([] { insertPaths({ "Docs/ReadMe.txt", "docs/README.TXT" }); },
+		"Duplicate or case-conflicting", "case-only duplicate path");
+	expectThrowsWith([] { insertPaths({ "Docs/a.txt", "other.txt", "DOCS/A.TXT" }); },
+		"Duplicate or case-conflicting", "case-only duplicate after an unrelated entry");
+
+	// A file and a directory the same name implies, in both orders.
+	expectThrowsWith([] { insertPaths({ "a/b", "a/b/c.txt" }); },
+		"conflicts with an existing file path", "file listed before the directory it clashes with");
+	expectThrowsWith([] { insertPaths({ "a/b/c.txt", "a/b" }); },
+		"conflicts with an existing directory path", "file listed after the directory it clashes with");
+	expectThrowsWith([] { insertPaths({ "a/B/c.txt", "A/b" }); },
+		"conflicts with an existing directory path", "file clashing with a directory by case only");
+	// A listed file and directory of the same name share one node.
+	expectThrowsWith([] { insertPaths({ "a/b", "a/b/" }); },
+		"Duplicate or case-conflicting", "directory entry after a file of the same name");
+	expectThrowsWith([] { insertPaths({ "a/b/", "a/b" }); },
+		"Duplicate or case-conflicting", "file entry after a directory of the same name");
+
+	// Backslashes separate components just as slashes do.
+	expectThrowsWith([] { insertPaths({ "dir\\file.txt", "dir/file.txt" }); },
+		"Duplicate or case-conflicting", "backslash path duplicating a slash path");
+	expectThrowsWith([] { insertPaths({ "DIR/File.txt", "dir\\file.TXT" }); },
+		"Duplicate or case-conflicting", "backslash path duplicating a slash path by case only");
+	expectThrowsWith([] { insertPaths({ "dir\\sub", "dir/sub/x.txt" }); },
+		"conflicts with an existing file path", "backslash file clashing with an implied directory");
+
+	expectThrowsWith([] { insertPaths({ "/" }); }, "Empty normalized path", "path with no components");
+}
+
+// The validation cache opens its directory once per process, so each cache
+// setup runs in a child of its own. The child's failures print there; the
+// parent counts one for the whole run.
+void runInChild(const auto& fn, std::string_view label) {
+	std::cout.flush();
+	const pid_t child = ::fork();
+	if (child < 0) {
+		throw std::runtime_error("fork failed");
+	}
+	if (child == 0) {
+		g_failures = 0;
+		try {
+			fn();
+		}
+		catch (const std::exception& e) {
+			std::println(std::cerr, "FAIL: {}: {}", label, e.what());
+			++g_failures;
+		}
+		std::cerr.flush();
+		::_exit(g_failures == 0 ? 0 : 1);
+	}
+	int status = 0;
+	while (::waitpid(child, &status, 0) < 0 && errno == EINTR) {
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		std::println(std::cerr, "FAIL: {}", label);
+		++g_failures;
+	}
+}
+
+bool sameDirectory(const ZipDirectoryIndex& a, const ZipDirectoryIndex& b) {
+	const auto sameSlots = [](const ZipDirectoryIndex::Zip64OffsetSlot& x, const ZipDirectoryIndex::Zip64OffsetSlot& y) {
+		return x.record == y.record && x.field_offset == y.field_offset;
+	};
+	return a.central_start == b.central_start
+		&& a.eocd_offset == b.eocd_offset
+		&& a.eocd_comment_length == b.eocd_comment_length
+		&& a.zip64_eocd_offset == b.zip64_eocd_offset
+		&& a.local_records_crc == b.local_records_crc
+		&& a.local_header_offsets == b.local_header_offsets
+		&& a.central_record_offsets == b.central_record_offsets
+		&& std::ranges::equal(a.zip64_offset_slots, b.zip64_offset_slots, sameSlots);
+}
+
+bool sameValidation(const validation_cache_internal::CachedValidation& lhs,
+                    const validation_cache_internal::CachedValidation& rhs) {
+	return lhs.first_referenced_filename == rhs.first_referenced_filename
+		&& lhs.has_jar_manifest_file == rhs.has_jar_manifest_file
+		&& sameDirectory(lhs.directory, rhs.directory);
+}
+
+bool sameMetadata(const ArchiveMetadata& lhs, const ArchiveMetadata& rhs) {
+	return lhs.file_type == rhs.file_type
+		&& lhs.first_filename == rhs.first_filename
+		&& sameDirectory(lhs.directory, rhs.directory);
+}
+
+void testValidationCache() {
+	namespace cache = validation_cache_internal;
+	const fs::path tmp = fs::temp_directory_path()
+		/ std::format("pdvzip-cache-test-{}", ::getpid());
+	fs::create_directories(tmp);
+
+	runInChild([&] {
+		const fs::path root = tmp / "private";
+		::setenv("XDG_CACHE_HOME", root.c_str(), 1);
+		const Zip64Fixture fixture = makeZip64Fixture();
+		const ArchiveMetadata metadata = analyzeArchive(fixture.zip, true);
+		const cache::CachedValidation validation{
+			.first_referenced_filename = "a.txt",
+			.has_jar_manifest_file = false,
+			.directory = metadata.directory
+		};
+
+		expectTrue(!cache::keyFor(fixture.zip), "cache stays off until enabled");
+		enableValidationCache();
+		const std::optional<cache::CacheKey> key = cache::keyFor(fixture.zip);
+		if (!key) {
+			throw std::runtime_error("no cache key for a private cache directory");
+		}
+		const fs::path directory = root / "pdvzip";
+		struct stat status{};
+		expectTrue(::stat(directory.c_str(), &status) == 0 && (status.st_mode & 0777) == 0700,
+			"cache directory is created private");
+
+		expectTrue(!cache::lookup(*key), "empty cache has no entry");
+		cache::store(*key, validation);
+		const std::optional<cache::CachedValidation> cached = cache::lookup(*key);
+		expectTrue(cached && sameValidation(*cached, validation), "cached validation round-trips");
+
+		vBytes other = fixture.zip;
+		other[other.size() / 2] ^= 1;
+		const std::optional<cache::CacheKey> other_key = cache::keyFor(other);
+		expectTrue(other_key && other_key->digest != key->digest, "changed archive gets a different key");
+		expectTrue(other_key && !cache::lookup(*other_key), "changed archive misses the cache");
+		expectTrue(!cache::lookup({ .digest = key->digest, .size = key->size + 1 }), "wrong archive size misses");
+
+		// An entry filed under another key is refused even when found.
+		const fs::path entry = directory / std::format("{:016x}-{:x}", key->digest, key->size);
+		const fs::path moved = directory / std::format("{:016x}-{:x}", other_key->digest, other_key->size);
+		fs::copy_file(entry, moved);
+		expectTrue(!cache::lookup(*other_key), "entry stored under the wrong key is rejected");
+
+		const vBytes original = readBinaryFile(entry);
+		const auto rewrite = [&](const vBytes& bytes) {
+			fs::remove(entry);
+			writeTextFile(entry, std::string(bytes.begin(), bytes.end()));
+			fs::permissions(entry, fs::perms::owner_read | fs::perms::owner_write);
+		};
+		for (const std::size_t offset : { std::size_t{8}, original.size() / 2, original.size() - 1 }) {
+			vBytes tampered = original;
+			tampered[offset] ^= 0x40;
+			rewrite(tampered);
+			expectTrue(!cache::lookup(*key), std::format("entry tampered at byte {} is rejected", offset));
+		}
+		rewrite(vBytes(original.begin(), original.end() - 1));
+		expectTrue(!cache::lookup(*key), "truncated entry is rejected");
+
+		rewrite(original);
+		expectTrue(cache::lookup(*key).has_value(), "restored entry is accepted again");
+		fs::permissions(entry, fs::perms::group_write, fs::perm_options::add);
+		expectTrue(!cache::lookup(*key), "group-writable entry is rejected");
+	}, "validation cache round trip");
+
+	for (const mode_t mode : { mode_t{0720}, mode_t{0702} }) {
+		runInChild([&] {
+			const fs::path root = tmp / std::format("shared-{:o}", mode);
+			fs::create_directories(root / "pdvzip");
+			::chmod((root / "pdvzip").c_str(), mode);
+			::setenv("XDG_CACHE_HOME", root.c_str(), 1);
+			enableValidationCache();
+			const vBytes zip = makeSingleFileZip("a.txt", "hello");
+			expectTrue(!cache::keyFor(zip), std::format("cache directory with mode {:o} is refused", mode));
+			expectTrue(!fs::exists(root / "pdvzip" / "key"), "no key is written to a shared directory");
+		}, std::format("validation cache directory mode {:o}", mode));
+	}
+
+	fs::remove_all(tmp);
+}
+
+// One entry for makeZip: stored when level is negative, otherwise deflated
+// by zlib at that level and strategy. makeZip lays the entries out in order;
+// central_order, when given, lists them in the central directory instead, so
+// entry numbers need not follow the file.
+struct ZipEntrySpec {
+	std::string_view name;
+	vBytes payload;
+	int level = -1;
+	int strategy = Z_DEFAULT_STRATEGY;
+};
+
+vBytes makeZip(std::span<const ZipEntrySpec> entries, std::span<const std::size_t> central_order = {}) {
+	vBytes zip;
+	std::vector<vBytes> central_records;
+	for (const ZipEntrySpec& entry : entries) {
+		vBytes& central = central_records.emplace_back();
+		const bool deflated = entry.level >= 0;
+		const vBytes data = deflated ? zlibDeflate(entry.payload, entry.level, entry.strategy) : entry.payload;
+		const uint32_t crc = zlibCrc32(entry.payload);
+		const auto local_offset = static_cast<uint32_t>(zip.size());
+		for (vBytes* record : { &zip, &central }) {
+			const bool is_central = record == &central;
+			appendLe32(*record, is_central ? ZIP_CENTRAL_DIRECTORY_SIGNATURE : ZIP_LOCAL_FILE_HEADER_SIGNATURE);
+			if (is_central) {
+				appendLe16(*record, 0x0314);
+			}
+			appendLe16(*record, 20);
+			appendLe16(*record, 0);
+			appendLe16(*record, deflated ? 8 : 0);
+			appendLe16(*record, 0);
+			appendLe16(*record, 0);
+			appendLe32(*record, crc);
+			appendLe32(*record, static_cast<uint32_t>(data.size()));
+			appendLe32(*record, static_cast<uint32_t>(entry.payload.size()));
+			appendLe16(*record, static_cast<uint16_t>(entry.name.size()));
+			appendLe16(*record, 0);
+			if (is_central) {
+				appendLe16(*record, 0);
+				appendLe16(*record, 0);
+				appendLe16(*record, 0);
+				appendLe32(*record, static_cast<uint32_t>(entry.name.ends_with('/') ? 040755 : 0100644) << 16);
+				appendLe32(*record, local_offset);
+			}
+			appendBytes(*record, entry.name);
+		}
+		zip.insert(zip.end(), data.begin(), data.end());
+	}
+	const auto central_start = static_cast<uint32_t>(zip.size());
+	for (std::size_t i = 0; i < central_records.size(); ++i) {
+		const vBytes& central = central_records[central_order.empty() ? i : central_order[i]];
+		zip.insert(zip.end(), central.begin(), central.end());
+	}
+	const auto central_size = static_cast<uint32_t>(zip.size() - central_start);
+	appendLe32(zip, ZIP_END_CENTRAL_DIRECTORY_SIGNATURE);
+	appendLe16(zip, 0);
+	appendLe16(zip, 0);
+	appendLe16(zip, static_cast<uint16_t>(entries.size()));
+	appendLe16(zip, static_cast<uint16_t>(entries.size()));
+	appendLe32(zip, central_size);
+	appendLe32(zip, central_start);
+	appendLe16(zip, 0);
+	return zip;
+}
+
+void testRecompressArchive() {
+	expectTrue(isCompressedMedia("PHOTO.JPG") && isCompressedMedia("clip.Mp4") && isCompressedMedia("a/b.zip"),
+		"compressed media extensions match in any case");
+	expectTrue(!isCompressedMedia("notes.txt") && !isCompressedMedia("photos.jpg/readme")
+		&& !isCompressedMedia("jpg"), "other names are not compressed media");
+
+	std::string notes;
+	for (int i = 0; i < 1500; ++i) {
+		notes += std::format("line {} of the notes\n", i);
+	}
+	const vBytes text(notes.begin(), notes.end());
+	const std::array<ZipEntrySpec, 4> entries = {{
+		{ .name = "notes.txt", .payload = text },
+		{ .name = "logs/", .payload = {} },
+		{ .name = "logs/run.log", .payload = text, .level = 1, .strategy = Z_HUFFMAN_ONLY },
+		{ .name = "PHOTO.JPG", .payload = pseudoRandomBytes(4096, 3), .level = 0 },
+	}};
+	const vBytes zip = makeZip(entries);
+
+	try {
+		const ArchiveMetadata metadata = analyzeArchive(zip, true);
+		const std::size_t budget = zip.size() / 2;
+		const std::optional<vBytes> rebuilt = recompressArchive(zip, metadata.directory, budget);
+		if (!rebuilt) {
+			throw std::runtime_error("nothing was recompressed");
+		}
+		expectTrue(rebuilt->size() <= budget, "recompressed archive comes in under budget");
+
+		// analyzeArchive inflates every entry and checks its CRC.
+		const ArchiveMetadata rebuilt_metadata = analyzeArchive(*rebuilt, true);
+		expectTrue(rebuilt_metadata.first_filename == metadata.first_filename,
+			"recompressed archive keeps its first entry");
+		const ZipDirectoryIndex& directory = rebuilt_metadata.directory;
+		expectTrue(directory.central_record_offsets.size() == entries.size(), "recompressed archive keeps every entry");
+		if (directory.central_record_offsets.size() == entries.size()) {
+			for (std::size_t i = 0; i < entries.size(); ++i) {
+				const std::size_t central = directory.central_record_offsets[i];
+				const std::string_view name(
+					reinterpret_cast<const char*>(rebuilt->data() + central + 46), readLe16(*rebuilt, central + 28));
+				expectTrue(name == entries[i].name, std::format("entry {} keeps its name and position", i + 1));
+			}
+			expectTrue(readLe16(*rebuilt, directory.central_record_offsets[0] + 10) == 8, "stored text is deflated");
+		}
+
+		// Out of reach, so every entry is tried.
+		const std::optional<vBytes> smallest = recompressArchive(zip, metadata.directory, 1);
+		if (!smallest) {
+			throw std::runtime_error("nothing was recompressed for an unreachable budget");
+		}
+		const ZipDirectoryIndex smallest_directory = analyzeArchive(*smallest, true).directory;
+		expectTrue(smallest->size() <= rebuilt->size(), "unreachable budget recompresses at least as far");
+		expectTrue(smallest_directory.central_record_offsets.size() == entries.size()
+			&& readLe16(*smallest, smallest_directory.central_record_offsets[3] + 10) == 0,
+			"compressed media is stored rather than deflated");
+
+		expectTrue(!recompressArchive(zip, metadata.directory, zip.size()), "archive within budget is left alone");
+		const Zip64Fixture fixture = makeZip64Fixture();
+		expectTrue(!recompressArchive(fixture.zip, analyzeArchive(fixture.zip, true).directory, 1),
+			"ZIP64 archive is left alone");
+
+		// Already at its smallest: nothing comes out smaller.
+		const std::array<ZipEntrySpec, 1> random = {{ { .name = "noise.bin", .payload = pseudoRandomBytes(4096, 9) } }};
+		const vBytes incompressible = makeZip(random);
+		expectTrue(!recompressArchive(incompressible, analyzeArchive(incompressible, true).directory, 1),
+			"incompressible archive yields nothing");
+	}
+	catch (const std::exception& e) {
+		std::println(std::cerr, "FAIL: recompress archive: {}", e.what());
+		++g_failures;
+	}
+}
+
+void testManifestParser() {
+	using batch_mode_internal::parseManifest;
+	const fs::path tmp = fs::temp_directory_path()
+		/ std::format("pdvzip-manifest-test-{}", ::getpid());
+	fs::create_directories(tmp);
+	const fs::path manifest = tmp / "jobs.tsv";
+	const auto parse = [&](std::string_view text) {
+		writeTextFile(manifest, text);
+		return parseManifest(manifest);
+	};
+
+	try {
+		const std::vector<batch_mode_internal::BatchJob> jobs = parse(
+			"# cover\tarchive\tlinux\twindows\toutput\n"
+			"\n"
+			"cover.png\tone.zip\n"
+			"cover.png\ttwo.zip\t-v\t/v\tout/two.png\r\n"
+			"#cover.png\tskipped.zip\n"
+			"other.png\tthree.jar\t\t/q\n"
+			"cover.png\tfour.zip\t\t\t\n");
+		expectTrue(jobs.size() == 4, "manifest skips comments and empty lines");
+		if (jobs.size() == 4) {
+			expectTrue(jobs[0].line == 3 && jobs[0].image_path == "cover.png" && jobs[0].archive_path == "one.zip"
+				&& jobs[0].user_args.linux_args.empty() && !jobs[0].output_path,
+				"two-field line has no arguments or output");
+			expectTrue(jobs[1].line == 4 && jobs[1].user_args.linux_args == "-v"
+				&& jobs[1].user_args.windows_args == "/v" && jobs[1].output_path == fs::path("out/two.png"),
+				"five-field CRLF line keeps its arguments and output");
+			expectTrue(jobs[2].user_args.linux_args.empty() && jobs[2].user_args.windows_args == "/q",
+				"empty Linux field keeps the Windows arguments");
+			expectTrue(!jobs[3].output_path, "empty output field means a generated name");
+		}
+	}
+	catch (const std::exception& e) {
+		std::println(std::cerr, "FAIL: valid manifest rejected: {}", e.what());
+		++g_failures;
+	}
+
+	expectThrowsWith([&] { (void)parse("# only a comment\n\n"); }, "contains no jobs", "manifest without jobs");
+	expectThrowsWith([&] { (void)parse("cover.png\n"); }, "Manifest line 1", "line missing the archive");
+	expectThrowsWith([&] { (void)parse("cover.png\tone.zip\n   \n"); }, "Manifest line 2",
+		"whitespace-only line is not blank");
+	expectThrowsWith([&] { (void)parse("cover.png\tone.zip\n\tone.zip\n"); }, "Manifest line 2",
+		"line with an empty cover");
+	expectThrowsWith([&] { (void)parse("cover.png\t\n"); }, "Manifest line 1", "line with an empty archive");
+	expectThrowsWith([&] { (void)parse("cover.png\tone.zip\ta\tb\tout.png\textra\n"); }, "Manifest line 1",
+		"line with too many fields");
+	expectThrowsWith([&] { (void)parse(std::format("cover.png\tone.zip\t{}\n", std::string(1025, 'x'))); },
+		"exceed maximum length", "overlong Linux arguments");
+	expectThrowsWith([&] { (void)parseManifest(tmp / "missing.tsv"); }, "Unable to open manifest",
+		"missing manifest file");
+
+	// Two lines may not write the same file, however it is spelled.
+	expectThrowsWith([&] {
+		(void)parse("a.png\tone.zip\t\t\tout/x.png\nb.png\ttwo.zip\t\t\tout/./x.png\n");
+	}, "Manifest line 2: output path is already used", "output path named twice");
+
+	// An output that already exists is refused and left as it was.
+	const fs::path existing = tmp / "existing.png";
+	writeTextFile(existing, "keep me");
+	const vBytes output(1024, Byte{0x41});
+	const std::array<OutputSegment, 1> segments{ OutputSegment{ .bytes = output } };
+	expectThrowsWith([&] { (void)writePolyglotFile(segments, true, existing); }, "already exists",
+		"output path that already exists");
+	expectTrue(fs::file_size(existing) == 7, "existing output file is not overwritten");
+	try {
+		expectTrue(writePolyglotFile(segments, true, tmp / "fresh.png") == tmp / "fresh.png",
+			"the output path given is the one returned");
+		expectTrue(fs::file_size(tmp / "fresh.png") == output.size(), "fresh output path is written");
+	}
+	catch (const std::exception& e) {
+		std::println(std::cerr, "FAIL: fresh output path refused: {}", e.what());
+		++g_failures;
+	}
+	fs::remove_all(tmp);
+
+	// Arguments a job's archive type never prompts for are an error, not dropped.
+	const UserArguments linux_only{ .linux_args = "-v", .windows_args = "" };
+	const UserArguments windows_only{ .linux_args = "", .windows_args = "/v" };
+	const UserArguments none{};
+	expectThrowsWith([&] { requireArgumentsApply(FileType::VIDEO_AUDIO, linux_only); }, "Linux arguments",
+		"Linux arguments for media");
+	expectThrowsWith([&] { requireArgumentsApply(FileType::PDF, windows_only); }, "Windows arguments",
+		"Windows arguments for a PDF");
+	expectThrowsWith([&] { requireArgumentsApply(FileType::WINDOWS_EXECUTABLE, linux_only); }, "Linux arguments",
+		"Linux arguments for a Windows executable");
+	expectThrowsWith([&] { requireArgumentsApply(FileType::LINUX_EXECUTABLE, windows_only); }, "Windows arguments",
+		"Windows arguments for a Linux executable");
+	try {
+		requireArgumentsApply(FileType::VIDEO_AUDIO, none);
+		requireArgumentsApply(FileType::PYTHON, linux_only);
+		requireArgumentsApply(FileType::PYTHON, windows_only);
+		requireArgumentsApply(FileType::JAR, linux_only);
+		requireArgumentsApply(FileType::WINDOWS_EXECUTABLE, windows_only);
+		requireArgumentsApply(FileType::LINUX_EXECUTABLE, linux_only);
+	}
+	catch (const std::exception& e) {
+		std::println(std::cerr, "FAIL: usable arguments rejected: {}", e.what());
+		++g_failures;
+	}
+}
+
+// The batch report names the file each job wrote, chosen or generated, and
+// the per-file banner of a single run is not repeated for every job.
+void testBatchReportNamesOutputs() {
+	const fs::path tmp = fs::temp_directory_path()
+		/ std::format("pdvzip-batch-report-test-{}", ::getpid());
+	fs::create_directories(tmp);
+	const vBytes cover = makeIndexedPng({});
+	const vBytes zip = makeSingleFileZip("notes.txt", "batch report test payload");
+	writeTextFile(tmp / "cover.png", std::string_view(reinterpret_cast<const char*>(cover.data()), cover.size()));
+	writeTextFile(tmp / "one.zip", std::string_view(reinterpret_cast<const char*>(zip.data()), zip.size()));
+	writeTextFile(tmp / "two.zip", std::string_view(reinterpret_cast<const char*>(zip.data()), zip.size()));
+	writeTextFile(tmp / "jobs.tsv", "cover.png\tone.zip\t\t\tchosen.png\ncover.png\ttwo.zip\n");
+
+	runInChild([&] {
+		fs::current_path(tmp);
+		const int report_fd = ::open("report.txt", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		if (report_fd < 0 || ::dup2(report_fd, STDOUT_FILENO) < 0) {
+			throw std::runtime_error("cannot redirect stdout");
+		}
+		expectTrue(runManifestBatch("jobs.tsv") == 0, "batch with two good jobs succeeds");
+		std::fflush(stdout);
+	}, "batch report run");
+
+	try {
+		const vBytes bytes = readBinaryFile(tmp / "report.txt");
+		const std::string report(bytes.begin(), bytes.end());
+		expectContains(report, "OK      Line 1 (one.zip) -> chosen.png", "batch report names a chosen output");
+		std::string generated;
+		for (const auto& entry : fs::directory_iterator(tmp)) {
+			if (entry.path().filename().string().starts_with("pzip_")) {
+				generated = entry.path().filename().string();
+			}
+		}
+		expectTrue(!generated.empty(), "batch job without an output path writes a generated name");
+		expectContains(report, std::format("OK      Line 2 (two.zip) -> {}", generated),
+			"batch report names a generated output");
+		expectTrue(report.find("Created") == std::string::npos, "batch jobs print no per-file banner");
+	}
+	catch (const std::exception& e) {
+		std::println(std::cerr, "FAIL: batch report: {}", e.what());
+		++g_failures;
+	}
+	fs::remove_all(tmp);
+}
+
+void testAdler32MatchesZlib() {
+	constexpr std::size_t NMAX = 5552;   // bytes zlib sums between reductions
+	const auto zlibAdler32 = [](uint32_t adler, std::span<const Byte> data) {
+		return static_cast<uint32_t>(::adler32(adler, reinterpret_cast<const Bytef*>(data.data()),
+			static_cast<uInt>(data.size())));
+	};
+
+	// All 0xFF is the worst case for the sums between reductions.
+	const vBytes noise = pseudoRandomBytes(4 * NMAX + 64, 5);
+	const vBytes saturated(4 * NMAX + 64, Byte{0xFF});
+	std::vector<std::size_t> lengths;
+	for (std::size_t length = 0; length <= 200; ++length) {
+		lengths.push_back(length);
+	}
+	for (const std::size_t edge : { NMAX, 2 * NMAX, 3 * NMAX }) {
+		for (std::size_t length = edge - 40; length <= edge + 40; ++length) {
+			lengths.push_back(length);
+		}
+	}
+	lengths.push_back(4 * NMAX + 31);
+
+	for (const adler32_internal::NamedKernel& kernel : adler32_internal::availableKernels()) {
+		std::size_t mismatches = 0;
+		for (const vBytes* source : { &noise, &saturated }) {
+			for (const std::size_t length : lengths) {
+				for (const std::size_t offset : { std::size_t{0}, std::size_t{1}, std::size_t{7}, std::size_t{31} }) {
+					const std::span<const Byte> bytes = std::span(*source).subspan(offset, length);
+					mismatches += kernel.kernel(1, bytes.data(), bytes.size()) != zlibAdler32(1, bytes);
+					// Resuming from a running checksum near the modulus.
+					mismatches += kernel.kernel(0xFFF0FFF0U, bytes.data(), bytes.size())
+						!= zlibAdler32(0xFFF0FFF0U, bytes);
+				}
+			}
+		}
+		expectTrue(mismatches == 0, std::format("Adler-32 {} kernel matches zlib", kernel.name));
+	}
+
+	const std::span<const Byte> whole(noise);
+	expectTrue(lodepng_adler32(whole.data(), whole.size()) == zlibAdler32(1, whole),
+		"lodepng_adler32 matches zlib");
+	expectTrue(lodepng_adler32(whole.data(), 0) == 1, "Adler-32 of nothing is 1");
+}
+
+ProgramArgs parseArgs(const std::vector<const char*>& words) {
+	std::vector<char*> argv;
+	for (const char* word : words) {
+		argv.push_back(const_cast<char*>(word));
+	}
+	argv.push_back(nullptr);
+	return ProgramArgs::parse(static_cast<int>(words.size()), argv.data());
+}
+
+void testProfileRequestParsing() {
+	try {
+		const ProgramArgs plain = parseArgs({ "pdvzip", "--profile-archive", "a.zip" });
+		expectTrue(plain.profile_archive_path == "a.zip" && !plain.profile_as_json && plain.profile_top_entries == 10,
+			"--profile-archive with defaults");
+		const ProgramArgs options = parseArgs({ "pdvzip", "--profile-archive", "--top", "3", "--json", "a.zip" });
+		expectTrue(options.profile_archive_path == "a.zip" && options.profile_as_json && options.profile_top_entries == 3,
+			"--profile-archive options in any order");
+		const ProgramArgs embed = parseArgs({ "pdvzip", "--cache", "cover.png", "a.zip" });
+		expectTrue(!embed.profile_archive_path && embed.use_validation_cache, "--cache still leads an embed");
+	}
+	catch (const std::exception& e) {
+		std::println(std::cerr, "FAIL: valid invocation rejected: {}", e.what());
+		++g_failures;
+	}
+
+	// Leading options are named in the error rather than failing as a bad usage.
+	for (const auto& words : {
+			std::vector<const char*>{ "pdvzip", "--cache", "--profile-archive", "a.zip" },
+			std::vector<const char*>{ "pdvzip", "--verify-cover", "--profile-archive", "--json", "a.zip" },
+			std::vector<const char*>{ "pdvzip", "--fit", "5M", "--profile-archive", "a.zip" } }) {
+		expectThrowsWith([&] { (void)parseArgs(words); },
+			"do not apply to --profile-archive", std::format("{} before --profile-archive", words[1]));
+	}
+	expectThrowsWith([] { (void)parseArgs({ "pdvzip", "--profile-archive", "--top", "0", "a.zip" }); },
+		"positive entry count", "--top 0");
+}
+
+// Entry names reach the --json report as they are stored, and need not be
+// UTF-8; every byte outside a well-formed sequence must come out escaped.
+void testProfileJsonStrings() {
+	using archive_profile_internal::jsonString;
+	const auto expectJson = [](std::string_view text, std::string_view expected, std::string_view label) {
+		const std::string actual = jsonString(text);
+		expectTrue(actual == expected, std::format("{} (got {})", label, actual));
+	};
+	expectJson("docs/a \"b\"\\c.txt", R"("docs/a \"b\"\\c.txt")", "quotes and backslashes are escaped");
+	expectJson("a\tb\nc\x01", R"("a\tb\nc\u0001")", "control characters are escaped");
+	expectJson("caf\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x93\x81", "\"caf\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x93\x81\"",
+		"well-formed UTF-8 passes through");
+	expectJson("caf\x82.txt", R"("caf\u0082.txt")", "a CP437 name byte is escaped");
+	expectJson("\xC3", R"("\u00c3")", "a truncated sequence is escaped");
+	expectJson("\xC3(", R"("\u00c3(")", "a lead byte without its continuation is escaped");
+	expectJson("\xC0\xAF", R"("\u00c0\u00af")", "an overlong form is escaped");
+	expectJson("\xED\xA0\x80", R"("\u00ed\u00a0\u0080")", "a surrogate is escaped");
+	expectJson("\xF4\x90\x80\x80", R"("\u00f4\u0090\u0080\u0080")", "a code point past U+10FFFF is escaped");
+	expectJson("\xFF\xFE", R"("\u00ff\u00fe")", "bytes that never start a sequence are escaped");
+}
+
+// Give each listed entry (1-based) a wrong CRC-32 in both its headers, so it
+// fails only once its whole payload has been checked.
+void corruptEntryCrcs(vBytes& zip, std::initializer_list<std::size_t> entry_numbers) {
+	const ZipDirectoryIndex directory = analyzeArchive(zip, true).directory;
+	for (const std::size_t entry_number : entry_numbers) {
+		zip[directory.local_header_offsets[entry_number - 1] + 14] ^= 0x01;
+		zip[directory.central_record_offsets[entry_number - 1] + 16] ^= 0x01;
+	}
+}
+
+void testParallelEntryVerification() {
+	namespace internal = archive_analysis_internal;
+	// Past the 1 MiB parallel threshold. The first entry in the file is a
+	// slow one listed third, so it is claimed first and is still inflating
+	// when the quick entries behind it, listed first and second, finish.
+	std::string text;
+	for (int i = 0; text.size() < 24 * 1024 * 1024; ++i) {
+		text += std::format("{} bottles of beer on the wall\n", i);
+	}
+	std::vector<std::string> names;
+	std::vector<ZipEntrySpec> entries;
+	entries.push_back({ .name = "slow.txt", .payload = vBytes(text.begin(), text.end()), .level = 1 });
+	for (std::size_t i = 0; i < 6; ++i) {
+		names.push_back(std::format("part{:02}.bin", i + 1));
+	}
+	for (std::size_t i = 0; i < names.size(); ++i) {
+		entries.push_back({ .name = names[i], .payload = pseudoRandomBytes(192 * 1024, static_cast<uint32_t>(20 + i)) });
+	}
+	const std::array<std::size_t, 7> central_order = { 1, 2, 0, 3, 4, 5, 6 };
+	const vBytes zip = makeZip(entries, central_order);
+
+	try {
+		internal::setVerifyThreadCount(1);
+		const ArchiveMetadata sequential = analyzeArchive(zip, true);
+		internal::setVerifyThreadCount(4);
+		const ArchiveMetadata parallel = analyzeArchive(zip, true);
+		expectTrue(parallel.first_filename == sequential.first_filename
+			&& parallel.directory.local_records_crc == sequential.directory.local_records_crc
+			&& parallel.directory.local_header_offsets == sequential.directory.local_header_offsets,
+			"parallel verification matches a sequential one");
+
+		// Entry 2 fails at once; entry 3, already under way, fails later.
+		vBytes corrupt = zip;
+		corruptEntryCrcs(corrupt, { 2, 3 });
+		for (int run = 0; run < 3; ++run) {
+			expectThrowsWith([&] { (void)analyzeArchive(corrupt, true); },
+				"CRC-32 verification failed on entry 2.", "parallel check reports the lowest failing entry");
+		}
+		vBytes late_only = zip;
+		corruptEntryCrcs(late_only, { 6 });
+		expectThrowsWith([&] { (void)analyzeArchive(late_only, true); },
+			"CRC-32 verification failed on entry 6.", "parallel check reports a lone failing entry");
+
+		// Two honest entries, enough for the pool, and a third whose declared
+		// size takes the total one byte past the 2 GiB limit.
+		const std::array<ZipEntrySpec, 3> budget_entries{{
+			{ .name = "a.bin", .payload = pseudoRandomBytes(640 * 1024, 40) },
+			{ .name = "b.bin", .payload = pseudoRandomBytes(640 * 1024, 41) },
+			{ .name = "c.bin", .payload = pseudoRandomBytes(1024, 42) },
+		}};
+		vBytes oversized = makeZip(budget_entries);
+		const ZipDirectoryIndex directory = analyzeArchive(oversized, true).directory;
+		const auto declared = static_cast<uint32_t>(internal::MAX_TOTAL_UNCOMPRESSED_SIZE
+			- budget_entries[0].payload.size() - budget_entries[1].payload.size() + 1);
+		for (const std::size_t field : { directory.local_header_offsets[2] + 22, directory.central_record_offsets[2] + 24 }) {
+			for (std::size_t b = 0; b < 4; ++b) {
+				oversized[field + b] = static_cast<Byte>(declared >> (8 * b));
+			}
+		}
+		expectThrowsWith([&] { (void)analyzeArchive(oversized, true); },
+			"Total uncompressed archive size exceeds the safety limit",
+			"declared sizes past the total limit are rejected");
+	}
+	catch (const std::exception& e) {
+		std::println(std::cerr, "FAIL: parallel entry verification: {}", e.what());
+		++g_failures;
+	}
+	internal::setVerifyThreadCount(0);
+
+	// Concurrent reservations never overshoot the limit and leave no usable gap.
+	constexpr std::uint64_t CHUNK = 3 * 1024 * 1024 + 1;
+	internal::UncompressedBudget budget;
+	std::atomic<std::uint64_t> reserved{0};
+	{
+		std::vector<std::jthread> threads;
+		for (int t = 0; t < 8; ++t) {
+			threads.emplace_back([&] {
+				while (budget.tryReserve(CHUNK)) {
+					reserved.fetch_add(CHUNK);
+				}
+			});
+		}
+	}
+	expectTrue(reserved.load() <= internal::MAX_TOTAL_UNCOMPRESSED_SIZE
+		&& internal::MAX_TOTAL_UNCOMPRESSED_SIZE - reserved.load() < CHUNK,
+		"concurrent budget reservations fill the limit exactly");
+	expectTrue(!budget.tryReserve(CHUNK) && budget.tryReserve(internal::MAX_TOTAL_UNCOMPRESSED_SIZE - reserved.load())
+		&& !budget.tryReserve(1), "an exhausted budget admits only the exact remainder");
+}
+
+// Mark the windows of progress loaded from another thread, in a fixed
+// shuffled order with a short pause between each, leaving out skip; then
+// report failure if fail_with is given.
+std::jthread loadWindowsShuffled(ArchiveLoadProgress& progress, std::size_t window_count, uint32_t seed,
+                                 std::optional<std::size_t> skip = std::nullopt,
+                                 std::optional<std::string> fail_with = std::nullopt) {
+	std::vector<std::size_t> order(window_count);
+	std::iota(order.begin(), order.end(), std::size_t{0});
+	std::shuffle(order.begin(), order.end(), std::mt19937(seed));
+	return std::jthread([&progress, order = std::move(order), skip, fail_with = std::move(fail_with)] {
+		for (const std::size_t window : order) {
+			if (window != skip) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				progress.markLoaded(window);
+			}
+		}
+		if (fail_with) {
+			progress.markFailed(*fail_with);
+		}
+	});
+}
+
+void testStreamedArchiveLoad() {
+	namespace internal = archive_analysis_internal;
+	constexpr std::size_t WINDOW = 64 * 1024;
+	std::vector<std::string> names;
+	std::vector<ZipEntrySpec> entries;
+	for (std::size_t i = 0; i < 10; ++i) {
+		names.push_back(std::format("stream{:02}.bin", i + 1));
+	}
+	for (std::size_t i = 0; i < names.size(); ++i) {
+		entries.push_back({ .name = names[i], .payload = pseudoRandomBytes(160 * 1024, static_cast<uint32_t>(60 + i)),
+			.level = i % 2 == 0 ? 6 : -1 });
+	}
+	const vBytes zip = makeZip(entries);
+	const std::size_t window_count = (zip.size() + WINDOW - 1) / WINDOW;
+
+	try {
+		const ArchiveMetadata loaded = analyzeArchive(zip, true);
+		for (const unsigned threads : { 1U, 4U }) {
+			internal::setVerifyThreadCount(threads);
+			ArchiveLoadProgress progress;
+			progress.beginLoading(zip.size(), WINDOW);
+			const std::jthread loader = loadWindowsShuffled(progress, window_count, threads);
+			expectTrue(sameMetadata(analyzeArchive(zip, true, &progress), loaded),
+				std::format("analysis of a shuffled streamed load matches a loaded one ({} threads)", threads));
+		}
+	}
+	catch (const std::exception& e) {
+		std::println(std::cerr, "FAIL: streamed archive load: {}", e.what());
+		++g_failures;
+	}
+	internal::setVerifyThreadCount(0);
+
+	// A window in the middle never arrives; the loader reports failure once
+	// the rest are in. The analysis must fail with that error, not wait on.
+	for (const unsigned threads : { 1U, 4U }) {
+		runInChild([&] {
+			::alarm(30);
+			internal::setVerifyThreadCount(threads);
+			ArchiveLoadProgress progress;
+			progress.beginLoading(zip.size(), WINDOW);
+			const std::jthread loader = loadWindowsShuffled(progress, window_count, 7, window_count / 2,
+				"Failed to read file: stream.zip (Input/output error)");
+			expectThrowsWith([&] { (void)analyzeArchive(zip, true, &progress); },
+				"Failed to read file: stream.zip (Input/output error)", "a failed load fails the analysis");
+			progress.waitFor(0, WINDOW);
+		}, std::format("a load failure part-way fails the analysis ({} threads)", threads));
+	}
+
+	// The same through the real loader, from files on disk.
+	const fs::path tmp = fs::temp_directory_path()
+		/ std::format("pdvzip-stream-test-{}", ::getpid());
+	fs::create_directories(tmp);
+	try {
+		const vBytes cover = makeIndexedPng({});
+		writeTextFile(tmp / "cover.png", std::string_view(reinterpret_cast<const char*>(cover.data()), cover.size()));
+		writeTextFile(tmp / "stream.zip", std::string_view(reinterpret_cast<const char*>(zip.data()), zip.size()));
+		InputLoader inputs(tmp / "cover.png", tmp / "stream.zip");
+		const ArchiveMetadata streamed = analyzeArchive(inputs.archive().bytes(), true, &inputs.archiveLoadProgress());
+		expectTrue(inputs.takeCoverImage() == cover, "input loader reads the cover");
+		expectTrue(sameMetadata(streamed, analyzeArchive(zip, true)), "input loader analysis matches a loaded one");
+	}
+	catch (const std::exception& e) {
+		std::println(std::cerr, "FAIL: input loader: {}", e.what());
+		++g_failures;
+	}
+	fs::remove_all(tmp);
+}
+
 } // namespace
 
 int main() {
@@ -328,6 +2005,22 @@ int main() {
 		testLinuxPowershellUsesFileFlag();
 		testInfoBannerUsesSharedVersion();
 		testWriteFailureRemovesPartialFile();
+		testFolderArchiveRoundTrip();
+		testInflateMatchesZlib();
+		testCrc32MatchesZlib();
+		testKernelCopyChecksCopiedBytes();
+		testIndexedCoverFastPath();
+		testZip64ArchiveIsRelocated();
+		testPortablePathIndex();
+		testValidationCache();
+		testRecompressArchive();
+		testManifestParser();
+		testBatchReportNamesOutputs();
+		testAdler32MatchesZlib();
+		testProfileRequestParsing();
+		testProfileJsonStrings();
+		testParallelEntryVerification();
+		testStreamedArchiveLoad();
 	}
 	catch (const std::exception& e) {
 		std::println(std::cerr, "Unhandled exception: {}", e.what());
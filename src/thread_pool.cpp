@@ -0,0 +1,132 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+// Identifies the pool and deque of the calling worker thread, so nested
+// submissions stay local to it.
+thread_local const void* current_pool = nullptr;
+thread_local std::size_t current_worker = 0;
+
+} // anonymous namespace
+
+ThreadPool::ThreadPool(unsigned thread_count) {
+	const unsigned count = std::max(1U, thread_count);
+	queues_.reserve(count);
+	for (unsigned i = 0; i < count; ++i) {
+		queues_.push_back(std::make_unique<WorkerQueue>());
+	}
+	workers_.reserve(count);
+	for (unsigned i = 0; i < count; ++i) {
+		workers_.emplace_back([this, i](std::stop_token stop) {
+			workerLoop(stop, i);
+		});
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		const std::lock_guard lock(state_mutex_);
+		for (auto& worker : workers_) {
+			worker.request_stop();
+		}
+	}
+	work_available_.notify_all();
+	// jthread joins on destruction; queued jobs still run first.
+}
+
+unsigned ThreadPool::defaultThreadCount() noexcept {
+	return std::max(1U, std::thread::hardware_concurrency());
+}
+
+bool ThreadPool::onWorkerThread() noexcept {
+	return current_pool != nullptr;
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+	const std::size_t target = current_pool == this
+		? current_worker
+		: next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+	{
+		WorkerQueue& queue = *queues_[target];
+		const std::lock_guard lock(queue.mutex);
+		queue.jobs.push_back(std::move(job));
+	}
+	{
+		const std::lock_guard lock(state_mutex_);
+		++queued_;
+		++unfinished_;
+	}
+	work_available_.notify_one();
+}
+
+void ThreadPool::wait() {
+	std::unique_lock lock(state_mutex_);
+	all_done_.wait(lock, [this] { return unfinished_ == 0; });
+	if (first_error_) {
+		std::rethrow_exception(std::exchange(first_error_, nullptr));
+	}
+}
+
+std::function<void()> ThreadPool::takeJob(std::size_t index) {
+	// The caller holds a reservation, so a job is guaranteed to be in some
+	// deque; another worker may take the one seen first, hence the retry.
+	for (;;) {
+		{
+			WorkerQueue& own = *queues_[index];
+			const std::lock_guard lock(own.mutex);
+			if (!own.jobs.empty()) {
+				std::function<void()> job = std::move(own.jobs.back());
+				own.jobs.pop_back();
+				return job;
+			}
+		}
+		for (std::size_t offset = 1; offset < queues_.size(); ++offset) {
+			WorkerQueue& victim = *queues_[(index + offset) % queues_.size()];
+			const std::lock_guard lock(victim.mutex);
+			if (!victim.jobs.empty()) {
+				std::function<void()> job = std::move(victim.jobs.front());
+				victim.jobs.pop_front();
+				return job;
+			}
+		}
+		std::this_thread::yield();
+	}
+}
+
+void ThreadPool::workerLoop(std::stop_token stop, std::size_t index) {
+	current_pool = this;
+	current_worker = index;
+
+	for (;;) {
+		{
+			std::unique_lock lock(state_mutex_);
+			work_available_.wait(lock, [&] { return queued_ != 0 || stop.stop_requested(); });
+			if (queued_ == 0) {
+				return;
+			}
+			--queued_;
+		}
+
+		const std::function<void()> job = takeJob(index);
+		std::exception_ptr error;
+		try {
+			job();
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+
+		{
+			const std::lock_guard lock(state_mutex_);
+			if (error && !first_error_) {
+				first_error_ = std::move(error);
+			}
+			if (--unfinished_ == 0) {
+				all_done_.notify_all();
+			}
+		}
+	}
+}
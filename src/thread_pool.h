@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool for independent jobs. Each worker owns a deque: jobs
+// submitted from outside are dealt round-robin across the deques, jobs
+// submitted from inside a job go to the submitting worker's own deque. A
+// worker takes its newest local job first and, when its deque is empty,
+// steals the oldest job from another worker, so uneven job sizes (one huge
+// archive among many small ones) do not leave threads idle.
+class ThreadPool {
+public:
+	explicit ThreadPool(unsigned thread_count = defaultThreadCount());
+	// Runs every job already submitted, then joins the workers.
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	[[nodiscard]] static unsigned defaultThreadCount() noexcept;
+	// True on a worker of any ThreadPool. Work that would otherwise start a
+	// pool of its own can run inline instead of oversubscribing the CPU.
+	[[nodiscard]] static bool onWorkerThread() noexcept;
+
+	void submit(std::function<void()> job);
+
+	// Block until every submitted job has finished. If any job threw, the
+	// first such exception is rethrown here.
+	void wait();
+
+private:
+	struct WorkerQueue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> jobs;
+	};
+
+	void workerLoop(std::stop_token stop, std::size_t index);
+	[[nodiscard]] std::function<void()> takeJob(std::size_t index);
+
+	std::vector<std::unique_ptr<WorkerQueue>> queues_;
+	std::atomic<std::size_t> next_queue_{0};
+
+	// Counts, not jobs, live under state_mutex_: a worker reserves a queued
+	// job here before searching the deques for one, so it never sleeps while
+	// work is pending and never spins when there is none.
+	std::mutex state_mutex_;
+	std::condition_variable work_available_;
+	std::condition_variable all_done_;
+	std::size_t queued_ = 0;
+	std::size_t unfinished_ = 0;
+	std::exception_ptr first_error_;
+
+	std::vector<std::jthread> workers_;   // last: joined before the state above is destroyed
+};
@@ -15,6 +15,14 @@ constexpr std::size_t MAX_ARG_LENGTH = 1024;
 		|| file_type == FileType::JAR;
 }
 
+[[nodiscard]] bool acceptsLinuxArguments(FileType file_type) {
+	return fileTypeAcceptsArguments(file_type) && file_type != FileType::WINDOWS_EXECUTABLE;
+}
+
+[[nodiscard]] bool acceptsWindowsArguments(FileType file_type) {
+	return fileTypeAcceptsArguments(file_type) && file_type != FileType::LINUX_EXECUTABLE;
+}
+
 void readArgumentLine(std::string& out, std::string_view label) {
 	out.clear();
 	out.reserve(MAX_ARG_LENGTH);
@@ -59,13 +67,22 @@ UserArguments promptForArguments(FileType file_type) {
 
 	std::println("\nFor this file type, if required, you can provide command-line arguments here.");
 
-	if (file_type != FileType::WINDOWS_EXECUTABLE) {
+	if (acceptsLinuxArguments(file_type)) {
 		std::print("\nLinux: ");
 		readArgumentLine(args.linux_args, "Linux arguments");
 	}
-	if (file_type != FileType::LINUX_EXECUTABLE) {
+	if (acceptsWindowsArguments(file_type)) {
 		std::print("\nWindows: ");
 		readArgumentLine(args.windows_args, "Windows arguments");
 	}
 	return args;
 }
+
+void requireArgumentsApply(FileType file_type, const UserArguments& args) {
+	if (!args.linux_args.empty() && !acceptsLinuxArguments(file_type)) {
+		throw std::runtime_error("Input Error: Linux arguments were given, but this archive type does not use them.");
+	}
+	if (!args.windows_args.empty() && !acceptsWindowsArguments(file_type)) {
+		throw std::runtime_error("Input Error: Windows arguments were given, but this archive type does not use them.");
+	}
+}
@@ -0,0 +1,481 @@
+#include "validation_cache_internal.h"
+
+#include <fcntl.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <print>
+#include <string_view>
+#include <utility>
+
+namespace {
+
+using SipKey = std::array<Byte, 16>;
+
+constexpr std::array<Byte, 8> ENTRY_MAGIC{ 'P', 'D', 'V', 'Z', 'V', 'C', '0', '1' };
+
+constexpr mode_t
+	PRIVATE_DIRECTORY_MODE = 0700,
+	PRIVATE_FILE_MODE      = 0600;
+
+constexpr std::size_t
+	CENTRAL_RECORD_MIN_SIZE = 46,
+	EOCD_MIN_SIZE           = 22,
+	MAX_ENTRY_FILE_SIZE     = 64 * 1024 * 1024;
+
+std::atomic<bool> cache_enabled{ false };
+std::atomic<std::uint64_t> temp_counter{ 0 };
+
+struct ScopedFd {
+	int fd{-1};
+
+	explicit ScopedFd(int file_descriptor) noexcept : fd(file_descriptor) {}
+	~ScopedFd() {
+		if (fd >= 0) {
+			::close(fd);
+		}
+	}
+
+	ScopedFd(const ScopedFd&) = delete;
+	ScopedFd& operator=(const ScopedFd&) = delete;
+
+	[[nodiscard]] int get() const noexcept { return fd; }
+};
+
+// SipHash-2-4 (Aumasson and Bernstein): a keyed 64-bit PRF, fast enough to
+// run over a whole archive and unpredictable without the key.
+class SipHash {
+public:
+	explicit SipHash(const SipKey& key) noexcept {
+		const std::uint64_t k0 = loadLe64(key.data());
+		const std::uint64_t k1 = loadLe64(key.data() + 8);
+		v0_ = k0 ^ 0x736F6D6570736575ULL;
+		v1_ = k1 ^ 0x646F72616E646F6DULL;
+		v2_ = k0 ^ 0x6C7967656E657261ULL;
+		v3_ = k1 ^ 0x7465646279746573ULL;
+	}
+
+	[[nodiscard]] std::uint64_t digest(std::span<const Byte> data) noexcept {
+		const std::size_t whole = data.size() & ~std::size_t{7};
+		for (std::size_t offset = 0; offset < whole; offset += 8) {
+			compress(loadLe64(data.data() + offset));
+		}
+		std::uint64_t last = static_cast<std::uint64_t>(data.size()) << 56U;
+		for (std::size_t i = whole; i < data.size(); ++i) {
+			last |= static_cast<std::uint64_t>(data[i]) << (8U * (i - whole));
+		}
+		compress(last);
+		v2_ ^= 0xFF;
+		for (int i = 0; i < 4; ++i) {
+			round();
+		}
+		return v0_ ^ v1_ ^ v2_ ^ v3_;
+	}
+
+private:
+	[[nodiscard]] static std::uint64_t loadLe64(const Byte* bytes) noexcept {
+		std::uint64_t value = 0;
+		std::memcpy(&value, bytes, sizeof(value));
+		if constexpr (std::endian::native == std::endian::big) {
+			value = std::byteswap(value);
+		}
+		return value;
+	}
+
+	void round() noexcept {
+		v0_ += v1_; v1_ = std::rotl(v1_, 13); v1_ ^= v0_; v0_ = std::rotl(v0_, 32);
+		v2_ += v3_; v3_ = std::rotl(v3_, 16); v3_ ^= v2_;
+		v0_ += v3_; v3_ = std::rotl(v3_, 21); v3_ ^= v0_;
+		v2_ += v1_; v1_ = std::rotl(v1_, 17); v1_ ^= v2_; v2_ = std::rotl(v2_, 32);
+	}
+
+	void compress(std::uint64_t block) noexcept {
+		v3_ ^= block;
+		round();
+		round();
+		v0_ ^= block;
+	}
+
+	std::uint64_t v0_, v1_, v2_, v3_;
+};
+
+[[nodiscard]] std::uint64_t sipHash(const SipKey& key, std::span<const Byte> data) noexcept {
+	return SipHash(key).digest(data);
+}
+
+// Cache entries are little-endian records of fixed-width fields.
+class RecordWriter {
+public:
+	void put(std::uint64_t value, std::size_t width) {
+		for (std::size_t i = 0; i < width; ++i) {
+			bytes_.push_back(static_cast<Byte>(value >> (8 * i)));
+		}
+	}
+	void put(std::span<const Byte> data) { bytes_.insert(bytes_.end(), data.begin(), data.end()); }
+	void put(std::string_view text) { bytes_.insert(bytes_.end(), text.begin(), text.end()); }
+
+	[[nodiscard]] vBytes& bytes() noexcept { return bytes_; }
+
+private:
+	vBytes bytes_;
+};
+
+// Reads fields in the order RecordWriter wrote them. Running off the end
+// clears ok() and yields zeros rather than throwing.
+class RecordReader {
+public:
+	explicit RecordReader(std::span<const Byte> data) noexcept : data_(data) {}
+
+	[[nodiscard]] std::uint64_t take(std::size_t width) noexcept {
+		if (!ok_ || data_.size() - position_ < width) {
+			ok_ = false;
+			return 0;
+		}
+		std::uint64_t value = 0;
+		for (std::size_t i = 0; i < width; ++i) {
+			value |= static_cast<std::uint64_t>(data_[position_ + i]) << (8 * i);
+		}
+		position_ += width;
+		return value;
+	}
+
+	[[nodiscard]] std::span<const Byte> takeBytes(std::size_t length) noexcept {
+		if (!ok_ || data_.size() - position_ < length) {
+			ok_ = false;
+			return {};
+		}
+		const std::span<const Byte> bytes = data_.subspan(position_, length);
+		position_ += length;
+		return bytes;
+	}
+
+	[[nodiscard]] bool ok() const noexcept { return ok_; }
+	[[nodiscard]] std::size_t position() const noexcept { return position_; }
+
+private:
+	std::span<const Byte> data_;
+	std::size_t position_ = 0;
+	bool ok_ = true;
+};
+
+struct CacheContext {
+	fs::path directory;
+	SipKey key{};
+};
+
+// Only a directory or file this user owns and nobody else can write (or, for
+// the key, read) may feed validation results back in.
+[[nodiscard]] bool isPrivate(const struct stat& status, mode_t forbidden_bits) noexcept {
+	return status.st_uid == ::geteuid() && (status.st_mode & forbidden_bits) == 0;
+}
+
+[[nodiscard]] std::optional<fs::path> cacheRoot() {
+	// The XDG spec says relative paths are invalid and must be ignored.
+	if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg != nullptr && xdg[0] == '/') {
+		return fs::path(xdg);
+	}
+	if (const char* home = std::getenv("HOME"); home != nullptr && home[0] == '/') {
+		return fs::path(home) / ".cache";
+	}
+	return std::nullopt;
+}
+
+[[nodiscard]] bool makeDirectory(const fs::path& path) noexcept {
+	return ::mkdir(path.c_str(), PRIVATE_DIRECTORY_MODE) == 0 || errno == EEXIST;
+}
+
+[[nodiscard]] bool writeAll(int fd, std::span<const Byte> data) noexcept {
+	while (!data.empty()) {
+		const ssize_t written = ::write(fd, data.data(), data.size());
+		if (written < 0 && errno == EINTR) {
+			continue;
+		}
+		if (written <= 0) {
+			return false;
+		}
+		data = data.subspan(static_cast<std::size_t>(written));
+	}
+	return true;
+}
+
+[[nodiscard]] bool readAll(int fd, std::span<Byte> data) noexcept {
+	while (!data.empty()) {
+		const ssize_t got = ::read(fd, data.data(), data.size());
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			return false;
+		}
+		data = data.subspan(static_cast<std::size_t>(got));
+	}
+	return true;
+}
+
+// Write data to a private temporary file in directory and give it its final
+// name in one step, so concurrent readers see either nothing or all of it.
+// With replace false an existing file wins and the write is dropped.
+[[nodiscard]] bool publishFile(const fs::path& directory, const fs::path& name,
+                               std::span<const Byte> data, bool replace) {
+	const fs::path temp = directory / std::format(".tmp-{}-{}", ::getpid(), temp_counter.fetch_add(1));
+	bool written = false;
+	{
+		const ScopedFd fd(::open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, PRIVATE_FILE_MODE));
+		if (fd.get() < 0) {
+			return false;
+		}
+		written = writeAll(fd.get(), data);
+	}
+	bool published = false;
+	if (written) {
+		const fs::path target = directory / name;
+		published = replace
+			? ::rename(temp.c_str(), target.c_str()) == 0
+			: ::link(temp.c_str(), target.c_str()) == 0 || errno == EEXIST;
+	}
+	if (!published || !replace) {
+		::unlink(temp.c_str());
+	}
+	return published;
+}
+
+[[nodiscard]] std::optional<SipKey> loadOrCreateKey(const fs::path& directory) {
+	const fs::path key_path = directory / "key";
+	int fd = ::open(key_path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0 && errno == ENOENT) {
+		SipKey fresh{};
+		if (::getrandom(fresh.data(), fresh.size(), 0) != static_cast<ssize_t>(fresh.size())
+			|| !publishFile(directory, "key", fresh, false)) {
+			return std::nullopt;
+		}
+		// Another process may have won the race; its key is the one to use.
+		fd = ::open(key_path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	}
+	const ScopedFd key_fd(fd);
+	struct stat status{};
+	SipKey key{};
+	if (key_fd.get() < 0 || ::fstat(key_fd.get(), &status) != 0 || !S_ISREG(status.st_mode)
+		|| !isPrivate(status, 077) || status.st_size != static_cast<off_t>(key.size())
+		|| !readAll(key_fd.get(), key)) {
+		return std::nullopt;
+	}
+	return key;
+}
+
+[[nodiscard]] std::optional<CacheContext> openContext() {
+	const std::optional<fs::path> root = cacheRoot();
+	std::string_view problem;
+	if (!root) {
+		problem = "neither XDG_CACHE_HOME nor HOME is an absolute path";
+	}
+	else {
+		const fs::path directory = *root / "pdvzip";
+		struct stat status{};
+		if (!makeDirectory(*root) || !makeDirectory(directory)
+			|| ::lstat(directory.c_str(), &status) != 0 || !S_ISDIR(status.st_mode)) {
+			problem = "the cache directory could not be created";
+		}
+		else if (!isPrivate(status, 022)) {
+			problem = "the cache directory is not private to this user";
+		}
+		else if (const std::optional<SipKey> key = loadOrCreateKey(directory)) {
+			return CacheContext{ .directory = directory, .key = *key };
+		}
+		else {
+			problem = "the cache key is missing, unreadable or not private";
+		}
+	}
+	std::println(std::cerr, "\nCache Warning: {}; validation results will not be cached.", problem);
+	return std::nullopt;
+}
+
+[[nodiscard]] const std::optional<CacheContext>& context() {
+	static const std::optional<CacheContext> opened = openContext();
+	return opened;
+}
+
+[[nodiscard]] fs::path entryName(const validation_cache_internal::CacheKey& key) {
+	return std::format("{:016x}-{:x}", key.digest, key.size);
+}
+
+// The stored layout must still describe an archive of this size; anything
+// else means the entry is not one this validator wrote.
+[[nodiscard]] bool isPlausible(const validation_cache_internal::CachedValidation& validation,
+                               std::uint64_t archive_size) {
+	const ZipDirectoryIndex& directory = validation.directory;
+	if (validation.first_referenced_filename.empty()
+		|| directory.central_start > directory.eocd_offset
+		|| directory.eocd_offset > archive_size
+		|| archive_size - directory.eocd_offset < EOCD_MIN_SIZE + directory.eocd_comment_length
+		|| directory.local_header_offsets.size() != directory.central_record_offsets.size()
+		|| directory.central_record_offsets.size()
+			> (directory.eocd_offset - directory.central_start) / CENTRAL_RECORD_MIN_SIZE) {
+		return false;
+	}
+	for (std::size_t i = 0; i < directory.central_record_offsets.size(); ++i) {
+		if (directory.local_header_offsets[i] >= directory.central_start
+			|| directory.central_record_offsets[i] < directory.central_start
+			|| directory.central_record_offsets[i] >= directory.eocd_offset) {
+			return false;
+		}
+	}
+	if (directory.zip64_eocd_offset
+		&& (*directory.zip64_eocd_offset < directory.central_start
+			|| *directory.zip64_eocd_offset >= directory.eocd_offset)) {
+		return false;
+	}
+	std::size_t next_record = 0;
+	for (const ZipDirectoryIndex::Zip64OffsetSlot& slot : directory.zip64_offset_slots) {
+		if (slot.record < next_record || slot.record >= directory.central_record_offsets.size()
+			|| slot.field_offset < directory.central_record_offsets[slot.record]
+			|| slot.field_offset >= directory.eocd_offset) {
+			return false;
+		}
+		next_record = slot.record + 1;
+	}
+	return true;
+}
+
+} // anonymous namespace
+
+void enableValidationCache() noexcept {
+	cache_enabled.store(true, std::memory_order_relaxed);
+}
+
+namespace validation_cache_internal {
+
+std::optional<CacheKey> keyFor(std::span<const Byte> archive) {
+	if (!cache_enabled.load(std::memory_order_relaxed) || !context()) {
+		return std::nullopt;
+	}
+	return CacheKey{ .digest = sipHash(context()->key, archive), .size = archive.size() };
+}
+
+std::optional<CachedValidation> lookup(const CacheKey& key) {
+	const std::optional<CacheContext>& cache = context();
+	if (!cache) {
+		return std::nullopt;
+	}
+	const fs::path path = cache->directory / entryName(key);
+	const ScopedFd fd(::open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+	struct stat status{};
+	if (fd.get() < 0 || ::fstat(fd.get(), &status) != 0 || !S_ISREG(status.st_mode)
+		|| !isPrivate(status, 022) || status.st_size < 8
+		|| static_cast<std::uint64_t>(status.st_size) > MAX_ENTRY_FILE_SIZE) {
+		return std::nullopt;
+	}
+	vBytes record(static_cast<std::size_t>(status.st_size));
+	if (!readAll(fd.get(), record)) {
+		return std::nullopt;
+	}
+
+	const std::span<const Byte> body(record.data(), record.size() - 8);
+	RecordReader reader(record);
+	const std::span<const Byte> magic = reader.takeBytes(ENTRY_MAGIC.size());
+	if (!std::ranges::equal(magic, ENTRY_MAGIC)
+		|| reader.take(4) != VALIDATOR_REVISION) {
+		return std::nullopt;
+	}
+	const std::span<const Byte> version = reader.takeBytes(static_cast<std::size_t>(reader.take(1)));
+	if (!std::ranges::equal(version, PDVZIP_VERSION)
+		|| reader.take(8) != key.digest || reader.take(8) != key.size) {
+		return std::nullopt;
+	}
+
+	CachedValidation validation;
+	validation.has_jar_manifest_file = reader.take(1) != 0;
+	const std::span<const Byte> name = reader.takeBytes(static_cast<std::size_t>(reader.take(4)));
+	validation.first_referenced_filename.assign(name.begin(), name.end());
+	ZipDirectoryIndex& directory = validation.directory;
+	directory.central_start = static_cast<std::size_t>(reader.take(8));
+	directory.eocd_offset = static_cast<std::size_t>(reader.take(8));
+	directory.eocd_comment_length = static_cast<uint16_t>(reader.take(2));
+	if (reader.take(1) != 0) {
+		directory.zip64_eocd_offset = static_cast<std::size_t>(reader.take(8));
+	}
+	directory.local_records_crc = static_cast<uint32_t>(reader.take(4));
+	const std::uint64_t count = reader.take(8);
+	if (!reader.ok() || count > (record.size() - reader.position()) / 8) {
+		return std::nullopt;
+	}
+	directory.local_header_offsets.resize(static_cast<std::size_t>(count));
+	directory.central_record_offsets.resize(static_cast<std::size_t>(count));
+	for (uint32_t& offset : directory.local_header_offsets) {
+		offset = static_cast<uint32_t>(reader.take(4));
+	}
+	for (uint32_t& offset : directory.central_record_offsets) {
+		offset = static_cast<uint32_t>(reader.take(4));
+	}
+	const std::uint64_t slot_count = reader.take(8);
+	if (!reader.ok() || slot_count > count) {
+		return std::nullopt;
+	}
+	directory.zip64_offset_slots.resize(static_cast<std::size_t>(slot_count));
+	for (ZipDirectoryIndex::Zip64OffsetSlot& slot : directory.zip64_offset_slots) {
+		slot.record = static_cast<uint32_t>(reader.take(4));
+		slot.field_offset = static_cast<uint32_t>(reader.take(4));
+	}
+	if (!reader.ok() || reader.position() != body.size()
+		|| reader.take(8) != sipHash(cache->key, body)
+		|| !isPlausible(validation, key.size)) {
+		return std::nullopt;
+	}
+	return validation;
+}
+
+void store(const CacheKey& key, const CachedValidation& validation) noexcept {
+	try {
+		const std::optional<CacheContext>& cache = context();
+		if (!cache) {
+			return;
+		}
+		const ZipDirectoryIndex& directory = validation.directory;
+		RecordWriter writer;
+		writer.put(ENTRY_MAGIC);
+		writer.put(VALIDATOR_REVISION, 4);
+		writer.put(PDVZIP_VERSION.size(), 1);
+		writer.put(PDVZIP_VERSION);
+		writer.put(key.digest, 8);
+		writer.put(key.size, 8);
+		writer.put(validation.has_jar_manifest_file ? 1 : 0, 1);
+		writer.put(validation.first_referenced_filename.size(), 4);
+		writer.put(validation.first_referenced_filename);
+		writer.put(directory.central_start, 8);
+		writer.put(directory.eocd_offset, 8);
+		writer.put(directory.eocd_comment_length, 2);
+		writer.put(directory.zip64_eocd_offset ? 1 : 0, 1);
+		if (directory.zip64_eocd_offset) {
+			writer.put(*directory.zip64_eocd_offset, 8);
+		}
+		writer.put(directory.local_records_crc, 4);
+		writer.put(directory.local_header_offsets.size(), 8);
+		for (const uint32_t offset : directory.local_header_offsets) {
+			writer.put(offset, 4);
+		}
+		for (const uint32_t offset : directory.central_record_offsets) {
+			writer.put(offset, 4);
+		}
+		writer.put(directory.zip64_offset_slots.size(), 8);
+		for (const ZipDirectoryIndex::Zip64OffsetSlot& slot : directory.zip64_offset_slots) {
+			writer.put(slot.record, 4);
+			writer.put(slot.field_offset, 4);
+		}
+		// The trailing MAC catches truncated or damaged entries.
+		writer.put(sipHash(cache->key, writer.bytes()), 8);
+		(void)publishFile(cache->directory, entryName(key), writer.bytes(), true);
+	}
+	catch (...) {
+	}
+}
+
+}  // namespace validation_cache_internal
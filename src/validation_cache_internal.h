@@ -0,0 +1,44 @@
+#pragma once
+
+#include "pdvzip.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+
+namespace validation_cache_internal {
+
+// Bump whenever archive validation changes what it accepts or what it
+// records, so results from an older validator are never reused.
+constexpr std::uint32_t VALIDATOR_REVISION = 2;
+
+// Everything analyzeArchive needs from a successful validation; the
+// archive's classification is cheap and is always recomputed.
+struct CachedValidation {
+	std::string first_referenced_filename;
+	bool has_jar_manifest_file = false;
+	ZipDirectoryIndex directory;
+};
+
+// Identifies one archive's exact bytes. The digest is keyed with a secret
+// held in the cache directory, so archives cannot be crafted to collide
+// with one validated earlier.
+struct CacheKey {
+	std::uint64_t digest = 0;
+	std::uint64_t size = 0;
+};
+
+// nullopt unless the cache is enabled and its directory is usable.
+[[nodiscard]] std::optional<CacheKey> keyFor(std::span<const Byte> archive);
+
+// A stored result for exactly this archive, or nullopt. Entries that are
+// damaged, from another validator revision, or inconsistent with the
+// archive's size are ignored.
+[[nodiscard]] std::optional<CachedValidation> lookup(const CacheKey& key);
+
+// Best effort: a cache that cannot be written never fails the run.
+void store(const CacheKey& key, const CachedValidation& validation) noexcept;
+
+}  // namespace validation_cache_internal